@@ -0,0 +1,46 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+
+// Minimal timing helpers shared by the benchmark apps. Build them in Release
+// mode, the numbers of an unoptimized build are meaningless.
+
+// Keeps the compiler from optimizing away the benchmarked work.
+template <typename T> inline void do_not_optimize(T const &value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static volatile const T *sink;
+  sink = &value;
+#endif
+}
+
+// Runs f repeatedly for about min_duration and returns the mean time of one
+// call in nanoseconds.
+template <typename F>
+double time_per_call_ns(F &&f, std::chrono::milliseconds min_duration =
+                                   std::chrono::milliseconds(200)) {
+  using clock = std::chrono::steady_clock;
+  for (int i = 0; i < 16; ++i) {
+    f();
+  }
+  long long iterations = 0;
+  auto start = clock::now();
+  auto elapsed = clock::duration::zero();
+  do {
+    for (int i = 0; i < 64; ++i) {
+      f();
+    }
+    iterations += 64;
+    elapsed = clock::now() - start;
+  } while (elapsed < min_duration);
+  return std::chrono::duration<double, std::nano>(elapsed).count() /
+         double(iterations);
+}
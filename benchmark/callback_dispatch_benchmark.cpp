@@ -0,0 +1,115 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "benchmark.h"
+#include <cstdint>
+#include <experimental/__p1386/callback_swap.h>
+#include <experimental/audio>
+#include <experimental/audio_backend/FunctionExtras.h>
+#include <memory>
+#include <vector>
+
+// Time from the backend's C callback to a trivial user callback, per
+// period. "two levels" is how the SDL backend used to dispatch, a
+// unique_function wrapping the unique_function of the user callback. "one
+// thunk" is how it dispatches now, a function pointer to a function that
+// knows the callback's type. "replaced" is one thunk after
+// replace_callback(), which calls the replacement through a unique_function.
+
+using namespace std::experimental;
+
+namespace {
+constexpr int num_channels = 2;
+constexpr int num_frames = 64;
+
+struct fake_device {
+  std::uint64_t position = 0;
+};
+
+using c_callback = void (*)(void *, std::uint8_t *, int);
+using io_function =
+    llvm::unique_function<void(fake_device &, audio_device_io<float> &)>;
+
+audio_device_io<float> make_io(std::uint8_t *stream, int len, int channels,
+                               std::uint64_t position) noexcept {
+  audio_device_io<float> io;
+  io.output_buffer.emplace(reinterpret_cast<float *>(stream),
+                           std::size_t(len) / sizeof(float) / channels,
+                           std::size_t(channels), contiguous_interleaved);
+  io.sample_position = position;
+  return io;
+}
+
+auto make_user_callback() {
+  return [](fake_device &, audio_device_io<float> &io) noexcept {
+    (*io.output_buffer)(0, 0) = 0.5f;
+  };
+}
+
+using user_callback = decltype(make_user_callback());
+using connected =
+    detail::connected_callback<float, io_function, user_callback>;
+
+struct two_levels {
+  fake_device device;
+  llvm::unique_function<void(void *, std::uint8_t *, int)> callback;
+
+  two_levels() {
+    callback = [this, cb = io_function(make_user_callback()),
+                channel_num = num_channels](void *, std::uint8_t *stream,
+                                            int len) mutable noexcept {
+      audio_device_io<float> io =
+          make_io(stream, len, channel_num, device.position);
+      cb(device, io);
+    };
+  }
+
+  static void entry(void *self, std::uint8_t *stream, int len) {
+    static_cast<two_levels *>(self)->callback(nullptr, stream, len);
+  }
+};
+
+struct one_thunk {
+  fake_device device;
+  int channels = num_channels;
+  std::unique_ptr<connected> callback =
+      std::make_unique<connected>(make_user_callback(), num_channels);
+
+  static void entry(void *self, std::uint8_t *stream, int len) {
+    auto &state = *static_cast<one_thunk *>(self);
+    audio_device_io<float> io =
+        make_io(stream, len, state.channels, state.device.position);
+    (*state.callback)(state.device, io);
+  }
+};
+
+// Calls through a pointer the compiler can't see through, as SDL does.
+double dispatch_ns(c_callback entry, void *userdata) {
+  std::vector<float> samples(num_frames * num_channels);
+  volatile c_callback opaque = entry;
+  auto *stream = reinterpret_cast<std::uint8_t *>(samples.data());
+  const int len = int(samples.size() * sizeof(float));
+  return time_per_call_ns([&] {
+    opaque(userdata, stream, len);
+    do_not_optimize(samples[0]);
+  });
+}
+} // namespace
+
+int main() {
+  std::printf("%-12s %12s\n", "", "ns/callback");
+  two_levels old_path;
+  std::printf("%-12s %12.2f\n", "two levels",
+              dispatch_ns(two_levels::entry, &old_path));
+  one_thunk new_path;
+  std::printf("%-12s %12.2f\n", "one thunk",
+              dispatch_ns(one_thunk::entry, &new_path));
+  new_path.callback->post(std::make_unique<io_function>(make_user_callback()),
+                          0, num_frames);
+  std::printf("%-12s %12.2f\n", "replaced",
+              dispatch_ns(one_thunk::entry, &new_path));
+  new_path.callback->collect();
+}
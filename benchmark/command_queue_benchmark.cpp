@@ -0,0 +1,109 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "benchmark.h"
+#include <atomic>
+#include <deque>
+#include <experimental/audio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Command throughput of audio_command_queue against a mutex protected
+// queue, the usual way of handing parameter changes to a device callback.
+// 1 to 4 control threads push commands, one thread drains them like a
+// device callback would at the start of each period.
+
+using namespace std::experimental;
+
+namespace {
+constexpr size_t queue_capacity = 256;
+constexpr size_t commands_per_thread = 1000000;
+
+struct command {
+  int parameter;
+  float value;
+};
+
+class locked_queue {
+public:
+  bool try_push(command &&c) {
+    std::lock_guard lock(_mutex);
+    if (_commands.size() == queue_capacity) {
+      return false;
+    }
+    _commands.push_back(c);
+    return true;
+  }
+
+  template <typename F> size_t drain(F &&f) {
+    std::lock_guard lock(_mutex);
+    size_t count = _commands.size();
+    for (command &c : _commands) {
+      f(std::move(c));
+    }
+    _commands.clear();
+    return count;
+  }
+
+private:
+  std::mutex _mutex;
+  std::deque<command> _commands;
+};
+
+// Million commands per second from producer threads to one consumer.
+template <typename Queue> double throughput(Queue &queue, int producers) {
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&queue, p] {
+      for (size_t i = 0; i < commands_per_thread; ++i) {
+        while (!queue.try_push(command{p, float(i)})) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  const size_t total = producers * commands_per_thread;
+  float sum = 0.0f;
+  for (size_t received = 0; received < total;) {
+    size_t drained =
+        queue.drain([&](command &&c) noexcept { sum += c.value; });
+    if (drained == 0) {
+      std::this_thread::yield();
+    }
+    received += drained;
+  }
+  do_not_optimize(sum);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return total / elapsed.count();
+}
+} // namespace
+
+int main() {
+  std::printf("%-20s %10s %10s %10s\n", "Mcommands/s", "1 thread", "2 threads",
+              "4 threads");
+  {
+    std::printf("%-20s", "audio_command_queue");
+    for (int producers : {1, 2, 4}) {
+      audio_command_queue<command> queue(queue_capacity);
+      std::printf(" %10.1f", throughput(queue, producers));
+    }
+    std::printf("\n");
+  }
+  {
+    std::printf("%-20s", "locked queue");
+    for (int producers : {1, 2, 4}) {
+      locked_queue queue;
+      std::printf(" %10.1f", throughput(queue, producers));
+    }
+    std::printf("\n");
+  }
+}
@@ -0,0 +1,56 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "benchmark.h"
+#include <experimental/audio>
+#include <vector>
+
+// Compares copy() between interleaved and deinterleaved buffers with the
+// naive per-sample (channel, frame) loop over type-erased buffers.
+
+int main() {
+  using namespace std::experimental;
+  constexpr size_t num_frames = 256;
+
+  std::printf("%8s %14s %14s %14s %14s\n", "channels", "naive deint",
+              "copy deint", "naive int", "copy int");
+  std::printf("%8s %14s %14s %14s %14s\n", "", "(ns/frame)", "(ns/frame)",
+              "(ns/frame)", "(ns/frame)");
+
+  for (size_t num_channels : {1, 2, 4, 6, 8}) {
+    std::vector<float> interleaved(num_channels * num_frames, 0.5f);
+    std::vector<float> planar(num_channels * num_frames);
+
+    auto src = audio_buffer(interleaved.data(), num_frames, num_channels,
+                            contiguous_interleaved);
+    auto dst = audio_buffer(planar.data(), num_frames, num_channels,
+                            contiguous_deinterleaved);
+
+    auto naive = [](const audio_buffer<float> &from, audio_buffer<float> &to) {
+      for (size_t ch = 0; ch < from.size_channels(); ++ch) {
+        for (size_t frame = 0; frame < from.size_frames(); ++frame) {
+          to(ch, frame) = from(ch, frame);
+        }
+      }
+      do_not_optimize(to.data()[0]);
+    };
+
+    double naive_deinterleave = time_per_call_ns([&] { naive(src, dst); });
+    double copy_deinterleave = time_per_call_ns([&] {
+      copy(src, dst);
+      do_not_optimize(planar[0]);
+    });
+    double naive_interleave = time_per_call_ns([&] { naive(dst, src); });
+    double copy_interleave = time_per_call_ns([&] {
+      copy(dst, src);
+      do_not_optimize(interleaved[0]);
+    });
+
+    std::printf("%8zu %14.3f %14.3f %14.3f %14.3f\n", num_channels,
+                naive_deinterleave / num_frames, copy_deinterleave / num_frames,
+                naive_interleave / num_frames, copy_interleave / num_frames);
+  }
+}
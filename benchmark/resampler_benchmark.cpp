@@ -0,0 +1,70 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "benchmark.h"
+#include <cmath>
+#include <experimental/audio>
+#include <vector>
+
+// Throughput of resampler per quality tier and conversion, in million stereo
+// output frames per second.
+
+using namespace std::experimental;
+
+namespace {
+constexpr size_t num_channels = 2;
+constexpr size_t num_frames = 512;
+
+const char *quality_name(resampler_quality quality) {
+  switch (quality) {
+  case resampler_quality::fast:
+    return "fast";
+  case resampler_quality::balanced:
+    return "balanced";
+  case resampler_quality::best:
+    return "best";
+  }
+  return "";
+}
+
+double run(resampler_quality quality, double from, double to) {
+  resampler rs(num_channels, from, to, quality, num_frames);
+  std::vector<float> input(num_channels * num_frames);
+  for (size_t i = 0; i < input.size(); ++i) {
+    input[i] = float(std::sin(0.01 * double(i)));
+  }
+  std::vector<float> output(num_channels * 4 * num_frames);
+  audio_buffer<float, contiguous_interleaved_t> in(input.data(), num_frames,
+                                                   num_channels);
+  audio_buffer<float, contiguous_interleaved_t> out(
+      output.data(), 4 * num_frames, num_channels);
+  size_t produced = 0;
+  double ns = time_per_call_ns([&] {
+    rs.write(in);
+    produced = rs.read(out);
+    do_not_optimize(output[0]);
+  });
+  return double(produced) * 1e3 / ns;
+}
+} // namespace
+
+int main() {
+  const std::pair<double, double> conversions[] = {
+      {44100, 48000}, {48000, 44100}, {96000, 48000}, {48000, 96000}};
+  std::printf("%-10s", "");
+  for (auto [from, to] : conversions) {
+    std::printf(" %5.1fk->%5.1fk", from / 1000, to / 1000);
+  }
+  std::printf("   (Mframes/s)\n");
+  for (auto quality : {resampler_quality::fast, resampler_quality::balanced,
+                       resampler_quality::best}) {
+    std::printf("%-10s", quality_name(quality));
+    for (auto [from, to] : conversions) {
+      std::printf(" %14.1f", run(quality, from, to));
+    }
+    std::printf("\n");
+  }
+}
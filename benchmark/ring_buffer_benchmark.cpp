@@ -0,0 +1,143 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "benchmark.h"
+#include <algorithm>
+#include <deque>
+#include <experimental/audio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Throughput and round-trip latency of audio_ring_buffer against a mutex
+// protected queue, which is how SDL_QueueAudio/SDL_DequeueAudio hand audio
+// between threads. Two threads pass periods of stereo float frames.
+
+using namespace std::experimental;
+
+namespace {
+constexpr size_t num_channels = 2;
+constexpr size_t period_frames = 256;
+constexpr size_t queue_frames = 4 * period_frames;
+
+using period_buffer = audio_buffer<float, contiguous_interleaved_t>;
+
+class locked_queue {
+public:
+  size_t write(const period_buffer &src) {
+    std::lock_guard lock(_mutex);
+    size_t frames = std::min(src.size_frames(),
+                             queue_frames - _samples.size() / num_channels);
+    _samples.insert(_samples.end(), src.data(),
+                    src.data() + frames * num_channels);
+    return frames;
+  }
+
+  size_t read(period_buffer &dst) {
+    std::lock_guard lock(_mutex);
+    size_t frames =
+        std::min(dst.size_frames(), _samples.size() / num_channels);
+    auto end = _samples.begin() + frames * num_channels;
+    std::copy(_samples.begin(), end, dst.data());
+    _samples.erase(_samples.begin(), end);
+    return frames;
+  }
+
+private:
+  std::mutex _mutex;
+  std::deque<float> _samples;
+};
+
+// Push all frames of buffer through queue, yielding while it is full/empty.
+template <typename Queue> void write_all(Queue &queue, period_buffer &buffer) {
+  for (size_t done = 0; done < buffer.size_frames();) {
+    period_buffer rest(buffer.data() + done * num_channels,
+                       buffer.size_frames() - done, num_channels);
+    if (size_t frames = queue.write(rest)) {
+      done += frames;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+template <typename Queue> void read_all(Queue &queue, period_buffer &buffer) {
+  for (size_t done = 0; done < buffer.size_frames();) {
+    period_buffer rest(buffer.data() + done * num_channels,
+                       buffer.size_frames() - done, num_channels);
+    if (size_t frames = queue.read(rest)) {
+      done += frames;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+// Million frames per second streamed from one thread to another.
+template <typename Queue> double throughput(Queue &queue) {
+  constexpr size_t periods = 20000;
+  std::vector<float> in(period_frames * num_channels, 0.5f);
+  std::vector<float> out(in.size());
+
+  auto start = std::chrono::steady_clock::now();
+  std::thread producer([&] {
+    period_buffer buffer(in.data(), period_frames, num_channels);
+    for (size_t i = 0; i < periods; ++i) {
+      write_all(queue, buffer);
+    }
+  });
+  period_buffer buffer(out.data(), period_frames, num_channels);
+  for (size_t i = 0; i < periods; ++i) {
+    read_all(queue, buffer);
+    do_not_optimize(out[0]);
+  }
+  producer.join();
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return periods * period_frames / elapsed.count();
+}
+
+// Mean time in microseconds for a period to go to another thread and back.
+template <typename Queue> double round_trip_us(Queue &there, Queue &back) {
+  constexpr size_t periods = 20000;
+  std::vector<float> ping(period_frames * num_channels, 0.5f);
+  std::vector<float> pong(ping.size());
+
+  std::thread echo([&] {
+    period_buffer buffer(pong.data(), period_frames, num_channels);
+    for (size_t i = 0; i < periods; ++i) {
+      read_all(there, buffer);
+      write_all(back, buffer);
+    }
+  });
+  period_buffer buffer(ping.data(), period_frames, num_channels);
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < periods; ++i) {
+    write_all(there, buffer);
+    read_all(back, buffer);
+  }
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  echo.join();
+  return elapsed.count() / periods;
+}
+} // namespace
+
+int main() {
+  std::printf("%-18s %12s %14s\n", "", "Mframes/s", "round trip us");
+  {
+    audio_ring_buffer<float> queue(queue_frames, num_channels);
+    audio_ring_buffer<float> there(queue_frames, num_channels);
+    audio_ring_buffer<float> back(queue_frames, num_channels);
+    std::printf("%-18s %12.1f %14.2f\n", "audio_ring_buffer", throughput(queue),
+                round_trip_us(there, back));
+  }
+  {
+    locked_queue queue, there, back;
+    std::printf("%-18s %12.1f %14.2f\n", "locked queue", throughput(queue),
+                round_trip_us(there, back));
+  }
+}
@@ -0,0 +1,67 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "benchmark.h"
+#include <experimental/audio>
+#include <vector>
+
+// Throughput of convert_samples() for every pair of sample formats, in
+// million stereo frames per second.
+
+using namespace std::experimental;
+
+namespace {
+constexpr size_t num_channels = 2;
+constexpr size_t num_frames = 512;
+
+template <typename T> const char *format_name();
+template <> const char *format_name<uint8_t>() { return "u8"; }
+template <> const char *format_name<int8_t>() { return "s8"; }
+template <> const char *format_name<int16_t>() { return "s16"; }
+template <> const char *format_name<int24_t>() { return "s24"; }
+template <> const char *format_name<int32_t>() { return "s32"; }
+template <> const char *format_name<float>() { return "f32"; }
+template <> const char *format_name<double>() { return "f64"; }
+
+template <typename Src, typename Dst> void run() {
+  std::vector<Src> src(num_channels * num_frames);
+  std::vector<float> ramp(src.size());
+  for (size_t i = 0; i < ramp.size(); ++i) {
+    ramp[i] = float(i % 200) / 100.0f - 1.0f;
+  }
+  convert_samples(ramp.data(), src.data(), src.size());
+  std::vector<Dst> dst(src.size());
+
+  double plain = time_per_call_ns([&] {
+    convert_samples(src.data(), dst.data(), src.size());
+    do_not_optimize(dst[0]);
+  });
+  tpdf_dither dither;
+  double dithered = time_per_call_ns([&] {
+    convert_samples(src.data(), dst.data(), src.size(), dither);
+    do_not_optimize(dst[0]);
+  });
+
+  std::printf("%4s -> %-4s %12.1f %12.1f\n", format_name<Src>(),
+              format_name<Dst>(), num_frames * 1e3 / plain,
+              num_frames * 1e3 / dithered);
+}
+
+template <typename Src, typename... Dsts> void run_from() {
+  (run<Src, Dsts>(), ...);
+}
+} // namespace
+
+int main() {
+  std::printf("%12s %12s %12s\n", "", "Mframes/s", "dithered");
+  run_from<float, uint8_t, int8_t, int16_t, int24_t, int32_t, double>();
+  run_from<double, uint8_t, int8_t, int16_t, int24_t, int32_t, float>();
+  run_from<uint8_t, float, double, int16_t, int32_t>();
+  run_from<int8_t, float, double, int16_t, int32_t>();
+  run_from<int16_t, float, double, uint8_t, int8_t, int24_t, int32_t>();
+  run_from<int24_t, float, double, int16_t, int32_t>();
+  run_from<int32_t, float, double, int16_t, int24_t>();
+}
@@ -83,14 +83,14 @@ int main() {
         if (!io.output_buffer.has_value())
           return;
 
-        auto &out = *io.output_buffer;
-
-        for (int frame = 0; frame < out.size_frames(); ++frame) {
-          auto next_sample = synth.get_next_sample();
-
-          for (int channel = 0; channel < out.size_channels(); ++channel)
-            out(channel, frame) = next_sample;
-        }
+        io.output_buffer->visit([&](auto &out) noexcept {
+          for (int frame = 0; frame < out.size_frames(); ++frame) {
+            auto next_sample = synth.get_next_sample();
+
+            for (int channel = 0; channel < out.size_channels(); ++channel)
+              out(channel, frame) = next_sample;
+          }
+        });
       });
 
   device->start();
@@ -23,11 +23,12 @@ int main() {
           if (!io.output_buffer.has_value())
             return;
 
-          auto &out = *io.output_buffer;
-
-          for (int frame = 0; frame < out.size_frames(); ++frame)
-            for (int channel = 0; channel < out.size_channels(); ++channel)
-              out(channel, frame) = white_noise(gen);
+          // Resolve the buffer layout once, outside the per-sample loop.
+          io.output_buffer->visit([&](auto &out) noexcept {
+            for (int frame = 0; frame < out.size_frames(); ++frame)
+              for (int channel = 0; channel < out.size_channels(); ++channel)
+                out(channel, frame) = white_noise(gen);
+          });
         });
 
     device->start();
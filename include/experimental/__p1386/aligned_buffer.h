@@ -0,0 +1,64 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+#include "experimental/__p1386/config.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+namespace detail {
+
+// Zero-initialized heap array aligned to AUDIO_CACHE_LINE_SIZE. resize()
+// only allocates when growing, so a buffer sized up front can be reused from
+// the audio thread.
+template <typename T> class aligned_buffer {
+  static_assert(std::is_trivial_v<T>);
+
+public:
+  aligned_buffer() = default;
+
+  explicit aligned_buffer(std::size_t size) { resize(size); }
+
+  void resize(std::size_t size) {
+    if (size > _capacity) {
+      _data.reset(static_cast<T *>(::operator new(
+          size * sizeof(T), std::align_val_t{AUDIO_CACHE_LINE_SIZE})));
+      std::memset(static_cast<void *>(_data.get()), 0, size * sizeof(T));
+      _capacity = size;
+    }
+    _size = size;
+  }
+
+  T *data() const noexcept { return _data.get(); }
+
+  std::size_t size() const noexcept { return _size; }
+
+  std::size_t capacity() const noexcept { return _capacity; }
+
+  T &operator[](std::size_t i) const noexcept { return _data.get()[i]; }
+
+private:
+  struct deleter {
+    void operator()(T *ptr) const noexcept {
+      ::operator delete(ptr, std::align_val_t{AUDIO_CACHE_LINE_SIZE});
+    }
+  };
+
+  std::unique_ptr<T, deleter> _data;
+  std::size_t _size = 0;
+  std::size_t _capacity = 0;
+};
+
+} // namespace detail
+
+_LIBSTDAUDIO_NAMESPACE_END
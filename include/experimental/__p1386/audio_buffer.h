@@ -6,11 +6,16 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <chrono>
+#include <cstdint>
 #include <optional>
+#include <span>
+#include <stdexcept>
 #include <type_traits>
+#include <utility>
 #include <variant>
 
 #if __cpp_lib_mdspan >= 202207L
@@ -32,133 +37,337 @@ inline constexpr contiguous_deinterleaved_t contiguous_deinterleaved;
 struct ptr_to_ptr_deinterleaved_t {};
 inline constexpr ptr_to_ptr_deinterleaved_t ptr_to_ptr_deinterleaved;
 
-template <typename SampleType> class audio_buffer {
+// Layout only known at runtime, see audio_buffer::visit.
+struct dynamic_layout_t {};
+
+// audio_buffer<SampleType> is type-erased: the layout is chosen by the
+// constructor tag and every element access has to dispatch on it. The
+// specializations for a concrete layout tag fix the layout at compile time,
+// so their element access is plain index arithmetic which can be inlined and
+// auto-vectorized. Use visit() to get the specialization once per callback:
+//
+//   out.visit([&](auto &typed_out) noexcept {
+//     for (...) typed_out(channel, frame) = ...;
+//   });
+template <typename SampleType, typename Layout = dynamic_layout_t>
+class audio_buffer;
+
+template <typename SampleType>
+class audio_buffer<SampleType, contiguous_interleaved_t> {
 public:
   using sample_type = SampleType;
   using index_type = size_t;
+  using layout_type = contiguous_interleaved_t;
   using contiguous_view_type =
-      mdspan<sample_type, dextents<index_type, 2>, layout_stride>;
-  using distant_view_type = std::vector<std::span<sample_type>>;
+      mdspan<sample_type, dextents<index_type, 2>, layout_left>;
 
   audio_buffer(sample_type *data, index_type num_frames,
-               index_type num_channels, contiguous_interleaved_t)
-      : _num_frames(num_frames), _num_channels(num_channels),
-        _is_contiguous(true) {
-    _data_view = mdspan(
-        data, typename contiguous_view_type::mapping_type{
-                  dextents<index_type, 2>{num_channels, num_frames},
-                  std::array<index_type, 2>{1, num_channels}}); // layout_left
+               index_type num_channels,
+               contiguous_interleaved_t = {}) noexcept
+      : _data_view(data, num_channels, num_frames) {}
+
+  sample_type *data() const noexcept { return _data_view.data_handle(); }
+
+  static constexpr bool is_contiguous() noexcept { return true; }
+
+  static constexpr bool frames_are_contiguous() noexcept { return true; }
+
+  static constexpr bool channels_are_contiguous() noexcept { return false; }
+
+  index_type size_frames() const noexcept { return _data_view.extent(1); }
+
+  index_type size_channels() const noexcept { return _data_view.extent(0); }
+
+  index_type size_samples() const noexcept {
+    return size_channels() * size_frames();
   }
 
+  sample_type &operator()(index_type channel, index_type frame) noexcept {
+    return data()[frame * size_channels() + channel];
+  }
+
+  const sample_type &operator()(index_type channel,
+                                index_type frame) const noexcept {
+    return data()[frame * size_channels() + channel];
+  }
+
+#if __cpp_multidimensional_subscript >= 202110L
+  sample_type &operator[](index_type channel, index_type frame) noexcept {
+    return operator()(channel, frame);
+  }
+
+  const sample_type &operator[](index_type channel,
+                                index_type frame) const noexcept {
+    return operator()(channel, frame);
+  }
+#endif
+
+  const contiguous_view_type &view() const noexcept { return _data_view; }
+
+private:
+  contiguous_view_type _data_view;
+};
+
+template <typename SampleType>
+class audio_buffer<SampleType, contiguous_deinterleaved_t> {
+public:
+  using sample_type = SampleType;
+  using index_type = size_t;
+  using layout_type = contiguous_deinterleaved_t;
+  using contiguous_view_type =
+      mdspan<sample_type, dextents<index_type, 2>, layout_right>;
+
   audio_buffer(sample_type *data, index_type num_frames,
-               index_type num_channels, contiguous_deinterleaved_t)
-      : _num_frames(num_frames), _num_channels(num_channels),
-        _is_contiguous(true) {
-    _data_view = mdspan(
-        data, typename contiguous_view_type::mapping_type{
-                  dextents<index_type, 2>{num_channels, num_frames},
-                  std::array<index_type, 2>{num_frames, 1}}); // layout_right
+               index_type num_channels,
+               contiguous_deinterleaved_t = {}) noexcept
+      : _data_view(data, num_channels, num_frames) {}
+
+  sample_type *data() const noexcept { return _data_view.data_handle(); }
+
+  static constexpr bool is_contiguous() noexcept { return true; }
+
+  static constexpr bool frames_are_contiguous() noexcept { return false; }
+
+  static constexpr bool channels_are_contiguous() noexcept { return true; }
+
+  index_type size_frames() const noexcept { return _data_view.extent(1); }
+
+  index_type size_channels() const noexcept { return _data_view.extent(0); }
+
+  index_type size_samples() const noexcept {
+    return size_channels() * size_frames();
   }
 
-  audio_buffer(sample_type **data, index_type num_frames,
-               index_type num_channels, ptr_to_ptr_deinterleaved_t)
-      : _num_frames(num_frames), _num_channels(num_channels),
-        _is_contiguous(false) {
-    distant_view_type view;
-    view.reserve(_num_channels);
-    for (int i = 0; i < _num_channels; i++) {
-      view.emplace_back(data[i], num_frames);
+  std::span<sample_type> channel(index_type channel) const noexcept {
+    return {data() + channel * size_frames(), size_frames()};
+  }
+
+  sample_type &operator()(index_type channel, index_type frame) noexcept {
+    return data()[channel * size_frames() + frame];
+  }
+
+  const sample_type &operator()(index_type channel,
+                                index_type frame) const noexcept {
+    return data()[channel * size_frames() + frame];
+  }
+
+#if __cpp_multidimensional_subscript >= 202110L
+  sample_type &operator[](index_type channel, index_type frame) noexcept {
+    return operator()(channel, frame);
+  }
+
+  const sample_type &operator[](index_type channel,
+                                index_type frame) const noexcept {
+    return operator()(channel, frame);
+  }
+#endif
+
+  const contiguous_view_type &view() const noexcept { return _data_view; }
+
+private:
+  contiguous_view_type _data_view;
+};
+
+// The channel pointers are copied into an inline table of AUDIO_MAX_CHANNELS
+// entries, so constructing or copying the buffer never allocates.
+template <typename SampleType>
+class audio_buffer<SampleType, ptr_to_ptr_deinterleaved_t> {
+public:
+  using sample_type = SampleType;
+  using index_type = size_t;
+  using layout_type = ptr_to_ptr_deinterleaved_t;
+  static constexpr index_type max_channels = AUDIO_MAX_CHANNELS;
+  using distant_view_type = std::array<sample_type *, max_channels>;
+
+  audio_buffer(sample_type *const *data, index_type num_frames,
+               index_type num_channels, ptr_to_ptr_deinterleaved_t = {})
+      : _num_frames(num_frames), _num_channels(num_channels) {
+    if (num_channels > max_channels) {
+      throw std::runtime_error("audio:: too many channels, "
+                               "increase AUDIO_MAX_CHANNELS");
     }
-    _data_view = view;
+    std::copy_n(data, num_channels, _data_view.begin());
+  }
+
+  sample_type *data() const noexcept { return nullptr; }
+
+  static constexpr bool is_contiguous() noexcept { return false; }
+
+  static constexpr bool frames_are_contiguous() noexcept { return false; }
+
+  static constexpr bool channels_are_contiguous() noexcept { return false; }
+
+  index_type size_frames() const noexcept { return _num_frames; }
+
+  index_type size_channels() const noexcept { return _num_channels; }
+
+  index_type size_samples() const noexcept {
+    return size_channels() * size_frames();
+  }
+
+  std::span<sample_type> channel(index_type channel) const noexcept {
+    return {_data_view[channel], _num_frames};
+  }
+
+  sample_type &operator()(index_type channel, index_type frame) noexcept {
+    return _data_view[channel][frame];
+  }
+
+  const sample_type &operator()(index_type channel,
+                                index_type frame) const noexcept {
+    return _data_view[channel][frame];
+  }
+
+#if __cpp_multidimensional_subscript >= 202110L
+  sample_type &operator[](index_type channel, index_type frame) noexcept {
+    return operator()(channel, frame);
+  }
+
+  const sample_type &operator[](index_type channel,
+                                index_type frame) const noexcept {
+    return operator()(channel, frame);
+  }
+#endif
+
+private:
+  index_type _num_frames = 0;
+  index_type _num_channels = 0;
+  distant_view_type _data_view{};
+};
+
+template <typename SampleType, typename Layout> class audio_buffer {
+  static_assert(std::is_same_v<Layout, dynamic_layout_t>,
+                "unknown audio_buffer layout");
+
+public:
+  using sample_type = SampleType;
+  using index_type = size_t;
+  using layout_type = dynamic_layout_t;
+  using interleaved_type = audio_buffer<sample_type, contiguous_interleaved_t>;
+  using deinterleaved_type =
+      audio_buffer<sample_type, contiguous_deinterleaved_t>;
+  using ptr_to_ptr_type = audio_buffer<sample_type, ptr_to_ptr_deinterleaved_t>;
+
+  audio_buffer(sample_type *data, index_type num_frames,
+               index_type num_channels, contiguous_interleaved_t)
+      : _data_view(std::in_place_type<interleaved_type>, data, num_frames,
+                   num_channels) {}
+
+  audio_buffer(sample_type *data, index_type num_frames,
+               index_type num_channels, contiguous_deinterleaved_t)
+      : _data_view(std::in_place_type<deinterleaved_type>, data, num_frames,
+                   num_channels) {}
+
+  audio_buffer(sample_type *const *data, index_type num_frames,
+               index_type num_channels, ptr_to_ptr_deinterleaved_t)
+      : _data_view(std::in_place_type<ptr_to_ptr_type>, data, num_frames,
+                   num_channels) {}
+
+  template <typename Layout2>
+    requires(!std::is_same_v<Layout2, dynamic_layout_t>)
+  audio_buffer(audio_buffer<sample_type, Layout2> buffer)
+      : _data_view(std::move(buffer)) {}
+
+  // Call f with the layout-specialized buffer. This is the only dispatch on
+  // the layout, so keep per-sample loops inside f.
+  template <typename F> decltype(auto) visit(F &&f) {
+    return std::visit(std::forward<F>(f), _data_view);
+  }
+
+  template <typename F> decltype(auto) visit(F &&f) const {
+    return std::visit(std::forward<F>(f), _data_view);
+  }
+
+  template <typename Layout2> bool holds_layout() const noexcept {
+    return std::holds_alternative<audio_buffer<sample_type, Layout2>>(
+        _data_view);
   }
 
   sample_type *data() const noexcept {
-    return _is_contiguous ? get<contiguous_view_type>(_data_view).data_handle()
-                          : nullptr;
+    return visit([](auto &&v) { return v.data(); });
   }
 
-  bool is_contiguous() const noexcept { return _is_contiguous; }
+  bool is_contiguous() const noexcept {
+    return visit([](auto &&v) { return v.is_contiguous(); });
+  }
 
   bool frames_are_contiguous() const noexcept {
-    return is_contiguous()
-               ? get<contiguous_view_type>(_data_view).stride(0) == 1
-               : false;
+    return visit([](auto &&v) { return v.frames_are_contiguous(); });
   }
 
   bool channels_are_contiguous() const noexcept {
-    return is_contiguous()
-               ? get<contiguous_view_type>(_data_view).stride(1) == 1
-               : false;
+    return visit([](auto &&v) { return v.channels_are_contiguous(); });
   }
 
-  index_type size_frames() const noexcept { return _num_frames; }
+  index_type size_frames() const noexcept {
+    return visit([](auto &&v) { return v.size_frames(); });
+  }
 
-  index_type size_channels() const noexcept { return _num_channels; }
+  index_type size_channels() const noexcept {
+    return visit([](auto &&v) { return v.size_channels(); });
+  }
 
   index_type size_samples() const noexcept {
-    return _num_channels * _num_frames;
+    return visit([](auto &&v) { return v.size_samples(); });
   }
 
   // TODO: enable this only if AUDIO_USE_PAREN_OPERATOR defined.
   sample_type &operator()(index_type channel, index_type frame) noexcept {
     return const_cast<sample_type &>(
-        as_const(*this).operator()(channel, frame));
+        std::as_const(*this).operator()(channel, frame));
   }
 
   const sample_type &operator()(index_type channel,
                                 index_type frame) const noexcept {
-    return std::visit(
-        [&channel, &frame](auto &&v) -> const sample_type & {
-          if constexpr (std::is_same_v<std::decay_t<decltype(v)>,
-                                       contiguous_view_type>) {
-#if __cpp_multidimensional_subscript >= 202110L
-            return v[channel, frame];
-#else
-            return v(channel, frame);
-#endif
-          } else {
-            return v[channel][frame];
-          }
-        },
-        _data_view);
+    return visit([&channel, &frame](auto &&v) -> const sample_type & {
+      return v(channel, frame);
+    });
   }
 
 #if __cpp_multidimensional_subscript >= 202110L
   sample_type &operator[](index_type channel, index_type frame) noexcept {
-    return const_cast<sample_type &>(
-        as_const(*this).operator()(channel, frame));
+    return operator()(channel, frame);
   }
 
   const sample_type &operator[](index_type channel,
                                 index_type frame) const noexcept {
-    return std::visit(
-        [&channel, &frame](auto &&v) -> const sample_type & {
-          if constexpr (std::is_same_v<std::decay_t<decltype(v)>,
-                                       contiguous_view_type>) {
-            return v[channel, frame];
-          } else {
-            return v[channel][frame];
-          }
-        },
-        _data_view);
+    return operator()(channel, frame);
   }
 #endif
 
 private:
-  bool _is_contiguous = false;
-  index_type _num_frames = 0;
-  index_type _num_channels = 0;
-
-  std::variant<contiguous_view_type, distant_view_type> _data_view;
+  std::variant<interleaved_type, deinterleaved_type, ptr_to_ptr_type>
+      _data_view;
 };
 
 using audio_clock_t = chrono::steady_clock;
 
+// input_time is when frame 0 of input_buffer was captured, output_time when
+// frame 0 of output_buffer will be presented. sample_position counts the
+// device's frames since start(), it is the position of frame 0 of the
+// buffers.
 template <typename SampleType> struct audio_device_io {
   std::optional<audio_buffer<SampleType>> input_buffer;
   std::optional<chrono::time_point<audio_clock_t>> input_time;
   std::optional<audio_buffer<SampleType>> output_buffer;
   std::optional<chrono::time_point<audio_clock_t>> output_time;
+  std::uint64_t sample_position = 0;
 };
 
+namespace detail {
+
+// time, frames later (or earlier, if negative) at sample_rate. For the
+// timestamps of a block starting frames into the device buffer.
+inline std::optional<chrono::time_point<audio_clock_t>>
+offset_time(const std::optional<chrono::time_point<audio_clock_t>> &time,
+            double frames, double sample_rate) noexcept {
+  if (!time) {
+    return time;
+  }
+  return *time + chrono::round<audio_clock_t::duration>(
+                     chrono::duration<double>(frames / sample_rate));
+}
+
+} // namespace detail
+
 _LIBSTDAUDIO_NAMESPACE_END
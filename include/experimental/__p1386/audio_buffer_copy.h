@@ -0,0 +1,295 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+
+#include "experimental/__p1386/audio_buffer.h"
+#include "experimental/__p1386/config.h"
+#include "experimental/__p1386/simd.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+namespace detail {
+
+// Interleaved <=> planar transposes. `planar(channel)` returns the pointer to
+// the first sample of a channel. The channel counts that show up in practice
+// (1, 2, 4, 6, 8) get a fixed-size kernel, float samples additionally a SIMD
+// body; every other case goes through the scalar loops.
+template <size_t NumChannels, typename SampleType, typename Planar>
+void deinterleave_fixed(const SampleType *src, size_t num_frames,
+                        Planar &&planar) noexcept {
+  std::array<SampleType *, NumChannels> dst;
+  for (size_t ch = 0; ch < NumChannels; ++ch) {
+    dst[ch] = planar(ch);
+  }
+
+  size_t frame = 0;
+  if constexpr (std::is_same_v<SampleType, float>) {
+#if defined(_LIBSTDAUDIO_HAS_AVX2)
+    if constexpr (NumChannels == 2) {
+      for (; frame + 8 <= num_frames; frame += 8) {
+        auto a = simd::load8(src + 2 * frame);
+        auto b = simd::load8(src + 2 * frame + 8);
+        simd::unzip2(a, b);
+        simd::store8(dst[0] + frame, a);
+        simd::store8(dst[1] + frame, b);
+      }
+    } else if constexpr (NumChannels == 8) {
+      for (; frame + 8 <= num_frames; frame += 8) {
+        const float *row = src + 8 * frame;
+        simd::f32x8 rows[8] = {
+            simd::load8(row),      simd::load8(row + 8),
+            simd::load8(row + 16), simd::load8(row + 24),
+            simd::load8(row + 32), simd::load8(row + 40),
+            simd::load8(row + 48), simd::load8(row + 56)};
+        simd::transpose8(rows);
+        simd::store8(dst[0] + frame, rows[0]);
+        simd::store8(dst[1] + frame, rows[1]);
+        simd::store8(dst[2] + frame, rows[2]);
+        simd::store8(dst[3] + frame, rows[3]);
+        simd::store8(dst[4] + frame, rows[4]);
+        simd::store8(dst[5] + frame, rows[5]);
+        simd::store8(dst[6] + frame, rows[6]);
+        simd::store8(dst[7] + frame, rows[7]);
+      }
+    }
+#endif
+#if defined(_LIBSTDAUDIO_HAS_F32X4)
+    if constexpr (NumChannels == 2) {
+      for (; frame + 4 <= num_frames; frame += 4) {
+        auto a = simd::load4(src + 2 * frame);
+        auto b = simd::load4(src + 2 * frame + 4);
+        simd::unzip2(a, b);
+        simd::store4(dst[0] + frame, a);
+        simd::store4(dst[1] + frame, b);
+      }
+    } else if constexpr (NumChannels >= 4 && NumChannels % 2 == 0) {
+      // Transpose 4x4 tiles. For 6 channels the second tile starts at
+      // channel 2 and overlaps the first one, which is cheaper than a
+      // dedicated 2-channel tail.
+      for (; frame + 4 <= num_frames; frame += 4) {
+        for (size_t tile = 0; tile < NumChannels; tile += 4) {
+          size_t first = std::min(tile, NumChannels - 4);
+          const float *row = src + NumChannels * frame + first;
+          auto a = simd::load4(row);
+          auto b = simd::load4(row + NumChannels);
+          auto c = simd::load4(row + 2 * NumChannels);
+          auto d = simd::load4(row + 3 * NumChannels);
+          simd::transpose4(a, b, c, d);
+          simd::store4(dst[first] + frame, a);
+          simd::store4(dst[first + 1] + frame, b);
+          simd::store4(dst[first + 2] + frame, c);
+          simd::store4(dst[first + 3] + frame, d);
+        }
+      }
+    }
+#endif
+  }
+
+  for (; frame < num_frames; ++frame) {
+    for (size_t ch = 0; ch < NumChannels; ++ch) {
+      dst[ch][frame] = src[NumChannels * frame + ch];
+    }
+  }
+}
+
+template <size_t NumChannels, typename SampleType, typename Planar>
+void interleave_fixed(Planar &&planar, size_t num_frames,
+                      SampleType *dst) noexcept {
+  std::array<const SampleType *, NumChannels> src;
+  for (size_t ch = 0; ch < NumChannels; ++ch) {
+    src[ch] = planar(ch);
+  }
+
+  size_t frame = 0;
+  if constexpr (std::is_same_v<SampleType, float>) {
+#if defined(_LIBSTDAUDIO_HAS_AVX2)
+    if constexpr (NumChannels == 2) {
+      for (; frame + 8 <= num_frames; frame += 8) {
+        auto a = simd::load8(src[0] + frame);
+        auto b = simd::load8(src[1] + frame);
+        simd::zip2(a, b);
+        simd::store8(dst + 2 * frame, a);
+        simd::store8(dst + 2 * frame + 8, b);
+      }
+    } else if constexpr (NumChannels == 8) {
+      for (; frame + 8 <= num_frames; frame += 8) {
+        simd::f32x8 rows[8] = {
+            simd::load8(src[0] + frame), simd::load8(src[1] + frame),
+            simd::load8(src[2] + frame), simd::load8(src[3] + frame),
+            simd::load8(src[4] + frame), simd::load8(src[5] + frame),
+            simd::load8(src[6] + frame), simd::load8(src[7] + frame)};
+        simd::transpose8(rows);
+        float *row = dst + 8 * frame;
+        simd::store8(row, rows[0]);
+        simd::store8(row + 8, rows[1]);
+        simd::store8(row + 16, rows[2]);
+        simd::store8(row + 24, rows[3]);
+        simd::store8(row + 32, rows[4]);
+        simd::store8(row + 40, rows[5]);
+        simd::store8(row + 48, rows[6]);
+        simd::store8(row + 56, rows[7]);
+      }
+    }
+#endif
+#if defined(_LIBSTDAUDIO_HAS_F32X4)
+    if constexpr (NumChannels == 2) {
+      for (; frame + 4 <= num_frames; frame += 4) {
+        auto a = simd::load4(src[0] + frame);
+        auto b = simd::load4(src[1] + frame);
+        simd::zip2(a, b);
+        simd::store4(dst + 2 * frame, a);
+        simd::store4(dst + 2 * frame + 4, b);
+      }
+    } else if constexpr (NumChannels >= 4 && NumChannels % 2 == 0) {
+      for (; frame + 4 <= num_frames; frame += 4) {
+        for (size_t tile = 0; tile < NumChannels; tile += 4) {
+          size_t first = std::min(tile, NumChannels - 4);
+          auto a = simd::load4(src[first] + frame);
+          auto b = simd::load4(src[first + 1] + frame);
+          auto c = simd::load4(src[first + 2] + frame);
+          auto d = simd::load4(src[first + 3] + frame);
+          simd::transpose4(a, b, c, d);
+          float *row = dst + NumChannels * frame + first;
+          simd::store4(row, a);
+          simd::store4(row + NumChannels, b);
+          simd::store4(row + 2 * NumChannels, c);
+          simd::store4(row + 3 * NumChannels, d);
+        }
+      }
+    }
+#endif
+  }
+
+  for (; frame < num_frames; ++frame) {
+    for (size_t ch = 0; ch < NumChannels; ++ch) {
+      dst[NumChannels * frame + ch] = src[ch][frame];
+    }
+  }
+}
+
+template <typename SampleType, typename Planar>
+void deinterleave(const SampleType *src, size_t num_channels,
+                  size_t num_frames, Planar &&planar) noexcept {
+  switch (num_channels) {
+  case 1:
+    std::copy_n(src, num_frames, planar(0));
+    return;
+  case 2:
+    return deinterleave_fixed<2>(src, num_frames, planar);
+  case 4:
+    return deinterleave_fixed<4>(src, num_frames, planar);
+  case 6:
+    return deinterleave_fixed<6>(src, num_frames, planar);
+  case 8:
+    return deinterleave_fixed<8>(src, num_frames, planar);
+  default:
+    for (size_t ch = 0; ch < num_channels; ++ch) {
+      SampleType *dst = planar(ch);
+      for (size_t frame = 0; frame < num_frames; ++frame) {
+        dst[frame] = src[num_channels * frame + ch];
+      }
+    }
+  }
+}
+
+template <typename SampleType, typename Planar>
+void interleave(Planar &&planar, size_t num_channels, size_t num_frames,
+                SampleType *dst) noexcept {
+  switch (num_channels) {
+  case 1:
+    std::copy_n(planar(0), num_frames, dst);
+    return;
+  case 2:
+    return interleave_fixed<2>(planar, num_frames, dst);
+  case 4:
+    return interleave_fixed<4>(planar, num_frames, dst);
+  case 6:
+    return interleave_fixed<6>(planar, num_frames, dst);
+  case 8:
+    return interleave_fixed<8>(planar, num_frames, dst);
+  default:
+    for (size_t ch = 0; ch < num_channels; ++ch) {
+      const SampleType *src = planar(ch);
+      for (size_t frame = 0; frame < num_frames; ++frame) {
+        dst[num_channels * frame + ch] = src[frame];
+      }
+    }
+  }
+}
+
+} // namespace detail
+
+// Copy num_frames frames of src starting at src_frame into dst starting at
+// dst_frame, converting between layouts. Both buffers must have the same
+// number of channels. The count is clamped to the frames both buffers have
+// left and the number of frames copied is returned.
+template <typename SampleType, typename SrcLayout, typename DstLayout>
+size_t copy(const audio_buffer<SampleType, SrcLayout> &src, size_t src_frame,
+            audio_buffer<SampleType, DstLayout> &dst, size_t dst_frame,
+            size_t num_frames) noexcept {
+  if constexpr (std::is_same_v<SrcLayout, dynamic_layout_t>) {
+    return src.visit([&](const auto &typed_src) noexcept {
+      return copy(typed_src, src_frame, dst, dst_frame, num_frames);
+    });
+  } else if constexpr (std::is_same_v<DstLayout, dynamic_layout_t>) {
+    return dst.visit([&](auto &typed_dst) noexcept {
+      return copy(src, src_frame, typed_dst, dst_frame, num_frames);
+    });
+  } else {
+    assert(src.size_channels() == dst.size_channels());
+    assert(src_frame <= src.size_frames() && dst_frame <= dst.size_frames());
+    const size_t num_channels = src.size_channels();
+    num_frames = std::min({num_frames, src.size_frames() - src_frame,
+                           dst.size_frames() - dst_frame});
+
+    constexpr bool src_interleaved =
+        std::is_same_v<SrcLayout, contiguous_interleaved_t>;
+    constexpr bool dst_interleaved =
+        std::is_same_v<DstLayout, contiguous_interleaved_t>;
+
+    if constexpr (src_interleaved && dst_interleaved) {
+      std::copy_n(src.data() + src_frame * num_channels,
+                  num_frames * num_channels,
+                  dst.data() + dst_frame * num_channels);
+    } else if constexpr (src_interleaved) {
+      detail::deinterleave(src.data() + src_frame * num_channels, num_channels,
+                           num_frames, [&](size_t ch) noexcept {
+                             return dst.channel(ch).data() + dst_frame;
+                           });
+    } else if constexpr (dst_interleaved) {
+      detail::interleave(
+          [&](size_t ch) noexcept {
+            return static_cast<const SampleType *>(src.channel(ch).data()) +
+                   src_frame;
+          },
+          num_channels, num_frames, dst.data() + dst_frame * num_channels);
+    } else {
+      for (size_t ch = 0; ch < num_channels; ++ch) {
+        std::copy_n(src.channel(ch).data() + src_frame, num_frames,
+                    dst.channel(ch).data() + dst_frame);
+      }
+    }
+    return num_frames;
+  }
+}
+
+// Copy the samples of src into dst, converting between layouts. Both buffers
+// must have the same number of channels; min(src.size_frames(),
+// dst.size_frames()) frames are copied and that count is returned.
+template <typename SampleType, typename SrcLayout, typename DstLayout>
+size_t copy(const audio_buffer<SampleType, SrcLayout> &src,
+            audio_buffer<SampleType, DstLayout> &dst) noexcept {
+  return copy(src, 0, dst, 0, size_t(-1));
+}
+
+_LIBSTDAUDIO_NAMESPACE_END
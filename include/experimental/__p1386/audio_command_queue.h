@@ -0,0 +1,309 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "experimental/__p1386/audio_buffer.h"
+#include "experimental/__p1386/config.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+namespace detail {
+
+// Lock-free bounded multi-producer/single-consumer FIFO. Every cell carries
+// a sequence number telling whose turn it is: producers claim a position
+// with a CAS on the tail, construct the element in its cell and publish it
+// by bumping the sequence; the consumer takes it and hands the cell to the
+// producer one lap later. The capacity is rounded up to a power of two and
+// allocated by the constructor, push() and pop() never allocate.
+template <typename T> class mpsc_queue {
+  static_assert(std::is_nothrow_move_constructible_v<T>);
+
+public:
+  explicit mpsc_queue(size_t min_capacity)
+      : _capacity(std::bit_ceil(std::max<size_t>(min_capacity, 1))),
+        _mask(_capacity - 1), _cells(new cell[_capacity]) {
+    for (size_t i = 0; i < _capacity; ++i) {
+      _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  mpsc_queue(const mpsc_queue &) = delete;
+  mpsc_queue &operator=(const mpsc_queue &) = delete;
+
+  ~mpsc_queue() {
+    while (pop([](T &&) noexcept {})) {
+    }
+  }
+
+  size_t capacity() const noexcept { return _capacity; }
+
+  // Any thread. False, and value left alone, if the queue is full.
+  bool push(T &&value) noexcept {
+    size_t position = _tail.index.load(std::memory_order_relaxed);
+    cell *c;
+    while (true) {
+      c = &_cells[position & _mask];
+      const size_t sequence = c->sequence.load(std::memory_order_acquire);
+      const auto lap = std::ptrdiff_t(sequence - position);
+      if (lap == 0) {
+        if (_tail.index.compare_exchange_weak(position, position + 1,
+                                              std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (lap < 0) {
+        return false;
+      } else {
+        position = _tail.index.load(std::memory_order_relaxed);
+      }
+    }
+    ::new (static_cast<void *>(c->storage)) T(std::move(value));
+    c->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  // The consumer thread only. Move the oldest element into f(T &&), false
+  // if there is none, or its producer hasn't finished writing it.
+  template <typename F> bool pop(F &&f) noexcept {
+    const size_t position = _head.index.load(std::memory_order_relaxed);
+    cell &c = _cells[position & _mask];
+    if (c.sequence.load(std::memory_order_acquire) != position + 1) {
+      return false;
+    }
+    T *value = std::launder(reinterpret_cast<T *>(c.storage));
+    std::forward<F>(f)(std::move(*value));
+    value->~T();
+    c.sequence.store(position + _capacity, std::memory_order_release);
+    _head.index.store(position + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Approximate, exact when neither side runs.
+  size_t size() const noexcept {
+    return _tail.index.load(std::memory_order_relaxed) -
+           _head.index.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct cell {
+    std::atomic<size_t> sequence;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  struct alignas(AUDIO_CACHE_LINE_SIZE) side {
+    std::atomic<size_t> index{0};
+  };
+
+  side _tail;
+  side _head;
+  size_t _capacity;
+  size_t _mask;
+  std::unique_ptr<cell[]> _cells;
+};
+
+} // namespace detail
+
+// Commands from any thread to a device callback, e.g. a new filter, a gain
+// or a sample bank to switch to:
+//
+//   audio_command_queue<std::unique_ptr<biquad>> commands(64);
+//   commands.try_push(std::make_unique<biquad>(coefficients));
+//
+// and in the callback, or through command_io:
+//
+//   commands.drain([&](std::unique_ptr<biquad> &&next) noexcept {
+//     garbage.retire(std::exchange(filter, std::move(next)));
+//   });
+//
+// Lock-free on both sides and bounded: the storage is allocated by the
+// constructor, and try_push() fails rather than allocating when the audio
+// thread is behind. Allocate what a command carries before pushing it, and
+// free what it replaces on an audio_garbage_collector.
+template <typename Command> class audio_command_queue {
+public:
+  using command_type = Command;
+
+  // The capacity is min_capacity rounded up to a power of two.
+  explicit audio_command_queue(size_t min_capacity = 256)
+      : _queue(min_capacity) {}
+
+  size_t capacity() const noexcept { return _queue.capacity(); }
+
+  // Any number of threads. False if the queue is full, the command is then
+  // not moved from.
+  [[nodiscard]] bool try_push(Command &&command) noexcept {
+    return _queue.push(std::move(command));
+  }
+
+  [[nodiscard]] bool try_push(const Command &command) noexcept(
+      std::is_nothrow_copy_constructible_v<Command>) {
+    Command copy(command);
+    return _queue.push(std::move(copy));
+  }
+
+  // The audio thread only. Call f(Command &&) for each pending command in
+  // push order and return how many there were. Commands pushed while this
+  // runs may be left for the next call.
+  template <typename F> size_t drain(F &&f) noexcept {
+    size_t count = 0;
+    while (_queue.pop(f)) {
+      ++count;
+    }
+    return count;
+  }
+
+  // Commands pushed and not drained yet, approximate while either side runs.
+  size_t size() const noexcept { return _queue.size(); }
+
+private:
+  detail::mpsc_queue<Command> _queue;
+};
+
+// Destroys on a background thread what device callbacks retire, so that
+// replacing the state of a callback never frees memory, runs a destructor
+// or takes a lock on the audio thread. retire() is lock-free and can be
+// called from any number of audio threads; the collector thread frees what
+// was retired every interval, and the destructor frees the rest.
+class audio_garbage_collector {
+public:
+  explicit audio_garbage_collector(
+      size_t min_capacity = 1024,
+      chrono::milliseconds interval = chrono::milliseconds(20))
+      : _queue(min_capacity), _interval(interval),
+        _thread([this] { run(); }) {}
+
+  audio_garbage_collector(const audio_garbage_collector &) = delete;
+  audio_garbage_collector &operator=(const audio_garbage_collector &) = delete;
+
+  ~audio_garbage_collector() {
+    {
+      std::lock_guard lock(_mutex);
+      _stopping = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+    collect();
+  }
+
+  size_t capacity() const noexcept { return _queue.capacity(); }
+
+  // Hand object over for destruction. False if the queue is full, object is
+  // then still owned by the caller, who should keep it and retry on a later
+  // callback.
+  template <typename T, typename Deleter>
+  [[nodiscard]] bool retire(std::unique_ptr<T, Deleter> &&object) noexcept {
+    static_assert(std::is_empty_v<Deleter>,
+                  "audio:: garbage collector Error : stateful deleter");
+    if (!object) {
+      return true;
+    }
+    if (!_queue.push(retired{object.get(), destroy<T, Deleter>})) {
+      return false;
+    }
+    (void)object.release();
+    return true;
+  }
+
+  // Destroy what was retired so far on the calling thread, instead of
+  // waiting for the collector thread, and return how many objects there
+  // were. Never call it from an audio thread.
+  size_t collect() noexcept {
+    std::lock_guard lock(_collecting);
+    size_t count = 0;
+    while (_queue.pop([](retired &&r) noexcept { r.destroy(r.object); })) {
+      ++count;
+    }
+    _collected.fetch_add(count, std::memory_order_relaxed);
+    return count;
+  }
+
+  // Objects destroyed since construction.
+  size_t collected() const noexcept {
+    return _collected.load(std::memory_order_relaxed);
+  }
+
+  // Objects retired and not destroyed yet, approximate.
+  size_t pending() const noexcept { return _queue.size(); }
+
+private:
+  struct retired {
+    void *object;
+    void (*destroy)(void *) noexcept;
+  };
+
+  template <typename T, typename Deleter>
+  static void destroy(void *object) noexcept {
+    Deleter()(static_cast<T *>(object));
+  }
+
+  void run() {
+    std::unique_lock lock(_mutex);
+    while (!_wake.wait_for(lock, _interval, [this] { return _stopping; })) {
+      lock.unlock();
+      collect();
+      lock.lock();
+    }
+  }
+
+  detail::mpsc_queue<retired> _queue;
+  chrono::milliseconds _interval;
+  std::atomic<size_t> _collected{0};
+  // Serializes collect(), the only consumer of the queue.
+  std::mutex _collecting;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  bool _stopping = false;
+  std::thread _thread;
+};
+
+// Device callback that drains queue before each period: callback(Command
+// &&) is called for each pending command, then callback(device, io). The
+// callback is typically a class holding the DSP state with both overloads,
+// so commands change it between periods, never while it renders one:
+//
+//   device.connect<float>(make_command_io<float>(commands, synth));
+template <typename SampleType, typename Command, typename Callback>
+class command_io {
+public:
+  command_io(audio_command_queue<Command> &queue, Callback callback)
+      : _queue(&queue), _callback(std::move(callback)) {}
+
+  template <typename Device>
+  void operator()(Device &device, audio_device_io<SampleType> &io) noexcept {
+    _queue->drain([this](Command &&command) noexcept {
+      _callback(std::move(command));
+    });
+    _callback(device, io);
+  }
+
+  Callback &callback() noexcept { return _callback; }
+
+private:
+  audio_command_queue<Command> *_queue;
+  Callback _callback;
+};
+
+template <typename SampleType, typename Command, typename Callback>
+command_io<SampleType, Command, std::decay_t<Callback>>
+make_command_io(audio_command_queue<Command> &queue, Callback &&callback) {
+  return command_io<SampleType, Command, std::decay_t<Callback>>(
+      queue, std::forward<Callback>(callback));
+}
+
+_LIBSTDAUDIO_NAMESPACE_END
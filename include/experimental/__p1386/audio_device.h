@@ -14,11 +14,33 @@ _LIBSTDAUDIO_NAMESPACE_BEGIN
 
 class audio_device;
 class audio_device_list;
+class audio_duplex_device;
 
 inline std::optional<audio_device> get_default_audio_input_device();
 inline std::optional<audio_device> get_default_audio_output_device();
 
+inline std::optional<audio_duplex_device> get_default_audio_duplex_device();
+
 inline audio_device_list get_audio_input_device_list();
 inline audio_device_list get_audio_output_device_list();
 
+namespace detail {
+
+// Private base of a device whose threads point back to it. The defaulted
+// move constructor of Device runs this one first, which stops the device
+// moved from, so its threads are joined before its members move and both
+// devices end up stopped.
+template <typename Device> class stop_before_move {
+protected:
+  stop_before_move() = default;
+
+  stop_before_move(stop_before_move &&other) {
+    static_cast<Device &>(other).stop();
+  }
+
+  stop_before_move &operator=(stop_before_move &&) = delete;
+};
+
+} // namespace detail
+
 _LIBSTDAUDIO_NAMESPACE_END
@@ -0,0 +1,158 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <system_error>
+
+#include "experimental/__p1386/audio_buffer.h"
+#include "experimental/__p1386/config.h"
+#include "experimental/__p1386/realtime_thread.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+// XRun counters of a device since start(), see audio_device::stats().
+struct audio_device_stats {
+  // Periods of output padded with silence because no audio was ready.
+  std::uint64_t underruns = 0;
+  // Periods of input dropped because the capture queue was full.
+  std::uint64_t overruns = 0;
+  // Callbacks entered more than a period after the device clock expected.
+  std::uint64_t late_callbacks = 0;
+  // When the last of the above happened.
+  std::optional<chrono::time_point<audio_clock_t>> last_xrun_time;
+  // Times a device following the default device moved to a new one.
+  std::uint64_t device_switches = 0;
+  // From the default device change to the first callback on the new device.
+  std::optional<chrono::nanoseconds> last_switch_duration;
+  // How promoting the callback thread went, empty until its first callback
+  // or without a set_realtime() config.
+  std::optional<audio_realtime_result> realtime;
+
+  audio_device_stats &operator+=(const audio_device_stats &other) noexcept {
+    underruns += other.underruns;
+    overruns += other.overruns;
+    late_callbacks += other.late_callbacks;
+    if (other.last_xrun_time &&
+        (!last_xrun_time || *last_xrun_time < *other.last_xrun_time)) {
+      last_xrun_time = other.last_xrun_time;
+    }
+    device_switches += other.device_switches;
+    if (other.last_switch_duration) {
+      last_switch_duration = other.last_switch_duration;
+    }
+    // A failure wins over a success.
+    if (other.realtime && (!realtime || *realtime)) {
+      realtime = other.realtime;
+    }
+    return *this;
+  }
+};
+
+namespace detail {
+
+// Written from the audio threads, read from anywhere. Relaxed atomics, the
+// counters are independent and only need to be eventually visible.
+class xrun_counters {
+public:
+  using time_point = chrono::time_point<audio_clock_t>;
+
+  void underrun(time_point when) noexcept { record(_underruns, when); }
+
+  void overrun(time_point when) noexcept { record(_overruns, when); }
+
+  void late_callback(time_point when) noexcept {
+    record(_late_callbacks, when);
+  }
+
+  void device_switched(chrono::nanoseconds took) noexcept {
+    _switches.fetch_add(1, std::memory_order_relaxed);
+    _last_switch_ns.store(took.count(), std::memory_order_relaxed);
+  }
+
+  void realtime_promoted(const audio_realtime_result &result) noexcept {
+    if (!result) {
+      _realtime_step.store(int(result.error().failed),
+                           std::memory_order_relaxed);
+      _realtime_error.store(result.error().error.value(),
+                            std::memory_order_relaxed);
+      _realtime_category.store(&result.error().error.category(),
+                               std::memory_order_relaxed);
+    }
+    _realtime.store(result ? realtime_promoted_ok : realtime_failed,
+                    std::memory_order_release);
+  }
+
+  // Not thread safe, the audio threads must not be running.
+  void reset() noexcept {
+    _underruns.store(0, std::memory_order_relaxed);
+    _overruns.store(0, std::memory_order_relaxed);
+    _late_callbacks.store(0, std::memory_order_relaxed);
+    _last_xrun.store(0, std::memory_order_relaxed);
+    _switches.store(0, std::memory_order_relaxed);
+    _last_switch_ns.store(-1, std::memory_order_relaxed);
+    _realtime.store(realtime_none, std::memory_order_relaxed);
+  }
+
+  audio_device_stats snapshot() const noexcept {
+    audio_device_stats stats;
+    stats.underruns = _underruns.load(std::memory_order_relaxed);
+    stats.overruns = _overruns.load(std::memory_order_relaxed);
+    stats.late_callbacks = _late_callbacks.load(std::memory_order_relaxed);
+    if (auto last = _last_xrun.load(std::memory_order_relaxed)) {
+      stats.last_xrun_time = time_point(audio_clock_t::duration(last));
+    }
+    stats.device_switches = _switches.load(std::memory_order_relaxed);
+    if (auto took = _last_switch_ns.load(std::memory_order_relaxed);
+        took >= 0) {
+      stats.last_switch_duration = chrono::nanoseconds(took);
+    }
+    switch (_realtime.load(std::memory_order_acquire)) {
+    case realtime_promoted_ok:
+      stats.realtime = audio_realtime_result();
+      break;
+    case realtime_failed:
+      stats.realtime = std::unexpected(audio_realtime_error{
+          audio_realtime_error::step(
+              _realtime_step.load(std::memory_order_relaxed)),
+          std::error_code(_realtime_error.load(std::memory_order_relaxed),
+                          *_realtime_category.load(
+                              std::memory_order_relaxed))});
+      break;
+    }
+    return stats;
+  }
+
+private:
+  void record(std::atomic<std::uint64_t> &counter, time_point when) noexcept {
+    counter.fetch_add(1, std::memory_order_relaxed);
+    _last_xrun.store(when.time_since_epoch().count(),
+                     std::memory_order_relaxed);
+  }
+
+  std::atomic<std::uint64_t> _underruns{0};
+  std::atomic<std::uint64_t> _overruns{0};
+  std::atomic<std::uint64_t> _late_callbacks{0};
+  // audio_clock_t ticks since its epoch, 0 if there was no xrun yet.
+  std::atomic<audio_clock_t::rep> _last_xrun{0};
+  std::atomic<std::uint64_t> _switches{0};
+  // -1 if the device never switched.
+  std::atomic<std::int64_t> _last_switch_ns{-1};
+  // One of the below, the error is written before a realtime_failed.
+  enum { realtime_none, realtime_promoted_ok, realtime_failed };
+  std::atomic<int> _realtime{realtime_none};
+  std::atomic<int> _realtime_step{0};
+  std::atomic<int> _realtime_error{0};
+  std::atomic<const std::error_category *> _realtime_category{nullptr};
+};
+
+} // namespace detail
+
+_LIBSTDAUDIO_NAMESPACE_END
@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include <cstdint>
+
 #include "experimental/__p1386/audio_buffer.h"
 #include "experimental/__p1386/audio_device.h"
 #include "experimental/__p1386/config.h"
@@ -17,7 +19,13 @@ enum class audio_device_list_event {
   default_output_device_changed,
 };
 
-void set_audio_device_list_callback(audio_device_list_event,
-                                    AudioDeviceListCallback auto &&cb);
+// Identifies a callback added by set_audio_device_list_callback().
+enum class audio_device_list_callback_id : std::uint64_t {};
+
+// Add cb to the callbacks of event, any number can be added. They are called
+// on the backend's event thread, once per burst of hotplug events.
+audio_device_list_callback_id
+set_audio_device_list_callback(audio_device_list_event,
+                               AudioDeviceListCallback auto &&cb);
 
 _LIBSTDAUDIO_NAMESPACE_END
@@ -0,0 +1,155 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <utility>
+
+#include "experimental/__p1386/audio_buffer.h"
+#include "experimental/__p1386/config.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+// Where a coroutine suspended in next_io() is resumed. post() is called on
+// the audio thread, so it must not block: push the handle onto a lock-free
+// queue or wake a worker, don't resume it in place.
+template <typename T>
+concept AudioIOExecutor = requires(T &executor,
+                                   std::coroutine_handle<> handle) {
+  { executor.post(handle) } noexcept;
+};
+
+namespace detail {
+
+// A coroutine suspended in next_io(), parked in its device until the
+// device is ready.
+struct io_waiter {
+  std::coroutine_handle<> handle;
+  void *executor = nullptr;
+  void (*post)(void *executor, std::coroutine_handle<> handle) noexcept =
+      nullptr;
+};
+
+// Coroutine side: park waiter in slot unless ready() turns true meanwhile.
+// Returns false if the coroutine should go on without suspending.
+template <typename Ready>
+bool park_io_waiter(std::atomic<io_waiter *> &slot, io_waiter &waiter,
+                    Ready ready) noexcept {
+  assert(slot.load(std::memory_order_relaxed) == nullptr &&
+         "one next_io() at a time per device");
+  slot.store(&waiter, std::memory_order_release);
+  // Pairs with the fence in wake_io_waiter(): either the audio thread sees
+  // the waiter, or this sees what the audio thread produced.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!ready()) {
+    return true;
+  }
+  // Take it back, unless the audio thread is already posting it.
+  io_waiter *expected = &waiter;
+  return !slot.compare_exchange_strong(expected, nullptr,
+                                       std::memory_order_acquire);
+}
+
+// Audio thread once the device is ready, or stop(): hand the parked
+// coroutine, if any, to its executor.
+inline void wake_io_waiter(std::atomic<io_waiter *> &slot) noexcept {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (slot.load(std::memory_order_relaxed) == nullptr) {
+    return;
+  }
+  if (io_waiter *waiter = slot.exchange(nullptr, std::memory_order_acquire)) {
+    waiter->post(waiter->executor, waiter->handle);
+  }
+}
+
+} // namespace detail
+
+// One period of a device in pull mode, handed out by co_await
+// device.next_io<SampleType>(executor). Input is read from and output
+// written to io() in place, in the device's queue whenever the period
+// doesn't wrap around its end. The period goes back to the device, output
+// to be played, when the lease is released or destroyed, which must happen
+// before the device is stopped.
+template <typename SampleType, typename Device> class audio_io_lease {
+public:
+  audio_io_lease(audio_io_lease &&other) noexcept
+      : _device(std::exchange(other._device, nullptr)),
+        _io(std::move(other._io)), _frames(other._frames),
+        _direct(other._direct) {}
+
+  audio_io_lease &operator=(audio_io_lease &&other) noexcept {
+    if (this != &other) {
+      release();
+      _device = std::exchange(other._device, nullptr);
+      _io = std::move(other._io);
+      _frames = other._frames;
+      _direct = other._direct;
+    }
+    return *this;
+  }
+
+  ~audio_io_lease() { release(); }
+
+  audio_device_io<SampleType> &io() noexcept { return _io; }
+
+  void release() noexcept {
+    if (_device) {
+      std::exchange(_device, nullptr)->finish_io(_frames, _direct);
+    }
+  }
+
+private:
+  friend Device;
+
+  audio_io_lease(Device &device, audio_device_io<SampleType> io,
+                 std::size_t frames, bool direct) noexcept
+      : _device(&device), _io(std::move(io)), _frames(frames),
+        _direct(direct) {}
+
+  Device *_device;
+  audio_device_io<SampleType> _io;
+  std::size_t _frames;
+  // Whether _io points into the device's queue rather than a copy.
+  bool _direct;
+};
+
+// Returned by next_io(). Suspends until a period of input was captured or
+// there is room for a period of output, so a coroutine never runs ahead of
+// the device, then resumes on the executor with the period's lease. Throws
+// std::runtime_error on resumption if the device stopped meanwhile.
+template <typename SampleType, typename Device, AudioIOExecutor Executor>
+class audio_io_awaitable {
+public:
+  audio_io_awaitable(Device &device, Executor &executor) noexcept
+      : _device(device), _executor(executor) {}
+
+  bool await_ready() const noexcept { return _device.io_ready(); }
+
+  bool await_suspend(std::coroutine_handle<> handle) noexcept {
+    _waiter.handle = handle;
+    _waiter.executor = &_executor;
+    _waiter.post = [](void *executor,
+                      std::coroutine_handle<> handle) noexcept {
+      static_cast<Executor *>(executor)->post(handle);
+    };
+    return _device.park_io(_waiter);
+  }
+
+  audio_io_lease<SampleType, Device> await_resume() {
+    return _device.template take_io<SampleType>();
+  }
+
+private:
+  Device &_device;
+  Executor &_executor;
+  detail::io_waiter _waiter;
+};
+
+_LIBSTDAUDIO_NAMESPACE_END
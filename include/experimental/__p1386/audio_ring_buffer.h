@@ -0,0 +1,274 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <span>
+#include <type_traits>
+
+#include "experimental/__p1386/aligned_buffer.h"
+#include "experimental/__p1386/audio_buffer.h"
+#include "experimental/__p1386/audio_buffer_copy.h"
+#include "experimental/__p1386/config.h"
+#include "experimental/__p1386/sample_convert.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+namespace detail {
+
+// Wait-free single-producer/single-consumer FIFO of trivially copyable
+// elements, in units of stride consecutive elements (one audio frame for
+// audio_ring_buffer). The capacity is rounded up to a power of two units so
+// positions are masked instead of wrapped. Each side keeps a cached copy of
+// the other side's index next to its own, on its own cache line, and only
+// reloads it when the cached value says the ring is full/empty.
+template <typename T> class spsc_ring {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+public:
+  // At most two contiguous parts, the second one starts at the beginning of
+  // the storage when the region wraps around. The spans count elements, the
+  // sizes passed to and returned by the member functions count units.
+  struct regions {
+    std::span<T> first;
+    std::span<T> second;
+
+    size_t size() const noexcept { return first.size() + second.size(); }
+  };
+
+  spsc_ring() = default;
+
+  explicit spsc_ring(size_t min_capacity, size_t stride = 1) {
+    reset(min_capacity, stride);
+  }
+
+  spsc_ring(const spsc_ring &) = delete;
+  spsc_ring &operator=(const spsc_ring &) = delete;
+
+  // Not thread safe, neither side may be running.
+  void reset(size_t min_capacity, size_t stride = 1) {
+    _capacity = std::bit_ceil(std::max<size_t>(min_capacity, 1));
+    _mask = _capacity - 1;
+    _stride = std::max<size_t>(stride, 1);
+    _storage.resize(_capacity * _stride);
+    _producer.index.store(0, std::memory_order_relaxed);
+    _producer.cached = 0;
+    _consumer.index.store(0, std::memory_order_relaxed);
+    _consumer.cached = 0;
+  }
+
+  size_t capacity() const noexcept { return _capacity; }
+
+  size_t stride() const noexcept { return _stride; }
+
+  size_t read_available() const noexcept {
+    return _producer.index.load(std::memory_order_acquire) -
+           _consumer.index.load(std::memory_order_acquire);
+  }
+
+  size_t write_available() const noexcept {
+    return capacity() - read_available();
+  }
+
+  // Producer side.
+  regions write_regions(size_t max_size = size_t(-1)) noexcept {
+    size_t tail = _producer.index.load(std::memory_order_relaxed);
+    if (capacity() - (tail - _producer.cached) < max_size) {
+      _producer.cached = _consumer.index.load(std::memory_order_acquire);
+    }
+    size_t size = std::min(max_size, capacity() - (tail - _producer.cached));
+    return make_regions(tail, size);
+  }
+
+  void commit_write(size_t size) noexcept {
+    _producer.index.store(_producer.index.load(std::memory_order_relaxed) +
+                              size,
+                          std::memory_order_release);
+  }
+
+  size_t write(const T *src, size_t size) noexcept {
+    regions r = write_regions(size);
+    std::copy_n(src, r.first.size(), r.first.data());
+    std::copy_n(src + r.first.size(), r.second.size(), r.second.data());
+    commit_write(r.size() / _stride);
+    return r.size() / _stride;
+  }
+
+  // Consumer side.
+  regions read_regions(size_t max_size = size_t(-1)) noexcept {
+    size_t head = _consumer.index.load(std::memory_order_relaxed);
+    if (_consumer.cached - head < max_size) {
+      _consumer.cached = _producer.index.load(std::memory_order_acquire);
+    }
+    return make_regions(head, std::min(max_size, _consumer.cached - head));
+  }
+
+  void commit_read(size_t size) noexcept {
+    _consumer.index.store(_consumer.index.load(std::memory_order_relaxed) +
+                              size,
+                          std::memory_order_release);
+  }
+
+  size_t read(T *dst, size_t size) noexcept {
+    regions r = read_regions(size);
+    std::copy_n(r.first.data(), r.first.size(), dst);
+    std::copy_n(r.second.data(), r.second.size(), dst + r.first.size());
+    commit_read(r.size() / _stride);
+    return r.size() / _stride;
+  }
+
+private:
+  regions make_regions(size_t index, size_t size) const noexcept {
+    size_t offset = index & _mask;
+    size_t first = std::min(size, capacity() - offset);
+    return {{_storage.data() + offset * _stride, first * _stride},
+            {_storage.data(), (size - first) * _stride}};
+  }
+
+  struct alignas(AUDIO_CACHE_LINE_SIZE) side {
+    std::atomic<size_t> index{0};
+    // The other side's index as last seen by this side.
+    size_t cached = 0;
+  };
+
+  side _producer;
+  side _consumer;
+  aligned_buffer<T> _storage;
+  size_t _capacity = 0;
+  size_t _mask = 0;
+  size_t _stride = 1;
+};
+
+} // namespace detail
+
+// Wait-free FIFO of audio frames between exactly one producer and one
+// consumer thread, e.g. a device callback and a worker thread that is not
+// real-time safe. Frames are stored interleaved; read_views() and
+// write_views() expose them in place as at most two audio_buffers, the second
+// one starting at the beginning of the storage when the region wraps around.
+template <typename SampleType> class audio_ring_buffer {
+public:
+  using sample_type = SampleType;
+  using index_type = size_t;
+  using view_type = audio_buffer<sample_type, contiguous_interleaved_t>;
+
+  struct views {
+    view_type first;
+    view_type second;
+
+    index_type size_frames() const noexcept {
+      return first.size_frames() + second.size_frames();
+    }
+  };
+
+  // The capacity is min_frames rounded up to a power of two.
+  audio_ring_buffer(index_type min_frames, index_type num_channels)
+      : _ring(min_frames, num_channels) {}
+
+  index_type size_channels() const noexcept { return _ring.stride(); }
+
+  index_type capacity_frames() const noexcept { return _ring.capacity(); }
+
+  index_type frames_readable() const noexcept { return _ring.read_available(); }
+
+  index_type frames_writable() const noexcept {
+    return _ring.write_available();
+  }
+
+  // Producer side: fill up to max_frames frames of the views, then publish
+  // them with commit_write().
+  views write_views(index_type max_frames = index_type(-1)) noexcept {
+    return make_views(_ring.write_regions(max_frames));
+  }
+
+  void commit_write(index_type num_frames) noexcept {
+    _ring.commit_write(num_frames);
+  }
+
+  // Copy as many frames of src as fit, return how many were written.
+  template <typename Layout>
+  index_type write(const audio_buffer<sample_type, Layout> &src) noexcept {
+    views v = write_views(src.size_frames());
+    index_type frames = copy(src, 0, v.first, 0, v.first.size_frames());
+    frames += copy(src, frames, v.second, 0, v.second.size_frames());
+    commit_write(frames);
+    return frames;
+  }
+
+  // Consumer side: read up to max_frames frames of the views, then release
+  // them with commit_read().
+  views read_views(index_type max_frames = index_type(-1)) noexcept {
+    return make_views(_ring.read_regions(max_frames));
+  }
+
+  void commit_read(index_type num_frames) noexcept {
+    _ring.commit_read(num_frames);
+  }
+
+  // Fill dst with as many frames as are available, return how many were read.
+  template <typename Layout>
+  index_type read(audio_buffer<sample_type, Layout> &dst) noexcept {
+    views v = read_views(dst.size_frames());
+    index_type frames = copy(v.first, 0, dst, 0, v.first.size_frames());
+    frames += copy(v.second, 0, dst, frames, v.second.size_frames());
+    commit_read(frames);
+    return frames;
+  }
+
+private:
+  views make_views(typename detail::spsc_ring<sample_type>::regions r) const
+      noexcept {
+    const index_type num_channels = size_channels();
+    return {view_type(r.first.data(), r.first.size() / num_channels,
+                      num_channels),
+            view_type(r.second.data(), r.second.size() / num_channels,
+                      num_channels)};
+  }
+
+  detail::spsc_ring<sample_type> _ring;
+};
+
+// Device callback that moves audio between a device and a ring buffer, so the
+// audio can be produced or consumed on a thread that is not real-time safe:
+//
+//   audio_ring_buffer<float> ring(4 * period, num_channels);
+//   device.connect<float>(audio_ring_buffer_io(ring));
+//   // worker thread: ring.write(...) for output, ring.read(...) for input
+//
+// Output the ring can't provide is filled with silence, input the ring has no
+// room for is dropped. The ring must outlive the connection.
+template <typename SampleType> class audio_ring_buffer_io {
+public:
+  explicit audio_ring_buffer_io(audio_ring_buffer<SampleType> &ring) noexcept
+      : _ring(&ring) {}
+
+  template <typename Device>
+  void operator()(Device &, audio_device_io<SampleType> &io) const noexcept {
+    if (io.input_buffer.has_value()) {
+      _ring->write(*io.input_buffer);
+    }
+    if (io.output_buffer.has_value()) {
+      size_t frames = _ring->read(*io.output_buffer);
+      io.output_buffer->visit([frames](auto &out) noexcept {
+        const SampleType silence = detail::from_signed<SampleType>(0);
+        for (size_t frame = frames; frame < out.size_frames(); ++frame) {
+          for (size_t ch = 0; ch < out.size_channels(); ++ch) {
+            out(ch, frame) = silence;
+          }
+        }
+      });
+    }
+  }
+
+private:
+  audio_ring_buffer<SampleType> *_ring;
+};
+
+_LIBSTDAUDIO_NAMESPACE_END
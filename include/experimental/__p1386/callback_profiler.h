@@ -0,0 +1,226 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+#include "experimental/__p1386/audio_buffer.h"
+#include "experimental/__p1386/config.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+struct audio_duration_percentiles {
+  chrono::nanoseconds p50{0};
+  chrono::nanoseconds p99{0};
+  chrono::nanoseconds p999{0};
+  chrono::nanoseconds max{0};
+};
+
+// Callback timing since start(), see audio_device::profile(). Only collected
+// when the library is built with AUDIO_ENABLE_PROFILER, otherwise empty.
+struct audio_callback_profile {
+  std::uint64_t callbacks = 0;
+  // Time spent in callbacks relative to the audio they produced, in percent.
+  double dsp_load_percent = 0;
+  // Time spent in one callback.
+  audio_duration_percentiles callback_time;
+  // Deviation of the time between two callbacks from the previous callback's
+  // duration of audio.
+  audio_duration_percentiles jitter;
+};
+
+namespace detail {
+
+// Histogram of nanosecond values in buckets of 1/8 octave, so percentiles
+// are within 12.5% from 1us to hours in a few KB. record() is wait-free and
+// meant for a single writer, snapshot() may run on any thread.
+class log_histogram {
+public:
+  static constexpr int sub_bucket_bits = 3;
+  static constexpr std::size_t sub_buckets = 1 << sub_bucket_bits;
+  static constexpr std::size_t num_buckets = 44 * sub_buckets;
+
+  void record(std::uint64_t value) noexcept {
+    _counts[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    if (value > _max.load(std::memory_order_relaxed)) {
+      _max.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  void reset() noexcept {
+    for (auto &count : _counts) {
+      count.store(0, std::memory_order_relaxed);
+    }
+    _max.store(0, std::memory_order_relaxed);
+  }
+
+  audio_duration_percentiles snapshot() const noexcept {
+    std::array<std::uint64_t, num_buckets> counts;
+    std::uint64_t total = 0;
+    for (std::size_t i = 0; i < num_buckets; ++i) {
+      counts[i] = _counts[i].load(std::memory_order_relaxed);
+      total += counts[i];
+    }
+    audio_duration_percentiles result;
+    result.p50 = percentile(counts, total, 0.5);
+    result.p99 = percentile(counts, total, 0.99);
+    result.p999 = percentile(counts, total, 0.999);
+    result.max = chrono::nanoseconds(_max.load(std::memory_order_relaxed));
+    return result;
+  }
+
+  static std::size_t bucket(std::uint64_t value) noexcept {
+    if (value < sub_buckets) {
+      return value;
+    }
+    int exponent = std::bit_width(value) - 1;
+    std::size_t mantissa =
+        (value >> (exponent - sub_bucket_bits)) & (sub_buckets - 1);
+    return std::min<std::size_t>(
+        (exponent - sub_bucket_bits + 1) * sub_buckets + mantissa,
+        num_buckets - 1);
+  }
+
+  // Largest value that falls into index.
+  static std::uint64_t bucket_limit(std::size_t index) noexcept {
+    if (index + 1 < sub_buckets) {
+      return index;
+    }
+    std::size_t next = index + 1;
+    int exponent = int(next / sub_buckets) + sub_bucket_bits - 1;
+    std::uint64_t mantissa = sub_buckets + next % sub_buckets;
+    return (mantissa << (exponent - sub_bucket_bits)) - 1;
+  }
+
+private:
+  static chrono::nanoseconds
+  percentile(const std::array<std::uint64_t, num_buckets> &counts,
+             std::uint64_t total, double fraction) noexcept {
+    if (total == 0) {
+      return chrono::nanoseconds(0);
+    }
+    auto rank = std::uint64_t(std::ceil(fraction * double(total)));
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < num_buckets; ++i) {
+      seen += counts[i];
+      if (seen >= rank) {
+        return chrono::nanoseconds(bucket_limit(i));
+      }
+    }
+    return chrono::nanoseconds(bucket_limit(num_buckets - 1));
+  }
+
+  std::array<std::atomic<std::uint32_t>, num_buckets> _counts{};
+  std::atomic<std::uint64_t> _max{0};
+};
+
+#if defined(AUDIO_ENABLE_PROFILER)
+
+// Times the user callback of a device against its deadline, the duration of
+// the audio it renders. record() runs on the audio thread and neither locks
+// nor allocates.
+class callback_profiler {
+public:
+  using time_point = chrono::time_point<audio_clock_t>;
+  static constexpr bool enabled = true;
+
+  // Not thread safe, the audio thread must not be running.
+  void reset(double sample_rate) {
+    if (!_state) {
+      _state = std::make_unique<state>();
+    }
+    _state->frame_ns = 1e9 / sample_rate;
+    _state->callback_time.reset();
+    _state->jitter.reset();
+    _state->callbacks.store(0, std::memory_order_relaxed);
+    _state->busy_ns.store(0, std::memory_order_relaxed);
+    _state->budget_ns.store(0, std::memory_order_relaxed);
+    _state->last_entered.reset();
+  }
+
+  // A callback for num_frames frames ran from entered to left.
+  void record(time_point entered, time_point left,
+              std::size_t num_frames) noexcept {
+    state &s = *_state;
+    const auto busy = std::uint64_t(
+        chrono::duration_cast<chrono::nanoseconds>(left - entered).count());
+    const auto budget = std::uint64_t(double(num_frames) * s.frame_ns);
+    s.callback_time.record(busy);
+    if (s.last_entered) {
+      auto interval = chrono::duration<double, std::nano>(
+                          entered - *s.last_entered)
+                          .count();
+      s.jitter.record(std::uint64_t(std::abs(interval - s.last_budget_ns)));
+    }
+    s.last_entered = entered;
+    s.last_budget_ns = double(budget);
+    s.callbacks.fetch_add(1, std::memory_order_relaxed);
+    s.busy_ns.fetch_add(busy, std::memory_order_relaxed);
+    s.budget_ns.fetch_add(budget, std::memory_order_relaxed);
+  }
+
+  audio_callback_profile snapshot() const noexcept {
+    audio_callback_profile profile;
+    if (!_state) {
+      return profile;
+    }
+    profile.callbacks = _state->callbacks.load(std::memory_order_relaxed);
+    auto budget = _state->budget_ns.load(std::memory_order_relaxed);
+    if (budget != 0) {
+      profile.dsp_load_percent =
+          100.0 * double(_state->busy_ns.load(std::memory_order_relaxed)) /
+          double(budget);
+    }
+    profile.callback_time = _state->callback_time.snapshot();
+    profile.jitter = _state->jitter.snapshot();
+    return profile;
+  }
+
+private:
+  struct state {
+    log_histogram callback_time;
+    log_histogram jitter;
+    std::atomic<std::uint64_t> callbacks{0};
+    std::atomic<std::uint64_t> busy_ns{0};
+    std::atomic<std::uint64_t> budget_ns{0};
+    // Audio thread only.
+    double frame_ns = 0;
+    double last_budget_ns = 0;
+    std::optional<time_point> last_entered;
+  };
+  // Heap allocated as atomics can't move.
+  std::unique_ptr<state> _state;
+};
+
+#else
+
+// Compiled out, define AUDIO_ENABLE_PROFILER to collect callback timing.
+class callback_profiler {
+public:
+  using time_point = chrono::time_point<audio_clock_t>;
+  static constexpr bool enabled = false;
+
+  void reset(double) noexcept {}
+
+  void record(time_point, time_point, std::size_t) noexcept {}
+
+  audio_callback_profile snapshot() const noexcept { return {}; }
+};
+
+#endif
+
+} // namespace detail
+
+_LIBSTDAUDIO_NAMESPACE_END
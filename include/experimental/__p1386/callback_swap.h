@@ -0,0 +1,277 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <semaphore>
+#include <stdexcept>
+#include <utility>
+
+#include "experimental/__p1386/aligned_buffer.h"
+#include "experimental/__p1386/audio_buffer.h"
+#include "experimental/__p1386/config.h"
+#include "experimental/__p1386/sample_convert.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+namespace detail {
+
+// The connect()ed callback of a device, replaceable while the device runs.
+// The audio thread owns the current callback. post() hands it the next one
+// through an atomic pointer, taken at the start of the next callback, and
+// the previous one comes back the same way once the audio thread is done
+// with it, to be destroyed by collect() on the replacing thread. So the
+// audio thread never allocates or frees.
+//
+// With a crossfade both callbacks run for crossfade frames, the previous one
+// into scratch memory cleared before each callback, and the output ramps
+// linearly from its output to the next one's. Without output, or if a
+// callback has more frames than the scratch memory, the callback is
+// replaced right away.
+//
+// Replacements are Functions. The callback the device was connected with
+// keeps its own type in connected_callback, a null Function pointer stands
+// for it, so until the first replacement it's called without type erasure.
+template <typename SampleType, typename Function> class callback_swap {
+public:
+  callback_swap(const callback_swap &) = delete;
+  callback_swap &operator=(const callback_swap &) = delete;
+
+  // Replacing thread: queue next for the audio thread, to be crossfaded in
+  // callbacks of at most max_frames frames. Throws if the previous
+  // replacement wasn't collect()ed yet.
+  void post(std::unique_ptr<Function> next, std::size_t crossfade,
+            std::size_t max_frames) {
+    if (_replacing.exchange(true, std::memory_order_acquire)) {
+      throw std::runtime_error(
+          "audio:: callback swap Error : replacement in progress");
+    }
+    // No crossfade is running, the audio thread doesn't touch _scratch.
+    if (crossfade != 0) {
+      _scratch.resize(max_frames * _num_channels);
+      _max_frames = max_frames;
+    }
+    _crossfade = crossfade;
+    _incoming.store(next.release(), std::memory_order_release);
+  }
+
+  // Wait for the audio thread to take the callback of post() and finish the
+  // crossfade. Return false on timeout.
+  bool wait(std::chrono::nanoseconds timeout) {
+    return _replaced.try_acquire_for(timeout);
+  }
+
+  // Finish the replacement in place of the audio thread, which must not be
+  // running a callback. What it replaces is destroyed right away.
+  void take_over() noexcept {
+    if (_fading) {
+      _fading = false;
+      destroy(std::exchange(_previous, nullptr));
+    }
+    if (Function *next = _incoming.exchange(nullptr,
+                                            std::memory_order_acquire)) {
+      destroy(std::exchange(_current, next));
+    }
+    _replaced.try_acquire();
+  }
+
+  // Destroy the replaced callback, after wait() or take_over(), and allow
+  // the next post().
+  void collect() noexcept {
+    delete _outgoing.exchange(nullptr, std::memory_order_acquire);
+    if (_connected_retired.exchange(false, std::memory_order_acquire)) {
+      _destroy_connected(*this);
+    }
+    _replacing.store(false, std::memory_order_release);
+  }
+
+protected:
+  callback_swap(std::size_t num_channels,
+                void (*destroy_connected)(callback_swap &) noexcept)
+      : _num_channels(num_channels), _destroy_connected(destroy_connected) {}
+
+  ~callback_swap() {
+    delete _current;
+    delete _previous;
+    delete _incoming.load(std::memory_order_relaxed);
+    delete _outgoing.load(std::memory_order_relaxed);
+  }
+
+  // Audio thread: run the current callback, (*connected)(device, io) for
+  // the connected one.
+  template <typename Device, typename Connected>
+  void run(Device &device, audio_device_io<SampleType> &io,
+           Connected *connected) noexcept {
+    if (_incoming.load(std::memory_order_relaxed) != nullptr) {
+      take_incoming(io);
+    }
+    if (_fading) {
+      crossfade(device, io, connected);
+    } else {
+      call(_current, device, io, connected);
+    }
+  }
+
+private:
+  template <typename Device, typename Connected>
+  static void call(Function *callback, Device &device,
+                   audio_device_io<SampleType> &io,
+                   Connected *connected) noexcept {
+    if (callback) {
+      (*callback)(device, io);
+    } else {
+      (*connected)(device, io);
+    }
+  }
+
+  void take_incoming(const audio_device_io<SampleType> &io) noexcept {
+    Function *next = _incoming.exchange(nullptr, std::memory_order_acquire);
+    if (!next) {
+      return;
+    }
+    Function *previous = std::exchange(_current, next);
+    if (_crossfade != 0 && io.output_buffer &&
+        io.output_buffer->size_frames() <= _max_frames) {
+      _fading = true;
+      _previous = previous;
+      _faded = 0;
+    } else {
+      retire(previous);
+      _replaced.release();
+    }
+  }
+
+  template <typename Device, typename Connected>
+  void crossfade(Device &device, audio_device_io<SampleType> &io,
+                 Connected *connected) noexcept {
+    audio_buffer<SampleType> &out = *io.output_buffer;
+    const std::size_t frames = out.size_frames();
+    if (frames > _max_frames) {
+      // Doesn't fit the scratch memory, cut over.
+      finish_crossfade();
+      call(_current, device, io, connected);
+      return;
+    }
+    // A callback that doesn't write all of its output fades from silence,
+    // not from what was left in the scratch memory.
+    std::fill_n(_scratch.data(), frames * _num_channels,
+                from_signed<SampleType>(0));
+    audio_device_io<SampleType> previous_io = io;
+    previous_io.output_buffer.emplace(_scratch.data(), frames, _num_channels,
+                                      contiguous_interleaved);
+    call(_previous, device, previous_io, connected);
+    call(_current, device, io, connected);
+
+    const SampleType *previous = _scratch.data();
+    const float step = 1.0f / float(_crossfade);
+    out.visit([&](auto &typed) noexcept {
+      for (std::size_t frame = 0; frame < frames; ++frame) {
+        const float gain =
+            std::min(1.0f, float(_faded + frame + 1) * step);
+        for (std::size_t ch = 0; ch < _num_channels; ++ch) {
+          typed(ch, frame) =
+              mix(typed(ch, frame), previous[frame * _num_channels + ch],
+                  gain);
+        }
+      }
+    });
+    _faded += frames;
+    if (_faded >= _crossfade) {
+      finish_crossfade();
+    }
+  }
+
+  void finish_crossfade() noexcept {
+    _fading = false;
+    retire(std::exchange(_previous, nullptr));
+    _replaced.release();
+  }
+
+  // gain * a + (1 - gain) * b.
+  static SampleType mix(SampleType a, SampleType b, float gain) noexcept {
+    using Work = work_type<SampleType, SampleType>;
+    if constexpr (is_integer_sample<SampleType>) {
+      return from_scaled<SampleType>(Work(to_signed(a)) * Work(gain) +
+                                     Work(to_signed(b)) * Work(1 - gain));
+    } else {
+      return SampleType(Work(a) * Work(gain) + Work(b) * Work(1 - gain));
+    }
+  }
+
+  // Replacing thread, in take_over().
+  void destroy(Function *callback) noexcept {
+    if (callback) {
+      delete callback;
+    } else {
+      _destroy_connected(*this);
+    }
+  }
+
+  void retire(Function *callback) noexcept {
+    if (callback) {
+      _outgoing.store(callback, std::memory_order_release);
+    } else {
+      _connected_retired.store(true, std::memory_order_release);
+    }
+  }
+
+  // Audio thread only, or take_over(). Null is the connected callback.
+  Function *_current = nullptr;
+  Function *_previous = nullptr;
+  bool _fading = false;
+  std::size_t _faded = 0;
+  std::size_t _num_channels;
+
+  // Written by post() before _incoming is published.
+  aligned_buffer<SampleType> _scratch;
+  std::size_t _max_frames = 0;
+  std::size_t _crossfade = 0;
+  std::atomic<Function *> _incoming{nullptr};
+  std::atomic<Function *> _outgoing{nullptr};
+  std::atomic<bool> _connected_retired{false};
+  // From post() to collect().
+  std::atomic<bool> _replacing{false};
+  void (*_destroy_connected)(callback_swap &) noexcept;
+  std::binary_semaphore _replaced{0};
+};
+
+// The callback_swap of a device connect()ed with a Callback, called
+// directly until it's replaced.
+template <typename SampleType, typename Function, typename Callback>
+class connected_callback : public callback_swap<SampleType, Function> {
+  using base = callback_swap<SampleType, Function>;
+
+public:
+  connected_callback(Callback callback, std::size_t num_channels)
+      : base(num_channels, destroy_connected),
+        _callback(std::move(callback)), _connected(&*_callback) {}
+
+  // Audio thread. _connected is only called while no replacement is
+  // current, so never once destroy_connected() ran on the replacing thread.
+  template <typename Device>
+  void operator()(Device &device, audio_device_io<SampleType> &io) noexcept {
+    this->run(device, io, _connected);
+  }
+
+private:
+  static void destroy_connected(base &self) noexcept {
+    static_cast<connected_callback &>(self)._callback.reset();
+  }
+
+  // Only the replacing thread touches the optional.
+  std::optional<Callback> _callback;
+  Callback *_connected;
+};
+
+} // namespace detail
+
+_LIBSTDAUDIO_NAMESPACE_END
@@ -0,0 +1,487 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <numbers>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "experimental/__p1386/aligned_buffer.h"
+#include "experimental/__p1386/audio_buffer.h"
+#include "experimental/__p1386/audio_buffer_copy.h"
+#include "experimental/__p1386/config.h"
+#include "experimental/__p1386/simd.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+namespace detail {
+
+// dst[i] = gain * src[i]
+inline void scale_channel(const float *src, float gain, float *dst,
+                          size_t num_frames) noexcept {
+  size_t i = 0;
+#if defined(_LIBSTDAUDIO_HAS_AVX2)
+  const simd::f32x8 g8 = simd::splat8(gain);
+  for (; i + 8 <= num_frames; i += 8) {
+    simd::store8(dst + i, simd::mul8(g8, simd::load8(src + i)));
+  }
+#elif defined(_LIBSTDAUDIO_HAS_F32X4)
+  const simd::f32x4 g4 = simd::splat4(gain);
+  for (; i + 4 <= num_frames; i += 4) {
+    simd::store4(dst + i, simd::mul4(g4, simd::load4(src + i)));
+  }
+#endif
+  for (; i < num_frames; ++i) {
+    dst[i] = gain * src[i];
+  }
+}
+
+// dst[i] += gain * src[i]
+inline void accumulate_channel(const float *src, float gain, float *dst,
+                               size_t num_frames) noexcept {
+  size_t i = 0;
+#if defined(_LIBSTDAUDIO_HAS_AVX2)
+  const simd::f32x8 g8 = simd::splat8(gain);
+  for (; i + 8 <= num_frames; i += 8) {
+    simd::store8(dst + i, simd::add8(simd::load8(dst + i),
+                                     simd::mul8(g8, simd::load8(src + i))));
+  }
+#elif defined(_LIBSTDAUDIO_HAS_F32X4)
+  const simd::f32x4 g4 = simd::splat4(gain);
+  for (; i + 4 <= num_frames; i += 4) {
+    simd::store4(dst + i, simd::add4(simd::load4(dst + i),
+                                     simd::mul4(g4, simd::load4(src + i))));
+  }
+#endif
+  for (; i < num_frames; ++i) {
+    dst[i] += gain * src[i];
+  }
+}
+
+// Interleaved stereo to mono: dst[i] = left * src[2i] + right * src[2i + 1].
+inline void downmix_interleaved_stereo(const float *src, float left,
+                                       float right, float *dst,
+                                       size_t num_frames) noexcept {
+  size_t i = 0;
+#if defined(_LIBSTDAUDIO_HAS_AVX2)
+  const simd::f32x8 l8 = simd::splat8(left), r8 = simd::splat8(right);
+  for (; i + 8 <= num_frames; i += 8) {
+    simd::f32x8 a = simd::load8(src + 2 * i);
+    simd::f32x8 b = simd::load8(src + 2 * i + 8);
+    simd::unzip2(a, b);
+    simd::store8(dst + i, simd::add8(simd::mul8(l8, a), simd::mul8(r8, b)));
+  }
+#elif defined(_LIBSTDAUDIO_HAS_F32X4)
+  const simd::f32x4 l4 = simd::splat4(left), r4 = simd::splat4(right);
+  for (; i + 4 <= num_frames; i += 4) {
+    simd::f32x4 a = simd::load4(src + 2 * i);
+    simd::f32x4 b = simd::load4(src + 2 * i + 4);
+    simd::unzip2(a, b);
+    simd::store4(dst + i, simd::add4(simd::mul4(l4, a), simd::mul4(r4, b)));
+  }
+#endif
+  for (; i < num_frames; ++i) {
+    dst[i] = left * src[2 * i] + right * src[2 * i + 1];
+  }
+}
+
+// Planar 5.1 to stereo in one pass, the center is read once for both sides:
+// left = front * L + center * C + surround * Ls, right likewise.
+inline void downmix_surround(const float *const *src, float front,
+                             float center, float surround, float *left,
+                             float *right, size_t num_frames) noexcept {
+  size_t i = 0;
+#if defined(_LIBSTDAUDIO_HAS_AVX2)
+  const simd::f32x8 f8 = simd::splat8(front), c8 = simd::splat8(center),
+                    s8 = simd::splat8(surround);
+  for (; i + 8 <= num_frames; i += 8) {
+    const simd::f32x8 c = simd::mul8(c8, simd::load8(src[2] + i));
+    simd::store8(left + i,
+                 simd::add8(simd::add8(simd::mul8(f8, simd::load8(src[0] + i)),
+                                       c),
+                            simd::mul8(s8, simd::load8(src[4] + i))));
+    simd::store8(right + i,
+                 simd::add8(simd::add8(simd::mul8(f8, simd::load8(src[1] + i)),
+                                       c),
+                            simd::mul8(s8, simd::load8(src[5] + i))));
+  }
+#elif defined(_LIBSTDAUDIO_HAS_F32X4)
+  const simd::f32x4 f4 = simd::splat4(front), c4 = simd::splat4(center),
+                    s4 = simd::splat4(surround);
+  for (; i + 4 <= num_frames; i += 4) {
+    const simd::f32x4 c = simd::mul4(c4, simd::load4(src[2] + i));
+    simd::store4(left + i,
+                 simd::add4(simd::add4(simd::mul4(f4, simd::load4(src[0] + i)),
+                                       c),
+                            simd::mul4(s4, simd::load4(src[4] + i))));
+    simd::store4(right + i,
+                 simd::add4(simd::add4(simd::mul4(f4, simd::load4(src[1] + i)),
+                                       c),
+                            simd::mul4(s4, simd::load4(src[5] + i))));
+  }
+#endif
+  for (; i < num_frames; ++i) {
+    const float c = center * src[2][i];
+    left[i] = front * src[0][i] + c + surround * src[4][i];
+    right[i] = front * src[1][i] + c + surround * src[5][i];
+  }
+}
+
+} // namespace detail
+
+// Applies a gain matrix from one channel layout to another: output channel o
+// is the sum over input channels i of gain(o, i) * input channel i. 5.1 is
+// in the WAV/SDL order L R C LFE Ls Rs.
+//
+// The matrix is classified whenever it changes and the common cases get
+// their own kernel: identity (a copy), stereo to mono, and the ITU-R BS.775
+// 5.1 to stereo downmix. Every other matrix runs one multiply-add pass per
+// non-zero gain. Interleaved buffers are transposed to planar blocks on the
+// way, the scratch for that is allocated by the constructor, so process()
+// doesn't allocate.
+class audio_channel_mixer {
+public:
+  // The default matrix of the channel counts: identity when they are equal,
+  // stereo to mono at half gain per side, mono to the front pair at -3dB,
+  // the ITU 5.1 downmix to stereo or mono, and otherwise channel i to
+  // channel i.
+  audio_channel_mixer(size_t input_channels, size_t output_channels)
+      : _input_channels(input_channels), _output_channels(output_channels) {
+    if (input_channels == 0 || output_channels == 0 ||
+        input_channels > AUDIO_MAX_CHANNELS ||
+        output_channels > AUDIO_MAX_CHANNELS) {
+      throw std::invalid_argument(
+          "audio:: channel mixer Error : unsupported channel count");
+    }
+    _matrix.resize(input_channels * output_channels);
+    _input_scratch.resize(kBlockFrames * input_channels);
+    _output_scratch.resize(kBlockFrames * output_channels);
+    set_default_matrix();
+  }
+
+  size_t input_channels() const noexcept { return _input_channels; }
+
+  size_t output_channels() const noexcept { return _output_channels; }
+
+  float gain(size_t output_channel, size_t input_channel) const noexcept {
+    assert(output_channel < _output_channels &&
+           input_channel < _input_channels);
+    return _matrix[output_channel * _input_channels + input_channel];
+  }
+
+  void set_gain(size_t output_channel, size_t input_channel,
+                float gain) noexcept {
+    assert(output_channel < _output_channels &&
+           input_channel < _input_channels);
+    _matrix[output_channel * _input_channels + input_channel] = gain;
+    classify();
+  }
+
+  // Set every gain to zero, for building a matrix with set_gain().
+  void clear() noexcept {
+    std::fill_n(_matrix.data(), _matrix.size(), 0.0f);
+    classify();
+  }
+
+  // Mix num_frames frames of in starting at in_frame into out starting at
+  // out_frame. The count is clamped to the frames both buffers have left and
+  // the number of frames mixed is returned.
+  template <typename InLayout, typename OutLayout>
+  size_t process(const audio_buffer<float, InLayout> &in, size_t in_frame,
+                 audio_buffer<float, OutLayout> &out, size_t out_frame,
+                 size_t num_frames) noexcept {
+    if constexpr (std::is_same_v<InLayout, dynamic_layout_t>) {
+      return in.visit([&](const auto &typed_in) noexcept {
+        return process(typed_in, in_frame, out, out_frame, num_frames);
+      });
+    } else if constexpr (std::is_same_v<OutLayout, dynamic_layout_t>) {
+      return out.visit([&](auto &typed_out) noexcept {
+        return process(in, in_frame, typed_out, out_frame, num_frames);
+      });
+    } else {
+      assert(in.size_channels() == _input_channels &&
+             out.size_channels() == _output_channels);
+      num_frames = std::min({num_frames, in.size_frames() - in_frame,
+                             out.size_frames() - out_frame});
+      if (_kind == kind::identity) {
+        return copy(in, in_frame, out, out_frame, num_frames);
+      }
+      constexpr bool in_interleaved =
+          std::is_same_v<InLayout, contiguous_interleaved_t>;
+      constexpr bool out_interleaved =
+          std::is_same_v<OutLayout, contiguous_interleaved_t>;
+      if constexpr (in_interleaved) {
+        if (_kind == kind::stereo_to_mono) {
+          // Mono interleaved is planar, so no transposes at all.
+          float *mono;
+          if constexpr (out_interleaved) {
+            mono = out.data() + out_frame;
+          } else {
+            mono = out.channel(0).data() + out_frame;
+          }
+          detail::downmix_interleaved_stereo(in.data() + 2 * in_frame,
+                                             _matrix[0], _matrix[1], mono,
+                                             num_frames);
+          return num_frames;
+        }
+      }
+
+      const float *src[AUDIO_MAX_CHANNELS];
+      float *dst[AUDIO_MAX_CHANNELS];
+      for (size_t done = 0; done < num_frames;) {
+        const size_t frames = std::min(kBlockFrames, num_frames - done);
+        for (size_t ch = 0; ch < _input_channels; ++ch) {
+          if constexpr (in_interleaved) {
+            src[ch] = _input_scratch.data() + ch * kBlockFrames;
+          } else {
+            src[ch] = in.channel(ch).data() + in_frame + done;
+          }
+        }
+        for (size_t ch = 0; ch < _output_channels; ++ch) {
+          if constexpr (out_interleaved) {
+            dst[ch] = _output_scratch.data() + ch * kBlockFrames;
+          } else {
+            dst[ch] = out.channel(ch).data() + out_frame + done;
+          }
+        }
+        if constexpr (in_interleaved) {
+          detail::deinterleave(
+              in.data() + (in_frame + done) * _input_channels,
+              _input_channels, frames, [&](size_t ch) noexcept {
+                return _input_scratch.data() + ch * kBlockFrames;
+              });
+        }
+        mix_planar(src, dst, frames);
+        if constexpr (out_interleaved) {
+          detail::interleave(
+              [&](size_t ch) noexcept {
+                return static_cast<const float *>(dst[ch]);
+              },
+              _output_channels, frames,
+              out.data() + (out_frame + done) * _output_channels);
+        }
+        done += frames;
+      }
+      return num_frames;
+    }
+  }
+
+  // Mix all frames of in into out, min(in.size_frames(), out.size_frames())
+  // of them, and return that count.
+  template <typename InLayout, typename OutLayout>
+  size_t process(const audio_buffer<float, InLayout> &in,
+                 audio_buffer<float, OutLayout> &out) noexcept {
+    return process(in, 0, out, 0, size_t(-1));
+  }
+
+private:
+  enum class kind { identity, stereo_to_mono, surround_to_stereo, general };
+
+  // Frames transposed at a time, a block of 8 channels stays in L1.
+  static constexpr size_t kBlockFrames = 256;
+
+  void set_default_matrix() noexcept {
+    constexpr float half_power = std::numbers::sqrt2_v<float> / 2;
+    std::fill_n(_matrix.data(), _matrix.size(), 0.0f);
+    auto set = [this](size_t o, size_t i, float g) noexcept {
+      _matrix[o * _input_channels + i] = g;
+    };
+    if (_input_channels == 2 && _output_channels == 1) {
+      set(0, 0, 0.5f);
+      set(0, 1, 0.5f);
+    } else if (_input_channels == 1 && _output_channels >= 2) {
+      set(0, 0, half_power);
+      set(1, 0, half_power);
+    } else if (_input_channels == 6 && _output_channels <= 2) {
+      // ITU-R BS.775, LFE dropped.
+      const float scale = _output_channels == 1 ? 0.5f : 1.0f;
+      for (size_t o = 0; o < 2; ++o) {
+        const size_t out = _output_channels == 1 ? 0 : o;
+        set(out, o, _matrix[out * 6 + o] + scale);
+        set(out, 2, _matrix[out * 6 + 2] + scale * half_power);
+        set(out, 4 + o, _matrix[out * 6 + 4 + o] + scale * half_power);
+      }
+    } else {
+      for (size_t ch = 0; ch < std::min(_input_channels, _output_channels);
+           ++ch) {
+        set(ch, ch, 1.0f);
+      }
+    }
+    classify();
+  }
+
+  void classify() noexcept {
+    auto g = [this](size_t o, size_t i) noexcept {
+      return _matrix[o * _input_channels + i];
+    };
+    auto only = [&](size_t o, std::initializer_list<size_t> inputs) noexcept {
+      for (size_t i = 0; i < _input_channels; ++i) {
+        if (g(o, i) != 0 &&
+            std::find(inputs.begin(), inputs.end(), i) == inputs.end()) {
+          return false;
+        }
+      }
+      return true;
+    };
+
+    _kind = kind::general;
+    if (_input_channels == _output_channels) {
+      bool identity = true;
+      for (size_t o = 0; o < _output_channels; ++o) {
+        for (size_t i = 0; i < _input_channels; ++i) {
+          identity = identity && g(o, i) == (o == i ? 1.0f : 0.0f);
+        }
+      }
+      if (identity) {
+        _kind = kind::identity;
+      }
+    } else if (_input_channels == 2 && _output_channels == 1) {
+      _kind = kind::stereo_to_mono;
+    } else if (_input_channels == 6 && _output_channels == 2 &&
+               only(0, {0, 2, 4}) && only(1, {1, 2, 5}) &&
+               g(0, 0) == g(1, 1) && g(0, 2) == g(1, 2) &&
+               g(0, 4) == g(1, 5)) {
+      _kind = kind::surround_to_stereo;
+    }
+  }
+
+  void mix_planar(const float *const *src, float *const *dst,
+                  size_t num_frames) noexcept {
+    switch (_kind) {
+    case kind::identity:
+      for (size_t ch = 0; ch < _output_channels; ++ch) {
+        std::copy_n(src[ch], num_frames, dst[ch]);
+      }
+      return;
+    case kind::stereo_to_mono:
+      detail::scale_channel(src[0], _matrix[0], dst[0], num_frames);
+      detail::accumulate_channel(src[1], _matrix[1], dst[0], num_frames);
+      return;
+    case kind::surround_to_stereo:
+      detail::downmix_surround(src, _matrix[0], _matrix[2], _matrix[4],
+                               dst[0], dst[1], num_frames);
+      return;
+    case kind::general:
+      break;
+    }
+    for (size_t o = 0; o < _output_channels; ++o) {
+      const float *row = _matrix.data() + o * _input_channels;
+      bool first = true;
+      for (size_t i = 0; i < _input_channels; ++i) {
+        if (row[i] == 0) {
+          continue;
+        }
+        if (first) {
+          detail::scale_channel(src[i], row[i], dst[o], num_frames);
+        } else {
+          detail::accumulate_channel(src[i], row[i], dst[o], num_frames);
+        }
+        first = false;
+      }
+      if (first) {
+        std::fill_n(dst[o], num_frames, 0.0f);
+      }
+    }
+  }
+
+  size_t _input_channels;
+  size_t _output_channels;
+  // Row-major, one row of input gains per output channel.
+  detail::aligned_buffer<float> _matrix;
+  kind _kind = kind::general;
+  // Planar blocks of kBlockFrames for interleaved buffers.
+  detail::aligned_buffer<float> _input_scratch;
+  detail::aligned_buffer<float> _output_scratch;
+};
+
+// Device callback that lets callback work in callback_channels channels
+// whatever the device has, mixing with the default matrices of
+// audio_channel_mixer:
+//
+//   device.connect<float>(channel_mixing_io(
+//       2, device.get_num_output_channels(), device.get_sample_rate(),
+//       callback));
+//
+// The device buffers are handed to callback in blocks of at most
+// max_callback_frames; duplex input and output are mixed in the same
+// blocks. Each block's timestamps are those of its first frame, offset
+// from the device buffer's at sample_rate. input_mixer() and
+// output_mixer() change the matrices.
+template <typename Callback> class channel_mixing_io {
+public:
+  channel_mixing_io(size_t callback_channels, size_t device_channels,
+                    double sample_rate, Callback callback,
+                    size_t max_callback_frames = 1024)
+      : _callback(std::move(callback)), _sample_rate(sample_rate),
+        _input(device_channels, callback_channels),
+        _output(callback_channels, device_channels),
+        _input_scratch(max_callback_frames * callback_channels),
+        _output_scratch(max_callback_frames * callback_channels),
+        _max_frames(max_callback_frames) {
+    if (!(sample_rate > 0)) {
+      throw std::invalid_argument(
+          "audio:: channel mixer Error : invalid sample rate");
+    }
+  }
+
+  // Device input channels to callback channels.
+  audio_channel_mixer &input_mixer() noexcept { return _input; }
+
+  // Callback channels to device output channels.
+  audio_channel_mixer &output_mixer() noexcept { return _output; }
+
+  template <typename Device>
+  void operator()(Device &device, audio_device_io<float> &io) noexcept {
+    const size_t channels = _output.input_channels();
+    const size_t num_frames =
+        io.output_buffer ? io.output_buffer->size_frames()
+        : io.input_buffer ? io.input_buffer->size_frames()
+                          : 0;
+    for (size_t done = 0; done < num_frames;) {
+      const size_t frames = std::min(_max_frames, num_frames - done);
+      audio_device_io<float> block;
+      block.sample_position = io.sample_position + done;
+      if (io.input_buffer) {
+        block.input_buffer.emplace(_input_scratch.data(), frames, channels,
+                                   contiguous_interleaved);
+        block.input_time =
+            detail::offset_time(io.input_time, double(done), _sample_rate);
+        _input.process(*io.input_buffer, done, *block.input_buffer, 0, frames);
+      }
+      if (io.output_buffer) {
+        std::fill_n(_output_scratch.data(), frames * channels, 0.0f);
+        block.output_buffer.emplace(_output_scratch.data(), frames, channels,
+                                    contiguous_interleaved);
+        block.output_time =
+            detail::offset_time(io.output_time, double(done), _sample_rate);
+      }
+      _callback(device, block);
+      if (io.output_buffer) {
+        _output.process(*block.output_buffer, 0, *io.output_buffer, done,
+                        frames);
+      }
+      done += frames;
+    }
+  }
+
+private:
+  Callback _callback;
+  double _sample_rate;
+  audio_channel_mixer _input;
+  audio_channel_mixer _output;
+  detail::aligned_buffer<float> _input_scratch;
+  detail::aligned_buffer<float> _output_scratch;
+  size_t _max_frames;
+};
+
+_LIBSTDAUDIO_NAMESPACE_END
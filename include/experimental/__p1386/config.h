@@ -11,3 +11,14 @@
 
 #define _LIBSTDAUDIO_NAMESPACE_BEGIN namespace _LIBSTDAUDIO_NAMESPACE {
 #define _LIBSTDAUDIO_NAMESPACE_END }
+
+// Capacity of the inline channel table of ptr_to_ptr_deinterleaved buffers.
+#if !defined(AUDIO_MAX_CHANNELS)
+#define AUDIO_MAX_CHANNELS 32
+#endif
+
+// Alignment of buffers and counters touched by the audio thread, to keep
+// them off cache lines shared with other data.
+#if !defined(AUDIO_CACHE_LINE_SIZE)
+#define AUDIO_CACHE_LINE_SIZE 64
+#endif
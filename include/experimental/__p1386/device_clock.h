@@ -0,0 +1,145 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <numbers>
+
+#include "experimental/__p1386/audio_buffer.h"
+#include "experimental/__p1386/config.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+namespace detail {
+
+// Maps the device's running frame position to audio_clock_t time. The audio
+// thread calls tick() on entry to every callback; the wake-up times it passes
+// jitter with the scheduler, so they are smoothed by a second order
+// delay-locked loop (F. Adriaensen, "Using a DLL to filter time", 2005) that
+// also tracks the actual sample rate of the device against audio_clock_t.
+//
+// time_at() may be called from any thread, the filter state is published
+// through a sequence lock.
+class device_clock {
+public:
+  using time_point = chrono::time_point<audio_clock_t>;
+
+  // Not thread safe, the audio thread must not be running. bandwidth_hz
+  // trades jitter rejection against how fast drift is followed.
+  void reset(double sample_rate, std::size_t period_frames,
+             double bandwidth_hz = 1.0) noexcept {
+    _epoch = audio_clock_t::now();
+    _nominal_frame_ns = 1e9 / sample_rate;
+    double omega = 2 * std::numbers::pi * bandwidth_hz * period_frames /
+                   sample_rate;
+    _b = std::numbers::sqrt2 * omega;
+    _c = omega * omega;
+    _position = 0;
+    _started = false;
+    _resync.store(false, std::memory_order_relaxed);
+    publish(0, 0, _nominal_frame_ns);
+  }
+
+  // Any thread: the stream was interrupted (e.g. paused), restart the loop
+  // from the next tick() without resetting the position.
+  void resync() noexcept { _resync.store(true, std::memory_order_relaxed); }
+
+  // Audio thread: a callback for num_frames frames was entered at now.
+  // Returns the device position of its first frame.
+  std::uint64_t tick(time_point now, std::size_t num_frames) noexcept {
+    const std::uint64_t position = _position;
+    const double now_ns =
+        chrono::duration<double, std::nano>(now - _epoch).count();
+    _lateness_ns = 0;
+    if (!_started || _resync.exchange(false, std::memory_order_relaxed)) {
+      _started = true;
+      _time_ns = now_ns;
+      _frame_ns = _nominal_frame_ns;
+    } else if (std::uint64_t elapsed = position - _origin) {
+      double predicted = _time_ns + double(elapsed) * _frame_ns;
+      double error = now_ns - predicted;
+      _lateness_ns = error;
+      _time_ns = predicted + _b * error;
+      _frame_ns += _c * error / double(elapsed);
+    }
+    _origin = position;
+    publish(_time_ns, position, _frame_ns);
+    _position += num_frames;
+    return position;
+  }
+
+  // Filtered time at which the device position reaches position, i.e. when
+  // the callback starting at that frame is (or was) entered.
+  time_point time_at(std::uint64_t position) const noexcept {
+    double time_ns, frame_ns;
+    std::uint64_t origin;
+    std::uint32_t seq;
+    do {
+      seq = _seq.load(std::memory_order_acquire);
+      time_ns = _shared_time_ns.load(std::memory_order_relaxed);
+      origin = _shared_origin.load(std::memory_order_relaxed);
+      frame_ns = _shared_frame_ns.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) != 0 || seq != _seq.load(std::memory_order_relaxed));
+
+    double ns = time_ns + (double(position) - double(origin)) * frame_ns;
+    return _epoch + chrono::duration_cast<audio_clock_t::duration>(
+                        chrono::duration<double, std::nano>(ns));
+  }
+
+  // Audio thread: how much later than predicted the last tick() came, zero
+  // for the first tick after reset() or resync().
+  chrono::nanoseconds lateness() const noexcept {
+    return chrono::nanoseconds(std::int64_t(_lateness_ns));
+  }
+
+  // Duration of one frame as measured against audio_clock_t.
+  chrono::duration<double, std::nano> frame_duration() const noexcept {
+    return chrono::duration<double, std::nano>(
+        _shared_frame_ns.load(std::memory_order_relaxed));
+  }
+
+private:
+  void publish(double time_ns, std::uint64_t origin,
+               double frame_ns) noexcept {
+    std::uint32_t seq = _seq.load(std::memory_order_relaxed);
+    _seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    _shared_time_ns.store(time_ns, std::memory_order_relaxed);
+    _shared_origin.store(origin, std::memory_order_relaxed);
+    _shared_frame_ns.store(frame_ns, std::memory_order_relaxed);
+    _seq.store(seq + 2, std::memory_order_release);
+  }
+
+  // Times are kept in double nanoseconds since _epoch, which reset() sets
+  // before the audio thread starts.
+  time_point _epoch;
+
+  // Audio thread only.
+  double _nominal_frame_ns = 0;
+  double _b = 0;
+  double _c = 0;
+  double _time_ns = 0;
+  double _frame_ns = 0;
+  double _lateness_ns = 0;
+  std::uint64_t _origin = 0;
+  std::uint64_t _position = 0;
+  bool _started = false;
+  std::atomic<bool> _resync{false};
+
+  std::atomic<std::uint32_t> _seq{0};
+  std::atomic<double> _shared_time_ns{0};
+  std::atomic<std::uint64_t> _shared_origin{0};
+  std::atomic<double> _shared_frame_ns{0};
+};
+
+} // namespace detail
+
+_LIBSTDAUDIO_NAMESPACE_END
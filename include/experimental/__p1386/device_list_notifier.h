@@ -0,0 +1,122 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "experimental/audio_backend/FunctionExtras.h"
+
+#include "experimental/__p1386/audio_event.h"
+#include "experimental/__p1386/config.h"
+#include "experimental/__p1386/rcu_cell.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+namespace detail {
+
+// Subscribers of set_audio_device_list_callback(), shared by the backends.
+//
+// The subscriber table is copy-on-write in an rcu_cell, so the backend's
+// event thread reads it without a lock. post() coalesces: events posted
+// while another thread is dispatching are merged into that thread's next
+// round, so each subscriber runs once per round, never concurrently with
+// itself, and a callback that triggers another event doesn't recurse.
+class device_list_notifier {
+public:
+  using events = std::uint32_t;
+
+  static constexpr events event_bit(audio_device_list_event event) noexcept {
+    return events(1) << unsigned(event);
+  }
+
+  static device_list_notifier &instance() {
+    static device_list_notifier notifier;
+    return notifier;
+  }
+
+  audio_device_list_callback_id subscribe(audio_device_list_event event,
+                                          llvm::unique_function<void()> cb) {
+    auto id = audio_device_list_callback_id(
+        _next_id.fetch_add(1, std::memory_order_relaxed));
+    auto callback =
+        std::make_shared<llvm::unique_function<void()>>(std::move(cb));
+    _subscribers.update([&](std::vector<subscriber> &subscribers) {
+      subscribers.push_back({id, event_bit(event), std::move(callback)});
+    });
+    return id;
+  }
+
+  // Returns false if id isn't subscribed. A dispatch round that already
+  // started may still call it once.
+  bool unsubscribe(audio_device_list_callback_id id) {
+    bool found = false;
+    _subscribers.update([&](std::vector<subscriber> &subscribers) {
+      std::erase_if(subscribers, [&](const subscriber &s) {
+        return s.id == id ? (found = true) : false;
+      });
+    });
+    return found;
+  }
+
+  // Any thread: notify the subscribers of every event in mask.
+  void post(events mask) noexcept {
+    if (mask == 0 ||
+        (_pending.fetch_or(mask | kDispatching, std::memory_order_acq_rel) &
+         kDispatching) != 0) {
+      // The dispatching thread picks mask up.
+      return;
+    }
+    for (;;) {
+      events round =
+          _pending.exchange(kDispatching, std::memory_order_acq_rel) &
+          ~kDispatching;
+      if (round == 0) {
+        events expected = kDispatching;
+        if (_pending.compare_exchange_strong(expected, 0,
+                                             std::memory_order_acq_rel)) {
+          return;
+        }
+        continue;
+      }
+      auto subscribers = _subscribers.read();
+      for (const subscriber &s : *subscribers) {
+        if ((s.mask & round) != 0) {
+          (*s.callback)();
+        }
+      }
+    }
+  }
+
+private:
+  struct subscriber {
+    audio_device_list_callback_id id;
+    events mask;
+    // Shared by the copies of the table.
+    std::shared_ptr<llvm::unique_function<void()>> callback;
+  };
+
+  static constexpr events kDispatching = events(1) << 31;
+
+  rcu_cell<std::vector<subscriber>> _subscribers;
+  std::atomic<events> _pending{0};
+  std::atomic<std::uint64_t> _next_id{1};
+};
+
+} // namespace detail
+
+// Remove a callback added by set_audio_device_list_callback(). Returns false
+// if it was already removed.
+inline bool
+remove_audio_device_list_callback(audio_device_list_callback_id id) {
+  return detail::device_list_notifier::instance().unsubscribe(id);
+}
+
+_LIBSTDAUDIO_NAMESPACE_END
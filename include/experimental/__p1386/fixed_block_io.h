@@ -0,0 +1,274 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+#include "experimental/__p1386/aligned_buffer.h"
+#include "experimental/__p1386/audio_buffer.h"
+#include "experimental/__p1386/audio_buffer_copy.h"
+#include "experimental/__p1386/config.h"
+#include "experimental/__p1386/sample_convert.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+namespace detail {
+
+// num_frames frames of buffer starting at first_frame, without copying.
+// Deinterleaved buffers become ptr_to_ptr views, whose channel table is
+// inline, so this doesn't allocate either.
+template <typename SampleType>
+audio_buffer<SampleType> frame_range(const audio_buffer<SampleType> &buffer,
+                                     size_t first_frame,
+                                     size_t num_frames) noexcept {
+  return buffer.visit([&](const auto &typed) noexcept {
+    using layout = typename std::remove_cvref_t<decltype(typed)>::layout_type;
+    const size_t num_channels = typed.size_channels();
+    if constexpr (std::is_same_v<layout, contiguous_interleaved_t>) {
+      return audio_buffer<SampleType>(
+          typed.data() + first_frame * num_channels, num_frames, num_channels,
+          contiguous_interleaved);
+    } else {
+      SampleType *channels[AUDIO_MAX_CHANNELS];
+      for (size_t ch = 0; ch < num_channels; ++ch) {
+        channels[ch] = typed.channel(ch).data() + first_frame;
+      }
+      return audio_buffer<SampleType>(channels, num_frames, num_channels,
+                                      ptr_to_ptr_deinterleaved);
+    }
+  });
+}
+
+} // namespace detail
+
+// Device callback that calls callback with exactly block_frames frames per
+// call whatever period the device delivers, for DSP tuned to a block size:
+//
+//   device.connect<float>(make_fixed_block_io<float>(
+//       64, device.get_num_output_channels(), device.get_sample_rate(),
+//       callback));
+//
+// sample_position, input_time and output_time are those of each block's
+// first frame, the times are offset from the device buffer's by the
+// frames in between at sample_rate.
+//
+// While the device period is a multiple of block_frames the device buffers
+// are split into views of block_frames, no frame is copied and no latency
+// added. Any other period goes through internal FIFOs: output is rendered a
+// block ahead and the rest of the block kept for the next period, input
+// waits until a block is complete. Duplex input is then delayed by one
+// block, so each block has the input it needs. This adds at most
+// block_frames - 1 frames of output latency and block_frames of input
+// latency, and only once a period was not a multiple of block_frames.
+//
+// Everything is allocated by the constructor. Periods longer than
+// max_period_frames are fine, they are processed in parts.
+template <typename SampleType, typename Callback> class fixed_block_io {
+public:
+  fixed_block_io(size_t block_frames, size_t num_channels, double sample_rate,
+                 Callback callback, size_t max_period_frames = 4096)
+      : _callback(std::move(callback)), _block_frames(block_frames),
+        _num_channels(num_channels), _sample_rate(sample_rate),
+        _input_capacity(block_frames + std::max(max_period_frames,
+                                                block_frames)),
+        _input(_input_capacity * num_channels),
+        _output(block_frames * num_channels) {
+    if (block_frames == 0 || num_channels == 0) {
+      throw std::invalid_argument("audio:: fixed block Error : empty block");
+    }
+    if (!(sample_rate > 0)) {
+      throw std::invalid_argument("audio:: fixed block Error : invalid "
+                                  "sample rate");
+    }
+    if (num_channels > AUDIO_MAX_CHANNELS) {
+      throw std::invalid_argument("audio:: fixed block Error : too many "
+                                  "channels, increase AUDIO_MAX_CHANNELS");
+    }
+  }
+
+  size_t block_frames() const noexcept { return _block_frames; }
+
+  // Bound on the latency added, 0 as long as every period was a multiple of
+  // block_frames(). Once buffering started it stays on, so the latency
+  // doesn't change with the period.
+  size_t max_added_latency_frames() const noexcept {
+    return _buffered ? _block_frames : 0;
+  }
+
+  template <typename Device>
+  void operator()(Device &device, audio_device_io<SampleType> &io) noexcept {
+    const size_t num_frames =
+        io.output_buffer ? io.output_buffer->size_frames()
+        : io.input_buffer ? io.input_buffer->size_frames()
+                          : 0;
+    if (!_buffered && num_frames % _block_frames == 0) {
+      split(device, io, num_frames);
+      return;
+    }
+    if (!_buffered) {
+      _buffered = true;
+      _position = io.sample_position;
+      if (io.input_buffer && io.output_buffer) {
+        // Every block of output then finds a block of input.
+        std::fill_n(_input.data(), _block_frames * _num_channels, silence());
+        _input_filled = _block_frames;
+      }
+    }
+    buffer(device, io, num_frames);
+  }
+
+private:
+  static SampleType silence() noexcept {
+    return detail::from_signed<SampleType>(0);
+  }
+
+  std::optional<chrono::time_point<audio_clock_t>>
+  offset(const std::optional<chrono::time_point<audio_clock_t>> &time,
+         std::ptrdiff_t frames) const noexcept {
+    return detail::offset_time(time, double(frames), _sample_rate);
+  }
+
+  // The period is a multiple of the block: hand out views.
+  template <typename Device>
+  void split(Device &device, audio_device_io<SampleType> &io,
+             size_t num_frames) noexcept {
+    for (size_t frame = 0; frame < num_frames; frame += _block_frames) {
+      audio_device_io<SampleType> block;
+      block.sample_position = io.sample_position + frame;
+      if (io.input_buffer) {
+        block.input_buffer =
+            detail::frame_range(*io.input_buffer, frame, _block_frames);
+        block.input_time = offset(io.input_time, std::ptrdiff_t(frame));
+      }
+      if (io.output_buffer) {
+        block.output_buffer =
+            detail::frame_range(*io.output_buffer, frame, _block_frames);
+        block.output_time = offset(io.output_time, std::ptrdiff_t(frame));
+      }
+      _callback(device, block);
+    }
+  }
+
+  // Any other period: run whole blocks through the FIFOs.
+  template <typename Device>
+  void buffer(Device &device, audio_device_io<SampleType> &io,
+              size_t num_frames) noexcept {
+    audio_buffer<SampleType> input(_input.data(), _input_capacity,
+                                   _num_channels, contiguous_interleaved);
+    audio_buffer<SampleType> output(_output.data(), _block_frames,
+                                    _num_channels, contiguous_interleaved);
+    size_t input_done = 0;
+    size_t output_done = 0;
+    if (io.output_buffer) {
+      output_done = copy(output, _block_frames - _output_left,
+                         *io.output_buffer, 0, _output_left);
+      _output_left -= output_done;
+    }
+    while (true) {
+      if (io.input_buffer) {
+        input_done += push_input(input, *io.input_buffer, input_done);
+      }
+      const bool input_ready =
+          !io.input_buffer || _input_filled - _input_read >= _block_frames;
+      if (!input_ready || (io.output_buffer && output_done == num_frames)) {
+        break;
+      }
+      audio_device_io<SampleType> block;
+      block.sample_position = _position;
+      if (io.input_buffer) {
+        block.input_buffer =
+            detail::frame_range(input, _input_read, _block_frames);
+        // The FIFO ends with the device frames before input_done, the
+        // block may start in an earlier period.
+        block.input_time =
+            offset(io.input_time, std::ptrdiff_t(input_done) -
+                                      std::ptrdiff_t(_input_filled -
+                                                     _input_read));
+        _input_read += _block_frames;
+      }
+      if (io.output_buffer) {
+        block.output_buffer = output;
+        // Its first frame is played at output_done.
+        block.output_time =
+            offset(io.output_time, std::ptrdiff_t(output_done));
+      }
+      _callback(device, block);
+      _position += _block_frames;
+      if (io.output_buffer) {
+        const size_t played =
+            copy(output, 0, *io.output_buffer, output_done, _block_frames);
+        output_done += played;
+        _output_left = _block_frames - played;
+      }
+    }
+    // Only reached if a period had less input than output.
+    if (io.output_buffer && output_done < num_frames) {
+      io.output_buffer->visit([&](auto &out) noexcept {
+        for (size_t ch = 0; ch < _num_channels; ++ch) {
+          for (size_t frame = output_done; frame < num_frames; ++frame) {
+            out(ch, frame) = silence();
+          }
+        }
+      });
+    }
+  }
+
+  // Move what is left to the front of the input FIFO and append as much of
+  // the device input starting at first_frame as fits. Returns the frames
+  // appended.
+  size_t push_input(audio_buffer<SampleType> &fifo,
+                    const audio_buffer<SampleType> &in,
+                    size_t first_frame) noexcept {
+    if (_input_read > 0) {
+      std::copy(_input.data() + _input_read * _num_channels,
+                _input.data() + _input_filled * _num_channels, _input.data());
+      _input_filled -= _input_read;
+      _input_read = 0;
+    }
+    const size_t pushed =
+        copy(in, first_frame, fifo, _input_filled,
+             std::min(in.size_frames() - first_frame,
+                      _input_capacity - _input_filled));
+    _input_filled += pushed;
+    return pushed;
+  }
+
+  Callback _callback;
+  size_t _block_frames;
+  size_t _num_channels;
+  double _sample_rate;
+  size_t _input_capacity;
+  // Interleaved input, frames [_input_read, _input_filled) not handed out
+  // yet.
+  detail::aligned_buffer<SampleType> _input;
+  size_t _input_read = 0;
+  size_t _input_filled = 0;
+  // The last block rendered, its last _output_left frames not played yet.
+  detail::aligned_buffer<SampleType> _output;
+  size_t _output_left = 0;
+  bool _buffered = false;
+  // Position of the next block in buffered mode.
+  std::uint64_t _position = 0;
+};
+
+template <typename SampleType, typename Callback>
+fixed_block_io<SampleType, std::decay_t<Callback>>
+make_fixed_block_io(size_t block_frames, size_t num_channels,
+                    double sample_rate, Callback &&callback,
+                    size_t max_period_frames = 4096) {
+  return fixed_block_io<SampleType, std::decay_t<Callback>>(
+      block_frames, num_channels, sample_rate,
+      std::forward<Callback>(callback), max_period_frames);
+}
+
+_LIBSTDAUDIO_NAMESPACE_END
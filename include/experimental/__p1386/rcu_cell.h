@@ -0,0 +1,112 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "experimental/__p1386/config.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+namespace detail {
+
+// An immutable T published read-copy-update style. Readers pin the current
+// value with read(), which is lock-free: one counter increment and a pointer
+// load. Writers copy the value, change the copy and publish it with a
+// pointer swap; they are serialized by a mutex and may allocate.
+//
+// The previous values are freed by a later writer once it sees no reader in
+// flight. Keep read() scopes short, a reader that never leaves keeps every
+// value published after it started alive.
+template <typename T> class rcu_cell {
+public:
+  // Pins the value that was current when it was created.
+  class read_guard {
+  public:
+    read_guard(read_guard &&other) noexcept
+        : _cell(std::exchange(other._cell, nullptr)), _value(other._value) {}
+
+    read_guard &operator=(read_guard &&) = delete;
+
+    ~read_guard() {
+      if (_cell) {
+        _cell->_readers.fetch_sub(1, std::memory_order_seq_cst);
+      }
+    }
+
+    const T &operator*() const noexcept { return *_value; }
+
+    const T *operator->() const noexcept { return _value; }
+
+  private:
+    friend class rcu_cell;
+
+    explicit read_guard(const rcu_cell &cell) noexcept : _cell(&cell) {
+      // The increment must be ordered before the load, so a writer that
+      // sees no readers after its swap knows later readers see the new value.
+      cell._readers.fetch_add(1, std::memory_order_seq_cst);
+      _value = cell._current.load(std::memory_order_seq_cst);
+    }
+
+    const rcu_cell *_cell;
+    const T *_value;
+  };
+
+  explicit rcu_cell(T value = T())
+      : _current(new T(std::move(value))) {}
+
+  rcu_cell(const rcu_cell &) = delete;
+  rcu_cell &operator=(const rcu_cell &) = delete;
+
+  ~rcu_cell() { delete _current.load(std::memory_order_relaxed); }
+
+  read_guard read() const noexcept { return read_guard(*this); }
+
+  // Publish a new value.
+  void store(T value) {
+    std::lock_guard lock(_writer);
+    publish(std::make_unique<T>(std::move(value)));
+  }
+
+  // Publish a copy of the current value changed by f(T &).
+  template <typename F> void update(F &&f) {
+    std::lock_guard lock(_writer);
+    auto next =
+        std::make_unique<T>(*_current.load(std::memory_order_relaxed));
+    std::forward<F>(f)(*next);
+    publish(std::move(next));
+  }
+
+  // Values retired but not freed yet, for tests.
+  std::size_t retired() const {
+    std::lock_guard lock(_writer);
+    return _retired.size();
+  }
+
+private:
+  void publish(std::unique_ptr<T> next) {
+    _retired.emplace_back(
+        _current.exchange(next.release(), std::memory_order_seq_cst));
+    if (_readers.load(std::memory_order_seq_cst) == 0) {
+      _retired.clear();
+    }
+  }
+
+  std::atomic<const T *> _current;
+  mutable std::atomic<std::size_t> _readers{0};
+  mutable std::mutex _writer;
+  std::vector<std::unique_ptr<const T>> _retired;
+};
+
+} // namespace detail
+
+_LIBSTDAUDIO_NAMESPACE_END
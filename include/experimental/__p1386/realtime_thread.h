@@ -0,0 +1,204 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <system_error>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "experimental/__p1386/config.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+// Scheduling policy of a real-time audio thread.
+enum class audio_thread_policy {
+  // Leave the scheduling alone, only apply the affinity and memory locking.
+  none,
+  // SCHED_FIFO.
+  fifo,
+  // SCHED_RR.
+  round_robin,
+  // SCHED_DEADLINE, set with sched_setattr() without going through rtkit.
+  deadline
+};
+
+// How an audio thread is promoted, see make_this_thread_realtime().
+struct audio_realtime_config {
+  audio_thread_policy policy = audio_thread_policy::fifo;
+  // SCHED_FIFO/SCHED_RR priority.
+  int priority = 70;
+  // SCHED_DEADLINE parameters. A zero period is the device period, a zero
+  // deadline the period and a zero runtime half of it.
+  chrono::nanoseconds runtime{0};
+  chrono::nanoseconds deadline{0};
+  chrono::nanoseconds period{0};
+  // CPUs the thread may run on, empty to keep its affinity. SCHED_DEADLINE
+  // threads can't be pinned, cpus with the deadline policy is rejected.
+  std::vector<int> cpus;
+  // mlockall() the current and future pages of the process and prefault
+  // the thread's stack, so the audio thread never takes a page fault.
+  bool lock_memory = false;
+};
+
+// The step of make_this_thread_realtime() that failed and why. The error is
+// errc::not_supported on platforms other than Linux, errc::invalid_argument
+// for a config out of range and errc::operation_not_permitted without the
+// privileges (CAP_SYS_NICE, RLIMIT_RTPRIO, RLIMIT_MEMLOCK).
+struct audio_realtime_error {
+  enum class step { affinity, memory_lock, scheduling };
+  step failed;
+  std::error_code error;
+};
+
+using audio_realtime_result = std::expected<void, audio_realtime_error>;
+
+namespace detail {
+
+#if defined(__linux__)
+
+inline audio_realtime_result realtime_failure(audio_realtime_error::step step,
+                                              int error) noexcept {
+  return std::unexpected(audio_realtime_error{
+      step, std::error_code(error, std::system_category())});
+}
+
+// Touch 64 KiB of stack so they are mapped, and locked by mlockall().
+[[gnu::noinline]] inline void prefault_stack() noexcept {
+  constexpr std::size_t size = 64 * 1024;
+  volatile unsigned char stack[size];
+  for (std::size_t i = 0; i < size; i += 4096) {
+    stack[i] = 0;
+  }
+  (void)stack;
+}
+
+// glibc only wraps sched_setattr() since 2.41.
+struct sched_deadline_attr {
+  std::uint32_t size;
+  std::uint32_t sched_policy;
+  std::uint64_t sched_flags;
+  std::int32_t sched_nice;
+  std::uint32_t sched_priority;
+  std::uint64_t sched_runtime;
+  std::uint64_t sched_deadline;
+  std::uint64_t sched_period;
+};
+
+inline int set_deadline_scheduling(const audio_realtime_config &config,
+                                   chrono::nanoseconds period) noexcept {
+  if (config.period.count() != 0) {
+    period = config.period;
+  }
+  const chrono::nanoseconds deadline =
+      config.deadline.count() != 0 ? config.deadline : period;
+  const chrono::nanoseconds runtime =
+      config.runtime.count() != 0 ? config.runtime : period / 2;
+  if (period.count() <= 0 || runtime.count() <= 0 || runtime > deadline ||
+      deadline > period) {
+    return EINVAL;
+  }
+  constexpr std::uint32_t sched_deadline = 6;
+  sched_deadline_attr attr{};
+  attr.size = sizeof(attr);
+  attr.sched_policy = sched_deadline;
+  attr.sched_runtime = std::uint64_t(runtime.count());
+  attr.sched_deadline = std::uint64_t(deadline.count());
+  attr.sched_period = std::uint64_t(period.count());
+  return syscall(SYS_sched_setattr, 0, &attr, 0) == 0 ? 0 : errno;
+}
+
+inline int set_priority_scheduling(int policy, int priority) noexcept {
+  if (priority < sched_get_priority_min(policy) ||
+      priority > sched_get_priority_max(policy)) {
+    return EINVAL;
+  }
+  sched_param param{};
+  param.sched_priority = priority;
+  return pthread_setschedparam(pthread_self(), policy, &param);
+}
+
+#endif
+
+} // namespace detail
+
+// Promote the calling thread to a real-time audio thread: apply the
+// affinity, lock the memory, then switch the scheduling policy, stopping at
+// the first step that fails. period is the device period that SCHED_DEADLINE
+// defaults to. The backends call this on their callback thread before its
+// first callback if set_realtime() was given a config; call it directly for
+// threads of your own, like the consumer of an audio_ring_buffer.
+inline audio_realtime_result
+make_this_thread_realtime(const audio_realtime_config &config,
+                          chrono::nanoseconds period = {}) noexcept {
+#if defined(__linux__)
+  using step = audio_realtime_error::step;
+  // The kernel refuses SCHED_DEADLINE for a pinned thread with EPERM, which
+  // would read as missing privileges, after the affinity was applied.
+  if (config.policy == audio_thread_policy::deadline &&
+      !config.cpus.empty()) {
+    return detail::realtime_failure(step::affinity, EINVAL);
+  }
+  if (!config.cpus.empty()) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : config.cpus) {
+      if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return detail::realtime_failure(step::affinity, EINVAL);
+      }
+      CPU_SET(cpu, &cpus);
+    }
+    if (int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus),
+                                           &cpus)) {
+      return detail::realtime_failure(step::affinity, error);
+    }
+  }
+  if (config.lock_memory) {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      return detail::realtime_failure(step::memory_lock, errno);
+    }
+    detail::prefault_stack();
+  }
+  int error = 0;
+  switch (config.policy) {
+  case audio_thread_policy::none:
+    break;
+  case audio_thread_policy::fifo:
+    error = detail::set_priority_scheduling(SCHED_FIFO, config.priority);
+    break;
+  case audio_thread_policy::round_robin:
+    error = detail::set_priority_scheduling(SCHED_RR, config.priority);
+    break;
+  case audio_thread_policy::deadline:
+    error = detail::set_deadline_scheduling(config, period);
+    break;
+  }
+  if (error != 0) {
+    return detail::realtime_failure(step::scheduling, error);
+  }
+  return {};
+#else
+  (void)config;
+  (void)period;
+  return std::unexpected(audio_realtime_error{
+      audio_realtime_error::step::scheduling,
+      std::make_error_code(std::errc::not_supported)});
+#endif
+}
+
+_LIBSTDAUDIO_NAMESPACE_END
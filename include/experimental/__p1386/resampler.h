@@ -0,0 +1,442 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <numbers>
+#include <stdexcept>
+#include <utility>
+
+#include "experimental/__p1386/aligned_buffer.h"
+#include "experimental/__p1386/audio_buffer.h"
+#include "experimental/__p1386/audio_buffer_copy.h"
+#include "experimental/__p1386/config.h"
+#include "experimental/__p1386/simd.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+// Filter length and stopband attenuation of a resampler. Every tier passes
+// the band up to (cutoff * the lower Nyquist frequency) flat.
+enum class resampler_quality {
+  // 16 taps, about 60dB, cutoff 0.80.
+  fast,
+  // 32 taps, about 90dB, cutoff 0.90.
+  balanced,
+  // 64 taps, about 120dB, cutoff 0.95.
+  best,
+};
+
+namespace detail {
+
+struct resampler_design {
+  std::size_t taps;
+  std::size_t phases;
+  double kaiser_beta;
+  double cutoff;
+};
+
+constexpr resampler_design resampler_design_of(resampler_quality quality) {
+  switch (quality) {
+  case resampler_quality::fast:
+    return {16, 32, 5.7, 0.80};
+  case resampler_quality::balanced:
+    return {32, 128, 8.6, 0.90};
+  case resampler_quality::best:
+    break;
+  }
+  return {64, 512, 11.5, 0.95};
+}
+
+// Modified Bessel function of the first kind of order 0, for the Kaiser
+// window. Not std::cyl_bessel_i, which libc++ doesn't have.
+inline double bessel_i0(double x) noexcept {
+  double sum = 1, term = 1;
+  for (int k = 1; k < 64 && term > sum * 1e-17; ++k) {
+    const double half = x / (2 * k);
+    term *= half * half;
+    sum += term;
+  }
+  return sum;
+}
+
+// coefficients = row0 + fraction * (row1 - row0), taps is a multiple of 8.
+inline void interpolate_taps(const float *row0, const float *row1,
+                             float fraction, float *coefficients,
+                             std::size_t taps) noexcept {
+  std::size_t i = 0;
+#if defined(_LIBSTDAUDIO_HAS_AVX2)
+  const simd::f32x8 f8 = simd::splat8(fraction);
+  for (; i < taps; i += 8) {
+    const simd::f32x8 a = simd::load8(row0 + i);
+    simd::store8(coefficients + i,
+                 simd::add8(a, simd::mul8(f8, simd::sub8(simd::load8(row1 + i),
+                                                         a))));
+  }
+#elif defined(_LIBSTDAUDIO_HAS_F32X4)
+  const simd::f32x4 f4 = simd::splat4(fraction);
+  for (; i < taps; i += 4) {
+    const simd::f32x4 a = simd::load4(row0 + i);
+    simd::store4(coefficients + i,
+                 simd::add4(a, simd::mul4(f4, simd::sub4(simd::load4(row1 + i),
+                                                         a))));
+  }
+#endif
+  for (; i < taps; ++i) {
+    coefficients[i] = row0[i] + fraction * (row1[i] - row0[i]);
+  }
+}
+
+// Sum of samples[i] * coefficients[i], taps is a multiple of 8.
+inline float dot_taps(const float *samples, const float *coefficients,
+                      std::size_t taps) noexcept {
+  std::size_t i = 0;
+  float sum = 0;
+#if defined(_LIBSTDAUDIO_HAS_AVX2)
+  // Two accumulators hide the latency of the adds.
+  simd::f32x8 acc0 = simd::splat8(0), acc1 = simd::splat8(0);
+  for (; i + 16 <= taps; i += 16) {
+    acc0 = simd::add8(acc0, simd::mul8(simd::load8(samples + i),
+                                       simd::load8(coefficients + i)));
+    acc1 = simd::add8(acc1, simd::mul8(simd::load8(samples + i + 8),
+                                       simd::load8(coefficients + i + 8)));
+  }
+  for (; i < taps; i += 8) {
+    acc0 = simd::add8(acc0, simd::mul8(simd::load8(samples + i),
+                                       simd::load8(coefficients + i)));
+  }
+  sum = simd::hsum8(simd::add8(acc0, acc1));
+#elif defined(_LIBSTDAUDIO_HAS_F32X4)
+  simd::f32x4 acc0 = simd::splat4(0), acc1 = simd::splat4(0);
+  for (; i < taps; i += 8) {
+    acc0 = simd::add4(acc0, simd::mul4(simd::load4(samples + i),
+                                       simd::load4(coefficients + i)));
+    acc1 = simd::add4(acc1, simd::mul4(simd::load4(samples + i + 4),
+                                       simd::load4(coefficients + i + 4)));
+  }
+  sum = simd::hsum4(simd::add4(acc0, acc1));
+#endif
+  for (; i < taps; ++i) {
+    sum += samples[i] * coefficients[i];
+  }
+  return sum;
+}
+
+} // namespace detail
+
+// Streaming sample rate converter for float audio: a Kaiser windowed sinc
+// evaluated from a polyphase table, interpolating linearly between the
+// phases, so any ratio works and it can change while streaming.
+//
+//   resampler rs(2, 44100, 48000);
+//   rs.write(input);               // frames accepted
+//   rs.read(output);               // frames produced
+//
+// Input is kept in an internal history of max_write_frames frames beyond the
+// filter length; write() accepts what fits, read() produces what the history
+// allows. Output frame n is the input at time n / ratio() with the filter
+// delay compensated, the first outputs ramp up from the silence the history
+// starts with. Constructing allocates, everything else is real-time safe.
+class resampler {
+public:
+  resampler(std::size_t num_channels, double input_rate, double output_rate,
+            resampler_quality quality = resampler_quality::balanced,
+            std::size_t max_write_frames = 1024)
+      : _num_channels(num_channels) {
+    if (num_channels == 0 || !(input_rate > 0) || !(output_rate > 0)) {
+      throw std::invalid_argument("audio:: resampler Error : bad format");
+    }
+    const auto design = detail::resampler_design_of(quality);
+    _ratio = output_rate / input_rate;
+    _step = 1 / _ratio;
+    // Downsampling stretches the filter to the output's Nyquist frequency.
+    const double scale = std::min(1.0, _ratio);
+    _taps = std::min<std::size_t>(
+        (std::size_t(std::ceil(double(design.taps) / scale)) + 7) & ~7,
+        1024);
+    _phases = design.phases;
+    build_table(design.cutoff * scale, design.kaiser_beta);
+    _capacity = _taps + max_write_frames;
+    _history.resize(_capacity * _num_channels);
+    _coefficients.resize(_taps);
+    reset();
+  }
+
+  std::size_t num_channels() const noexcept { return _num_channels; }
+
+  // Output frames per input frame.
+  double ratio() const noexcept { return _ratio; }
+
+  // Change the ratio from the next output frame, e.g. to follow the drift
+  // between two device clocks. The filter stays the one designed for the
+  // ratio at construction, so keep changes within a few percent of it.
+  void set_ratio(double ratio) noexcept {
+    assert(ratio > 0);
+    _ratio = ratio;
+    _step = 1 / ratio;
+  }
+
+  // Input frames the filter looks ahead: a frame written now shows up in
+  // the output after this many more input frames were written.
+  std::size_t latency_frames() const noexcept { return _taps / 2; }
+
+  // Input frames written after the input time the next output frame is
+  // centered on, fractional. The next output is the input at that many
+  // frames before the end of what was written.
+  double input_frames_ahead() const noexcept {
+    return double(_filled) - (_time + double(_taps / 2) - 1);
+  }
+
+  // Forget the history, as if just constructed.
+  void reset() noexcept {
+    std::fill_n(_history.data(), _history.size(), 0.0f);
+    // Delay compensation: output 0 is centered on input 0.
+    _filled = _taps / 2 - 1;
+    _time = 0;
+  }
+
+  // Frames write() accepts right now.
+  std::size_t write_available() const noexcept {
+    return _capacity - _filled + std::size_t(_time);
+  }
+
+  // Input frames to write before read() can produce output_frames frames.
+  std::size_t input_frames_needed(std::size_t output_frames) const noexcept {
+    if (output_frames == 0) {
+      return 0;
+    }
+    // Step like read() does, so the rounding is the same.
+    double time = _time;
+    for (std::size_t i = 1; i < output_frames; ++i) {
+      time += _step;
+    }
+    const std::size_t end = std::size_t(time) + _taps;
+    return end > _filled ? end - _filled : 0;
+  }
+
+  // Append input frames [first_frame, size_frames()) of in, as many as fit.
+  // Returns the number of frames accepted.
+  template <typename Layout>
+  std::size_t write(const audio_buffer<float, Layout> &in,
+                    std::size_t first_frame = 0) noexcept {
+    assert(in.size_channels() == _num_channels);
+    compact();
+    const std::size_t frames =
+        std::min(in.size_frames() - first_frame, _capacity - _filled);
+    audio_buffer<float, contiguous_deinterleaved_t> history(
+        _history.data(), _capacity, _num_channels);
+    copy(in, first_frame, history, _filled, frames);
+    _filled += frames;
+    return frames;
+  }
+
+  // Fill output frames [first_frame, size_frames()) of out, as many as the
+  // history allows. Returns the number of frames produced.
+  template <typename Layout>
+  std::size_t read(audio_buffer<float, Layout> &out,
+                   std::size_t first_frame = 0) noexcept {
+    assert(out.size_channels() == _num_channels);
+    if constexpr (std::is_same_v<Layout, dynamic_layout_t>) {
+      return out.visit([&](auto &typed_out) noexcept {
+        return read(typed_out, first_frame);
+      });
+    } else {
+      std::size_t frame = first_frame;
+      for (; frame < out.size_frames(); ++frame) {
+        const std::size_t base = std::size_t(_time);
+        if (base + _taps > _filled) {
+          break;
+        }
+        const double phase = (_time - double(base)) * double(_phases);
+        const std::size_t row = std::min(std::size_t(phase), _phases - 1);
+        detail::interpolate_taps(_table.data() + row * _taps,
+                                 _table.data() + (row + 1) * _taps,
+                                 float(phase - double(row)),
+                                 _coefficients.data(), _taps);
+        for (std::size_t ch = 0; ch < _num_channels; ++ch) {
+          out(ch, frame) =
+              detail::dot_taps(_history.data() + ch * _capacity + base,
+                               _coefficients.data(), _taps);
+        }
+        _time += _step;
+      }
+      return frame - first_frame;
+    }
+  }
+
+private:
+  // Row p of _table is the filter for the fractional delay p / _phases, the
+  // extra row _phases for the interpolation. Tap k of a row applies to input
+  // frame base + k and the output sits between frames base + taps / 2 - 1
+  // and base + taps / 2.
+  void build_table(double cutoff, double beta) {
+    _table.resize((_phases + 1) * _taps);
+    const double half = double(_taps / 2);
+    const double window_scale = 1 / detail::bessel_i0(beta);
+    for (std::size_t p = 0; p <= _phases; ++p) {
+      float *row = _table.data() + p * _taps;
+      double sum = 0;
+      for (std::size_t k = 0; k < _taps; ++k) {
+        const double x = double(k) - (half - 1) - double(p) / double(_phases);
+        const double t = x / half;
+        const double window =
+            t * t < 1 ? detail::bessel_i0(beta * std::sqrt(1 - t * t)) *
+                            window_scale
+                      : 0;
+        const double arg = std::numbers::pi * cutoff * x;
+        const double sinc = arg == 0 ? 1 : std::sin(arg) / arg;
+        row[k] = float(cutoff * sinc * window);
+        sum += row[k];
+      }
+      // Unity gain at DC for every phase, so a constant stays constant.
+      for (std::size_t k = 0; k < _taps; ++k) {
+        row[k] = float(row[k] / sum);
+      }
+    }
+  }
+
+  // Drop the frames before the filter window.
+  void compact() noexcept {
+    const std::size_t drop = std::min(std::size_t(_time), _filled);
+    if (drop == 0) {
+      return;
+    }
+    for (std::size_t ch = 0; ch < _num_channels; ++ch) {
+      float *channel = _history.data() + ch * _capacity;
+      std::memmove(channel, channel + drop, (_filled - drop) * sizeof(float));
+    }
+    _filled -= drop;
+    _time -= double(drop);
+  }
+
+  std::size_t _num_channels;
+  double _ratio = 1;
+  // Input frames per output frame.
+  double _step = 1;
+  std::size_t _taps = 0;
+  std::size_t _phases = 0;
+  detail::aligned_buffer<float> _table;
+  // Planar, _capacity frames per channel, _filled of them valid.
+  detail::aligned_buffer<float> _history;
+  std::size_t _capacity = 0;
+  std::size_t _filled = 0;
+  // Position of the next output's window start in _history, in frames.
+  double _time = 0;
+  // Filter of the output being computed.
+  detail::aligned_buffer<float> _coefficients;
+};
+
+// Device callback that runs callback at callback_rate whatever rate the
+// device runs at, so it always sees the rate it asked for:
+//
+//   device.connect<float>(resampling_io(44100, device.get_sample_rate(),
+//                                       device.get_num_output_channels(),
+//                                       callback));
+//
+// Input is resampled to callback_rate and handed to callback in blocks of
+// what the resampler produced, output is requested from callback in blocks
+// of what the resampler needs, at most max_callback_frames each. The block
+// size therefore varies by a frame from call to call. sample_position counts
+// frames at callback_rate, the timestamps are those of each block's first
+// frame, mapped through the resampler's delay to the device buffer's.
+// Use it on an input or an output device.
+template <typename Callback> class resampling_io {
+public:
+  resampling_io(double callback_rate, double device_rate,
+                std::size_t num_channels, Callback callback,
+                resampler_quality quality = resampler_quality::balanced,
+                std::size_t max_callback_frames = 1024)
+      : _callback(std::move(callback)),
+        _input(num_channels, device_rate, callback_rate, quality,
+               max_callback_frames),
+        _output(num_channels, callback_rate, device_rate, quality,
+                max_callback_frames),
+        _scratch(max_callback_frames * num_channels),
+        _max_frames(max_callback_frames), _device_rate(device_rate) {}
+
+  // Adjust the rate the callback runs at by factor, e.g. to correct drift.
+  void set_rate_factor(double factor) noexcept {
+    _input.set_ratio(_input_ratio * factor);
+    _output.set_ratio(_output_ratio / factor);
+  }
+
+  template <typename Device>
+  void operator()(Device &device, audio_device_io<float> &io) noexcept {
+    const std::size_t num_channels = _input.num_channels();
+    if (io.input_buffer.has_value()) {
+      const auto &in = *io.input_buffer;
+      std::size_t consumed = 0;
+      while (consumed < in.size_frames()) {
+        consumed += _input.write(in, consumed);
+        audio_buffer<float> block(_scratch.data(), _max_frames, num_channels,
+                                  contiguous_interleaved);
+        while (true) {
+          // The end of the history is device frame consumed.
+          const double ahead = _input.input_frames_ahead();
+          const std::size_t frames = _input.read(block);
+          if (frames == 0) {
+            break;
+          }
+          audio_device_io<float> block_io;
+          block_io.input_buffer.emplace(_scratch.data(), frames, num_channels,
+                                        contiguous_interleaved);
+          block_io.input_time = detail::offset_time(
+              io.input_time, double(consumed) - ahead, _device_rate);
+          call(device, block_io, frames);
+        }
+      }
+    }
+    if (io.output_buffer.has_value()) {
+      auto &out = *io.output_buffer;
+      std::size_t produced = _output.read(out);
+      while (produced < out.size_frames()) {
+        const std::size_t frames = std::clamp<std::size_t>(
+            _output.input_frames_needed(out.size_frames() - produced), 1,
+            std::min(_max_frames, _output.write_available()));
+        std::fill_n(_scratch.data(), frames * num_channels, 0.0f);
+        audio_device_io<float> block_io;
+        block_io.output_buffer.emplace(_scratch.data(), frames, num_channels,
+                                       contiguous_interleaved);
+        // The block is written after the callback frames ahead of device
+        // frame produced.
+        block_io.output_time = detail::offset_time(
+            io.output_time,
+            double(produced) + _output.input_frames_ahead() * _output.ratio(),
+            _device_rate);
+        call(device, block_io, frames);
+        _output.write(*block_io.output_buffer);
+        produced += _output.read(out, produced);
+      }
+    }
+  }
+
+private:
+  template <typename Device>
+  void call(Device &device, audio_device_io<float> &io,
+            std::size_t frames) noexcept {
+    io.sample_position = _position;
+    _position += frames;
+    _callback(device, io);
+  }
+
+  Callback _callback;
+  resampler _input;
+  resampler _output;
+  double _input_ratio = _input.ratio();
+  double _output_ratio = _output.ratio();
+  // One interleaved block at the callback rate.
+  detail::aligned_buffer<float> _scratch;
+  std::size_t _max_frames;
+  double _device_rate;
+  std::uint64_t _position = 0;
+};
+
+_LIBSTDAUDIO_NAMESPACE_END
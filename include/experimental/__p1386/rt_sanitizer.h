@@ -0,0 +1,78 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cstddef>
+#include <span>
+
+#include "experimental/__p1386/config.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+// A call a device callback made that may block the audio thread: an
+// allocation, a mutex lock, a sleep, file or console I/O. Reported by the
+// real-time sanitizer, see set_audio_rt_violation_handler().
+struct audio_rt_violation {
+  // The intercepted function, e.g. "malloc" or "pthread_mutex_lock".
+  const char *function;
+  // Kernel id of the audio thread.
+  int thread;
+  // Return addresses of the call, innermost first.
+  std::span<void *const> stack;
+};
+
+using audio_rt_violation_handler = void (*)(const audio_rt_violation &);
+
+#if defined(AUDIO_ENABLE_RT_SANITIZER)
+
+// The real-time sanitizer, built with -DAUDIO_ENABLE_RT_SANITIZER=ON on
+// Linux, interposes the allocation, locking and blocking functions of the C
+// library. Calls made while a device callback runs are queued without
+// blocking, and reported later by a background thread, by default to stderr
+// with a symbolized stack.
+
+// Replace the default handler, nullptr restores it. The handler runs on the
+// reporter thread or in flush_audio_rt_violations(), never on an audio
+// thread, so it may allocate and block.
+void set_audio_rt_violation_handler(
+    audio_rt_violation_handler handler) noexcept;
+
+// Report the queued violations on the calling thread, instead of waiting
+// for the reporter thread, and return how many there were.
+std::size_t flush_audio_rt_violations() noexcept;
+
+// Violations lost because the queue was full since the program started.
+std::size_t dropped_audio_rt_violations() noexcept;
+
+namespace detail {
+void rt_sanitizer_enter() noexcept;
+void rt_sanitizer_leave() noexcept;
+} // namespace detail
+
+#endif
+
+namespace detail {
+
+// Marks the calling thread as running a device callback while alive, so
+// the real-time sanitizer reports what it must not do. Does nothing without
+// AUDIO_ENABLE_RT_SANITIZER.
+class rt_section {
+public:
+#if defined(AUDIO_ENABLE_RT_SANITIZER)
+  rt_section() noexcept { rt_sanitizer_enter(); }
+  ~rt_section() { rt_sanitizer_leave(); }
+#else
+  rt_section() noexcept = default;
+#endif
+
+  rt_section(const rt_section &) = delete;
+  rt_section &operator=(const rt_section &) = delete;
+};
+
+} // namespace detail
+
+_LIBSTDAUDIO_NAMESPACE_END
@@ -0,0 +1,362 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "experimental/__p1386/config.h"
+#include "experimental/__p1386/simd.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+// Packed little-endian 24 bit sample, as found in 24-in-3-bytes streams.
+struct int24_t {
+  uint8_t bytes[3];
+
+  int24_t() = default;
+
+  constexpr int24_t(int32_t value) noexcept
+      : bytes{uint8_t(value), uint8_t(value >> 8), uint8_t(value >> 16)} {}
+
+  constexpr operator int32_t() const noexcept {
+    return int32_t(uint32_t(bytes[0]) << 8 | uint32_t(bytes[1]) << 16 |
+                   uint32_t(bytes[2]) << 24) >>
+           8;
+  }
+};
+static_assert(sizeof(int24_t) == 3);
+
+// Triangular probability density dither of +-1 LSB of the target format.
+// Keep one per stream, the state is not thread safe.
+class tpdf_dither {
+public:
+  explicit tpdf_dither(uint32_t seed = 0x9E3779B9u) noexcept {
+    for (auto &s : _state) {
+      seed = seed * 1664525u + 1013904223u;
+      s = seed | 1u;
+    }
+  }
+
+  // Noise in LSBs, in (-1, 1).
+  float next() noexcept { return uniform(_state[0]) - uniform(_state[1]); }
+
+private:
+  template <typename Src, typename Dst>
+  friend void convert_samples(const Src *, Dst *, size_t,
+                              tpdf_dither &) noexcept;
+
+  static float uniform(uint32_t &s) noexcept {
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    return float(s >> 8) * (1.0f / 16777216.0f);
+  }
+
+  uint32_t _state[8];
+};
+
+namespace detail {
+
+template <typename T> inline constexpr int sample_bits = sizeof(T) * 8;
+template <> inline constexpr int sample_bits<int24_t> = 24;
+
+template <typename T>
+inline constexpr bool is_integer_sample =
+    std::is_integral_v<T> || std::is_same_v<T, int24_t>;
+
+template <typename T>
+inline constexpr bool is_sample_type =
+    is_integer_sample<T> || std::is_same_v<T, float> ||
+    std::is_same_v<T, double>;
+
+// Identifies a sample type by the address of its tag, without RTTI.
+template <typename T> inline constexpr char sample_type_tag = 0;
+
+// float rounds exactly only up to 2^22 (see round_to_even), use double for
+// wider integers.
+template <typename Src, typename Dst>
+using work_type =
+    std::conditional_t<std::is_same_v<Src, double> ||
+                           std::is_same_v<Dst, double> ||
+                           (sample_bits<Src> > 16) || (sample_bits<Dst> > 16),
+                       double, float>;
+
+// Round to nearest even like lrint in the default rounding mode, but without
+// the library call so the loops vectorize. Valid for |value| < 2^22 (float)
+// and 2^51 (double), and only without -ffast-math.
+template <typename Work> Work round_to_even(Work value) noexcept {
+  constexpr Work magic = std::is_same_v<Work, float> ? Work(12582912.0)
+                                                     : Work(6755399441055744.0);
+  return (value + magic) - magic;
+}
+
+template <typename T, typename Work> constexpr Work full_scale() noexcept {
+  return Work(int64_t(1) << (sample_bits<T> - 1));
+}
+
+template <typename Src, typename Dst>
+inline constexpr bool reduces_precision =
+    is_integer_sample<Dst> &&
+    (!is_integer_sample<Src> || (sample_bits<Src> > sample_bits<Dst>));
+
+template <typename T> constexpr int32_t to_signed(T value) noexcept {
+  if constexpr (std::is_same_v<T, uint8_t>) {
+    return int32_t(value) - 128;
+  } else {
+    return int32_t(value);
+  }
+}
+
+template <typename T> constexpr T from_signed(int64_t value) noexcept {
+  if constexpr (std::is_same_v<T, uint8_t>) {
+    return T(value + 128);
+  } else {
+    return T(value);
+  }
+}
+
+// Sample in [-1, 1).
+template <typename Work, typename T> Work to_normalized(T value) noexcept {
+  if constexpr (is_integer_sample<T>) {
+    return Work(to_signed(value)) * (Work(1) / full_scale<T, Work>());
+  } else {
+    return Work(value);
+  }
+}
+
+// value is already multiplied by full_scale<T>().
+template <typename T, typename Work> T from_scaled(Work value) noexcept {
+  constexpr Work lowest = -full_scale<T, Work>();
+  constexpr Work highest = full_scale<T, Work>() - 1;
+  value = std::clamp(value, lowest, highest);
+  return from_signed<T>(int32_t(round_to_even(value)));
+}
+
+template <typename Dst, typename Src> Dst convert_one(Src value) noexcept {
+  if constexpr (is_integer_sample<Src> && is_integer_sample<Dst>) {
+    constexpr int shift = sample_bits<Dst> - sample_bits<Src>;
+    int64_t v = to_signed(value);
+    if constexpr (shift >= 0) {
+      return from_signed<Dst>(v * (int64_t(1) << shift));
+    } else {
+      return from_signed<Dst>(v >> -shift);
+    }
+  } else if constexpr (is_integer_sample<Dst>) {
+    using Work = work_type<Src, Dst>;
+    return from_scaled<Dst>(Work(value) * full_scale<Dst, Work>());
+  } else {
+    return Dst(to_normalized<work_type<Src, Dst>>(value));
+  }
+}
+
+// Vector bodies, return how many samples they converted.
+template <typename Src, typename Dst>
+size_t convert_simd(const Src *src, Dst *dst, size_t count) noexcept {
+  size_t i = 0;
+#if defined(_LIBSTDAUDIO_HAS_SSE2)
+  if constexpr (std::is_same_v<Src, float> && std::is_same_v<Dst, int16_t>) {
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    const __m128 lowest = _mm_set1_ps(-32768.0f);
+    const __m128 highest = _mm_set1_ps(32767.0f);
+    for (; i + 8 <= count; i += 8) {
+      __m128 a = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+      __m128 b = _mm_mul_ps(_mm_loadu_ps(src + i + 4), scale);
+      a = _mm_min_ps(_mm_max_ps(a, lowest), highest);
+      b = _mm_min_ps(_mm_max_ps(b, lowest), highest);
+      __m128i packed =
+          _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), packed);
+    }
+  } else if constexpr (std::is_same_v<Src, int16_t> &&
+                       std::is_same_v<Dst, float>) {
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    for (; i + 8 <= count; i += 8) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+      __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+      __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+      _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+      _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+  } else if constexpr (std::is_same_v<Src, float> &&
+                       std::is_same_v<Dst, int32_t>) {
+    const __m128 scale = _mm_set1_ps(2147483648.0f);
+    for (; i + 4 <= count; i += 4) {
+      __m128 v = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+      // cvtps yields INT_MIN on overflow, flip it to INT_MAX for v >= 2^31.
+      __m128i overflow = _mm_castps_si128(_mm_cmpge_ps(v, scale));
+      __m128i r = _mm_xor_si128(_mm_cvtps_epi32(v), overflow);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), r);
+    }
+  } else if constexpr (std::is_same_v<Src, int32_t> &&
+                       std::is_same_v<Dst, float>) {
+    const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+    for (; i + 4 <= count; i += 4) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+      _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+  }
+#elif defined(_LIBSTDAUDIO_HAS_NEON) &&                                        \
+    (defined(__aarch64__) || defined(_M_ARM64))
+  if constexpr (std::is_same_v<Src, float> && std::is_same_v<Dst, int16_t>) {
+    for (; i + 8 <= count; i += 8) {
+      int32x4_t a = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + i), 32768.0f));
+      int32x4_t b =
+          vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + i + 4), 32768.0f));
+      vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+    }
+  } else if constexpr (std::is_same_v<Src, int16_t> &&
+                       std::is_same_v<Dst, float>) {
+    for (; i + 8 <= count; i += 8) {
+      int16x8_t v = vld1q_s16(src + i);
+      float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+      float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)));
+      vst1q_f32(dst + i, vmulq_n_f32(lo, 1.0f / 32768.0f));
+      vst1q_f32(dst + i + 4, vmulq_n_f32(hi, 1.0f / 32768.0f));
+    }
+  } else if constexpr (std::is_same_v<Src, float> &&
+                       std::is_same_v<Dst, int32_t>) {
+    for (; i + 4 <= count; i += 4) {
+      vst1q_s32(dst + i, vcvtnq_s32_f32(
+                             vmulq_n_f32(vld1q_f32(src + i), 2147483648.0f)));
+    }
+  } else if constexpr (std::is_same_v<Src, int32_t> &&
+                       std::is_same_v<Dst, float>) {
+    for (; i + 4 <= count; i += 4) {
+      vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(src + i)),
+                                     1.0f / 2147483648.0f));
+    }
+  }
+#endif
+  return i;
+}
+
+} // namespace detail
+
+// Convert count samples from Src to Dst. Supported sample types are int8_t,
+// uint8_t (offset binary), int16_t, int24_t, int32_t, float and double.
+// Floating point samples are in [-1, 1) and clipped when converted to
+// integers. Integer to integer conversions shift without rounding.
+template <typename Src, typename Dst>
+void convert_samples(const Src *src, Dst *dst, size_t count) noexcept {
+  static_assert(detail::is_sample_type<Src> && detail::is_sample_type<Dst>,
+                "unsupported sample type");
+  if constexpr (std::is_same_v<Src, Dst>) {
+    std::copy_n(src, count, dst);
+  } else {
+    size_t i = detail::convert_simd(src, dst, count);
+    for (; i < count; ++i) {
+      dst[i] = detail::convert_one<Dst>(src[i]);
+    }
+  }
+}
+
+// As above, but adds TPDF dither when Dst has less resolution than Src.
+template <typename Src, typename Dst>
+void convert_samples(const Src *src, Dst *dst, size_t count,
+                     tpdf_dither &dither) noexcept {
+  if constexpr (!detail::reduces_precision<Src, Dst>) {
+    convert_samples(src, dst, count);
+  } else {
+    using Work = detail::work_type<Src, Dst>;
+    size_t i = 0;
+#if defined(_LIBSTDAUDIO_HAS_SSE2)
+    if constexpr (std::is_same_v<Src, float> && std::is_same_v<Dst, int16_t>) {
+      // Four xorshift32 generators per vector, two vectors of them.
+      auto *state = reinterpret_cast<__m128i *>(dither._state);
+      __m128i s0 = _mm_loadu_si128(state);
+      __m128i s1 = _mm_loadu_si128(state + 1);
+      auto uniform = [](__m128i &s) noexcept {
+        s = _mm_xor_si128(s, _mm_slli_epi32(s, 13));
+        s = _mm_xor_si128(s, _mm_srli_epi32(s, 17));
+        s = _mm_xor_si128(s, _mm_slli_epi32(s, 5));
+        return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(s, 8)),
+                          _mm_set1_ps(1.0f / 16777216.0f));
+      };
+      const __m128 scale = _mm_set1_ps(32768.0f);
+      const __m128 lowest = _mm_set1_ps(-32768.0f);
+      const __m128 highest = _mm_set1_ps(32767.0f);
+      for (; i + 8 <= count; i += 8) {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+        a = _mm_add_ps(a, _mm_sub_ps(uniform(s0), uniform(s1)));
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(src + i + 4), scale);
+        b = _mm_add_ps(b, _mm_sub_ps(uniform(s0), uniform(s1)));
+        a = _mm_min_ps(_mm_max_ps(a, lowest), highest);
+        b = _mm_min_ps(_mm_max_ps(b, lowest), highest);
+        __m128i packed =
+            _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), packed);
+      }
+      _mm_storeu_si128(state, s0);
+      _mm_storeu_si128(state + 1, s1);
+    }
+#endif
+    for (; i < count; ++i) {
+      Work value = detail::to_normalized<Work>(src[i]) *
+                   detail::full_scale<Dst, Work>();
+      dst[i] = detail::from_scaled<Dst>(value + Work(dither.next()));
+    }
+  }
+}
+
+// Scale frames interleaved frames of channels samples by a gain that goes
+// linearly from `from` to `to`, reaching `to` on the last frame. Fades a
+// stream in or out without a click.
+template <typename T>
+void apply_gain_ramp(T *samples, size_t frames, size_t channels, float from,
+                     float to) noexcept {
+  static_assert(detail::is_sample_type<T>, "unsupported sample type");
+  using Work = detail::work_type<T, T>;
+  const Work step = (Work(to) - Work(from)) / Work(std::max<size_t>(frames, 1));
+  for (size_t frame = 0; frame < frames; ++frame) {
+    const Work gain = Work(from) + step * Work(frame + 1);
+    T *sample = samples + frame * channels;
+    for (size_t channel = 0; channel < channels; ++channel) {
+      if constexpr (detail::is_integer_sample<T>) {
+        sample[channel] =
+            detail::from_scaled<T>(Work(detail::to_signed(sample[channel])) *
+                                   gain);
+      } else {
+        sample[channel] = T(Work(sample[channel]) * gain);
+      }
+    }
+  }
+}
+
+namespace detail {
+
+// Crossfade frames interleaved frames of channels samples from `from` into
+// `to`, in place: the gain of `to` goes linearly up to 1 on the last frame,
+// that of `from` down to 0, like apply_gain_ramp() on each.
+template <typename T>
+void crossfade_ramp(const T *from, T *to, size_t frames,
+                    size_t channels) noexcept {
+  static_assert(is_sample_type<T>, "unsupported sample type");
+  using Work = work_type<T, T>;
+  const Work step = Work(1) / Work(std::max<size_t>(frames, 1));
+  for (size_t frame = 0; frame < frames; ++frame) {
+    const Work gain = step * Work(frame + 1);
+    const T *a = from + frame * channels;
+    T *b = to + frame * channels;
+    for (size_t channel = 0; channel < channels; ++channel) {
+      if constexpr (is_integer_sample<T>) {
+        b[channel] = from_scaled<T>(Work(to_signed(b[channel])) * gain +
+                                    Work(to_signed(a[channel])) *
+                                        (Work(1) - gain));
+      } else {
+        b[channel] = T(Work(b[channel]) * gain +
+                       Work(a[channel]) * (Work(1) - gain));
+      }
+    }
+  }
+}
+
+} // namespace detail
+
+_LIBSTDAUDIO_NAMESPACE_END
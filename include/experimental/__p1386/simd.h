@@ -0,0 +1,189 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+// Thin wrappers over the float vector instructions used by the sample
+// kernels. The instruction set is picked at compile time from the target
+// flags (e.g. -mavx2), there is no runtime dispatch. Every kernel must keep a
+// scalar path for targets without any of these.
+
+#if defined(__AVX2__)
+#define _LIBSTDAUDIO_HAS_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define _LIBSTDAUDIO_HAS_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define _LIBSTDAUDIO_HAS_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(_LIBSTDAUDIO_HAS_SSE2) || defined(_LIBSTDAUDIO_HAS_NEON)
+#define _LIBSTDAUDIO_HAS_F32X4 1
+#endif
+
+#include "experimental/__p1386/config.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+namespace detail::simd {
+
+#if defined(_LIBSTDAUDIO_HAS_SSE2)
+using f32x4 = __m128;
+
+inline f32x4 load4(const float *p) noexcept { return _mm_loadu_ps(p); }
+
+inline void store4(float *p, f32x4 v) noexcept { _mm_storeu_ps(p, v); }
+
+inline f32x4 splat4(float x) noexcept { return _mm_set1_ps(x); }
+
+inline f32x4 add4(f32x4 a, f32x4 b) noexcept { return _mm_add_ps(a, b); }
+
+inline f32x4 sub4(f32x4 a, f32x4 b) noexcept { return _mm_sub_ps(a, b); }
+
+inline f32x4 mul4(f32x4 a, f32x4 b) noexcept { return _mm_mul_ps(a, b); }
+
+inline float hsum4(f32x4 v) noexcept {
+  f32x4 pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  return _mm_cvtss_f32(
+      _mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(1, 1, 1, 1))));
+}
+
+inline void transpose4(f32x4 &a, f32x4 &b, f32x4 &c, f32x4 &d) noexcept {
+  _MM_TRANSPOSE4_PS(a, b, c, d);
+}
+
+// [a0 a1 a2 a3] [b0 b1 b2 b3] => [a0 a2 b0 b2] [a1 a3 b1 b3]
+inline void unzip2(f32x4 &a, f32x4 &b) noexcept {
+  f32x4 even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+  f32x4 odd = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+  a = even;
+  b = odd;
+}
+
+// Inverse of unzip2.
+inline void zip2(f32x4 &a, f32x4 &b) noexcept {
+  f32x4 lo = _mm_unpacklo_ps(a, b);
+  f32x4 hi = _mm_unpackhi_ps(a, b);
+  a = lo;
+  b = hi;
+}
+#elif defined(_LIBSTDAUDIO_HAS_NEON)
+using f32x4 = float32x4_t;
+
+inline f32x4 load4(const float *p) noexcept { return vld1q_f32(p); }
+
+inline void store4(float *p, f32x4 v) noexcept { vst1q_f32(p, v); }
+
+inline f32x4 splat4(float x) noexcept { return vdupq_n_f32(x); }
+
+inline f32x4 add4(f32x4 a, f32x4 b) noexcept { return vaddq_f32(a, b); }
+
+inline f32x4 sub4(f32x4 a, f32x4 b) noexcept { return vsubq_f32(a, b); }
+
+inline f32x4 mul4(f32x4 a, f32x4 b) noexcept { return vmulq_f32(a, b); }
+
+inline float hsum4(f32x4 v) noexcept {
+  float32x2_t pairs = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+  return vget_lane_f32(vpadd_f32(pairs, pairs), 0);
+}
+
+inline void transpose4(f32x4 &a, f32x4 &b, f32x4 &c, f32x4 &d) noexcept {
+  float32x4x2_t ab = vtrnq_f32(a, b);
+  float32x4x2_t cd = vtrnq_f32(c, d);
+  a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+  b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+  c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+  d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+
+inline void unzip2(f32x4 &a, f32x4 &b) noexcept {
+  float32x4x2_t r = vuzpq_f32(a, b);
+  a = r.val[0];
+  b = r.val[1];
+}
+
+inline void zip2(f32x4 &a, f32x4 &b) noexcept {
+  float32x4x2_t r = vzipq_f32(a, b);
+  a = r.val[0];
+  b = r.val[1];
+}
+#endif
+
+#if defined(_LIBSTDAUDIO_HAS_AVX2)
+using f32x8 = __m256;
+
+inline f32x8 load8(const float *p) noexcept { return _mm256_loadu_ps(p); }
+
+inline void store8(float *p, f32x8 v) noexcept { _mm256_storeu_ps(p, v); }
+
+inline f32x8 splat8(float x) noexcept { return _mm256_set1_ps(x); }
+
+inline f32x8 add8(f32x8 a, f32x8 b) noexcept { return _mm256_add_ps(a, b); }
+
+inline f32x8 sub8(f32x8 a, f32x8 b) noexcept { return _mm256_sub_ps(a, b); }
+
+inline f32x8 mul8(f32x8 a, f32x8 b) noexcept { return _mm256_mul_ps(a, b); }
+
+inline float hsum8(f32x8 v) noexcept {
+  return hsum4(_mm_add_ps(_mm256_castps256_ps128(v),
+                          _mm256_extractf128_ps(v, 1)));
+}
+
+// [a0..a7] [b0..b7] => [a0 a2 .. b4 b6] [a1 a3 .. b5 b7]
+inline void unzip2(f32x8 &a, f32x8 &b) noexcept {
+  // Per 128-bit lane: [a0 a2 b0 b2 | a4 a6 b4 b6], then fix the lane order.
+  f32x8 even = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+  f32x8 odd = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+  a = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(even),
+                                             _MM_SHUFFLE(3, 1, 2, 0)));
+  b = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(odd),
+                                             _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+inline void zip2(f32x8 &a, f32x8 &b) noexcept {
+  f32x8 lo = _mm256_unpacklo_ps(a, b);
+  f32x8 hi = _mm256_unpackhi_ps(a, b);
+  a = _mm256_permute2f128_ps(lo, hi, 0x20);
+  b = _mm256_permute2f128_ps(lo, hi, 0x31);
+}
+
+// Written out instead of looped, -O2 does not unroll the loops and spills.
+inline void transpose8(f32x8 (&r)[8]) noexcept {
+  f32x8 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+  f32x8 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+  f32x8 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+  f32x8 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+  f32x8 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+  f32x8 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+  f32x8 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+  f32x8 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+  f32x8 s0 = _mm256_shuffle_ps(t0, t2, 0x44);
+  f32x8 s1 = _mm256_shuffle_ps(t0, t2, 0xEE);
+  f32x8 s2 = _mm256_shuffle_ps(t1, t3, 0x44);
+  f32x8 s3 = _mm256_shuffle_ps(t1, t3, 0xEE);
+  f32x8 s4 = _mm256_shuffle_ps(t4, t6, 0x44);
+  f32x8 s5 = _mm256_shuffle_ps(t4, t6, 0xEE);
+  f32x8 s6 = _mm256_shuffle_ps(t5, t7, 0x44);
+  f32x8 s7 = _mm256_shuffle_ps(t5, t7, 0xEE);
+  r[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+  r[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+  r[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+  r[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+  r[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+  r[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+  r[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+  r[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+#endif
+
+} // namespace detail::simd
+
+_LIBSTDAUDIO_NAMESPACE_END
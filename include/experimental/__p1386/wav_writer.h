@@ -0,0 +1,235 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+
+#include "experimental/__p1386/config.h"
+#include "experimental/__p1386/sample_convert.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+namespace detail {
+
+// Streams interleaved samples into a RIFF/WAVE file, the sizes in the header
+// are filled in by close(). Samples are written as they are in memory, so
+// this needs a little-endian host.
+//
+// The fmt chunk is WAVE_FORMAT_EXTENSIBLE for more than two channels or
+// integer samples of more than 16 bits, as Microsoft requires, with the
+// first speakers of the channel mask in order. Float samples otherwise are
+// WAVE_FORMAT_IEEE_FLOAT with an empty extension. A float file also has the
+// fact chunk strict readers expect for formats other than PCM.
+//
+// The 32-bit RIFF sizes end at 4 GiB, about 3 hours of 48 kHz stereo float.
+// A file that grows past that becomes RF64 (EBU Tech 3306): the header
+// reserves a JUNK chunk that close() then turns into the ds64 chunk holding
+// the 64-bit sizes, with the 32-bit ones set to 0xFFFFFFFF.
+//
+// Errors throw std::runtime_error, except in the destructor, which finishes
+// the file as well as it can.
+class wav_writer {
+  static_assert(std::endian::native == std::endian::little);
+
+public:
+  // Largest RIFF size a plain WAV file can have.
+  static constexpr std::uint64_t max_riff_size = 0xFFFFFFFF;
+
+  // riff_limit is the size past which the file becomes RF64, lowered by
+  // tests.
+  template <typename SampleType>
+  static wav_writer open(const std::filesystem::path &path, int num_channels,
+                         int sample_rate,
+                         std::uint64_t riff_limit = max_riff_size) {
+    static_assert(is_sample_type<SampleType>);
+    constexpr bool is_float = std::is_floating_point_v<SampleType>;
+    // WAV has no signed 8-bit format, 8-bit samples are offset binary.
+    constexpr bool flip_sign = std::is_same_v<SampleType, int8_t>;
+    return wav_writer(path, num_channels, sample_rate, is_float,
+                      sample_bits<SampleType>, flip_sign,
+                      std::min(riff_limit, max_riff_size));
+  }
+
+  wav_writer(wav_writer &&) = default;
+  wav_writer &operator=(wav_writer &&) = default;
+
+  ~wav_writer() { finish(); }
+
+  void write(const void *data, std::size_t size_bytes) {
+    auto *bytes = static_cast<const char *>(data);
+    if (_flip_sign) {
+      // In blocks, not a put() per sample.
+      char block[4096];
+      for (std::size_t done = 0; done < size_bytes;) {
+        const std::size_t size = std::min(sizeof(block), size_bytes - done);
+        for (std::size_t i = 0; i < size; ++i) {
+          block[i] = char(bytes[done + i] ^ 0x80);
+        }
+        _file.write(block, std::streamsize(size));
+        done += size;
+      }
+    } else {
+      _file.write(bytes, std::streamsize(size_bytes));
+    }
+    if (!_file) {
+      throw std::runtime_error("audio:: wav Error : write failed");
+    }
+    _data_size += size_bytes;
+  }
+
+  // Patch the chunk sizes and close the file. Also done by the destructor,
+  // which can't report a failure.
+  void close() {
+    if (!finish()) {
+      throw std::runtime_error("audio:: wav Error : can't finish the file");
+    }
+  }
+
+private:
+  static constexpr std::uint16_t kFormatPcm = 1;
+  static constexpr std::uint16_t kFormatFloat = 3;
+  static constexpr std::uint16_t kFormatExtensible = 0xFFFE;
+  // Body of the JUNK/ds64 chunk: three 64-bit sizes and a table length.
+  static constexpr std::uint32_t kDs64Size = 28;
+  // Body of the fmt chunk: WAVEFORMAT plus PCM bits, cbSize, and the
+  // extension of WAVEFORMATEXTENSIBLE.
+  static constexpr std::uint32_t kFmtSize = 16;
+  static constexpr std::uint32_t kFmtExSize = kFmtSize + 2;
+  static constexpr std::uint32_t kFmtExtensibleSize = kFmtExSize + 22;
+
+  wav_writer(const std::filesystem::path &path, int num_channels,
+             int sample_rate, bool is_float, int bits, bool flip_sign,
+             std::uint64_t riff_limit)
+      : _file(path, std::ios::binary | std::ios::trunc),
+        _riff_limit(riff_limit),
+        _block_align(std::uint16_t(num_channels * bits / 8)),
+        _flip_sign(flip_sign) {
+    if (!_file) {
+      throw std::runtime_error("audio:: can't open " + path.string());
+    }
+    const bool extensible = num_channels > 2 || (!is_float && bits > 16);
+    const std::uint32_t fmt_size =
+        extensible ? kFmtExtensibleSize : (is_float ? kFmtExSize : kFmtSize);
+    const std::uint16_t block_align = _block_align;
+    _file.write("RIFF", 4);
+    put_u32(0);
+    _file.write("WAVE", 4);
+    _file.write("JUNK", 4);
+    put_u32(kDs64Size);
+    for (std::uint32_t i = 0; i < kDs64Size; ++i) {
+      _file.put(0);
+    }
+    _file.write("fmt ", 4);
+    put_u32(fmt_size);
+    put_u16(extensible ? kFormatExtensible
+                       : (is_float ? kFormatFloat : kFormatPcm));
+    put_u16(std::uint16_t(num_channels));
+    put_u32(std::uint32_t(sample_rate));
+    put_u32(std::uint32_t(sample_rate) * block_align);
+    put_u16(block_align);
+    put_u16(std::uint16_t(bits));
+    if (fmt_size > kFmtSize) {
+      put_u16(std::uint16_t(fmt_size - kFmtExSize));
+    }
+    if (extensible) {
+      // Valid bits, channel mask and the subformat GUID
+      // 0000000X-0000-0010-8000-00AA00389B71.
+      put_u16(std::uint16_t(bits));
+      put_u32(num_channels <= 18 ? (std::uint32_t(1) << num_channels) - 1
+                                 : 0);
+      put_u16(is_float ? kFormatFloat : kFormatPcm);
+      _file.write("\x00\x00\x00\x00\x10\x00\x80\x00\x00\xAA\x00\x38\x9B\x71",
+                  14);
+    }
+    if (is_float) {
+      _file.write("fact", 4);
+      put_u32(4);
+      _fact_offset = std::uint64_t(_file.tellp());
+      put_u32(0);
+    }
+    _file.write("data", 4);
+    put_u32(0);
+    _header_size = std::uint64_t(_file.tellp());
+    if (!_file) {
+      throw std::runtime_error("audio:: can't write " + path.string());
+    }
+  }
+
+  // close() without throwing, false if the file is incomplete.
+  bool finish() noexcept {
+    if (!_file.is_open()) {
+      return true;
+    }
+    if (_data_size % 2 != 0) {
+      _file.put(0);
+    }
+    const std::uint64_t riff_size =
+        _header_size - 8 + _data_size + _data_size % 2;
+    const std::uint64_t frames = _data_size / _block_align;
+    if (riff_size <= _riff_limit) {
+      _file.seekp(4);
+      put_u32(std::uint32_t(riff_size));
+      if (_fact_offset != 0) {
+        _file.seekp(std::streamoff(_fact_offset));
+        put_u32(std::uint32_t(frames));
+      }
+      _file.seekp(std::streamoff(_header_size - 4));
+      put_u32(std::uint32_t(_data_size));
+    } else {
+      _file.seekp(0);
+      _file.write("RF64", 4);
+      put_u32(0xFFFFFFFF);
+      _file.seekp(12);
+      _file.write("ds64", 4);
+      put_u32(kDs64Size);
+      put_u64(riff_size);
+      put_u64(_data_size);
+      put_u64(frames);
+      put_u32(0); // No table of other chunk sizes.
+      if (_fact_offset != 0) {
+        _file.seekp(std::streamoff(_fact_offset));
+        put_u32(0xFFFFFFFF);
+      }
+      _file.seekp(std::streamoff(_header_size - 4));
+      put_u32(0xFFFFFFFF);
+    }
+    const bool written = bool(_file);
+    _file.close();
+    return written && bool(_file);
+  }
+
+  void put_u16(std::uint16_t value) {
+    _file.write(reinterpret_cast<const char *>(&value), 2);
+  }
+
+  void put_u32(std::uint32_t value) {
+    _file.write(reinterpret_cast<const char *>(&value), 4);
+  }
+
+  void put_u64(std::uint64_t value) {
+    _file.write(reinterpret_cast<const char *>(&value), 8);
+  }
+
+  std::ofstream _file;
+  std::uint64_t _data_size = 0;
+  std::uint64_t _riff_limit;
+  // Offsets of the fact sample count, 0 without one, and of the samples.
+  std::uint64_t _fact_offset = 0;
+  std::uint64_t _header_size = 0;
+  std::uint16_t _block_align;
+  bool _flip_sign = false;
+};
+
+} // namespace detail
+
+_LIBSTDAUDIO_NAMESPACE_END
@@ -0,0 +1,992 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <forward_list>
+#include <memory>
+#include <optional>
+#include <semaphore>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include "experimental/audio_backend/FunctionExtras.h"
+
+#include "experimental/__p1386/aligned_buffer.h"
+#include "experimental/__p1386/audio_buffer.h"
+#include "experimental/__p1386/audio_device.h"
+#include "experimental/__p1386/audio_device_stats.h"
+#include "experimental/__p1386/audio_event.h"
+#include "experimental/__p1386/audio_io_awaitable.h"
+#include "experimental/__p1386/audio_ring_buffer.h"
+#include "experimental/__p1386/callback_profiler.h"
+#include "experimental/__p1386/concepts.h"
+#include "experimental/__p1386/device_list_notifier.h"
+#include "experimental/__p1386/realtime_thread.h"
+#include "experimental/__p1386/rt_sanitizer.h"
+#include "experimental/__p1386/sample_convert.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+// How a simulated device deviates from an ideal one, see
+// audio_device::set_simulation(). Everything is derived from the frame count
+// and the seed, so timestamps, positions and xruns are the same on every run.
+struct audio_device_simulation {
+  // Virtual seconds per real second, 0 runs the periods back to back.
+  double speed = 1.0;
+  // Each callback is entered up to this much after it is due, uniformly
+  // distributed. Callbacks more than a period late count as late_callbacks.
+  chrono::nanoseconds jitter{0};
+  // Rate error of the device clock against audio_clock_t.
+  double drift_ppm = 0;
+  // Every xrun_interval-th period is lost as if its callback missed the
+  // deadline: output plays silence, input is dropped. 0 for never.
+  std::uint64_t xrun_interval = 0;
+  // Seed of the jitter.
+  std::uint64_t seed = 1;
+};
+
+namespace detail {
+
+// splitmix64 (S. Vigna), so the jitter doesn't depend on the standard
+// library's distributions.
+class splitmix64 {
+public:
+  explicit splitmix64(std::uint64_t seed = 0) noexcept : _state(seed) {}
+
+  std::uint64_t operator()() noexcept {
+    std::uint64_t z = (_state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+  }
+
+  // Uniform in [0, 1).
+  double uniform() noexcept { return double((*this)() >> 11) * 0x1.0p-53; }
+
+private:
+  std::uint64_t _state;
+};
+
+// The cable from the loopback output device to the loopback input device: a
+// stereo float FIFO. One device of each direction can be attached at a time,
+// which keeps the ring single-producer/single-consumer; further devices run
+// unconnected (output is discarded, input is silent).
+class loopback_bus {
+public:
+  static constexpr std::size_t num_channels = 2;
+
+  static loopback_bus &instance() {
+    static loopback_bus bus;
+    return bus;
+  }
+
+  bool attach_writer() noexcept {
+    return !_writer.exchange(true, std::memory_order_acq_rel);
+  }
+
+  void detach_writer() noexcept {
+    _writer.store(false, std::memory_order_release);
+  }
+
+  // Also drops what was written while no reader was attached.
+  bool attach_reader() noexcept {
+    if (_reader.exchange(true, std::memory_order_acq_rel)) {
+      return false;
+    }
+    _ring.commit_read(_ring.read_available());
+    return true;
+  }
+
+  void detach_reader() noexcept {
+    _reader.store(false, std::memory_order_release);
+  }
+
+  // Writer thread. Frames that don't fit are dropped.
+  void write(const float *frames, std::size_t num_frames) noexcept {
+    _ring.write(frames, num_frames);
+  }
+
+  // Reader thread. Returns the frames read, the rest of frames is untouched.
+  std::size_t read(float *frames, std::size_t num_frames) noexcept {
+    return _ring.read(frames, num_frames);
+  }
+
+private:
+  loopback_bus() : _ring(kCapacityFrames, num_channels) {}
+
+  static constexpr std::size_t kCapacityFrames = 1 << 14;
+  spsc_ring<float> _ring;
+  std::atomic<bool> _writer{false};
+  std::atomic<bool> _reader{false};
+};
+
+// Device time of a simulated device: frame n is presented at epoch + n frame
+// durations, no filtering needed. The epoch only moves when the device is
+// paused, time_at() may be called from any thread.
+class virtual_clock {
+public:
+  using time_point = chrono::time_point<audio_clock_t>;
+
+  // Not thread safe, the audio thread must not be running.
+  void reset(double sample_rate, double drift_ppm) noexcept {
+    _frame_ns = 1e9 / sample_rate * (1 + drift_ppm * 1e-6);
+    _epoch.store(audio_clock_t::now().time_since_epoch().count(),
+                 std::memory_order_relaxed);
+  }
+
+  // Audio thread: the device stood still for duration.
+  void shift(audio_clock_t::duration duration) noexcept {
+    _epoch.fetch_add(duration.count(), std::memory_order_relaxed);
+  }
+
+  time_point time_at(std::uint64_t position) const noexcept {
+    return time_point(audio_clock_t::duration(
+               _epoch.load(std::memory_order_relaxed))) +
+           chrono::duration_cast<audio_clock_t::duration>(
+               frame_duration() * double(position));
+  }
+
+  chrono::duration<double, std::nano> frame_duration() const noexcept {
+    return chrono::duration<double, std::nano>(_frame_ns);
+  }
+
+private:
+  double _frame_ns = 0;
+  std::atomic<audio_clock_t::rep> _epoch{0};
+};
+
+} // namespace detail
+
+// Loopback backend: a simulated output and input device, each run by its own
+// thread on a virtual clock, with the output wired into the input. Used when
+// no native backend is available (or AUDIO_USE_LOOPBACK is defined), so the
+// device API can be tested and benchmarked without sound hardware. Moving a
+// device stops it.
+class audio_device : private detail::stop_before_move<audio_device> {
+public:
+  using device_id_t = unsigned;
+  using sample_rate_t = int;
+  using buffer_size_t = uint16_t;
+
+  audio_device() = delete;
+  audio_device(audio_device &) = delete;
+
+  audio_device(audio_device &&) = default;
+
+  ~audio_device() { stop(); }
+
+  string_view name() const noexcept { return name_; }
+
+  device_id_t device_id() const noexcept { return id_; }
+
+  bool is_input() const noexcept { return iscapture_; }
+
+  bool is_output() const noexcept { return !iscapture_; }
+
+  int get_num_input_channels() const noexcept {
+    return iscapture_ ? int(detail::loopback_bus::num_channels) : 0;
+  }
+
+  int get_num_output_channels() const noexcept {
+    return iscapture_ ? 0 : int(detail::loopback_bus::num_channels);
+  }
+
+  sample_rate_t get_sample_rate() const noexcept { return freq_; }
+
+  bool set_sample_rate(sample_rate_t freq) noexcept {
+    if (is_running() || freq <= 0) {
+      return false;
+    }
+    freq_ = freq;
+    return true;
+  }
+
+  buffer_size_t get_buffer_size_frames() const noexcept { return samples_; }
+
+  bool set_buffer_size_frames(buffer_size_t buffer_size) noexcept {
+    if (is_running() || buffer_size == 0) {
+      return false;
+    }
+    samples_ = buffer_size;
+    return true;
+  }
+
+  // The simulated hardware buffers one period, like the SDL backend.
+  chrono::nanoseconds get_latency() const noexcept {
+    return chrono::nanoseconds(std::int64_t(samples_) * 1000000000 / freq_);
+  }
+
+  const audio_device_simulation &simulation() const noexcept {
+    return simulation_;
+  }
+
+  bool set_simulation(const audio_device_simulation &simulation) noexcept {
+    if (is_running() || simulation.speed < 0) {
+      return false;
+    }
+    simulation_ = simulation;
+    return true;
+  }
+
+  // Promote the simulation thread when it starts, see
+  // make_this_thread_realtime(), and report how it went in
+  // stats().realtime. Return false if device is running.
+  bool set_realtime(const std::optional<audio_realtime_config> &config) {
+    if (is_running()) {
+      return false;
+    }
+    realtime_ = config;
+    return true;
+  }
+
+  template <typename SampleType>
+  static constexpr bool supports_sample_type() noexcept {
+    return detail::is_sample_type<SampleType>;
+  }
+
+  template <typename SampleType> bool set_sample_type() noexcept {
+    static_assert(supports_sample_type<SampleType>());
+    if (is_running()) {
+      return false;
+    }
+    format_ = format_of<SampleType>();
+    return true;
+  }
+
+  constexpr bool can_connect() const noexcept { return true; }
+
+  template <typename SampleType>
+  void connect(AudioIOCallback<SampleType> auto &&io_callback) {
+    if (is_running()) {
+      throw std::runtime_error("can't connect running device");
+    }
+    set_sample_type<SampleType>();
+    user_callback_ =
+        [cb = std::forward<decltype(io_callback)>(io_callback)](
+            audio_device &device, uint8_t *data, std::size_t num_frames,
+            std::uint64_t position) mutable noexcept {
+          audio_device_io<SampleType> io =
+              device.make_io<SampleType>(data, num_frames, position);
+          cb(device, io);
+        };
+  }
+
+  bool is_running() const noexcept { return running_; }
+
+  bool is_playing() const noexcept {
+    return running_ && !sim_->paused.load(std::memory_order_relaxed);
+  }
+
+  constexpr bool can_process() const noexcept { return true; }
+
+  template <typename SampleType>
+  void process(AudioIOCallback<SampleType> auto &&io_callback) {
+    if (!is_running()) {
+      throw std::runtime_error("device is not running");
+    }
+    if (format_.tag != &detail::sample_type_tag<SampleType>) {
+      throw std::runtime_error(
+          "device and callback's sample type is different");
+    }
+    if (user_callback_) {
+      throw std::runtime_error("device is not in pull mode");
+    }
+
+    pull_state &pull = *pull_;
+    const std::size_t frame_size = frame_size_in_bytes();
+    std::size_t frames = samples_;
+    if (iscapture_) {
+      frames = pull.queue.read(pull.staging.data(), frames);
+    } else {
+      fill_silence(pull.staging.data(), frames);
+    }
+
+    // Frames the audio thread dropped or filled with silence shift the
+    // device position of the queued frames.
+    audio_device_io<SampleType> io = make_io<SampleType>(
+        pull.staging.data(), frames,
+        process_position_ + pull.skipped_frames.load(std::memory_order_relaxed));
+    process_position_ += frames;
+
+    io_callback(*this, io);
+
+    if (!iscapture_) {
+      // Back pressure: block until the audio thread made room.
+      std::size_t written = 0;
+      while (written < frames) {
+        written += pull.queue.write(pull.staging.data() + written * frame_size,
+                                    frames - written);
+        if (written < frames && !is_playing()) {
+          throw std::runtime_error("audio:: output Error : device not playing");
+        }
+        if (written < frames) {
+          wait();
+        }
+      }
+    }
+  }
+
+  // Block until process() can run without waiting, see the SDL backend.
+  void wait() const { wait_until(std::nullopt); }
+
+  template <typename Rep, typename Period>
+  bool wait(const chrono::duration<Rep, Period> &timeout) const {
+    return wait_until(audio_clock_t::now() + timeout);
+  }
+
+  // wait() and process() for coroutines, see the SDL backend.
+  template <typename SampleType, AudioIOExecutor Executor>
+  audio_io_awaitable<SampleType, audio_device, Executor>
+  next_io(Executor &executor) {
+    if (!is_running()) {
+      throw std::runtime_error("device is not running");
+    }
+    if (format_.tag != &detail::sample_type_tag<SampleType>) {
+      throw std::runtime_error(
+          "device and callback's sample type is different");
+    }
+    if (user_callback_) {
+      throw std::runtime_error("device is not in pull mode");
+    }
+    return {*this, executor};
+  }
+
+  bool has_unprocessed_io() const noexcept {
+    if (user_callback_ || !is_running()) {
+      return false;
+    }
+    return iscapture_ ? pull_->queue.read_available() != 0 : false;
+  }
+
+  // XRuns since the device was last opened by start(). Late callbacks are
+  // the ones the simulation delayed by more than a period.
+  audio_device_stats stats() const noexcept {
+    return sim_ ? sim_->xruns.snapshot() : audio_device_stats{};
+  }
+
+  audio_callback_profile profile() const noexcept {
+    return profiler_.snapshot();
+  }
+
+  bool start() {
+    if (!is_running()) {
+      open();
+      attached_ = iscapture_ ? detail::loopback_bus::instance().attach_reader()
+                             : detail::loopback_bus::instance().attach_writer();
+      running_ = true;
+      sim_->thread = std::thread([this] { run(); });
+      return true;
+    }
+    sim_->paused.store(false, std::memory_order_release);
+    sim_->paused.notify_one();
+    return true;
+  }
+
+  bool pause() {
+    if (!is_running()) {
+      return false;
+    }
+    sim_->paused.store(true, std::memory_order_release);
+    return true;
+  }
+
+  bool stop() {
+    if (!is_running()) {
+      return true;
+    }
+    sim_->stop.store(true, std::memory_order_release);
+    sim_->paused.store(false, std::memory_order_release);
+    sim_->paused.notify_one();
+    sim_->thread.join();
+    running_ = false;
+    detach();
+    if (pull_) {
+      // Wake up a thread blocked in wait() or a coroutine in next_io().
+      pull_->ready.release();
+      detail::wake_io_waiter(pull_->awaiting);
+    }
+    return true;
+  }
+
+private:
+  friend class audio_device_list;
+  friend class audio_duplex_device;
+  friend class detail::stop_before_move<audio_device>;
+  template <typename, typename, AudioIOExecutor>
+  friend class audio_io_awaitable;
+  template <typename, typename> friend class audio_io_lease;
+
+  audio_device(device_id_t id, std::string name, bool iscapture)
+      : id_(id), name_(std::move(name)), iscapture_(iscapture) {}
+
+  // Samples of the device are whatever type the user chose, converted to
+  // and from float on the loopback bus.
+  struct sample_format {
+    const char *tag;
+    std::size_t size;
+    void (*to_float)(const uint8_t *, float *, std::size_t) noexcept;
+    void (*from_float)(const float *, uint8_t *, std::size_t) noexcept;
+  };
+
+  template <typename SampleType>
+  static constexpr sample_format format_of() noexcept {
+    return {&detail::sample_type_tag<SampleType>, sizeof(SampleType),
+            [](const uint8_t *src, float *dst, std::size_t count) noexcept {
+              convert_samples(reinterpret_cast<const SampleType *>(src), dst,
+                              count);
+            },
+            [](const float *src, uint8_t *dst, std::size_t count) noexcept {
+              convert_samples(src, reinterpret_cast<SampleType *>(dst), count);
+            }};
+  }
+
+  // Shared with the audio thread, heap allocated as it can't move.
+  struct sim_state {
+    std::thread thread;
+    std::atomic<bool> stop{false};
+    std::atomic<bool> paused{false};
+    detail::virtual_clock clock;
+    detail::xrun_counters xruns;
+    // Audio thread only.
+    detail::splitmix64 random;
+    detail::aligned_buffer<uint8_t> period;
+    detail::aligned_buffer<float> bus_frames;
+  };
+
+  // Pull mode FIFO between the audio thread and process(), plus the wakeups
+  // for wait() and next_io().
+  struct pull_state {
+    detail::spsc_ring<uint8_t> queue; // In frames.
+    std::counting_semaphore<> ready{0};
+    std::atomic<bool> waiting{false};
+    // Coroutine suspended in next_io().
+    std::atomic<detail::io_waiter *> awaiting{nullptr};
+    // Frames the audio thread dropped (input) or filled with silence
+    // (output) because queue was full/empty, or lost to an xrun.
+    std::atomic<std::uint64_t> skipped_frames{0};
+    // One period for process().
+    detail::aligned_buffer<uint8_t> staging;
+    // Audio thread only, set once process() queued the first output.
+    bool streaming = false;
+  };
+
+  // Reset the device to frame 0 and size its buffers, before the audio
+  // thread starts.
+  void open() {
+    if (!sim_) {
+      sim_ = std::make_unique<sim_state>();
+    }
+    sim_->stop.store(false, std::memory_order_relaxed);
+    sim_->paused.store(false, std::memory_order_relaxed);
+    sim_->clock.reset(freq_, simulation_.drift_ppm);
+    sim_->xruns.reset();
+    sim_->random = detail::splitmix64(simulation_.seed);
+    sim_->period.resize(std::size_t(samples_) * frame_size_in_bytes());
+    sim_->bus_frames.resize(std::size_t(samples_) *
+                            detail::loopback_bus::num_channels);
+    position_ = 0;
+    if (user_callback_) {
+      profiler_.reset(freq_);
+      return;
+    }
+    if (!pull_) {
+      pull_ = std::make_unique<pull_state>();
+    }
+    pull_->queue.reset(kPullQueuePeriods * samples_, frame_size_in_bytes());
+    pull_->staging.resize(std::size_t(samples_) * frame_size_in_bytes());
+    pull_->skipped_frames.store(0, std::memory_order_relaxed);
+    pull_->streaming = false;
+    process_position_ = 0;
+  }
+
+  void detach() noexcept {
+    if (attached_) {
+      iscapture_ ? detail::loopback_bus::instance().detach_reader()
+                 : detail::loopback_bus::instance().detach_writer();
+      attached_ = false;
+    }
+  }
+
+  // The audio thread: one iteration per period, on schedule with the
+  // virtual clock unless the simulation runs at speed 0.
+  void run() noexcept {
+    sim_state &sim = *sim_;
+    const std::size_t period = samples_;
+    const double speed = simulation_.speed;
+    const double period_ns =
+        sim.clock.frame_duration().count() * double(period);
+    // Real time at which the period at anchor_position is due.
+    auto anchor = audio_clock_t::now();
+    std::uint64_t anchor_position = 0;
+    std::uint64_t index = 0;
+    if (realtime_) {
+      sim.xruns.realtime_promoted(
+          make_this_thread_realtime(*realtime_, get_latency()));
+    }
+
+    while (!sim.stop.load(std::memory_order_acquire)) {
+      if (sim.paused.load(std::memory_order_acquire)) {
+        const auto paused_at = audio_clock_t::now();
+        sim.paused.wait(true, std::memory_order_acquire);
+        const auto now = audio_clock_t::now();
+        // Don't let the pause disturb the timestamps.
+        sim.clock.shift(chrono::duration_cast<audio_clock_t::duration>(
+            (now - paused_at) * speed));
+        anchor = now;
+        anchor_position = position_;
+        continue;
+      }
+
+      const double jitter_ns =
+          sim.random.uniform() * double(simulation_.jitter.count());
+      if (speed > 0) {
+        const double due_ns =
+            (double(position_ - anchor_position) *
+                 sim.clock.frame_duration().count() +
+             jitter_ns) /
+            speed;
+        std::this_thread::sleep_until(
+            anchor + chrono::duration_cast<audio_clock_t::duration>(
+                         chrono::duration<double, std::nano>(due_ns)));
+      }
+
+      const auto when = sim.clock.time_at(position_);
+      if (simulation_.xrun_interval != 0 &&
+          ++index % simulation_.xrun_interval == 0) {
+        lose_period(when);
+      } else {
+        if (jitter_ns > period_ns) {
+          sim.xruns.late_callback(when);
+        }
+        run_period(when);
+      }
+      position_ += period;
+    }
+  }
+
+  // Audio thread: the callback missed the period.
+  void lose_period(chrono::time_point<audio_clock_t> when) noexcept {
+    sim_state &sim = *sim_;
+    const std::size_t period = samples_;
+    if (iscapture_) {
+      sim.xruns.overrun(when);
+      read_bus(period);
+    } else {
+      sim.xruns.underrun(when);
+      fill_silence(sim.period.data(), period);
+      write_bus(period);
+    }
+    if (pull_) {
+      pull_->skipped_frames.fetch_add(period, std::memory_order_relaxed);
+    }
+  }
+
+  // Audio thread: run the callback, or move the period through pull_.
+  void run_period(chrono::time_point<audio_clock_t> when) noexcept {
+    sim_state &sim = *sim_;
+    const std::size_t period = samples_;
+    if (iscapture_) {
+      read_bus(period);
+    }
+
+    if (user_callback_) {
+      const auto entered = audio_clock_t::now();
+      {
+        [[maybe_unused]] detail::rt_section rt;
+        user_callback_(*this, sim.period.data(), period, position_);
+      }
+      if constexpr (detail::callback_profiler::enabled) {
+        profiler_.record(entered, audio_clock_t::now(), period);
+      }
+    } else {
+      pull_state &pull = *pull_;
+      std::size_t frames = iscapture_
+                               ? pull.queue.write(sim.period.data(), period)
+                               : pull.queue.read(sim.period.data(), period);
+      if (!iscapture_) {
+        fill_silence(sim.period.data() + frames * frame_size_in_bytes(),
+                     period - frames);
+      }
+      if (frames < period) {
+        pull.skipped_frames.fetch_add(period - frames,
+                                      std::memory_order_relaxed);
+        // Output before the first process() isn't starved, just not started.
+        if (iscapture_) {
+          sim.xruns.overrun(when);
+        } else if (pull.streaming) {
+          sim.xruns.underrun(when);
+        }
+      }
+      pull.streaming = pull.streaming || frames != 0;
+      if (pull.waiting.exchange(false, std::memory_order_acq_rel)) {
+        pull.ready.release();
+      }
+      if (pull_ready()) {
+        detail::wake_io_waiter(pull.awaiting);
+      }
+    }
+
+    if (!iscapture_) {
+      write_bus(period);
+    }
+  }
+
+  // Audio thread: fill the period buffer from the loopback bus, silence when
+  // it is empty or this device isn't attached.
+  void read_bus(std::size_t num_frames) noexcept {
+    sim_state &sim = *sim_;
+    constexpr std::size_t channels = detail::loopback_bus::num_channels;
+    std::size_t frames =
+        attached_ ? detail::loopback_bus::instance().read(
+                        sim.bus_frames.data(), num_frames)
+                  : 0;
+    std::fill(sim.bus_frames.data() + frames * channels,
+              sim.bus_frames.data() + num_frames * channels, 0.0f);
+    format_.from_float(sim.bus_frames.data(), sim.period.data(),
+                       num_frames * channels);
+  }
+
+  // Audio thread: pass the period buffer on to the loopback bus.
+  void write_bus(std::size_t num_frames) noexcept {
+    if (!attached_) {
+      return;
+    }
+    sim_state &sim = *sim_;
+    format_.to_float(sim.period.data(), sim.bus_frames.data(),
+                     num_frames * detail::loopback_bus::num_channels);
+    detail::loopback_bus::instance().write(sim.bus_frames.data(), num_frames);
+  }
+
+  void fill_silence(uint8_t *data, std::size_t num_frames) const noexcept {
+    constexpr float zeros[detail::loopback_bus::num_channels] = {};
+    for (std::size_t frame = 0; frame < num_frames; ++frame) {
+      format_.from_float(zeros, data + frame * frame_size_in_bytes(),
+                         detail::loopback_bus::num_channels);
+    }
+  }
+
+  bool pull_ready() const noexcept {
+    return (iscapture_ ? pull_->queue.read_available()
+                       : pull_->queue.write_available()) >= samples_;
+  }
+
+  bool io_ready() const noexcept { return !is_playing() || pull_ready(); }
+
+  bool park_io(detail::io_waiter &waiter) noexcept {
+    return detail::park_io_waiter(pull_->awaiting, waiter,
+                                  [this]() noexcept { return io_ready(); });
+  }
+
+  // Hand out the next period of the queue in place, or pull_->staging if it
+  // wraps around the end of the queue.
+  template <typename SampleType>
+  audio_io_lease<SampleType, audio_device> take_io() {
+    if (!is_playing()) {
+      throw std::runtime_error("audio:: next_io Error : device not playing");
+    }
+    pull_state &pull = *pull_;
+    const std::size_t frames = samples_;
+    auto regions = iscapture_ ? pull.queue.read_regions(frames)
+                              : pull.queue.write_regions(frames);
+    const bool direct = regions.first.size() == frames * frame_size_in_bytes();
+    uint8_t *data = direct ? regions.first.data() : pull.staging.data();
+    if (iscapture_ && !direct) {
+      pull.queue.read(data, frames);
+    } else if (!iscapture_) {
+      fill_silence(data, frames);
+    }
+    audio_device_io<SampleType> io = make_io<SampleType>(
+        data, frames,
+        process_position_ +
+            pull.skipped_frames.load(std::memory_order_relaxed));
+    process_position_ += frames;
+    return {*this, std::move(io), frames, direct};
+  }
+
+  // Give a period of take_io() back to the queue. next_io() waited for
+  // room, so output always fits.
+  void finish_io(std::size_t frames, bool direct) noexcept {
+    if (iscapture_) {
+      if (direct) {
+        pull_->queue.commit_read(frames);
+      }
+    } else if (direct) {
+      pull_->queue.commit_write(frames);
+    } else {
+      pull_->queue.write(pull_->staging.data(), frames);
+    }
+  }
+
+  bool wait_until(
+      std::optional<chrono::time_point<audio_clock_t>> deadline) const {
+    if (!is_playing() || user_callback_) {
+      return true;
+    }
+    while (!pull_ready()) {
+      // Announce the waiter before the last check, so the audio thread
+      // can't produce in between and skip the wakeup.
+      pull_->waiting.store(true, std::memory_order_release);
+      if (pull_ready() || !is_playing()) {
+        break;
+      }
+      if (!deadline) {
+        pull_->ready.acquire();
+      } else if (!pull_->ready.try_acquire_until(*deadline)) {
+        return pull_ready();
+      }
+    }
+    return true;
+  }
+
+  std::size_t frame_size_in_bytes() const noexcept {
+    return format_.size * detail::loopback_bus::num_channels;
+  }
+
+  // position is the device position of the first frame in data.
+  template <typename SampleType>
+  audio_device_io<SampleType> make_io(uint8_t *data, std::size_t num_frames,
+                                      std::uint64_t position) const noexcept {
+    audio_device_io<SampleType> io;
+    audio_buffer<SampleType> buffer(reinterpret_cast<SampleType *>(data),
+                                    num_frames,
+                                    detail::loopback_bus::num_channels,
+                                    contiguous_interleaved);
+    io.sample_position = position;
+    auto timestamp = sim_->clock.time_at(position);
+    if (iscapture_) {
+      io.input_buffer = std::move(buffer);
+      io.input_time = timestamp - get_latency();
+    } else {
+      io.output_buffer = std::move(buffer);
+      io.output_time = timestamp + get_latency();
+    }
+    return io;
+  }
+
+  static constexpr std::size_t kPullQueuePeriods = 4;
+
+  device_id_t id_;
+  std::string name_;
+  bool iscapture_;
+  sample_rate_t freq_ = 48000;
+  buffer_size_t samples_ = 256;
+  sample_format format_ = format_of<float>();
+  audio_device_simulation simulation_;
+  std::optional<audio_realtime_config> realtime_;
+
+  llvm::unique_function<void(audio_device &, uint8_t *, std::size_t,
+                             std::uint64_t)>
+      user_callback_;
+  bool running_ = false;
+  // Whether this device holds its end of the loopback bus.
+  bool attached_ = false;
+  // Audio thread only while running: position of the current period.
+  std::uint64_t position_ = 0;
+  std::unique_ptr<sim_state> sim_;
+
+  std::unique_ptr<pull_state> pull_;
+  // Device position of the next frame process() hands out.
+  std::uint64_t process_position_ = 0;
+  [[no_unique_address]] detail::callback_profiler profiler_;
+};
+
+class audio_device_list : public std::forward_list<audio_device> {
+public:
+  audio_device default_input_device() {
+    return audio_device(kInputId, "Loopback Input", true);
+  }
+
+  audio_device default_output_device() {
+    return audio_device(kOutputId, "Loopback Output", false);
+  }
+
+  void fill_with_input_device() {
+    clear();
+    push_front(default_input_device());
+  }
+
+  void fill_with_output_device() {
+    clear();
+    push_front(default_output_device());
+  }
+
+private:
+  static constexpr audio_device::device_id_t kInputId = 1;
+  static constexpr audio_device::device_id_t kOutputId = 2;
+};
+
+// Simulates an interface whose input and output share one clock: the output
+// device's thread reads a period from the loopback bus and runs the callback
+// with both buffers, so the capture-to-render latency is exactly the input
+// plus the output latency.
+class audio_duplex_device {
+public:
+  using sample_rate_t = audio_device::sample_rate_t;
+  using buffer_size_t = audio_device::buffer_size_t;
+
+  audio_duplex_device(audio_device input, audio_device output)
+      : input_(std::move(input)), output_(std::move(output)) {
+    if (!input_.is_input() || !output_.is_output()) {
+      throw std::runtime_error(
+          "audio:: duplex device needs an input and an output device");
+    }
+  }
+
+  // The output callback points back to the duplex device.
+  audio_duplex_device(const audio_duplex_device &) = delete;
+  audio_duplex_device &operator=(const audio_duplex_device &) = delete;
+
+  ~audio_duplex_device() { stop(); }
+
+  const audio_device &input_device() const noexcept { return input_; }
+
+  const audio_device &output_device() const noexcept { return output_; }
+
+  int get_num_input_channels() const noexcept {
+    return input_.get_num_input_channels();
+  }
+
+  int get_num_output_channels() const noexcept {
+    return output_.get_num_output_channels();
+  }
+
+  sample_rate_t get_sample_rate() const noexcept {
+    return output_.get_sample_rate();
+  }
+
+  bool set_sample_rate(sample_rate_t freq) noexcept {
+    return input_.set_sample_rate(freq) && output_.set_sample_rate(freq);
+  }
+
+  buffer_size_t get_buffer_size_frames() const noexcept {
+    return output_.get_buffer_size_frames();
+  }
+
+  bool set_buffer_size_frames(buffer_size_t buffer_size) noexcept {
+    return input_.set_buffer_size_frames(buffer_size) &&
+           output_.set_buffer_size_frames(buffer_size);
+  }
+
+  bool set_simulation(const audio_device_simulation &simulation) noexcept {
+    return output_.set_simulation(simulation);
+  }
+
+  bool set_realtime(const std::optional<audio_realtime_config> &config) {
+    return input_.set_realtime(config) && output_.set_realtime(config);
+  }
+
+  template <typename SampleType> bool set_sample_type() noexcept {
+    return input_.set_sample_type<SampleType>() &&
+           output_.set_sample_type<SampleType>();
+  }
+
+  bool is_running() const noexcept { return output_.is_running(); }
+
+  // io_callback gets the output device and both buffers, with the same
+  // number of frames.
+  template <typename SampleType>
+  void connect(AudioIOCallback<SampleType> auto &&io_callback) {
+    if (is_running()) {
+      throw std::runtime_error("can't connect running device");
+    }
+    input_.set_sample_type<SampleType>();
+    output_.connect<SampleType>(
+        [this, cb = std::forward<decltype(io_callback)>(io_callback)](
+            audio_device &device, audio_device_io<SampleType> &io) mutable
+        noexcept {
+          const std::size_t frames = io.output_buffer->size_frames();
+          input_.read_bus(frames);
+          io.input_buffer = audio_buffer<SampleType>(
+              reinterpret_cast<SampleType *>(input_.sim_->period.data()),
+              frames, detail::loopback_bus::num_channels,
+              contiguous_interleaved);
+          io.input_time = *io.output_time - get_latency();
+          cb(device, io);
+        });
+  }
+
+  bool start() {
+    if (!output_.user_callback_) {
+      throw std::runtime_error("audio:: duplex device is not connected");
+    }
+    if (!is_running()) {
+      // The input device only lends its buffers and its end of the bus.
+      input_.set_sample_rate(output_.get_sample_rate());
+      input_.set_buffer_size_frames(output_.get_buffer_size_frames());
+      input_.open();
+      input_.attached_ = detail::loopback_bus::instance().attach_reader();
+    }
+    return output_.start();
+  }
+
+  bool pause() { return output_.pause(); }
+
+  bool stop() {
+    bool stopped = output_.stop();
+    input_.detach();
+    return stopped;
+  }
+
+  // Capture-to-render latency: the input and the output device latency.
+  chrono::nanoseconds get_latency() const noexcept {
+    return input_.get_latency() + output_.get_latency();
+  }
+
+  audio_device_stats stats() const noexcept { return output_.stats(); }
+
+private:
+  audio_device input_;
+  audio_device output_;
+};
+
+optional<audio_device> get_default_audio_input_device() {
+  audio_device_list list;
+  return list.default_input_device();
+}
+
+optional<audio_device> get_default_audio_output_device() {
+  audio_device_list list;
+  return list.default_output_device();
+}
+
+optional<audio_duplex_device> get_default_audio_duplex_device() {
+  audio_device_list list;
+  return optional<audio_duplex_device>(std::in_place,
+                                       list.default_input_device(),
+                                       list.default_output_device());
+}
+
+audio_device_list get_audio_input_device_list() {
+  audio_device_list list;
+  list.fill_with_input_device();
+  return list;
+}
+
+audio_device_list get_audio_output_device_list() {
+  audio_device_list list;
+  list.fill_with_output_device();
+  return list;
+}
+
+// The simulated devices never change, cb is never called.
+audio_device_list_callback_id
+set_audio_device_list_callback(audio_device_list_event event,
+                               AudioDeviceListCallback auto &&cb) {
+  return detail::device_list_notifier::instance().subscribe(
+      event, std::forward<decltype(cb)>(cb));
+}
+
+_LIBSTDAUDIO_NAMESPACE_END
@@ -0,0 +1,676 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <forward_list>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "experimental/audio_backend/FunctionExtras.h"
+
+#include "experimental/__p1386/aligned_buffer.h"
+#include "experimental/__p1386/audio_buffer.h"
+#include "experimental/__p1386/audio_device.h"
+#include "experimental/__p1386/audio_device_stats.h"
+#include "experimental/__p1386/audio_event.h"
+#include "experimental/__p1386/audio_io_awaitable.h"
+#include "experimental/__p1386/callback_profiler.h"
+#include "experimental/__p1386/concepts.h"
+#include "experimental/__p1386/device_list_notifier.h"
+#include "experimental/__p1386/rt_sanitizer.h"
+#include "experimental/__p1386/sample_convert.h"
+#include "experimental/__p1386/wav_writer.h"
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+// Offline backend: no sound hardware, devices run the connected callback as
+// fast as the CPU allows. Output is rendered into memory and/or a WAV file,
+// input is read from a buffer (then silence). Timestamps are virtual: frame
+// 0 is at audio_clock_t's epoch and time advances by exactly one frame per
+// 1 / sample rate.
+//
+// Batch rendering runs on the calling thread:
+//
+//   auto device = get_default_audio_output_device();
+//   device->set_output_file("out.wav");
+//   device->connect<float>(callback);
+//   device->render(48000 * 3600); // an hour of audio
+//   device->stop();               // finishes the WAV file
+//
+// start() instead renders on a background thread until stop(), like a real
+// device. Without connect(), start() enters pull mode and every process()
+// renders one period. Moving a device stops it.
+class audio_device : private detail::stop_before_move<audio_device> {
+public:
+  using device_id_t = unsigned;
+  using sample_rate_t = int;
+  using buffer_size_t = uint16_t;
+
+  audio_device() = delete;
+  audio_device(audio_device &) = delete;
+
+  audio_device(audio_device &&) = default;
+
+  // Finishes the output file without reporting a failure, see stop().
+  ~audio_device() { stop_rendering(); }
+
+  string_view name() const noexcept { return name_; }
+
+  device_id_t device_id() const noexcept { return id_; }
+
+  bool is_input() const noexcept { return iscapture_; }
+
+  bool is_output() const noexcept { return !iscapture_; }
+
+  int get_num_input_channels() const noexcept {
+    return iscapture_ ? channels_ : 0;
+  }
+
+  int get_num_output_channels() const noexcept {
+    return iscapture_ ? 0 : channels_;
+  }
+
+  bool set_num_channels(int num_channels) noexcept {
+    if (is_running() || num_channels <= 0) {
+      return false;
+    }
+    channels_ = num_channels;
+    return true;
+  }
+
+  sample_rate_t get_sample_rate() const noexcept { return freq_; }
+
+  bool set_sample_rate(sample_rate_t freq) noexcept {
+    if (is_running() || freq <= 0) {
+      return false;
+    }
+    freq_ = freq;
+    return true;
+  }
+
+  buffer_size_t get_buffer_size_frames() const noexcept { return samples_; }
+
+  bool set_buffer_size_frames(buffer_size_t buffer_size) noexcept {
+    if (is_running() || buffer_size == 0) {
+      return false;
+    }
+    samples_ = buffer_size;
+    return true;
+  }
+
+  // Nothing sits between the callback and the rendered audio.
+  chrono::nanoseconds get_latency() const noexcept { return {}; }
+
+  template <typename SampleType>
+  static constexpr bool supports_sample_type() noexcept {
+    return detail::is_sample_type<SampleType>;
+  }
+
+  // The callback's sample type is rendered as is.
+  template <typename SampleType> bool set_sample_type() noexcept {
+    static_assert(supports_sample_type<SampleType>());
+    return !is_running();
+  }
+
+  // Samples for an input device, interleaved. After the last frame the
+  // device captures silence.
+  template <typename SampleType>
+  bool set_input(std::span<const SampleType> samples) {
+    static_assert(supports_sample_type<SampleType>());
+    if (is_running() || !iscapture_) {
+      return false;
+    }
+    input_.assign(reinterpret_cast<const uint8_t *>(samples.data()),
+                  reinterpret_cast<const uint8_t *>(samples.data() +
+                                                    samples.size()));
+    input_sample_size_ = sizeof(SampleType);
+    input_offset_ = 0;
+    return true;
+  }
+
+  // True once every frame given to set_input() has been captured.
+  bool input_exhausted() const noexcept {
+    return input_offset_ >= input_.size();
+  }
+
+  // Stream rendered output into a WAV file, finished by stop().
+  bool set_output_file(std::filesystem::path path) {
+    if (is_running() || iscapture_) {
+      return false;
+    }
+    output_path_ = std::move(path);
+    return true;
+  }
+
+  // Keep the rendered output in memory, see output().
+  bool set_output_to_memory(bool enable) noexcept {
+    if (is_running() || iscapture_) {
+      return false;
+    }
+    output_to_memory_ = enable;
+    return true;
+  }
+
+  // Interleaved output rendered since the last stop(), SampleType must be
+  // the callback's sample type.
+  template <typename SampleType>
+  std::span<const SampleType> output() const noexcept {
+    assert(output_.empty() || sample_size_ == sizeof(SampleType));
+    return {reinterpret_cast<const SampleType *>(output_.data()),
+            output_.size() / sizeof(SampleType)};
+  }
+
+  constexpr bool can_connect() const noexcept { return true; }
+
+  template <typename SampleType>
+  void connect(AudioIOCallback<SampleType> auto &&io_callback) {
+    if (is_running()) {
+      throw std::runtime_error("can't connect running device");
+    }
+    check_sample_type<SampleType>();
+    render_period_ = [cb = std::forward<decltype(io_callback)>(io_callback)](
+                         audio_device &device, std::size_t frames) mutable {
+      const auto entered = audio_clock_t::now();
+      device.run_period<SampleType>(cb, frames);
+      if constexpr (detail::callback_profiler::enabled) {
+        device.profiler_.record(entered, audio_clock_t::now(), frames);
+      }
+    };
+  }
+
+  // Run the connected callback for num_frames frames on the calling thread,
+  // in periods. The device must not be running. Consecutive calls continue
+  // where the last one ended, stop() rewinds to frame 0.
+  std::uint64_t render(std::uint64_t num_frames) {
+    if (is_running()) {
+      throw std::runtime_error("audio:: can't render a running device");
+    }
+    if (!render_period_) {
+      throw std::runtime_error("audio:: device is not connected");
+    }
+    prepare();
+    for (std::uint64_t done = 0; done < num_frames;) {
+      std::size_t frames =
+          std::size_t(std::min<std::uint64_t>(samples_, num_frames - done));
+      render_period_(*this, frames);
+      done += frames;
+    }
+    return num_frames;
+  }
+
+  bool is_running() const noexcept { return running_; }
+
+  bool start() {
+    if (is_running()) {
+      if (worker_) {
+        worker_->paused.store(false, std::memory_order_release);
+        worker_->paused.notify_one();
+      }
+      return true;
+    }
+    prepare();
+    running_ = true;
+    if (render_period_) {
+      if (!worker_) {
+        worker_ = std::make_unique<worker>();
+      }
+      worker_->stop.store(false, std::memory_order_relaxed);
+      worker_->paused.store(false, std::memory_order_relaxed);
+      worker_->thread = std::thread([this] {
+        while (!worker_->stop.load(std::memory_order_acquire)) {
+          if (worker_->paused.load(std::memory_order_acquire)) {
+            worker_->paused.wait(true, std::memory_order_acquire);
+            continue;
+          }
+          try {
+            render_period_(*this, samples_);
+          } catch (const std::runtime_error &) {
+            // The output file failed, stop() reports it.
+            return;
+          }
+        }
+      });
+    }
+    return true;
+  }
+
+  bool pause() {
+    if (!is_running()) {
+      return false;
+    }
+    if (worker_) {
+      worker_->paused.store(true, std::memory_order_release);
+    }
+    return true;
+  }
+
+  // Also finishes the output file and resets the position. Throws if the
+  // output file couldn't be written, including by start()'s thread.
+  bool stop() {
+    stop_rendering();
+    if (wav_) {
+      std::exchange(wav_, std::nullopt)->close();
+    }
+    return true;
+  }
+
+  constexpr bool can_process() const noexcept { return true; }
+
+  template <typename SampleType>
+  void process(AudioIOCallback<SampleType> auto &&io_callback) {
+    if (!is_running()) {
+      throw std::runtime_error("device is not running");
+    }
+    if (render_period_) {
+      throw std::runtime_error("device is not in pull mode");
+    }
+    check_sample_type<SampleType>();
+    open_output();
+    run_period<SampleType>(io_callback, samples_);
+  }
+
+  // A period is always ready.
+  void wait() const {}
+
+  template <typename Rep, typename Period>
+  bool wait(const chrono::duration<Rep, Period> &) const {
+    return true;
+  }
+
+  // wait() and process() for coroutines, see the SDL backend. A period is
+  // always ready, so the coroutine never suspends and executor is unused.
+  template <typename SampleType, AudioIOExecutor Executor>
+  audio_io_awaitable<SampleType, audio_device, Executor>
+  next_io(Executor &executor) {
+    if (!is_running()) {
+      throw std::runtime_error("device is not running");
+    }
+    if (render_period_) {
+      throw std::runtime_error("device is not in pull mode");
+    }
+    check_sample_type<SampleType>();
+    return {*this, executor};
+  }
+
+  // Input is captured on demand, so a period is always ready.
+  bool has_unprocessed_io() const noexcept {
+    return is_running() && !render_period_ && iscapture_;
+  }
+
+  // Offline devices never miss a deadline.
+  audio_device_stats stats() const noexcept { return {}; }
+
+  audio_callback_profile profile() const noexcept {
+    return profiler_.snapshot();
+  }
+
+private:
+  friend class audio_device_list;
+  friend class audio_duplex_device;
+  friend class detail::stop_before_move<audio_device>;
+  template <typename, typename, AudioIOExecutor>
+  friend class audio_io_awaitable;
+  template <typename, typename> friend class audio_io_lease;
+
+  audio_device(device_id_t id, std::string name, bool iscapture)
+      : id_(id), name_(std::move(name)), iscapture_(iscapture) {}
+
+  template <typename SampleType> void check_sample_type() {
+    static_assert(supports_sample_type<SampleType>());
+    if (iscapture_ && !input_.empty() &&
+        input_sample_size_ != sizeof(SampleType)) {
+      throw std::runtime_error(
+          "device input and callback's sample type is different");
+    }
+    if (wav_ && sample_size_ != sizeof(SampleType)) {
+      throw std::runtime_error("audio:: sample type changed while writing");
+    }
+    sample_size_ = sizeof(SampleType);
+    open_output_ = [](audio_device &device) {
+      device.wav_ = detail::wav_writer::open<SampleType>(
+          device.output_path_, device.channels_, device.freq_);
+    };
+    write_output_ = [](audio_device &device, const uint8_t *data,
+                       std::size_t size) {
+      if (device.wav_) {
+        device.wav_->write(data, size);
+      }
+      if (device.output_to_memory_) {
+        device.output_.insert(device.output_.end(), data, data + size);
+      }
+    };
+  }
+
+  // Open the output file once the sample type is known, on the calling
+  // thread so that its errors reach the caller.
+  void open_output() {
+    if (!iscapture_ && !output_path_.empty() && !wav_ && open_output_) {
+      open_output_(*this);
+    }
+  }
+
+  void stop_rendering() noexcept {
+    if (worker_ && worker_->thread.joinable()) {
+      worker_->stop.store(true, std::memory_order_release);
+      worker_->paused.store(false, std::memory_order_release);
+      worker_->paused.notify_one();
+      worker_->thread.join();
+    }
+    running_ = false;
+    prepared_ = false;
+  }
+
+  // Reset the position, open the output file and allocate a period, not on
+  // the audio thread.
+  void prepare() {
+    if (prepared_) {
+      return;
+    }
+    open_output();
+    prepared_ = true;
+    position_ = 0;
+    input_offset_ = 0;
+    output_.clear();
+    buffer_.resize(std::size_t(samples_) * channels_ * sizeof(double));
+    if (render_period_) {
+      profiler_.reset(freq_);
+    }
+  }
+
+  // Copy the next frames of set_input() into dst, silence after the end.
+  template <typename SampleType>
+  void read_input(SampleType *dst, std::size_t frames) noexcept {
+    const std::size_t size = frames * channels_ * sizeof(SampleType);
+    const std::size_t offset = std::min(input_offset_, input_.size());
+    const std::size_t available = std::min(size, input_.size() - offset);
+    std::memcpy(dst, input_.data() + offset, available);
+    std::fill(dst + available / sizeof(SampleType), dst + frames * channels_,
+              detail::from_signed<SampleType>(0));
+    input_offset_ += size;
+  }
+
+  chrono::time_point<audio_clock_t> time_at(std::uint64_t position) const {
+    return chrono::time_point<audio_clock_t>(
+        chrono::duration_cast<audio_clock_t::duration>(
+            chrono::duration<double>(double(position) / freq_)));
+  }
+
+  template <typename SampleType, typename Callback>
+  void run_period(Callback &cb, std::size_t frames) {
+    audio_device_io<SampleType> io = begin_period<SampleType>(frames);
+    {
+      // Not real time, but the same callback would be on a sound device.
+      [[maybe_unused]] detail::rt_section rt;
+      cb(*this, io);
+    }
+    end_period(frames);
+  }
+
+  // The next period in buffer_, input read or output silenced.
+  template <typename SampleType>
+  audio_device_io<SampleType> begin_period(std::size_t frames) noexcept {
+    auto *samples = reinterpret_cast<SampleType *>(buffer_.data());
+    audio_buffer<SampleType> buffer(samples, frames, channels_,
+                                    contiguous_interleaved);
+    audio_device_io<SampleType> io;
+    io.sample_position = position_;
+    if (iscapture_) {
+      read_input(samples, frames);
+      io.input_buffer = std::move(buffer);
+      io.input_time = time_at(position_);
+    } else {
+      std::fill_n(samples, frames * channels_,
+                  detail::from_signed<SampleType>(0));
+      io.output_buffer = std::move(buffer);
+      io.output_time = time_at(position_);
+    }
+    return io;
+  }
+
+  // Move on and write the output of begin_period().
+  void end_period(std::size_t frames) {
+    position_ += frames;
+    if (!iscapture_) {
+      write_output_(*this, buffer_.data(), frames * channels_ * sample_size_);
+    }
+  }
+
+  bool io_ready() const noexcept { return true; }
+
+  bool park_io(detail::io_waiter &) noexcept { return false; }
+
+  template <typename SampleType>
+  audio_io_lease<SampleType, audio_device> take_io() {
+    // Open the WAV file here, finish_io() runs in the lease's destructor
+    // and can't throw.
+    open_output();
+    return {*this, begin_period<SampleType>(samples_), samples_, true};
+  }
+
+  void finish_io(std::size_t frames, bool) noexcept {
+    try {
+      end_period(frames);
+    } catch (const std::runtime_error &) {
+      // The output file failed, stop() reports it.
+    }
+  }
+
+  struct worker {
+    std::thread thread;
+    std::atomic<bool> stop{false};
+    std::atomic<bool> paused{false};
+  };
+
+  device_id_t id_;
+  std::string name_;
+  bool iscapture_;
+  int channels_ = 2;
+  sample_rate_t freq_ = 48000;
+  buffer_size_t samples_ = 512;
+
+  llvm::unique_function<void(audio_device &, std::size_t)> render_period_;
+  void (*open_output_)(audio_device &) = nullptr;
+  void (*write_output_)(audio_device &, const uint8_t *, std::size_t) = nullptr;
+  std::size_t sample_size_ = 0;
+  bool running_ = false;
+  bool prepared_ = false;
+  std::uint64_t position_ = 0;
+  detail::aligned_buffer<uint8_t> buffer_;
+
+  std::vector<uint8_t> input_;
+  std::size_t input_sample_size_ = 0;
+  std::size_t input_offset_ = 0;
+
+  std::filesystem::path output_path_;
+  std::optional<detail::wav_writer> wav_;
+  bool output_to_memory_ = false;
+  std::vector<uint8_t> output_;
+
+  std::unique_ptr<worker> worker_;
+  [[no_unique_address]] detail::callback_profiler profiler_;
+};
+
+class audio_device_list : public std::forward_list<audio_device> {
+public:
+  audio_device default_input_device() {
+    return audio_device(kInputId, "Offline Input", true);
+  }
+
+  audio_device default_output_device() {
+    return audio_device(kOutputId, "Offline Output", false);
+  }
+
+  void fill_with_input_device() {
+    clear();
+    push_front(default_input_device());
+  }
+
+  void fill_with_output_device() {
+    clear();
+    push_front(default_output_device());
+  }
+
+private:
+  static constexpr audio_device::device_id_t kInputId = 1;
+  static constexpr audio_device::device_id_t kOutputId = 2;
+};
+
+// The input device's samples and the output device's buffer in one callback,
+// both devices run at the output device's sample rate and period.
+class audio_duplex_device {
+public:
+  using sample_rate_t = audio_device::sample_rate_t;
+  using buffer_size_t = audio_device::buffer_size_t;
+
+  audio_duplex_device(audio_device input, audio_device output)
+      : input_(std::move(input)), output_(std::move(output)) {
+    if (!input_.is_input() || !output_.is_output()) {
+      throw std::runtime_error(
+          "audio:: duplex device needs an input and an output device");
+    }
+  }
+
+  // The output callback points back to the duplex device.
+  audio_duplex_device(const audio_duplex_device &) = delete;
+  audio_duplex_device &operator=(const audio_duplex_device &) = delete;
+
+  audio_device &input_device() noexcept { return input_; }
+
+  audio_device &output_device() noexcept { return output_; }
+
+  int get_num_input_channels() const noexcept {
+    return input_.get_num_input_channels();
+  }
+
+  int get_num_output_channels() const noexcept {
+    return output_.get_num_output_channels();
+  }
+
+  sample_rate_t get_sample_rate() const noexcept {
+    return output_.get_sample_rate();
+  }
+
+  bool set_sample_rate(sample_rate_t freq) noexcept {
+    return input_.set_sample_rate(freq) && output_.set_sample_rate(freq);
+  }
+
+  buffer_size_t get_buffer_size_frames() const noexcept {
+    return output_.get_buffer_size_frames();
+  }
+
+  bool set_buffer_size_frames(buffer_size_t buffer_size) noexcept {
+    return input_.set_buffer_size_frames(buffer_size) &&
+           output_.set_buffer_size_frames(buffer_size);
+  }
+
+  template <typename SampleType>
+  void connect(AudioIOCallback<SampleType> auto &&io_callback) {
+    input_.check_sample_type<SampleType>();
+    output_.connect<SampleType>(
+        [this, cb = std::forward<decltype(io_callback)>(io_callback)](
+            audio_device &device, audio_device_io<SampleType> &io) mutable
+        noexcept {
+          auto *input = reinterpret_cast<SampleType *>(input_.buffer_.data());
+          const std::size_t frames = io.output_buffer->size_frames();
+          input_.read_input(input, frames);
+          io.input_buffer = audio_buffer<SampleType>(
+              input, frames, input_.channels_, contiguous_interleaved);
+          io.input_time = io.output_time;
+          cb(device, io);
+        });
+  }
+
+  std::uint64_t render(std::uint64_t num_frames) {
+    prepare_input();
+    return output_.render(num_frames);
+  }
+
+  bool start() {
+    if (!is_running()) {
+      prepare_input();
+    }
+    return output_.start();
+  }
+
+  bool pause() { return output_.pause(); }
+
+  bool stop() {
+    input_.stop();
+    return output_.stop();
+  }
+
+  bool is_running() const noexcept { return output_.is_running(); }
+
+  chrono::nanoseconds get_latency() const noexcept { return {}; }
+
+  audio_device_stats stats() const noexcept { return {}; }
+
+private:
+  // The input is read in the output device's periods.
+  void prepare_input() {
+    input_.freq_ = output_.freq_;
+    input_.samples_ = output_.samples_;
+    input_.prepare();
+  }
+
+  audio_device input_;
+  audio_device output_;
+};
+
+optional<audio_device> get_default_audio_input_device() {
+  audio_device_list list;
+  return list.default_input_device();
+}
+
+optional<audio_device> get_default_audio_output_device() {
+  audio_device_list list;
+  return list.default_output_device();
+}
+
+optional<audio_duplex_device> get_default_audio_duplex_device() {
+  audio_device_list list;
+  return optional<audio_duplex_device>(std::in_place,
+                                       list.default_input_device(),
+                                       list.default_output_device());
+}
+
+audio_device_list get_audio_input_device_list() {
+  audio_device_list list;
+  list.fill_with_input_device();
+  return list;
+}
+
+audio_device_list get_audio_output_device_list() {
+  audio_device_list list;
+  list.fill_with_output_device();
+  return list;
+}
+
+// Offline devices never change, cb is never called.
+audio_device_list_callback_id
+set_audio_device_list_callback(audio_device_list_event event,
+                               AudioDeviceListCallback auto &&cb) {
+  return detail::device_list_notifier::instance().subscribe(
+      event, std::forward<decltype(cb)>(cb));
+}
+
+_LIBSTDAUDIO_NAMESPACE_END
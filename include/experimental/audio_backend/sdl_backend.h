@@ -6,21 +6,26 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <forward_list>
 #include <functional>
 #include <memory>
 #include <mutex>
 #include <optional>
-#include <shared_mutex>
+#include <semaphore>
 #include <stdexcept>
 #include <string_view>
 #include <thread>
 #include <type_traits>
 #include <utility>
 #include <variant>
+#include <vector>
 
 #include "SDL3/SDL_audio.h"
 
@@ -31,21 +36,282 @@
 #include "SDL_stdinc.h"
 #include "experimental/audio_backend/FunctionExtras.h"
 
+#include "experimental/__p1386/aligned_buffer.h"
 #include "experimental/__p1386/audio_buffer.h"
+#include "experimental/__p1386/audio_command_queue.h"
 #include "experimental/__p1386/audio_device.h"
+#include "experimental/__p1386/audio_device_stats.h"
 #include "experimental/__p1386/audio_event.h"
+#include "experimental/__p1386/audio_io_awaitable.h"
+#include "experimental/__p1386/audio_ring_buffer.h"
+#include "experimental/__p1386/callback_profiler.h"
+#include "experimental/__p1386/callback_swap.h"
 #include "experimental/__p1386/concepts.h"
+#include "experimental/__p1386/device_clock.h"
+#include "experimental/__p1386/device_list_notifier.h"
+#include "experimental/__p1386/rcu_cell.h"
+#include "experimental/__p1386/realtime_thread.h"
+#include "experimental/__p1386/rt_sanitizer.h"
+#include "experimental/__p1386/sample_convert.h"
 
 _LIBSTDAUDIO_NAMESPACE_BEGIN
 
 namespace detail {
-template <class...> struct function_type;
-template <class R, class... A> struct function_type<R (*)(A...)> {
-  using type = R(A...);
+
+// What audio_device needs of an SDL device, so it can be constructed without
+// asking SDL again.
+struct sdl_device_info {
+  std::string name;
+  SDL_AudioSpec spec{};
+  // Assigned by sdl_device_cache and kept while the device stays plugged
+  // in. SDL only numbers unopened devices by their index, which shifts.
+  SDL_AudioDeviceID id = 0;
+};
+
+// The devices of one direction, indexed like SDL_GetAudioDeviceName().
+struct sdl_device_snapshot {
+  std::vector<sdl_device_info> devices;
+  sdl_device_info default_device;
+};
+
+inline int sdl_device_event_filter(void *, SDL_Event *event);
+
+// Process-wide cache of the SDL device lists. Enumerating asks SDL for every
+// device's name and spec, so it is done once and then only for the direction
+// a hotplug event touched. Readers pin an immutable snapshot without taking
+// a lock, see rcu_cell.
+//
+// SDL's event thread only queues the hotplug events, see
+// sdl_device_event_filter(). A thread of the cache applies them to the
+// snapshots, which locks and allocates, then notifies the subscribers of
+// set_audio_device_list_callback().
+class sdl_device_cache {
+public:
+  // SDL's audio subsystem must be initialized.
+  static sdl_device_cache &instance() {
+    static sdl_device_cache cache;
+    return cache;
+  }
+
+  ~sdl_device_cache() {
+    SDL_SetEventFilter(nullptr, nullptr);
+    _worker.request_stop();
+    _wake.release();
+  }
+
+  rcu_cell<sdl_device_snapshot>::read_guard read(bool iscapture) const {
+    return _snapshots[iscapture].read();
+  }
+
+  // SDL's event thread: queue the event for the cache's thread, without
+  // locking or allocating.
+  void queue(const SDL_AudioDeviceEvent &event) noexcept {
+    hotplug_event e{event.type == SDL_EventType::SDL_EVENT_AUDIO_DEVICE_ADDED,
+                    event.iscapture != 0, event.which};
+    if (!_events.push(std::move(e))) {
+      // Too many at once, enumerate everything again.
+      _overflowed.store(true, std::memory_order_release);
+    }
+    _wake.release();
+  }
+
+  // SDL_EVENT_AUDIO_DEVICE_ADDED carries the index of the new device, only
+  // that one is queried. Returns whether the default device changed.
+  bool device_added(bool iscapture, int index) {
+    bool default_changed = false;
+    _snapshots[iscapture].update([&](sdl_device_snapshot &snapshot) {
+      if (std::size_t(index) >= snapshot.devices.size()) {
+        snapshot.devices.resize(index + 1);
+      }
+      snapshot.devices[index] = query(iscapture, index);
+      snapshot.devices[index].id = new_id();
+      default_changed = refresh_default(iscapture, snapshot);
+    });
+    return default_changed;
+  }
+
+  // SDL_EVENT_AUDIO_DEVICE_REMOVED carries the id of an opened device, not
+  // an index, and the indices of the remaining devices shift, so the
+  // direction is enumerated again. Returns whether the default device
+  // changed.
+  bool device_removed(bool iscapture) {
+    bool default_changed = false;
+    _snapshots[iscapture].update([&](sdl_device_snapshot &snapshot) {
+      sdl_device_snapshot next = enumerate(iscapture);
+      carry_ids(snapshot, next);
+      next.default_device = snapshot.default_device;
+      default_changed = refresh_default(iscapture, next);
+      snapshot = std::move(next);
+    });
+    return default_changed;
+  }
+
+private:
+  struct hotplug_event {
+    bool added;
+    bool iscapture;
+    std::uint32_t which;
+  };
+
+  static constexpr std::size_t kQueuedEvents = 64;
+
+  sdl_device_cache()
+      : _snapshots{rcu_cell<sdl_device_snapshot>(enumerate(false)),
+                   rcu_cell<sdl_device_snapshot>(enumerate(true))},
+        _events(kQueuedEvents) {
+    for (auto &cell : _snapshots) {
+      cell.update([&](sdl_device_snapshot &snapshot) {
+        for (auto &device : snapshot.devices) {
+          device.id = new_id();
+        }
+        snapshot.default_device.id = default_id(snapshot);
+      });
+    }
+    _worker = std::jthread([this](std::stop_token stop) { run(stop); });
+    SDL_SetEventFilter(sdl_device_event_filter, nullptr);
+  }
+
+  // Apply the queued events, then notify.
+  void run(std::stop_token stop) {
+    using notifier = device_list_notifier;
+    while (true) {
+      _wake.acquire();
+      if (stop.stop_requested()) {
+        return;
+      }
+      notifier::events events = 0;
+      auto apply = [&](bool iscapture, bool default_changed) {
+        events |=
+            notifier::event_bit(audio_device_list_event::device_list_changed);
+        if (default_changed) {
+          events |= notifier::event_bit(
+              iscapture
+                  ? audio_device_list_event::default_input_device_changed
+                  : audio_device_list_event::default_output_device_changed);
+        }
+      };
+      while (_events.pop([&](hotplug_event &&e) noexcept {
+        // Enumerating may throw bad_alloc, which ends the program here
+        // rather than on SDL's thread.
+        apply(e.iscapture, e.added ? device_added(e.iscapture, int(e.which))
+                                   : device_removed(e.iscapture));
+      })) {
+      }
+      if (_overflowed.exchange(false, std::memory_order_acq_rel)) {
+        apply(false, device_removed(false));
+        apply(true, device_removed(true));
+      }
+      notifier::instance().post(events);
+    }
+  }
+
+  static sdl_device_info query(bool iscapture, int index) {
+    sdl_device_info info;
+    if (const char *name = SDL_GetAudioDeviceName(index, iscapture)) {
+      info.name = name;
+    }
+    SDL_GetAudioDeviceSpec(index, iscapture, &info.spec);
+    return info;
+  }
+
+  static sdl_device_snapshot enumerate(bool iscapture) {
+    sdl_device_snapshot snapshot;
+    const int count = SDL_GetNumAudioDevices(iscapture);
+    snapshot.devices.reserve(std::max(count, 0));
+    for (int i = 0; i < count; ++i) {
+      snapshot.devices.push_back(query(iscapture, i));
+    }
+    snapshot.default_device = query_default(iscapture);
+    return snapshot;
+  }
+
+  static sdl_device_info query_default(bool iscapture) {
+    sdl_device_info info;
+    char *name = nullptr;
+    if (SDL_GetDefaultAudioInfo(&name, &info.spec, iscapture) == 0 && name) {
+      info.name = name;
+    }
+    SDL_free(name);
+    return info;
+  }
+
+  static bool same_device(const sdl_device_info &a,
+                          const sdl_device_info &b) noexcept {
+    return a.name == b.name && a.spec.freq == b.spec.freq &&
+           a.spec.format == b.spec.format &&
+           a.spec.channels == b.spec.channels;
+  }
+
+  SDL_AudioDeviceID new_id() noexcept {
+    return _next_id.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Give the devices of next that were already in previous their ids. A
+  // removal only takes devices out of the list, the others keep their
+  // order, so the lists are aligned in order rather than looked up by name:
+  // two devices with the same name keep their own ids.
+  void carry_ids(const sdl_device_snapshot &previous,
+                 sdl_device_snapshot &next) noexcept {
+    std::size_t from = 0;
+    for (auto &device : next.devices) {
+      std::size_t match = from;
+      while (match < previous.devices.size() &&
+             !same_device(previous.devices[match], device)) {
+        ++match;
+      }
+      if (match < previous.devices.size()) {
+        device.id = previous.devices[match].id;
+        from = match + 1;
+      } else {
+        device.id = new_id();
+      }
+    }
+  }
+
+  // SDL only names the default device, it is the first device with that
+  // name, or a new id if there is none.
+  SDL_AudioDeviceID default_id(const sdl_device_snapshot &snapshot) noexcept {
+    for (const auto &device : snapshot.devices) {
+      if (device.name == snapshot.default_device.name && device.id != 0) {
+        return device.id;
+      }
+    }
+    return new_id();
+  }
+
+  // Query the default device of snapshot, return whether its id changed.
+  bool refresh_default(bool iscapture, sdl_device_snapshot &snapshot) {
+    const SDL_AudioDeviceID previous = snapshot.default_device.id;
+    snapshot.default_device = query_default(iscapture);
+    snapshot.default_device.id = default_id(snapshot);
+    return snapshot.default_device.id != previous;
+  }
+
+  std::atomic<SDL_AudioDeviceID> _next_id{1};
+  rcu_cell<sdl_device_snapshot> _snapshots[2];
+  mpsc_queue<hotplug_event> _events;
+  std::atomic<bool> _overflowed{false};
+  std::counting_semaphore<> _wake{0};
+  // Last, so it stops first.
+  std::jthread _worker;
 };
+
+// Installed with the cache once SDL is initialized. Runs on SDL's event
+// thread, so it only queues the hotplug event for the cache's thread: no
+// lock, no allocation, no enumeration.
+inline int sdl_device_event_filter(void *, SDL_Event *event) {
+  if (event->type == SDL_EventType::SDL_EVENT_AUDIO_DEVICE_ADDED ||
+      event->type == SDL_EventType::SDL_EVENT_AUDIO_DEVICE_REMOVED) {
+    sdl_device_cache::instance().queue(event->adevice);
+  }
+  return 1;
+}
+
 } // namespace detail
 
-class audio_device {
+// An SDL audio device. SDL and a device following the default device call
+// back into it by address, so moving a device stops it.
+class audio_device : private detail::stop_before_move<audio_device> {
 public:
   using device_id_t = SDL_AudioDeviceID;
   using sample_rate_t = int;
@@ -60,7 +326,8 @@ public:
 
   string_view name() const noexcept { return name_; }
 
-  device_id_t device_id() const noexcept { return id_; }
+  // Changes when a device following the default device switched.
+  device_id_t device_id() const noexcept { return current_id(); }
 
   bool is_input() const noexcept { return iscapture_; }
 
@@ -94,6 +361,14 @@ public:
     return true;
   }
 
+  // Time from a callback to when its output is heard, or from when its input
+  // was captured to the callback. SDL doesn't report the hardware latency, so
+  // this is the one period SDL buffers on top of the callback's own.
+  chrono::nanoseconds get_latency() const noexcept {
+    return chrono::nanoseconds(std::int64_t(spec_.samples) * 1000000000 /
+                               std::max(spec_.freq, 1));
+  }
+
   template <typename SampleType>
   static constexpr bool supports_sample_type() noexcept {
     return (std::is_floating_point_v<SampleType> ||
@@ -115,10 +390,11 @@ public:
 
   // return if device is in play/pause statu
   bool is_running() const noexcept {
-    return id_ != 0 &&
-           (SDL_GetAudioDeviceStatus(id_) ==
+    const device_id_t id = current_id();
+    return id != 0 &&
+           (SDL_GetAudioDeviceStatus(id) ==
                 SDL_AudioStatus::SDL_AUDIO_PLAYING ||
-            SDL_GetAudioDeviceStatus(id_) == SDL_AudioStatus::SDL_AUDIO_PAUSED);
+            SDL_GetAudioDeviceStatus(id) == SDL_AudioStatus::SDL_AUDIO_PAUSED);
   }
 
   template <typename SampleType>
@@ -129,21 +405,121 @@ public:
     if (!supports_sample_type<SampleType>()) {
       throw std::runtime_error("sample type not supported");
     }
-    set_sample_type<SampleType>();
-    device_callback_ = device_callback;
-    user_callback_ = [this,
-                      cb = llvm::unique_function<void(
-                          audio_device &, audio_device_io<SampleType> &)>(
-                          std::move(io_callback)),
-                      channel_num = spec_.channels](void *userdata,
-                                                    Uint8 *stream,
-                                                    int len) mutable noexcept {
-      audio_device_io<SampleType> io = CreateDeviceIOFromBytes<SampleType>(
-          stream, len, channel_num, iscapture_);
-      cb(*this, io);
-    };
+    // Converting ourselves is cheaper than SDL's generic converter, so only
+    // ask SDL for SampleType when we can't handle the device format.
+    if (!visit_sample_format(spec_.format, [](auto) {})) {
+      set_sample_type<SampleType>();
+    }
+    // SDL calls device_callback<...> through its function pointer, the only
+    // indirect call on the way to io_callback.
+    using Callback = std::decay_t<decltype(io_callback)>;
+    using Connected =
+        detail::connected_callback<SampleType, io_callback_type<SampleType>,
+                                   Callback>;
+    callback_state_ = {
+        new Connected(std::forward<decltype(io_callback)>(io_callback),
+                      spec_.channels),
+        [](void *state) noexcept { delete static_cast<Connected *>(state); }};
+    callback_swap_ = static_cast<callback_swap_type<SampleType> *>(
+        static_cast<Connected *>(callback_state_.get()));
+    callback_type_ = &detail::sample_type_tag<SampleType>;
+    callback_channels_ = spec_.channels;
+    convert_sample_size_ = 0;
+    if (spec_.format == GetTypeFormat<SampleType>()) {
+      device_callback_ = device_callback<SampleType, SampleType, Connected>;
+      return;
+    }
+    convert_sample_size_ = sizeof(SampleType);
+    visit_sample_format(spec_.format, [&]<typename DeviceSample>(
+                                          std::type_identity<DeviceSample>) {
+      device_callback_ = device_callback<DeviceSample, SampleType, Connected>;
+    });
+  }
+
+  // Replace the connect()ed callback of a running device between two
+  // callbacks, without closing the device. An output device can crossfade
+  // linearly from the old to the new callback over crossfade_frames frames,
+  // during which both run. The old callback is destroyed here once the audio
+  // thread let go of it, so this blocks for up to a period plus the
+  // crossfade, and the audio thread neither allocates nor frees. Connects a
+  // device that is not running.
+  template <typename SampleType>
+  void replace_callback(AudioIOCallback<SampleType> auto &&io_callback,
+                        std::size_t crossfade_frames = 0) {
+    if (!is_running()) {
+      connect<SampleType>(std::forward<decltype(io_callback)>(io_callback));
+      return;
+    }
+    if (!device_callback_) {
+      throw std::runtime_error("device is not connected");
+    }
+    if (callback_type_ != &detail::sample_type_tag<SampleType>) {
+      throw std::runtime_error(
+          "device and callback's sample type is different");
+    }
+    auto &swap = *static_cast<callback_swap_type<SampleType> *>(callback_swap_);
+    if (iscapture_) {
+      crossfade_frames = 0;
+    }
+    swap.post(std::make_unique<io_callback_type<SampleType>>(
+                  std::forward<decltype(io_callback)>(io_callback)),
+              crossfade_frames, spec_.samples);
+    const auto crossfade = chrono::nanoseconds(
+        std::int64_t(crossfade_frames) * 1000000000 / spec_.freq);
+    if (!is_playing() || !swap.wait(kHandoverTimeout + crossfade)) {
+      // Locking waits for a callback in flight.
+      const device_id_t id = current_id();
+      SDL_LockAudioDevice(id);
+      swap.take_over();
+      SDL_UnlockAudioDevice(id);
+    }
+    swap.collect();
+  }
+
+  // Add TPDF dither when a callback's samples are converted to a device
+  // format with less resolution.
+  bool set_dither(bool enable) noexcept {
+    if (is_running()) {
+      return false;
+    }
+    dither_enabled_ = enable;
+    return true;
+  }
+
+  // Promote the audio thread before its first callback after start(), see
+  // make_this_thread_realtime(), and report how it went in
+  // stats().realtime. nullopt leaves the thread as the backend created it.
+  // Return false if device is running.
+  bool set_realtime(const std::optional<audio_realtime_config> &config) {
+    if (is_running()) {
+      return false;
+    }
+    realtime_ = config;
+    return true;
+  }
+
+  bool is_playing() const noexcept {
+    const device_id_t id = current_id();
+    return id != 0 &&
+           SDL_GetAudioDeviceStatus(id) == SDL_AudioStatus::SDL_AUDIO_PLAYING;
   }
 
+  // Move to the new default device whenever the default device of this
+  // direction changes while running, keeping the connect()ed callback. The
+  // new device is opened in the background with the same spec, and both
+  // crossfade over one period rendered once, see follow_callback(). name()
+  // stays the name of the device this one was created from, stats() counts
+  // the switches. Return false if device is running.
+  bool set_follow_default(bool enable) noexcept {
+    if (is_running()) {
+      return false;
+    }
+    follow_default_ = enable;
+    return true;
+  }
+
+  bool follows_default() const noexcept { return follow_default_; }
+
   constexpr bool can_process() const noexcept { return true; }
 
   template <typename SampleType>
@@ -156,87 +532,171 @@ public:
       throw std::runtime_error(
           "device and callback's sample type is different");
     }
+    if (device_callback_ || !pull_) {
+      throw std::runtime_error("device is not in pull mode");
+    }
 
-    std::vector<uint8_t> process_buffer;
-
+    // staging_buffer_ is sized to one period by start(), the queue counts
+    // frames.
+    const std::size_t frame_size = frame_size_in_bytes();
+    std::size_t frames = staging_buffer_.size() / frame_size;
     if (iscapture_) {
-      std::vector<uint8_t> capture_process_buffer(
-          std::min(spec_.size, SDL_GetQueuedAudioSize(id_)));
-
-      auto size = SDL_DequeueAudio(id_, capture_process_buffer.data(),
-                                   capture_process_buffer.size());
-
-      capture_process_buffer.resize(size);
-
-      process_buffer.swap(capture_process_buffer);
+      frames = pull_->queue.read(staging_buffer_.data(), frames);
     } else {
-      process_buffer.resize(spec_.size);
+      std::memset(staging_buffer_.data(), spec_.silence,
+                  staging_buffer_.size());
     }
 
+    // Frames the audio thread dropped or filled with silence shift the
+    // device position of the queued frames.
     audio_device_io<SampleType> io = CreateDeviceIOFromBytes<SampleType>(
-        process_buffer.data(), process_buffer.size(), spec_.channels,
-        iscapture_);
+        staging_buffer_.data(), frames * frame_size, spec_.channels,
+        process_position_ +
+            pull_->skipped_frames.load(std::memory_order_relaxed));
+    process_position_ += frames;
 
     io_callback(*this, io);
 
     if (!iscapture_) {
-      if (SDL_QueueAudio(id_, process_buffer.data(), process_buffer.size()) !=
-          0) {
-        throw std::runtime_error("audio:: output Error :"s + SDL_GetError());
+      // Back pressure: block until the audio thread made room.
+      std::size_t written = 0;
+      while (written < frames) {
+        written += pull_->queue.write(
+            staging_buffer_.data() + written * frame_size, frames - written);
+        if (written < frames && !is_playing()) {
+          throw std::runtime_error("audio:: output Error : device not playing");
+        }
+        if (written < frames) {
+          wait();
+        }
       }
     }
   }
 
-  void wait() const {
-    if (!is_running() || device_callback_) {
-      return;
+  // Block until process() can run without waiting: a period of input has
+  // been captured, or there is room for a period of output. Woken up by the
+  // audio thread, returns immediately if the device is not playing in pull
+  // mode.
+  void wait() const { wait_until(std::nullopt); }
+
+  // As above, but give up after timeout. Return false on timeout.
+  template <typename Rep, typename Period>
+  bool wait(const chrono::duration<Rep, Period> &timeout) const {
+    return wait_until(audio_clock_t::now() + timeout);
+  }
+
+  // wait() and process() for coroutines, which the audio thread resumes on
+  // executor instead of blocking a thread per device:
+  //
+  //   auto lease = co_await device.next_io<float>(executor);
+  //   render(*lease.io().output_buffer);
+  //
+  // See audio_io_awaitable. One next_io() may be pending at a time, and
+  // process() must not be used meanwhile.
+  template <typename SampleType, AudioIOExecutor Executor>
+  audio_io_awaitable<SampleType, audio_device, Executor>
+  next_io(Executor &executor) {
+    if (!is_running()) {
+      throw std::runtime_error("device is not running");
     }
-    if (iscapture_) {
-      auto size = SDL_GetQueuedAudioSize(id_);
-      auto need_size = spec_.size;
-      if (size < need_size) {
-        std::this_thread::sleep_for(
-            1000.0 *
-            ((need_size - size) /
-             ((spec_.format & ((1 << 8) - 1)) * get_num_input_channels())) /
-            get_sample_rate() * 1ms);
-      }
+    if (GetTypeFormat<SampleType>() != spec_.format) {
+      throw std::runtime_error(
+          "device and callback's sample type is different");
     }
+    if (device_callback_ || !pull_) {
+      throw std::runtime_error("device is not in pull mode");
+    }
+    return {*this, executor};
+  }
+
+  // XRuns since the device was last opened by start().
+  audio_device_stats stats() const noexcept {
+    return xruns_ ? xruns_->snapshot() : audio_device_stats{};
+  }
+
+  // Timing of the connect()ed callback since start(), empty unless built
+  // with AUDIO_ENABLE_PROFILER.
+  audio_callback_profile profile() const noexcept {
+    return profiler_.snapshot();
   }
 
   bool has_unprocessed_io() const noexcept {
-    if (device_callback_ || id_ == 0) {
+    if (device_callback_ || !pull_ || !is_running()) {
       return false;
     }
-    return iscapture_ ? SDL_GetQueuedAudioSize(id_) != 0 : false;
+    return iscapture_ ? pull_->queue.read_available() != 0 : false;
   }
 
   // return true if device statu turn play/stop/pause => play
   bool start() {
-    if (!is_running() ||
-        SDL_GetAudioDeviceStatus(id_) != SDL_AudioStatus::SDL_AUDIO_PAUSED) {
-      if (id_ == 0 ||
-          SDL_GetAudioDeviceStatus(id_) != SDL_AudioStatus::SDL_AUDIO_PAUSED) {
-        spec_.userdata = this;
-        spec_.callback = device_callback_;
-
-        SDL_AudioSpec obtained;
-        id_ = SDL_OpenAudioDevice(name_.c_str(), iscapture_, &spec_, &obtained,
-                                  0);
-        if (id_ == 0) {
-          throw std::runtime_error("audio:: open device Error :"s +
-                                   SDL_GetError());
+    // Only open a stopped device, reopening a running one would leak the
+    // SDL device and its callbacks into this object.
+    if (!is_running()) {
+      spec_.userdata = this;
+      spec_.callback = device_callback_ ? device_callback_ : pull_callback;
+      follow_.reset();
+      if (follow_default_) {
+        follow_ = std::make_shared<follow_state>();
+        follow_->streams[0].device = follow_->streams[1].device = this;
+        follow_->streams[1].slot = 1;
+        spec_.userdata = &follow_->streams[0];
+        spec_.callback = follow_callback;
+      }
+
+      SDL_AudioSpec obtained;
+      const device_id_t opened =
+          SDL_OpenAudioDevice(name_.c_str(), iscapture_, &spec_, &obtained, 0);
+      if (opened == 0) {
+        throw std::runtime_error("audio:: open device Error :"s +
+                                 SDL_GetError());
+      }
+      spec_ = obtained;
+      if (follow_) {
+        // The worker switches it, id_ stays 0.
+        follow_->id.store(opened, std::memory_order_relaxed);
+        follow_->overlap.resize(spec_.size);
+      } else {
+        id_ = opened;
+      }
+      convert_buffer_.resize(std::size_t(spec_.samples) * spec_.channels *
+                             convert_sample_size_);
+      if (!clock_) {
+        clock_ = std::make_unique<detail::device_clock>();
+        xruns_ = std::make_unique<detail::xrun_counters>();
+      }
+      clock_->reset(spec_.freq, spec_.samples);
+      xruns_->reset();
+      ++starts_;
+      if (device_callback_) {
+        profiler_.reset(spec_.freq);
+      }
+      callback_position_ = 0;
+      if (!device_callback_) {
+        staging_buffer_.resize(spec_.size);
+        if (!pull_) {
+          pull_ = std::make_unique<pull_state>();
         }
-        spec_ = obtained;
+        pull_->queue.reset(kPullQueuePeriods * spec_.samples,
+                           frame_size_in_bytes());
+        pull_->skipped_frames.store(0, std::memory_order_relaxed);
+        pull_->streaming = false;
+        process_position_ = 0;
+      }
+      if (follow_) {
+        start_following();
       }
+    }
 
-      if (SDL_PlayAudioDevice(id_) != 0) {
+    const device_id_t id = current_id();
+    if (SDL_GetAudioDeviceStatus(id) != SDL_AudioStatus::SDL_AUDIO_PLAYING) {
+      // Don't let the pause disturb the timestamps.
+      clock_->resync();
+      if (SDL_PlayAudioDevice(id) != 0) {
         throw std::runtime_error("audio:: play device Error :"s +
                                  SDL_GetError());
       }
-      return true;
     }
-    return false;
+    return true;
   }
 
   // return true if device statu turn pause/play => pause
@@ -244,10 +704,11 @@ public:
     if (!is_running()) {
       return false;
     }
-    if (SDL_GetAudioDeviceStatus(id_) != SDL_AudioStatus::SDL_AUDIO_PAUSED) {
+    const device_id_t id = current_id();
+    if (SDL_GetAudioDeviceStatus(id) == SDL_AudioStatus::SDL_AUDIO_PAUSED) {
       return true;
     }
-    if (SDL_PauseAudioDevice(id_) != 0) {
+    if (SDL_PauseAudioDevice(id) != 0) {
       throw std::runtime_error("audio:: pause device Error :"s +
                                SDL_GetError());
     }
@@ -259,52 +720,470 @@ public:
     if (!is_running()) {
       return true;
     }
+    // No switch may be in flight while the device is closed.
+    stop_following();
     pause();
     device_callback_ = nullptr;
-    SDL_CloseAudioDevice(id_);
+    SDL_CloseAudioDevice(current_id());
+    // SDL reuses ids, a closed one may be another device's soon.
+    id_ = 0;
+    if (follow_) {
+      follow_->id.store(0, std::memory_order_release);
+    }
+    if (pull_) {
+      // Wake up a thread blocked in wait() or a coroutine in next_io().
+      pull_->ready.release();
+      detail::wake_io_waiter(pull_->awaiting);
+    }
     return true;
   }
 
 private:
+  friend class detail::stop_before_move<audio_device>;
   friend class audio_device_list;
-
-  audio_device(device_id_t id, bool iscapture)
-      : id_(id), iscapture_(iscapture) {
-    SDL_GetAudioDeviceSpec(id, iscapture, &spec_);
-    name_ = SDL_GetAudioDeviceName(id_, iscapture_);
-    id_ = 0;
-  }
+  friend class audio_duplex_device;
+  template <typename, typename, AudioIOExecutor>
+  friend class audio_io_awaitable;
+  template <typename, typename> friend class audio_io_lease;
 
   audio_device(std::string &&name, SDL_AudioSpec &&spec, bool iscapture)
       : iscapture_(iscapture), id_(0), name_(std::move(name)),
         spec_(std::move(spec)) {}
 
+  // SDL callback of a device connect()ed with a callback_swap Connected,
+  // converting between DeviceSample and SampleType if they differ.
+  template <typename DeviceSample, typename SampleType, typename Connected>
   static void device_callback(void *void_ptr_to_this_device, uint8_t *stream,
                               int len) {
     audio_device &this_device =
         *reinterpret_cast<audio_device *>(void_ptr_to_this_device);
+    auto &callback =
+        *static_cast<Connected *>(this_device.callback_state_.get());
+    const int channel_num = this_device.callback_channels_;
+    this_device.promote_realtime();
+
+    const auto entered = audio_clock_t::now();
+    const std::size_t num_frames =
+        std::size_t(len) / (sizeof(DeviceSample) * channel_num);
+    this_device.callback_position_ = this_device.tick(entered, num_frames);
+    {
+      [[maybe_unused]] detail::rt_section rt;
+      if constexpr (std::is_same_v<DeviceSample, SampleType>) {
+        audio_device_io<SampleType> io =
+            this_device.CreateDeviceIOFromBytes<SampleType>(
+                stream, len, channel_num, this_device.callback_position_);
+        callback(this_device, io);
+      } else {
+        this_device.convert_and_call<DeviceSample, SampleType>(
+            callback, stream, len, channel_num);
+      }
+    }
+    if constexpr (detail::callback_profiler::enabled) {
+      this_device.profiler_.record(entered, audio_clock_t::now(), num_frames);
+    }
+  }
 
-    this_device.user_callback_(nullptr, stream, len);
+  // SDL callback in pull mode: move one period between the device and
+  // pull_->queue, then wake up wait() or next_io().
+  static void pull_callback(void *void_ptr_to_this_device, uint8_t *stream,
+                            int len) {
+    audio_device &this_device =
+        *reinterpret_cast<audio_device *>(void_ptr_to_this_device);
+    pull_state &pull = *this_device.pull_;
+    const std::size_t frame_size = this_device.frame_size_in_bytes();
+    this_device.promote_realtime();
+
+    const std::size_t num_frames = len / frame_size;
+
+    this_device.tick(audio_clock_t::now(), num_frames);
+    std::size_t frames = this_device.iscapture_
+                             ? pull.queue.write(stream, num_frames)
+                             : pull.queue.read(stream, num_frames);
+    if (!this_device.iscapture_) {
+      std::memset(stream + frames * frame_size, this_device.spec_.silence,
+                  len - frames * frame_size);
+    }
+    if (frames < num_frames) {
+      pull.skipped_frames.fetch_add(num_frames - frames,
+                                    std::memory_order_relaxed);
+      // Output before the first process() isn't starved, just not started.
+      if (this_device.iscapture_) {
+        this_device.xruns_->overrun(audio_clock_t::now());
+      } else if (pull.streaming) {
+        this_device.xruns_->underrun(audio_clock_t::now());
+      }
+    }
+    pull.streaming = pull.streaming || frames != 0;
+    if (pull.waiting.exchange(false, std::memory_order_acq_rel)) {
+      pull.ready.release();
+    }
+    if (this_device.pull_ready()) {
+      detail::wake_io_waiter(pull.awaiting);
+    }
+  }
+
+  // SDL callback of a device following the default device. Only the active
+  // stream runs the device or pull callback, the other one is silent. A
+  // switch crossfades over one period, rendered once: the outgoing stream
+  // keeps a copy of its last output period in follow_state::overlap and
+  // fades it out, the incoming one fades the copy in, then renders on. An
+  // input period is captured by both devices, the outgoing one keeps its
+  // and the incoming one mixes both into one period for the callback.
+  static void follow_callback(void *void_ptr_to_stream, uint8_t *stream,
+                              int len) {
+    auto &from = *reinterpret_cast<follow_stream *>(void_ptr_to_stream);
+    audio_device &this_device = *from.device;
+    follow_state &follow = *this_device.follow_;
+    if (follow.active.load(std::memory_order_acquire) != from.slot) {
+      if (!this_device.iscapture_) {
+        std::memset(stream, this_device.spec_.silence, len);
+      }
+      return;
+    }
+
+    const bool fade_in = std::exchange(from.fade_in, false);
+    const bool fade_out = follow.handover.load(std::memory_order_acquire);
+    const std::size_t bytes = std::size_t(len);
+    // The overlap of the outgoing stream, if it fits this period.
+    const bool overlap = fade_in && follow.overlap_bytes == bytes;
+    if (fade_in) {
+      // The new device has its own clock.
+      this_device.clock_->resync();
+      const auto requested = chrono::time_point<audio_clock_t>(
+          audio_clock_t::duration(
+              follow.requested.load(std::memory_order_relaxed)));
+      this_device.xruns_->device_switched(
+          chrono::duration_cast<chrono::nanoseconds>(audio_clock_t::now() -
+                                                     requested));
+    }
+    const bool keep = fade_out && bytes <= follow.overlap.size();
+    if (this_device.iscapture_) {
+      if (keep) {
+        // Delivered mixed into the incoming device's first period.
+        std::memcpy(follow.overlap.data(), stream, bytes);
+        follow.overlap_bytes = bytes;
+      } else {
+        if (overlap) {
+          this_device.crossfade(stream, follow.overlap.data(), len);
+        } else if (fade_in || fade_out) {
+          this_device.fade(stream, len, fade_in);
+        }
+        this_device.run_callback(stream, len);
+      }
+    } else {
+      if (overlap) {
+        std::memcpy(stream, follow.overlap.data(), bytes);
+      } else {
+        this_device.run_callback(stream, len);
+      }
+      if (keep) {
+        std::memcpy(follow.overlap.data(), stream, bytes);
+        follow.overlap_bytes = bytes;
+      }
+      if (fade_in || fade_out) {
+        this_device.fade(stream, len, fade_in);
+      }
+    }
+    if (fade_out &&
+        follow.handover.exchange(false, std::memory_order_acq_rel)) {
+      follow.active.store(1 - from.slot, std::memory_order_release);
+      follow.handed_over.release();
+    }
+  }
+
+  // Audio thread: apply the set_realtime() config before the first callback
+  // of the thread since start(). A device following the default device
+  // moves to the thread of the new SDL device.
+  void promote_realtime() noexcept {
+    if (!realtime_) {
+      return;
+    }
+    thread_local const audio_device *promoted_device = nullptr;
+    thread_local std::uint64_t promoted_start = 0;
+    if (promoted_device == this && promoted_start == starts_) {
+      return;
+    }
+    promoted_device = this;
+    promoted_start = starts_;
+    xruns_->realtime_promoted(
+        make_this_thread_realtime(*realtime_, get_latency()));
   }
 
+  void run_callback(uint8_t *stream, int len) {
+    if (device_callback_) {
+      device_callback_(this, stream, len);
+    } else {
+      pull_callback(this, stream, len);
+    }
+  }
+
+  // Crossfade the device samples in stream from those in from.
+  void crossfade(uint8_t *stream, const uint8_t *from, int len) const noexcept {
+    const std::size_t frames = len / frame_size_in_bytes();
+    visit_sample_format(spec_.format, [&]<typename DeviceSample>(
+                                          std::type_identity<DeviceSample>) {
+      detail::crossfade_ramp(reinterpret_cast<const DeviceSample *>(from),
+                             reinterpret_cast<DeviceSample *>(stream), frames,
+                             spec_.channels);
+    });
+  }
+
+  // Ramp the device samples in stream from silence to full scale, or the
+  // other way round.
+  void fade(uint8_t *stream, int len, bool in) const noexcept {
+    const std::size_t frames = len / frame_size_in_bytes();
+    visit_sample_format(spec_.format, [&]<typename DeviceSample>(
+                                          std::type_identity<DeviceSample>) {
+      apply_gain_ramp(reinterpret_cast<DeviceSample *>(stream), frames,
+                      spec_.channels, in ? 0.0f : 1.0f, in ? 1.0f : 0.0f);
+    });
+  }
+
+  // Subscribe to the default device changes and start the thread that
+  // switches devices.
+  void start_following() {
+    follow_state &follow = *follow_;
+    follow.subscription = detail::device_list_notifier::instance().subscribe(
+        iscapture_ ? audio_device_list_event::default_input_device_changed
+                   : audio_device_list_event::default_output_device_changed,
+        [state = follow_] { state->request(); });
+    follow.worker = std::jthread([this, &follow](std::stop_token token) {
+      for (;;) {
+        follow.wake.acquire();
+        if (token.stop_requested()) {
+          return;
+        }
+        follow.pending.store(false, std::memory_order_relaxed);
+        switch_to_default();
+      }
+    });
+  }
+
+  void stop_following() {
+    if (!follow_ || !follow_->worker.joinable()) {
+      return;
+    }
+    detail::device_list_notifier::instance().unsubscribe(
+        follow_->subscription);
+    follow_->worker.request_stop();
+    follow_->wake.release();
+    follow_->worker.join();
+  }
+
+  // Worker thread: open the current default device next to the running one
+  // and hand the stream over to it. If the running device stopped calling
+  // back, e.g. because it was unplugged, it is taken over after a timeout.
+  void switch_to_default() {
+    follow_state &follow = *follow_;
+    const int slot = 1 - follow.active.load(std::memory_order_relaxed);
+    const std::string name = detail::sdl_device_cache::instance()
+                                 .read(iscapture_)
+                                 ->default_device.name;
+    SDL_AudioSpec spec = spec_;
+    spec.userdata = &follow.streams[slot];
+    spec.callback = follow_callback;
+    SDL_AudioSpec obtained;
+    // No changes allowed, the callback keeps the format it was set up for.
+    const device_id_t next =
+        SDL_OpenAudioDevice(name.empty() ? nullptr : name.c_str(), iscapture_,
+                            &spec, &obtained, 0);
+    if (next == 0) {
+      // Keep the current device.
+      return;
+    }
+
+    const device_id_t previous = follow.id.load(std::memory_order_relaxed);
+    const bool playing = SDL_GetAudioDeviceStatus(previous) ==
+                         SDL_AudioStatus::SDL_AUDIO_PLAYING;
+    follow.streams[slot].fade_in = true;
+    follow.overlap_bytes = 0;
+    follow.handover.store(true, std::memory_order_release);
+    if (playing) {
+      SDL_PlayAudioDevice(next);
+    }
+    if (!playing || !follow.handed_over.try_acquire_for(kHandoverTimeout)) {
+      // Locking waits for a callback in flight on the previous device.
+      SDL_LockAudioDevice(previous);
+      if (follow.handover.exchange(false, std::memory_order_acq_rel)) {
+        follow.active.store(slot, std::memory_order_release);
+      }
+      SDL_UnlockAudioDevice(previous);
+      follow.handed_over.try_acquire();
+    }
+    follow.id.store(next, std::memory_order_release);
+    SDL_CloseAudioDevice(previous);
+  }
+
+  // The open SDL device, 0 when stopped.
+  device_id_t current_id() const noexcept {
+    return follow_ ? follow_->id.load(std::memory_order_acquire) : id_;
+  }
+
+  bool pull_ready() const noexcept {
+    if (!pull_) {
+      return false;
+    }
+    return (iscapture_ ? pull_->queue.read_available()
+                       : pull_->queue.write_available()) >= spec_.samples;
+  }
+
+  // next_io() doesn't need to wait, for a period or because the device
+  // stopped.
+  bool io_ready() const noexcept { return pull_ready() || !is_playing(); }
+
+  bool park_io(detail::io_waiter &waiter) noexcept {
+    return detail::park_io_waiter(pull_->awaiting, waiter,
+                                  [this]() noexcept { return io_ready(); });
+  }
+
+  // Hand out the next period of the queue in place, or staging_buffer_ if
+  // it wraps around the end of the queue.
+  template <typename SampleType>
+  audio_io_lease<SampleType, audio_device> take_io() {
+    if (!is_playing()) {
+      throw std::runtime_error("audio:: next_io Error : device not playing");
+    }
+    const std::size_t frame_size = frame_size_in_bytes();
+    const std::size_t frames = spec_.samples;
+    auto regions = iscapture_ ? pull_->queue.read_regions(frames)
+                              : pull_->queue.write_regions(frames);
+    const bool direct = regions.first.size() == frames * frame_size;
+    uint8_t *data = direct ? regions.first.data() : staging_buffer_.data();
+    if (iscapture_ && !direct) {
+      pull_->queue.read(data, frames);
+    } else if (!iscapture_) {
+      std::memset(data, spec_.silence, frames * frame_size);
+    }
+    audio_device_io<SampleType> io = CreateDeviceIOFromBytes<SampleType>(
+        data, int(frames * frame_size), spec_.channels,
+        process_position_ +
+            pull_->skipped_frames.load(std::memory_order_relaxed));
+    process_position_ += frames;
+    return {*this, std::move(io), frames, direct};
+  }
+
+  // Give a period of take_io() back to the queue. next_io() waited for
+  // room, so output always fits.
+  void finish_io(std::size_t frames, bool direct) noexcept {
+    if (iscapture_) {
+      if (direct) {
+        pull_->queue.commit_read(frames);
+      }
+    } else if (direct) {
+      pull_->queue.commit_write(frames);
+    } else {
+      pull_->queue.write(staging_buffer_.data(), frames);
+    }
+  }
+
+  bool wait_until(
+      std::optional<chrono::time_point<audio_clock_t>> deadline) const {
+    if (!is_playing() || device_callback_ || !pull_) {
+      return true;
+    }
+    while (!pull_ready()) {
+      // Announce the waiter before the last check, so the audio thread
+      // can't produce in between and skip the wakeup.
+      pull_->waiting.store(true, std::memory_order_release);
+      if (pull_ready() || !is_playing()) {
+        break;
+      }
+      if (!deadline) {
+        pull_->ready.acquire();
+      } else if (!pull_->ready.try_acquire_until(*deadline)) {
+        return pull_ready();
+      }
+    }
+    return true;
+  }
+
+  // Audio thread: advance the device clock by a callback of num_frames
+  // entered at now and count the callback if it came more than a period
+  // late. Returns the device position of its first frame.
+  std::uint64_t tick(chrono::time_point<audio_clock_t> now,
+                     std::size_t num_frames) noexcept {
+    const std::uint64_t position = clock_->tick(now, num_frames);
+    if (clock_->lateness() > clock_->frame_duration() * double(num_frames)) {
+      xruns_->late_callback(now);
+    }
+    return position;
+  }
+
+  std::size_t frame_size_in_bytes() const noexcept {
+    return SDL_AUDIO_BITSIZE(spec_.format) / 8 * spec_.channels;
+  }
+
+  // position is the device position of the first frame in stream.
   template <typename SampleType>
-  static auto CreateDeviceIOFromBytes(uint8_t *stream, int len, int channel_num,
-                                      bool iscapture) {
+  auto CreateDeviceIOFromBytes(uint8_t *stream, int len, int channel_num,
+                               std::uint64_t position) const noexcept {
     audio_device_io<SampleType> io;
-    audio_buffer<SampleType> buffer(reinterpret_cast<SampleType *>(stream),
-                                    (len / sizeof(SampleType)) / channel_num,
-                                    channel_num, contiguous_interleaved);
-    auto timestamp = audio_clock_t::now();
-    if (iscapture) {
-      io.input_buffer = std::move(buffer);
-      io.input_time = timestamp;
+    auto &buffer = iscapture_ ? io.input_buffer : io.output_buffer;
+    buffer.emplace(reinterpret_cast<SampleType *>(stream),
+                   (len / sizeof(SampleType)) / channel_num, channel_num,
+                   contiguous_interleaved);
+    io.sample_position = position;
+    auto timestamp = clock_->time_at(position);
+    if (iscapture_) {
+      io.input_time = timestamp - get_latency();
     } else {
-      io.output_buffer = std::move(buffer);
-      io.output_time = timestamp;
+      io.output_time = timestamp + get_latency();
     }
     return io;
   }
 
+  // Run the callback on convert_buffer_ and convert from/to the device
+  // samples in stream, in chunks of at most one period.
+  template <typename DeviceSample, typename SampleType, typename Callback>
+  void convert_and_call(Callback &cb, uint8_t *stream, int len,
+                        int channel_num) noexcept {
+    auto *device_samples = reinterpret_cast<DeviceSample *>(stream);
+    auto *samples = reinterpret_cast<SampleType *>(convert_buffer_.data());
+    const std::size_t frame_size = std::size_t(channel_num);
+    const std::size_t capacity =
+        convert_buffer_.size() / (sizeof(SampleType) * frame_size);
+    const std::size_t num_frames = len / (sizeof(DeviceSample) * frame_size);
+    if (capacity == 0) {
+      std::memset(stream, spec_.silence, len);
+      return;
+    }
+
+    for (std::size_t offset = 0; offset < num_frames;) {
+      std::size_t frames = std::min(capacity, num_frames - offset);
+      std::size_t count = frames * frame_size;
+      DeviceSample *chunk = device_samples + offset * frame_size;
+      if (iscapture_) {
+        convert_samples(chunk, samples, count);
+      }
+      audio_device_io<SampleType> io = CreateDeviceIOFromBytes<SampleType>(
+          reinterpret_cast<uint8_t *>(samples), count * sizeof(SampleType),
+          channel_num, callback_position_ + offset);
+      cb(*this, io);
+      if (!iscapture_) {
+        if (dither_enabled_) {
+          convert_samples(samples, chunk, count, dither_);
+        } else {
+          convert_samples(samples, chunk, count);
+        }
+      }
+      offset += frames;
+    }
+  }
+
+  // Call f with std::type_identity<T> for the sample type T of an SDL format
+  // we convert natively, return false for any other format.
+  template <typename F>
+  static bool visit_sample_format(SDL_AudioFormat format, F &&f) {
+    return [&]<typename... Ts>(std::type_identity<Ts>...) {
+      return ((format == GetTypeFormat<Ts>()
+                   ? (f(std::type_identity<Ts>{}), true)
+                   : false) ||
+              ...);
+    }(std::type_identity<uint8_t>{}, std::type_identity<int8_t>{},
+           std::type_identity<int16_t>{}, std::type_identity<int32_t>{},
+           std::type_identity<float>{});
+  }
+
   template <typename SampleType>
   static constexpr SDL_AudioFormat GetTypeFormat() noexcept {
     return (std::is_signed_v<SampleType> << 15) |
@@ -322,8 +1201,105 @@ private:
   device_id_t id_{0};
   std::string name_;
 
-  llvm::unique_function<detail::function_type<SDL_AudioCallback>::type>
-      user_callback_;
+  // The connected_callback of the connect()ed callback, called by
+  // device_callback_.
+  std::unique_ptr<void, void (*)(void *) noexcept> callback_state_{nullptr,
+                                                                  nullptr};
+  int callback_channels_ = 0;
+  template <typename SampleType>
+  using io_callback_type = llvm::unique_function<void(
+      audio_device &, audio_device_io<SampleType> &)>;
+  template <typename SampleType>
+  using callback_swap_type =
+      detail::callback_swap<SampleType, io_callback_type<SampleType>>;
+  // callback_state_ as a callback_swap_type<SampleType>, and the
+  // sample_type_tag of its SampleType.
+  void *callback_swap_ = nullptr;
+  const void *callback_type_ = nullptr;
+
+  // Callback samples when they differ from the device format.
+  std::size_t convert_sample_size_ = 0;
+  detail::aligned_buffer<uint8_t> convert_buffer_;
+
+  // One period of device samples for process().
+  detail::aligned_buffer<uint8_t> staging_buffer_;
+
+  // Pull mode FIFO between the SDL audio thread and process(), plus the
+  // wakeups for wait() and next_io(). Heap allocated as semaphores can't move.
+  struct pull_state {
+    detail::spsc_ring<uint8_t> queue; // In frames.
+    std::counting_semaphore<> ready{0};
+    std::atomic<bool> waiting{false};
+    // Coroutine suspended in next_io().
+    std::atomic<detail::io_waiter *> awaiting{nullptr};
+    // Frames the audio thread dropped (input) or filled with silence
+    // (output) because queue was full/empty.
+    std::atomic<std::uint64_t> skipped_frames{0};
+    // Audio thread only, set once process() queued the first output.
+    bool streaming = false;
+  };
+  static constexpr std::size_t kPullQueuePeriods = 4;
+  std::unique_ptr<pull_state> pull_;
+  // Device position of the next frame process() hands out.
+  std::uint64_t process_position_ = 0;
+
+  // Filtered device time, heap allocated as it can't move.
+  std::unique_ptr<detail::device_clock> clock_;
+  // Device position of the first frame of the running callback.
+  std::uint64_t callback_position_ = 0;
+  std::unique_ptr<detail::xrun_counters> xruns_;
+  [[no_unique_address]] detail::callback_profiler profiler_;
+  bool dither_enabled_ = false;
+  tpdf_dither dither_;
+  std::optional<audio_realtime_config> realtime_;
+  // Times the device was opened, tells promote_realtime() a new start().
+  std::uint64_t starts_ = 0;
+
+  // One per SDL device opened while following the default device, the
+  // userdata of follow_callback.
+  struct follow_stream {
+    audio_device *device = nullptr;
+    int slot = 0;
+    // Audio thread of the stream, set by the worker before the handover.
+    bool fade_in = false;
+  };
+  // Shared with the notifier subscription, which may still run once after
+  // it was unsubscribed.
+  struct follow_state {
+    // Notifier thread: a default device change was posted.
+    void request() noexcept {
+      requested.store(audio_clock_t::now().time_since_epoch().count(),
+                      std::memory_order_relaxed);
+      if (!pending.exchange(true, std::memory_order_acq_rel)) {
+        wake.release();
+      }
+    }
+
+    follow_stream streams[2];
+    // Slot of the stream that runs the callback.
+    std::atomic<int> active{0};
+    // The SDL device of the active stream, or of the incoming one once the
+    // handover is done.
+    std::atomic<device_id_t> id{0};
+    // Set by the worker, cleared by the outgoing stream as it hands over.
+    std::atomic<bool> handover{false};
+    std::binary_semaphore handed_over{0};
+    // The outgoing stream's last period, overlap_bytes of it, 0 if it
+    // didn't keep one. Cleared by the worker before the handover, written
+    // by the outgoing stream before it hands over, read by the incoming
+    // one. Sized for a period by start().
+    detail::aligned_buffer<uint8_t> overlap;
+    std::size_t overlap_bytes = 0;
+    std::atomic<bool> pending{false};
+    std::counting_semaphore<> wake{0};
+    // audio_clock_t ticks of the last request.
+    std::atomic<audio_clock_t::rep> requested{0};
+    audio_device_list_callback_id subscription{};
+    std::jthread worker;
+  };
+  static constexpr chrono::milliseconds kHandoverTimeout{250};
+  bool follow_default_ = false;
+  std::shared_ptr<follow_state> follow_;
 
   SDL_AudioSpec spec_;
 };
@@ -339,6 +1315,7 @@ public:
         SDL_QuitSubSystem(SDL_INIT_AUDIO);
         SDL_Quit();
       });
+      detail::sdl_device_cache::instance();
     });
   }
 
@@ -353,18 +1330,19 @@ public:
 private:
   void fill_with_audio_device(bool iscapture) {
     clear();
-    for (int i = SDL_GetNumAudioDevices(iscapture) - 1; i >= 0; i--) {
-      push_front(audio_device(i, iscapture));
+    auto snapshot = detail::sdl_device_cache::instance().read(iscapture);
+    for (auto it = snapshot->devices.rbegin(); it != snapshot->devices.rend();
+         ++it) {
+      push_front(audio_device(std::string(it->name), SDL_AudioSpec(it->spec),
+                              iscapture));
     }
   }
 
   audio_device default_device(bool iscapture) {
-    char *name;
-    SDL_AudioSpec spec;
-    SDL_GetDefaultAudioInfo(&name, &spec, iscapture);
-    std::string name_tmp(name);
-    SDL_free(name);
-    return audio_device(std::move(name_tmp), std::move(spec), iscapture);
+    auto snapshot = detail::sdl_device_cache::instance().read(iscapture);
+    return audio_device(std::string(snapshot->default_device.name),
+                        SDL_AudioSpec(snapshot->default_device.spec),
+                        iscapture);
   }
 
 private:
@@ -384,6 +1362,285 @@ optional<audio_device> get_default_audio_output_device() {
   return list.default_output_device();
 }
 
+// A capture and a playback device opened at the same sample rate and period
+// and driven by one callback that gets both buffers. Captured frames reach
+// the playback callback through a ring which absorbs the phase offset between
+// the two devices: the input is primed with one period, and when capture runs
+// more than kMaxBufferedPeriods ahead the surplus is dropped, so the
+// capture-to-render latency stays bounded. get_latency() reports it as
+// measured from the timestamps.
+class audio_duplex_device {
+public:
+  using sample_rate_t = audio_device::sample_rate_t;
+  using buffer_size_t = audio_device::buffer_size_t;
+
+  audio_duplex_device(audio_device input, audio_device output)
+      : input_(std::move(input)), output_(std::move(output)),
+        state_(std::make_unique<duplex_state>()) {
+    if (!input_.is_input() || !output_.is_output()) {
+      throw std::runtime_error(
+          "audio:: duplex device needs an input and an output device");
+    }
+    input_.set_sample_rate(output_.get_sample_rate());
+    input_.set_buffer_size_frames(output_.get_buffer_size_frames());
+  }
+
+  // The device callbacks point back to the device.
+  audio_duplex_device(const audio_duplex_device &) = delete;
+  audio_duplex_device &operator=(const audio_duplex_device &) = delete;
+
+  ~audio_duplex_device() { stop(); }
+
+  const audio_device &input_device() const noexcept { return input_; }
+
+  const audio_device &output_device() const noexcept { return output_; }
+
+  int get_num_input_channels() const noexcept {
+    return input_.get_num_input_channels();
+  }
+
+  int get_num_output_channels() const noexcept {
+    return output_.get_num_output_channels();
+  }
+
+  sample_rate_t get_sample_rate() const noexcept {
+    return output_.get_sample_rate();
+  }
+
+  bool set_sample_rate(sample_rate_t freq) noexcept {
+    if (is_running()) {
+      return false;
+    }
+    return input_.set_sample_rate(freq) && output_.set_sample_rate(freq);
+  }
+
+  buffer_size_t get_buffer_size_frames() const noexcept {
+    return output_.get_buffer_size_frames();
+  }
+
+  bool set_buffer_size_frames(buffer_size_t buffer_size) noexcept {
+    if (is_running()) {
+      return false;
+    }
+    return input_.set_buffer_size_frames(buffer_size) &&
+           output_.set_buffer_size_frames(buffer_size);
+  }
+
+  template <typename SampleType> bool set_sample_type() noexcept {
+    if (is_running()) {
+      return false;
+    }
+    return input_.set_sample_type<SampleType>() &&
+           output_.set_sample_type<SampleType>();
+  }
+
+  // Promote the audio threads of both devices, stats().realtime reports the
+  // first failure.
+  bool set_realtime(const std::optional<audio_realtime_config> &config) {
+    if (is_running()) {
+      return false;
+    }
+    return input_.set_realtime(config) && output_.set_realtime(config);
+  }
+
+  bool is_running() const noexcept {
+    return input_.is_running() || output_.is_running();
+  }
+
+  // io_callback gets the output device and both buffers, with the same
+  // number of frames.
+  template <typename SampleType>
+  void connect(AudioIOCallback<SampleType> auto &&io_callback) {
+    if (is_running()) {
+      throw std::runtime_error("can't connect running device");
+    }
+    frame_size_ = sizeof(SampleType) * input_.get_num_input_channels();
+    input_.connect<SampleType>(
+        [this](audio_device &, audio_device_io<SampleType> &io) noexcept {
+          capture(io);
+        });
+    output_.connect<SampleType>(
+        [this, cb = std::forward<decltype(io_callback)>(io_callback)](
+            audio_device &device, audio_device_io<SampleType> &io) mutable
+        noexcept { render(cb, device, io); });
+  }
+
+  bool start() {
+    if (frame_size_ == 0) {
+      throw std::runtime_error("audio:: duplex device is not connected");
+    }
+    if (!is_running()) {
+      const std::size_t period = output_.get_buffer_size_frames();
+      state_->queue.reset(kQueuePeriods * period, frame_size_);
+      state_->scratch.resize(2 * period * frame_size_);
+      state_->input_skipped.store(0, std::memory_order_relaxed);
+      state_->input_position = 0;
+      state_->primed = false;
+      state_->latency_ns.store(0, std::memory_order_relaxed);
+      state_->xruns.reset();
+    }
+    // Playback first, it renders silence until the input is primed.
+    output_.start();
+    input_.start();
+    if (input_.get_sample_rate() != output_.get_sample_rate() ||
+        input_.get_buffer_size_frames() != output_.get_buffer_size_frames()) {
+      stop();
+      throw std::runtime_error("audio:: duplex devices opened with different "
+                               "sample rates or periods");
+    }
+    return true;
+  }
+
+  bool pause() {
+    bool input_paused = input_.pause();
+    return output_.pause() && input_paused;
+  }
+
+  bool stop() {
+    bool input_stopped = input_.stop();
+    return output_.stop() && input_stopped;
+  }
+
+  // XRuns of both devices plus the input the duplex ring dropped (overruns)
+  // or couldn't provide (underruns).
+  audio_device_stats stats() const noexcept {
+    audio_device_stats stats = state_->xruns.snapshot();
+    stats += input_.stats();
+    stats += output_.stats();
+    return stats;
+  }
+
+  // Capture-to-render latency of the last callback: from when frame 0 of its
+  // input was captured to when frame 0 of its output is presented.
+  chrono::nanoseconds get_latency() const noexcept {
+    return chrono::nanoseconds(
+        state_->latency_ns.load(std::memory_order_relaxed));
+  }
+
+private:
+  // Input device callback, only queues the captured frames.
+  template <typename SampleType>
+  void capture(audio_device_io<SampleType> &io) noexcept {
+    if (!io.input_buffer.has_value()) {
+      return;
+    }
+    // The SDL backend always hands out interleaved frames.
+    assert(io.input_buffer->template holds_layout<contiguous_interleaved_t>());
+    const std::size_t frames = io.input_buffer->size_frames();
+    std::size_t written = state_->queue.write(
+        reinterpret_cast<const uint8_t *>(io.input_buffer->data()), frames);
+    if (written < frames) {
+      state_->input_skipped.fetch_add(frames - written,
+                                      std::memory_order_relaxed);
+      state_->xruns.overrun(audio_clock_t::now());
+    }
+  }
+
+  // Output device callback. SDL can ask for more frames than the input
+  // scratch memory holds, the user callback then runs once per chunk of
+  // the output, so that its input and output always have the same size.
+  template <typename SampleType, typename Callback>
+  void render(Callback &cb, audio_device &device,
+              audio_device_io<SampleType> &io) noexcept {
+    const std::size_t total = io.output_buffer->size_frames();
+    const std::size_t chunk = state_->scratch.size() / frame_size_;
+    if (total <= chunk) {
+      render_chunk(cb, device, io);
+      return;
+    }
+    assert(io.output_buffer->template holds_layout<contiguous_interleaved_t>());
+    SampleType *output = io.output_buffer->data();
+    const std::size_t channels = io.output_buffer->size_channels();
+    for (std::size_t done = 0; done < total; done += chunk) {
+      audio_device_io<SampleType> part = io;
+      part.output_buffer.emplace(output + done * channels,
+                                 std::min(chunk, total - done), channels,
+                                 contiguous_interleaved);
+      part.output_time = detail::offset_time(io.output_time, double(done),
+                                             double(get_sample_rate()));
+      part.sample_position = io.sample_position + done;
+      render_chunk(cb, device, part);
+    }
+  }
+
+  // Pairs an output buffer that fits the scratch memory with as many frames
+  // of queued input and calls the user callback.
+  template <typename SampleType, typename Callback>
+  void render_chunk(Callback &cb, audio_device &device,
+                    audio_device_io<SampleType> &io) noexcept {
+    duplex_state &state = *state_;
+    const std::size_t channels = input_.get_num_input_channels();
+    const std::size_t period = output_.get_buffer_size_frames();
+    const std::size_t frames = io.output_buffer->size_frames();
+
+    std::size_t available = state.queue.read_available();
+    if (available > kMaxBufferedPeriods * period) {
+      // Capture ran ahead, drop the surplus to bound the latency.
+      state.xruns.overrun(audio_clock_t::now());
+      state.queue.commit_read(available - period);
+      state.input_position += available - period;
+      available = period;
+    }
+    state.primed = state.primed || available >= period;
+
+    auto *input = reinterpret_cast<SampleType *>(state.scratch.data());
+    std::size_t read =
+        state.primed ? state.queue.read(state.scratch.data(), frames) : 0;
+    std::fill(input + read * channels, input + frames * channels,
+              detail::from_signed<SampleType>(0));
+    if (read < frames) {
+      // Underrun, prime again.
+      if (state.primed) {
+        state.xruns.underrun(audio_clock_t::now());
+      }
+      state.primed = false;
+    }
+
+    io.input_buffer = audio_buffer<SampleType>(input, frames, channels,
+                                               contiguous_interleaved);
+    io.input_time =
+        input_.clock_->time_at(
+            state.input_position +
+            state.input_skipped.load(std::memory_order_relaxed)) -
+        input_.get_latency();
+    state.input_position += read;
+    if (read == frames) {
+      state.latency_ns.store((*io.output_time - *io.input_time).count(),
+                             std::memory_order_relaxed);
+    }
+
+    cb(device, io);
+  }
+
+  static constexpr std::size_t kQueuePeriods = 4;
+  static constexpr std::size_t kMaxBufferedPeriods = 2;
+
+  // Shared by the two audio threads, heap allocated as it can't move.
+  struct duplex_state {
+    detail::spsc_ring<uint8_t> queue; // Captured frames.
+    detail::aligned_buffer<uint8_t> scratch; // Input buffer of the callback.
+    // Captured frames dropped because queue was full.
+    std::atomic<std::uint64_t> input_skipped{0};
+    std::atomic<std::int64_t> latency_ns{0};
+    detail::xrun_counters xruns;
+    // Playback thread only.
+    std::uint64_t input_position = 0;
+    bool primed = false;
+  };
+
+  audio_device input_;
+  audio_device output_;
+  std::size_t frame_size_ = 0;
+  std::unique_ptr<duplex_state> state_;
+};
+
+optional<audio_duplex_device> get_default_audio_duplex_device() {
+  audio_device_list list;
+  return optional<audio_duplex_device>(std::in_place,
+                                       list.default_input_device(),
+                                       list.default_output_device());
+}
+
 audio_device_list get_audio_input_device_list() {
   audio_device_list list;
   list.fill_with_input_device();
@@ -396,60 +1653,13 @@ audio_device_list get_audio_output_device_list() {
   return list;
 }
 
-void set_audio_device_list_callback(audio_device_list_event event,
-                                    AudioDeviceListCallback auto &&cb) {
-  struct EventCallback {
-    llvm::unique_function<void()> device_change;
-    llvm::unique_function<void()> default_input_device_change;
-    llvm::unique_function<void()> default_output_device_change;
-  } static kEventCallback;
-  static std::shared_mutex kCallbackMutex;
-  std::unique_lock lock(kCallbackMutex);
-  switch (event) {
-  case audio_device_list_event::device_list_changed:
-    kEventCallback.device_change = std::move(cb);
-    break;
-  case audio_device_list_event::default_input_device_changed:
-    kEventCallback.default_input_device_change = std::move(cb);
-    break;
-  case audio_device_list_event::default_output_device_changed:
-    kEventCallback.default_output_device_change = std::move(cb);
-    break;
-  default:
-    assert("Unsupported Event" && false);
-  }
-  lock.unlock();
-
-  static std::once_flag kEventCallFlag;
-  std::call_once(kEventCallFlag, [] {
-    SDL_SetEventFilter(
-        [](void *userdata, SDL_Event *event) {
-          switch (event->type) {
-          case SDL_EventType::SDL_EVENT_AUDIO_DEVICE_ADDED:
-          case SDL_EventType::SDL_EVENT_AUDIO_DEVICE_REMOVED: {
-            std::shared_lock _(kCallbackMutex);
-            if (kEventCallback.device_change) {
-              kEventCallback.device_change();
-            }
-            if (kEventCallback.default_input_device_change &&
-                event->adevice.iscapture &&
-                SDL_GetAudioDeviceName(event->adevice.which, true) ==
-                    get_default_audio_input_device()->name()) {
-              kEventCallback.default_input_device_change();
-            }
-            if (kEventCallback.default_output_device_change &&
-                !event->adevice.iscapture &&
-                SDL_GetAudioDeviceName(event->adevice.which, false) ==
-                    get_default_audio_output_device()->name()) {
-              kEventCallback.default_output_device_change();
-            }
-          }
-          default:
-            return 1;
-          }
-        },
-        nullptr);
-  });
+audio_device_list_callback_id
+set_audio_device_list_callback(audio_device_list_event event,
+                               AudioDeviceListCallback auto &&cb) {
+  // Initializes SDL, which installs the event filter.
+  audio_device_list list;
+  return detail::device_list_notifier::instance().subscribe(
+      event, std::forward<decltype(cb)>(cb));
 }
 
 _LIBSTDAUDIO_NAMESPACE_END
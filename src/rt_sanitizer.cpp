@@ -0,0 +1,388 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+// The real-time sanitizer, see rt_sanitizer.h. Built as a shared library
+// that either is linked before the C library, or is LD_PRELOADed, so that
+// its definitions of malloc, pthread_mutex_lock, nanosleep... take
+// precedence over the C library's. Each one checks whether the calling
+// thread is inside an rt_section, queues a violation if so, and forwards to
+// the C library. Linux and glibc only.
+
+#include <experimental/__p1386/rt_sanitizer.h>
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+extern "C" {
+void *__libc_malloc(std::size_t size);
+void *__libc_calloc(std::size_t count, std::size_t size);
+void *__libc_realloc(void *ptr, std::size_t size);
+void *__libc_memalign(std::size_t alignment, std::size_t size);
+void __libc_free(void *ptr);
+}
+
+namespace {
+
+using _LIBSTDAUDIO_NAMESPACE::audio_rt_violation;
+using _LIBSTDAUDIO_NAMESPACE::audio_rt_violation_handler;
+
+// Initial-exec, so that reading them never allocates, unlike lazily
+// allocated dynamic TLS.
+#define RT_SANITIZER_TLS thread_local __attribute__((tls_model("initial-exec")))
+
+// Nesting depth of rt_section on this thread.
+RT_SANITIZER_TLS int rt_depth = 0;
+// Set while the sanitizer itself runs on this thread.
+RT_SANITIZER_TLS bool in_sanitizer = false;
+
+constexpr std::size_t max_frames = 32;
+
+struct violation_slot {
+  enum { empty, writing, full };
+  std::atomic<int> state{empty};
+  const char *function = nullptr;
+  int thread = 0;
+  int num_frames = 0;
+  std::array<void *, max_frames> frames;
+};
+
+// Multi-producer queue without order: audio threads claim a slot with a
+// CAS, drain() reports and frees whatever slots are full.
+std::array<violation_slot, 256> slots;
+std::atomic<std::size_t> next_slot{0};
+std::atomic<std::size_t> dropped{0};
+std::atomic<audio_rt_violation_handler> handler{nullptr};
+std::mutex drain_mutex;
+
+void default_handler(const audio_rt_violation &violation) {
+  std::fprintf(stderr,
+               "audio:: real-time violation: %s called from a device "
+               "callback on thread %d\n",
+               violation.function, violation.thread);
+  backtrace_symbols_fd(violation.stack.data(), int(violation.stack.size()),
+                       STDERR_FILENO);
+}
+
+std::size_t drain() {
+  std::lock_guard lock(drain_mutex);
+  audio_rt_violation_handler report = handler.load(std::memory_order_acquire);
+  if (!report) {
+    report = default_handler;
+  }
+  std::size_t reported = 0;
+  for (violation_slot &slot : slots) {
+    if (slot.state.load(std::memory_order_acquire) != violation_slot::full) {
+      continue;
+    }
+    report(audio_rt_violation{
+        slot.function, slot.thread,
+        std::span<void *const>(slot.frames.data(),
+                               std::size_t(slot.num_frames))});
+    slot.state.store(violation_slot::empty, std::memory_order_release);
+    ++reported;
+  }
+  return reported;
+}
+
+void *reporter(void *) {
+  while (true) {
+    timespec period{0, 100 * 1000 * 1000};
+    nanosleep(&period, nullptr);
+    drain();
+  }
+  return nullptr;
+}
+
+// The audio thread called function: queue it with the current stack.
+void record(const char *function) noexcept {
+  in_sanitizer = true;
+  violation_slot &slot =
+      slots[next_slot.fetch_add(1, std::memory_order_relaxed) % slots.size()];
+  int expected = violation_slot::empty;
+  if (slot.state.compare_exchange_strong(expected, violation_slot::writing,
+                                         std::memory_order_acquire)) {
+    slot.function = function;
+    slot.thread = int(gettid());
+    // Skip record() and the interposed function.
+    std::array<void *, max_frames + 2> frames;
+    const int captured = backtrace(frames.data(), int(frames.size()));
+    slot.num_frames = captured > 2 ? captured - 2 : 0;
+    for (int i = 0; i < slot.num_frames; ++i) {
+      slot.frames[i] = frames[i + 2];
+    }
+    slot.state.store(violation_slot::full, std::memory_order_release);
+  } else {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+  in_sanitizer = false;
+}
+
+inline void check(const char *function) noexcept {
+  if (rt_depth != 0 && !in_sanitizer) {
+    record(function);
+  }
+}
+
+// The C library's definition of the function named name, which the one
+// here hides.
+void *next(std::atomic<void *> &cache, const char *name) noexcept {
+  void *f = cache.load(std::memory_order_relaxed);
+  if (!f) {
+    // dlsym() may allocate.
+    const bool was_in_sanitizer = in_sanitizer;
+    in_sanitizer = true;
+    f = dlsym(RTLD_NEXT, name);
+    in_sanitizer = was_in_sanitizer;
+    cache.store(f, std::memory_order_relaxed);
+  }
+  return f;
+}
+
+#define RT_SANITIZER_NEXT(name)                                               \
+  ([]() noexcept {                                                            \
+    static std::atomic<void *> cache{nullptr};                                \
+    return reinterpret_cast<decltype(&::name)>(next(cache, #name));           \
+  }())
+
+__attribute__((constructor)) void start_reporter() {
+  // backtrace() loads the unwinder on its first call, which allocates.
+  std::array<void *, 4> frames;
+  backtrace(frames.data(), int(frames.size()));
+  pthread_t thread;
+  if (pthread_create(&thread, nullptr, reporter, nullptr) == 0) {
+    pthread_detach(thread);
+  }
+}
+
+} // namespace
+
+_LIBSTDAUDIO_NAMESPACE_BEGIN
+
+void set_audio_rt_violation_handler(
+    audio_rt_violation_handler new_handler) noexcept {
+  handler.store(new_handler, std::memory_order_release);
+}
+
+std::size_t flush_audio_rt_violations() noexcept { return drain(); }
+
+std::size_t dropped_audio_rt_violations() noexcept {
+  return dropped.load(std::memory_order_relaxed);
+}
+
+namespace detail {
+
+void rt_sanitizer_enter() noexcept { ++rt_depth; }
+
+void rt_sanitizer_leave() noexcept { --rt_depth; }
+
+} // namespace detail
+
+_LIBSTDAUDIO_NAMESPACE_END
+
+extern "C" {
+
+void *malloc(std::size_t size) {
+  check("malloc");
+  return __libc_malloc(size);
+}
+
+void *calloc(std::size_t count, std::size_t size) {
+  check("calloc");
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, std::size_t size) {
+  check("realloc");
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+  if (ptr) {
+    check("free");
+  }
+  __libc_free(ptr);
+}
+
+void *aligned_alloc(std::size_t alignment, std::size_t size) {
+  check("aligned_alloc");
+  return __libc_memalign(alignment, size);
+}
+
+void *memalign(std::size_t alignment, std::size_t size) {
+  check("memalign");
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, std::size_t alignment, std::size_t size) {
+  check("posix_memalign");
+  if (alignment % sizeof(void *) != 0 ||
+      (alignment & (alignment - 1)) != 0) {
+    return EINVAL;
+  }
+  void *result = __libc_memalign(alignment, size);
+  if (!result) {
+    return ENOMEM;
+  }
+  *ptr = result;
+  return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+  check("pthread_mutex_lock");
+  return RT_SANITIZER_NEXT(pthread_mutex_lock)(mutex);
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+  check("pthread_cond_wait");
+  return RT_SANITIZER_NEXT(pthread_cond_wait)(cond, mutex);
+}
+
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                           const timespec *abstime) {
+  check("pthread_cond_timedwait");
+  return RT_SANITIZER_NEXT(pthread_cond_timedwait)(cond, mutex, abstime);
+}
+
+int pthread_join(pthread_t thread, void **result) {
+  check("pthread_join");
+  return RT_SANITIZER_NEXT(pthread_join)(thread, result);
+}
+
+int sem_wait(sem_t *sem) {
+  check("sem_wait");
+  return RT_SANITIZER_NEXT(sem_wait)(sem);
+}
+
+int nanosleep(const timespec *duration, timespec *remaining) {
+  check("nanosleep");
+  return RT_SANITIZER_NEXT(nanosleep)(duration, remaining);
+}
+
+int clock_nanosleep(clockid_t clock, int flags, const timespec *duration,
+                    timespec *remaining) {
+  check("clock_nanosleep");
+  return RT_SANITIZER_NEXT(clock_nanosleep)(clock, flags, duration,
+                                            remaining);
+}
+
+int usleep(useconds_t usec) {
+  check("usleep");
+  return RT_SANITIZER_NEXT(usleep)(usec);
+}
+
+unsigned sleep(unsigned seconds) {
+  check("sleep");
+  return RT_SANITIZER_NEXT(sleep)(seconds);
+}
+
+ssize_t read(int fd, void *buffer, std::size_t count) {
+  check("read");
+  return RT_SANITIZER_NEXT(read)(fd, buffer, count);
+}
+
+ssize_t write(int fd, const void *buffer, std::size_t count) {
+  check("write");
+  return RT_SANITIZER_NEXT(write)(fd, buffer, count);
+}
+
+int open(const char *path, int flags, ...) {
+  check("open");
+  mode_t mode = 0;
+  if (flags & (O_CREAT | O_TMPFILE)) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  return RT_SANITIZER_NEXT(open)(path, flags, mode);
+}
+
+int openat(int dir, const char *path, int flags, ...) {
+  check("openat");
+  mode_t mode = 0;
+  if (flags & (O_CREAT | O_TMPFILE)) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  return RT_SANITIZER_NEXT(openat)(dir, path, flags, mode);
+}
+
+int close(int fd) {
+  check("close");
+  return RT_SANITIZER_NEXT(close)(fd);
+}
+
+int poll(pollfd *fds, nfds_t count, int timeout) {
+  check("poll");
+  return RT_SANITIZER_NEXT(poll)(fds, count, timeout);
+}
+
+int select(int count, fd_set *read_fds, fd_set *write_fds, fd_set *error_fds,
+           timeval *timeout) {
+  check("select");
+  return RT_SANITIZER_NEXT(select)(count, read_fds, write_fds, error_fds,
+                                   timeout);
+}
+
+// Logging: the stdio functions lock the stream and write to a file.
+
+std::size_t fwrite(const void *buffer, std::size_t size, std::size_t count,
+                   FILE *stream) {
+  check("fwrite");
+  return RT_SANITIZER_NEXT(fwrite)(buffer, size, count, stream);
+}
+
+int fputs(const char *string, FILE *stream) {
+  check("fputs");
+  return RT_SANITIZER_NEXT(fputs)(string, stream);
+}
+
+int puts(const char *string) {
+  check("puts");
+  return RT_SANITIZER_NEXT(puts)(string);
+}
+
+int vfprintf(FILE *stream, const char *format, va_list args) {
+  check("vfprintf");
+  return RT_SANITIZER_NEXT(vfprintf)(stream, format, args);
+}
+
+int printf(const char *format, ...) {
+  check("printf");
+  va_list args;
+  va_start(args, format);
+  const int result = RT_SANITIZER_NEXT(vfprintf)(stdout, format, args);
+  va_end(args);
+  return result;
+}
+
+int fprintf(FILE *stream, const char *format, ...) {
+  check("fprintf");
+  va_list args;
+  va_start(args, format);
+  const int result = RT_SANITIZER_NEXT(vfprintf)(stream, format, args);
+  va_end(args);
+  return result;
+}
+
+} // extern "C"
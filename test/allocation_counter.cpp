@@ -0,0 +1,91 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "allocation_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+thread_local std::size_t allocation_count = 0;
+thread_local std::size_t deallocation_count = 0;
+
+void *counted_alloc(std::size_t size, std::size_t alignment) {
+  ++allocation_count;
+  if (size == 0) {
+    size = 1;
+  }
+  void *ptr = nullptr;
+  if (alignment <= alignof(std::max_align_t)) {
+    ptr = std::malloc(size);
+  } else {
+    size = (size + alignment - 1) / alignment * alignment;
+    ptr = std::aligned_alloc(alignment, size);
+  }
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void counted_free(void *ptr) noexcept {
+  if (ptr != nullptr) {
+    ++deallocation_count;
+  }
+  std::free(ptr);
+}
+} // namespace
+
+allocation_counter::allocation_counter() noexcept
+    : _allocations(allocation_count), _deallocations(deallocation_count) {}
+
+std::size_t allocation_counter::allocations() const noexcept {
+  return allocation_count - _allocations;
+}
+
+std::size_t allocation_counter::deallocations() const noexcept {
+  return deallocation_count - _deallocations;
+}
+
+void *operator new(std::size_t size) {
+  return counted_alloc(size, alignof(std::max_align_t));
+}
+
+void *operator new[](std::size_t size) {
+  return counted_alloc(size, alignof(std::max_align_t));
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  return counted_alloc(size, static_cast<std::size_t>(alignment));
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+  return counted_alloc(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void *ptr) noexcept { counted_free(ptr); }
+
+void operator delete[](void *ptr) noexcept { counted_free(ptr); }
+
+void operator delete(void *ptr, std::size_t) noexcept { counted_free(ptr); }
+
+void operator delete[](void *ptr, std::size_t) noexcept { counted_free(ptr); }
+
+void operator delete(void *ptr, std::align_val_t) noexcept {
+  counted_free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept {
+  counted_free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept {
+  counted_free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept {
+  counted_free(ptr);
+}
@@ -0,0 +1,25 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cstddef>
+
+// Counts the calls to the global allocation functions made by the current
+// thread since construction. The replacement operators live in
+// allocation_counter.cpp.
+class allocation_counter {
+public:
+  allocation_counter() noexcept;
+
+  std::size_t allocations() const noexcept;
+
+  std::size_t deallocations() const noexcept;
+
+private:
+  std::size_t _allocations;
+  std::size_t _deallocations;
+};
@@ -0,0 +1,97 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "catch/catch.hpp"
+#include <experimental/audio>
+#include <numeric>
+#include <vector>
+
+using namespace std::experimental;
+
+namespace {
+template <typename SampleType> struct planar_storage {
+  planar_storage(size_t num_channels, size_t num_frames)
+      : samples(num_channels * num_frames), pointers(num_channels) {
+    for (size_t ch = 0; ch < num_channels; ++ch) {
+      pointers[ch] = samples.data() + ch * num_frames;
+    }
+  }
+
+  std::vector<SampleType> samples;
+  std::vector<SampleType *> pointers;
+};
+
+template <typename SampleType>
+void check_all_layouts(size_t num_channels, size_t num_frames) {
+  std::vector<SampleType> source(num_channels * num_frames);
+  std::iota(source.begin(), source.end(), SampleType(1));
+
+  std::vector<SampleType> interleaved(source.size());
+  planar_storage<SampleType> deinterleaved(num_channels, num_frames);
+  planar_storage<SampleType> ptr_to_ptr(num_channels, num_frames);
+
+  auto src = audio_buffer(source.data(), num_frames, num_channels,
+                          contiguous_interleaved);
+  auto to_deinterleaved =
+      audio_buffer(deinterleaved.samples.data(), num_frames, num_channels,
+                   contiguous_deinterleaved);
+  auto to_ptr_to_ptr = audio_buffer(ptr_to_ptr.pointers.data(), num_frames,
+                                    num_channels, ptr_to_ptr_deinterleaved);
+  auto to_interleaved = audio_buffer(interleaved.data(), num_frames,
+                                     num_channels, contiguous_interleaved);
+
+  CHECK(copy(src, to_deinterleaved) == num_frames);
+  CHECK(copy(to_deinterleaved, to_ptr_to_ptr) == num_frames);
+  CHECK(copy(to_ptr_to_ptr, to_interleaved) == num_frames);
+
+  for (size_t frame = 0; frame < num_frames; ++frame) {
+    for (size_t ch = 0; ch < num_channels; ++ch) {
+      REQUIRE(to_deinterleaved(ch, frame) == src(ch, frame));
+      REQUIRE(to_ptr_to_ptr(ch, frame) == src(ch, frame));
+    }
+  }
+  CHECK(interleaved == source);
+}
+} // namespace
+
+TEST_CASE("copy() converts between all buffer layouts") {
+  for (size_t num_channels : {1, 2, 3, 4, 5, 6, 7, 8, 9}) {
+    for (size_t num_frames : {0, 1, 3, 4, 7, 8, 17, 64}) {
+      check_all_layouts<float>(num_channels, num_frames);
+      check_all_layouts<int16_t>(num_channels, num_frames);
+    }
+  }
+}
+
+TEST_CASE("copy() between layout-specialized buffers") {
+  std::array<float, 8> interleaved = {0, 4, 1, 5, 2, 6, 3, 7};
+  std::array<float, 8> planar{};
+
+  audio_buffer<float, contiguous_interleaved_t> src(interleaved.data(), 4, 2);
+  audio_buffer<float, contiguous_deinterleaved_t> dst(planar.data(), 4, 2);
+  CHECK(copy(src, dst) == 4);
+  CHECK(planar == std::array<float, 8>{0, 1, 2, 3, 4, 5, 6, 7});
+}
+
+TEST_CASE("copy() copies the shorter of the two buffers") {
+  std::array<float, 6> source = {1, 2, 3, 4, 5, 6};
+  std::array<float, 4> destination{};
+
+  auto src = audio_buffer(source.data(), 3, 2, contiguous_interleaved);
+  auto dst = audio_buffer(destination.data(), 2, 2, contiguous_deinterleaved);
+  CHECK(copy(src, dst) == 2);
+  CHECK(destination == std::array<float, 4>{1, 3, 2, 4});
+}
+
+TEST_CASE("copy() with frame offsets copies a sub-range between layouts") {
+  std::array<int, 8> interleaved = {0, 10, 1, 11, 2, 12, 3, 13};
+  std::array<int, 6> planar{};
+  audio_buffer<int, contiguous_interleaved_t> src(interleaved.data(), 4, 2);
+  audio_buffer<int, contiguous_deinterleaved_t> dst(planar.data(), 3, 2);
+
+  CHECK(copy(src, 1, dst, 1, 5) == 2);
+  CHECK(planar == std::array<int, 6>{0, 1, 2, 0, 11, 12});
+}
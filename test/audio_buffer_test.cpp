@@ -4,6 +4,7 @@
 // (See accompanying file LICENSE.md or copy at
 // http://boost.org/LICENSE_1_0.txt)
 
+#include "allocation_counter.h"
 #include "catch/catch.hpp"
 #include <experimental/audio>
 
@@ -170,3 +171,86 @@ TEST_CASE("Deinterleaved pointer-to-pointer  buffer") {
     CHECK(right == std::array<float, 3>{9, 10, 11});
   }
 }
+
+TEST_CASE("Layout-specialized buffers") {
+  std::array<float, 6> data = {0, 1, 2, 3, 4, 5};
+
+  SECTION("Interleaved element access") {
+    audio_buffer<float, contiguous_interleaved_t> buffer(data.data(), 3, 2);
+    static_assert(buffer.frames_are_contiguous());
+    CHECK(buffer.size_frames() == 3);
+    CHECK(buffer.size_channels() == 2);
+    CHECK(buffer(0, 1) == 2);
+    CHECK(buffer(1, 2) == 5);
+  }
+
+  SECTION("Deinterleaved element access") {
+    audio_buffer<float, contiguous_deinterleaved_t> buffer(data.data(), 3, 2);
+    static_assert(buffer.channels_are_contiguous());
+    CHECK(buffer(0, 1) == 1);
+    CHECK(buffer(1, 2) == 5);
+    CHECK(buffer.channel(1).data() == data.data() + 3);
+  }
+
+  SECTION("Pointer-to-pointer element access") {
+    std::array<float *, 2> channels = {data.data(), data.data() + 3};
+    audio_buffer<float, ptr_to_ptr_deinterleaved_t> buffer(channels.data(), 3,
+                                                           2);
+    CHECK(buffer(0, 1) == 1);
+    CHECK(buffer(1, 2) == 5);
+    CHECK(buffer.channel(1).size() == 3);
+  }
+}
+
+TEST_CASE("visit() resolves the layout of a type-erased buffer") {
+  std::array<float, 6> data = {0, 1, 2, 3, 4, 5};
+
+  auto interleaved = audio_buffer(data.data(), 3, 2, contiguous_interleaved);
+  CHECK(interleaved.holds_layout<contiguous_interleaved_t>());
+  interleaved.visit([](auto &buffer) {
+    using layout = typename std::decay_t<decltype(buffer)>::layout_type;
+    CHECK(std::is_same_v<layout, contiguous_interleaved_t>);
+    buffer(1, 0) = 10;
+  });
+  CHECK(data[1] == 10);
+
+  auto deinterleaved =
+      audio_buffer(data.data(), 3, 2, contiguous_deinterleaved);
+  CHECK(deinterleaved.holds_layout<contiguous_deinterleaved_t>());
+  const auto &cbuffer = deinterleaved;
+  CHECK(cbuffer.visit([](const auto &buffer) { return buffer(1, 0); }) == 3);
+
+  audio_buffer<float> converted =
+      audio_buffer<float, contiguous_deinterleaved_t>(data.data(), 3, 2);
+  CHECK(converted.channels_are_contiguous());
+  CHECK(converted(0, 1) == 10);
+}
+
+TEST_CASE("Pointer-to-pointer buffers never touch the allocator") {
+  std::array<std::array<float, 4>, 8> channels{};
+  std::array<float *, 8> data;
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = channels[i].data();
+  }
+
+  allocation_counter counter;
+  {
+    auto buffer = audio_buffer(data.data(), 4, 8, ptr_to_ptr_deinterleaved);
+    auto copy = buffer;
+    copy(7, 3) = 1;
+
+    audio_device_io<float> io;
+    io.output_buffer = copy;
+    auto io_copy = io;
+    (*io_copy.output_buffer)(0, 0) = 2;
+  }
+  CHECK(counter.allocations() == 0);
+  CHECK(channels[7][3] == 1);
+  CHECK(channels[0][0] == 2);
+}
+
+TEST_CASE("Pointer-to-pointer buffers reject more than AUDIO_MAX_CHANNELS") {
+  std::array<float *, AUDIO_MAX_CHANNELS + 1> data{};
+  CHECK_THROWS(audio_buffer(data.data(), 0, data.size(),
+                            ptr_to_ptr_deinterleaved));
+}
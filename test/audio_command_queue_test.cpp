@@ -0,0 +1,245 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "allocation_counter.h"
+#include "catch/catch.hpp"
+#include <array>
+#include <atomic>
+#include <experimental/audio>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std::experimental;
+
+namespace {
+
+// Counts the live instances and where the last one was destroyed.
+struct tracked {
+  static inline std::atomic<int> alive{0};
+  static inline std::atomic<std::thread::id> destroyed_on{};
+
+  explicit tracked(float gain) : gain(gain) { ++alive; }
+
+  ~tracked() {
+    destroyed_on = std::this_thread::get_id();
+    --alive;
+  }
+
+  float gain;
+};
+
+// A callback owning its state, which commands replace. What the garbage
+// collector can't take yet waits in unretired, reserved up front.
+struct gain_callback {
+  audio_garbage_collector *garbage;
+  std::unique_ptr<tracked> state;
+  std::vector<std::unique_ptr<tracked>> unretired;
+
+  void operator()(std::unique_ptr<tracked> &&next) noexcept {
+    auto previous = std::exchange(state, std::move(next));
+    if (!garbage->retire(std::move(previous))) {
+      unretired.push_back(std::move(previous));
+    }
+  }
+
+  void retry_retire() noexcept {
+    while (!unretired.empty() &&
+           garbage->retire(std::move(unretired.back()))) {
+      unretired.pop_back();
+    }
+  }
+
+  template <typename Device>
+  void operator()(Device &, audio_device_io<float> &io) noexcept {
+    auto &out = *io.output_buffer;
+    for (std::size_t frame = 0; frame < out.size_frames(); ++frame) {
+      out(0, frame) = state->gain;
+    }
+  }
+};
+
+} // namespace
+
+TEST_CASE("audio_command_queue rounds its capacity up to a power of two") {
+  audio_command_queue<int> queue(5);
+  CHECK(queue.capacity() == 8);
+  CHECK(queue.size() == 0);
+}
+
+TEST_CASE("audio_command_queue drains in push order and fails when full") {
+  audio_command_queue<std::unique_ptr<int>> queue(4);
+  for (int i = 0; i < 4; ++i) {
+    REQUIRE(queue.try_push(std::make_unique<int>(i)));
+  }
+  auto rejected = std::make_unique<int>(4);
+  CHECK_FALSE(queue.try_push(std::move(rejected)));
+  REQUIRE(rejected != nullptr);
+
+  std::vector<int> drained;
+  CHECK(queue.drain([&](std::unique_ptr<int> &&command) noexcept {
+    drained.push_back(*command);
+  }) == 4);
+  CHECK(drained == std::vector<int>{0, 1, 2, 3});
+  CHECK(queue.size() == 0);
+
+  // The cells are reused one lap later.
+  CHECK(queue.try_push(std::move(rejected)));
+  CHECK(queue.size() == 1);
+}
+
+TEST_CASE("audio_command_queue keeps every producer's order under stress") {
+  constexpr int producers = 4;
+  constexpr int per_producer = 100000;
+  audio_command_queue<std::pair<int, int>> queue(64);
+
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&queue, p] {
+      for (int i = 0; i < per_producer;) {
+        if (queue.try_push(std::pair{p, i})) {
+          ++i;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  std::array<int, producers> next{};
+  bool in_order = true;
+  int received = 0;
+  while (received < producers * per_producer) {
+    received += int(queue.drain([&](std::pair<int, int> &&command) noexcept {
+      in_order = in_order && command.second == next[command.first]++;
+    }));
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  CHECK(in_order);
+  CHECK(next == std::array<int, producers>{per_producer, per_producer,
+                                            per_producer, per_producer});
+  CHECK(queue.size() == 0);
+}
+
+TEST_CASE("audio_garbage_collector destroys off the retiring thread") {
+  audio_garbage_collector garbage(8, std::chrono::milliseconds(1));
+  CHECK(garbage.capacity() == 8);
+  const std::thread::id test_thread = std::this_thread::get_id();
+  {
+    auto object = std::make_unique<tracked>(1.0f);
+    std::size_t deallocations;
+    {
+      allocation_counter counter;
+      REQUIRE(garbage.retire(std::move(object)));
+      deallocations = counter.deallocations();
+    }
+    CHECK(deallocations == 0);
+    CHECK(object == nullptr);
+  }
+  while (garbage.collected() == 0) {
+    std::this_thread::yield();
+  }
+  CHECK(tracked::alive == 0);
+  CHECK(tracked::destroyed_on.load() != test_thread);
+
+  std::unique_ptr<tracked> empty;
+  CHECK(garbage.retire(std::move(empty)));
+  CHECK(garbage.collected() == 1);
+}
+
+TEST_CASE("audio_garbage_collector keeps what it can't queue") {
+  auto garbage = std::make_unique<audio_garbage_collector>(
+      2, std::chrono::hours(1));
+  REQUIRE(garbage->retire(std::make_unique<tracked>(1.0f)));
+  REQUIRE(garbage->retire(std::make_unique<tracked>(2.0f)));
+  auto third = std::make_unique<tracked>(3.0f);
+  CHECK_FALSE(garbage->retire(std::move(third)));
+  REQUIRE(third != nullptr);
+  CHECK(garbage->pending() == 2);
+  CHECK(tracked::alive == 3);
+
+  CHECK(garbage->collect() == 2);
+  CHECK(tracked::alive == 1);
+  REQUIRE(garbage->retire(std::move(third)));
+  garbage.reset();
+  CHECK(tracked::alive == 0);
+}
+
+TEST_CASE("command_io applies commands before each period") {
+  struct fake_device {};
+  fake_device device;
+  audio_garbage_collector garbage(16, std::chrono::milliseconds(1));
+  audio_command_queue<std::unique_ptr<tracked>> commands(16);
+  gain_callback gain{&garbage, std::make_unique<tracked>(0.5f), {}};
+  gain.unretired.reserve(2);
+  auto callback = make_command_io<float>(commands, std::move(gain));
+
+  std::array<float, 4> samples{};
+  audio_device_io<float> io;
+  io.output_buffer = audio_buffer<float>(samples.data(), 4, 1,
+                                         contiguous_interleaved);
+  callback(device, io);
+  CHECK(samples == std::array<float, 4>{0.5f, 0.5f, 0.5f, 0.5f});
+
+  REQUIRE(commands.try_push(std::make_unique<tracked>(0.25f)));
+  REQUIRE(commands.try_push(std::make_unique<tracked>(0.75f)));
+  std::size_t allocations, deallocations;
+  {
+    allocation_counter counter;
+    callback(device, io);
+    allocations = counter.allocations();
+    deallocations = counter.deallocations();
+  }
+  CHECK(allocations == 0);
+  CHECK(deallocations == 0);
+  CHECK(samples == std::array<float, 4>{0.75f, 0.75f, 0.75f, 0.75f});
+  CHECK(commands.size() == 0);
+
+  garbage.collect();
+  CHECK(tracked::alive == 1);
+  CHECK(callback.callback().unretired.empty());
+}
+
+TEST_CASE("Swapping state through a device callback leaks nothing") {
+  constexpr int swaps = 20000;
+  struct fake_device {};
+  {
+    audio_garbage_collector garbage(64, std::chrono::milliseconds(1));
+    audio_command_queue<std::unique_ptr<tracked>> commands(32);
+    gain_callback gain{&garbage, std::make_unique<tracked>(0.0f), {}};
+    gain.unretired.reserve(swaps);
+    auto callback = make_command_io<float>(commands, std::move(gain));
+
+    std::thread control([&commands] {
+      for (int i = 1; i <= swaps; ++i) {
+        auto next = std::make_unique<tracked>(float(i));
+        while (!commands.try_push(std::move(next))) {
+          std::this_thread::yield();
+        }
+      }
+    });
+
+    fake_device device;
+    std::array<float, 8> samples{};
+    audio_device_io<float> io;
+    io.output_buffer = audio_buffer<float>(samples.data(), 8, 1,
+                                           contiguous_interleaved);
+    float last = 0.0f;
+    bool increasing = true;
+    while (samples[0] != float(swaps)) {
+      callback.callback().retry_retire();
+      callback(device, io);
+      increasing = increasing && samples[0] >= last;
+      last = samples[0];
+    }
+    control.join();
+    CHECK(increasing);
+  }
+  CHECK(tracked::alive == 0);
+}
@@ -0,0 +1,62 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "catch/catch.hpp"
+#include <experimental/audio>
+
+using namespace std::experimental;
+
+TEST_CASE("xrun_counters count each kind of xrun and the last time") {
+  detail::xrun_counters counters;
+  CHECK_FALSE(counters.snapshot().last_xrun_time.has_value());
+
+  auto now = audio_clock_t::now();
+  counters.underrun(now);
+  counters.underrun(now + std::chrono::milliseconds(1));
+  counters.overrun(now + std::chrono::milliseconds(2));
+  counters.late_callback(now + std::chrono::milliseconds(3));
+
+  audio_device_stats stats = counters.snapshot();
+  CHECK(stats.underruns == 2);
+  CHECK(stats.overruns == 1);
+  CHECK(stats.late_callbacks == 1);
+  CHECK(stats.last_xrun_time == now + std::chrono::milliseconds(3));
+
+  counters.reset();
+  CHECK(counters.snapshot().underruns == 0);
+  CHECK_FALSE(counters.snapshot().last_xrun_time.has_value());
+}
+
+TEST_CASE("audio_device_stats add up and keep the latest xrun time") {
+  auto now = audio_clock_t::now();
+  audio_device_stats a, b;
+  a.underruns = 1;
+  a.overruns = 2;
+  a.late_callbacks = 3;
+  a.last_xrun_time = now;
+  b.underruns = 10;
+  b.overruns = 20;
+  b.late_callbacks = 30;
+  b.last_xrun_time = now + std::chrono::seconds(1);
+  a += b;
+  CHECK(a.underruns == 11);
+  CHECK(a.overruns == 22);
+  CHECK(a.late_callbacks == 33);
+  CHECK(a.last_xrun_time == now + std::chrono::seconds(1));
+
+  a += audio_device_stats{};
+  CHECK(a.last_xrun_time == now + std::chrono::seconds(1));
+}
+
+TEST_CASE("device_clock reports how late a tick came") {
+  detail::device_clock clock;
+  clock.reset(48000, 480);
+  auto now = audio_clock_t::now();
+  clock.tick(now, 480);
+  CHECK(clock.lateness() == std::chrono::nanoseconds(0));
+  clock.tick(now + std::chrono::milliseconds(30), 480);
+  CHECK(clock.lateness() == std::chrono::milliseconds(20));
+}
@@ -4,8 +4,10 @@
 // (See accompanying file LICENSE.md or copy at
 // http://boost.org/LICENSE_1_0.txt)
 
+#include "allocation_counter.h"
 #include "catch/catch.hpp"
 #include <experimental/audio>
+#include <memory>
 #include <set>
 #include <thread>
 
@@ -391,3 +393,179 @@ TEST_CASE("Register default output device change callback") {
   set_audio_device_list_callback(
       audio_device_list_event::default_output_device_changed, cb);
 }
+
+TEST_CASE("Steady-state pull mode capture does not allocate") {
+  auto devices = get_audio_input_device_list();
+  for (auto &device : devices) {
+    device.set_sample_type<float>();
+    if (!device.start()) {
+      continue;
+    }
+    auto callback = [](audio_device &, audio_device_io<float> &) noexcept {};
+
+    device.wait();
+    device.process<float>(callback);
+
+    allocation_counter counter;
+    for (int i = 0; i < 16; ++i) {
+      device.wait();
+      device.process<float>(callback);
+    }
+    CHECK(counter.allocations() == 0);
+    device.stop();
+  }
+}
+
+TEST_CASE("Steady-state pull mode playback does not allocate") {
+  auto devices = get_audio_output_device_list();
+  for (auto &device : devices) {
+    device.set_sample_type<float>();
+    if (!device.start()) {
+      continue;
+    }
+    auto callback = [](audio_device &, audio_device_io<float> &) noexcept {};
+
+    device.wait();
+    device.process<float>(callback);
+
+    allocation_counter counter;
+    for (int i = 0; i < 16; ++i) {
+      device.wait();
+      device.process<float>(callback);
+    }
+    CHECK(counter.allocations() == 0);
+    device.stop();
+  }
+}
+
+TEST_CASE("Pull mode wait() returns once a period of input is available") {
+  auto devices = get_audio_input_device_list();
+  for (auto &device : devices) {
+    device.set_sample_type<float>();
+    if (!device.start()) {
+      continue;
+    }
+    CHECK(device.wait(std::chrono::seconds(5)));
+    CHECK(device.has_unprocessed_io());
+    device.stop();
+  }
+}
+
+TEST_CASE("Pull mode timestamps and sample positions advance per period") {
+  auto devices = get_audio_output_device_list();
+  for (auto &device : devices) {
+    device.set_sample_type<float>();
+    if (!device.start()) {
+      continue;
+    }
+    std::vector<std::uint64_t> positions;
+    std::vector<audio_clock_t::time_point> times;
+    positions.reserve(8);
+    times.reserve(8);
+    for (int i = 0; i < 8; ++i) {
+      device.wait();
+      device.process<float>(
+          [&](audio_device &, audio_device_io<float> &io) noexcept {
+            positions.push_back(io.sample_position);
+            times.push_back(*io.output_time);
+          });
+    }
+    device.stop();
+
+    for (std::size_t i = 1; i < positions.size(); ++i) {
+      CHECK(positions[i] >= positions[i - 1] + device.get_buffer_size_frames());
+      CHECK(times[i] > times[i - 1]);
+    }
+  }
+}
+
+TEST_CASE("Duplex device delivers input and output in one callback") {
+  auto duplex = get_default_audio_duplex_device();
+  if (!duplex.has_value()) {
+    return;
+  }
+  std::atomic<int> paired_calls{0};
+  duplex->connect<float>(
+      [&](audio_device &, audio_device_io<float> &io) noexcept {
+        if (io.input_buffer.has_value() && io.output_buffer.has_value() &&
+            io.input_buffer->size_frames() == io.output_buffer->size_frames() &&
+            io.input_time.has_value() && io.output_time.has_value()) {
+          ++paired_calls;
+        }
+      });
+  REQUIRE(duplex->start());
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (paired_calls < 32 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  auto latency = duplex->get_latency();
+  duplex->stop();
+
+  CHECK(paired_calls >= 32);
+  // Two device periods plus at most kMaxBufferedPeriods in the ring.
+  auto period = std::chrono::nanoseconds(
+      std::int64_t(duplex->get_buffer_size_frames()) * 1000000000 /
+      duplex->get_sample_rate());
+#if !defined(AUDIO_USE_OFFLINE)
+  CHECK(latency > std::chrono::nanoseconds(0));
+#endif
+  CHECK(latency <= 5 * period);
+}
+
+TEST_CASE("Duplex device copies a callback passed as an lvalue") {
+  auto duplex = get_default_audio_duplex_device();
+  if (!duplex.has_value()) {
+    return;
+  }
+  auto token = std::make_shared<int>(0);
+  auto callback = [token](audio_device &, audio_device_io<float> &) noexcept {};
+  duplex->connect<float>(callback);
+  // Held by token, callback and the connected copy.
+  CHECK(token.use_count() == 3);
+}
+
+// Offline devices render on demand and never fall behind.
+#if !defined(AUDIO_USE_OFFLINE)
+
+TEST_CASE("Pull mode capture counts overruns when process() falls behind") {
+  auto devices = get_audio_input_device_list();
+  for (auto &device : devices) {
+    device.set_sample_type<float>();
+    if (!device.start()) {
+      continue;
+    }
+    CHECK(device.stats().overruns == 0);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (device.stats().overruns == 0 &&
+           std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    auto stats = device.stats();
+    device.stop();
+    CHECK(stats.overruns > 0);
+    CHECK(stats.last_xrun_time.has_value());
+  }
+}
+
+TEST_CASE("Pull mode playback counts underruns once output is starved") {
+  auto devices = get_audio_output_device_list();
+  for (auto &device : devices) {
+    device.set_sample_type<float>();
+    if (!device.start()) {
+      continue;
+    }
+    device.process<float>(
+        [](audio_device &, audio_device_io<float> &) noexcept {});
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (device.stats().underruns == 0 &&
+           std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    auto stats = device.stats();
+    device.stop();
+    CHECK(stats.underruns > 0);
+    CHECK(stats.overruns == 0);
+  }
+}
+
+#endif // !AUDIO_USE_OFFLINE
@@ -0,0 +1,159 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "catch/catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <experimental/audio>
+#include <semaphore>
+#include <stdexcept>
+#include <vector>
+
+using namespace std::experimental;
+
+namespace {
+
+// Coroutine that starts right away and nobody waits for.
+struct detached {
+  struct promise_type {
+    detached get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+// Resumes posted coroutines on the thread calling run_until().
+struct test_executor {
+  std::atomic<void *> posted{nullptr};
+  std::counting_semaphore<> ready{0};
+
+  void post(std::coroutine_handle<> handle) noexcept {
+    posted.store(handle.address(), std::memory_order_release);
+    ready.release();
+  }
+
+  // Return false if done wasn't set within a few seconds.
+  bool run_until(const std::atomic<bool> &done) {
+    while (!done.load()) {
+      if (!ready.try_acquire_for(std::chrono::seconds(5))) {
+        return false;
+      }
+      std::coroutine_handle<>::from_address(posted.exchange(nullptr))
+          .resume();
+    }
+    return true;
+  }
+};
+
+detached render(audio_device &device, test_executor &executor, int periods,
+                std::vector<std::uint64_t> &positions,
+                std::atomic<bool> &done) {
+  for (int i = 0; i < periods; ++i) {
+    auto lease = co_await device.next_io<float>(executor);
+    auto &io = lease.io();
+    auto &buffer = io.output_buffer ? *io.output_buffer : *io.input_buffer;
+    positions.push_back(io.sample_position);
+    if (io.output_buffer) {
+      for (std::size_t frame = 0; frame < buffer.size_frames(); ++frame) {
+        buffer(0, frame) = 0.25f;
+      }
+    }
+  }
+  done = true;
+}
+
+// 480 frames don't divide the queue, so some periods wrap around its end
+// and are copied.
+void check_periods(audio_device_list &devices) {
+  for (auto &device : devices) {
+    device.set_sample_type<float>();
+    device.set_buffer_size_frames(480);
+    if (!device.start()) {
+      continue;
+    }
+    test_executor executor;
+    std::vector<std::uint64_t> positions;
+    std::atomic<bool> done{false};
+    render(device, executor, 16, positions, done);
+    CHECK(executor.run_until(done));
+    device.stop();
+
+    REQUIRE(positions.size() == 16);
+    for (std::size_t i = 1; i < positions.size(); ++i) {
+      CHECK(positions[i] >= positions[i - 1] + device.get_buffer_size_frames());
+    }
+  }
+}
+
+} // namespace
+
+TEST_CASE("next_io() resumes a coroutine for every output period") {
+  auto devices = get_audio_output_device_list();
+  check_periods(devices);
+}
+
+TEST_CASE("next_io() resumes a coroutine for every input period") {
+  auto devices = get_audio_input_device_list();
+  check_periods(devices);
+}
+
+TEST_CASE("next_io() requires a running device") {
+  auto devices = get_audio_output_device_list();
+  for (auto &device : devices) {
+    test_executor executor;
+    CHECK_THROWS_AS(device.next_io<float>(executor), std::runtime_error);
+  }
+}
+
+// Offline devices are always ready, a coroutine never waits for them.
+#if !defined(AUDIO_USE_OFFLINE)
+
+namespace {
+
+detached until_stopped(audio_device &device, test_executor &executor,
+                       std::atomic<int> &periods, std::atomic<bool> &done) {
+  try {
+    while (true) {
+      auto lease = co_await device.next_io<float>(executor);
+      ++periods;
+    }
+  } catch (const std::runtime_error &) {
+  }
+  done = true;
+}
+
+} // namespace
+
+TEST_CASE("stop() resumes a coroutine waiting in next_io()") {
+  auto devices = get_audio_input_device_list();
+  for (auto &device : devices) {
+    device.set_sample_type<float>();
+    if (!device.start()) {
+      continue;
+    }
+    test_executor executor;
+    std::atomic<int> periods{0};
+    std::atomic<bool> done{false};
+    until_stopped(device, executor, periods, done);
+    // Between two resumptions, so the coroutine is suspended.
+    bool stopped = false;
+    while (!done.load()) {
+      if (periods.load() >= 4 && !stopped) {
+        stopped = device.stop();
+      }
+      REQUIRE(executor.ready.try_acquire_for(std::chrono::seconds(5)));
+      std::coroutine_handle<>::from_address(executor.posted.exchange(nullptr))
+          .resume();
+    }
+    CHECK(periods.load() >= 4);
+  }
+}
+
+#endif
@@ -0,0 +1,115 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "catch/catch.hpp"
+#include <experimental/audio>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+using namespace std::experimental;
+
+TEST_CASE("spsc_ring rounds its capacity up to a power of two") {
+  detail::spsc_ring<int> ring(5);
+  CHECK(ring.capacity() == 8);
+  CHECK(ring.read_available() == 0);
+  CHECK(ring.write_available() == 8);
+}
+
+TEST_CASE("spsc_ring wraps around in two regions") {
+  detail::spsc_ring<int> ring(4);
+  std::array<int, 4> in = {1, 2, 3, 4};
+  std::array<int, 4> out{};
+
+  CHECK(ring.write(in.data(), 3) == 3);
+  CHECK(ring.read(out.data(), 2) == 2);
+  CHECK(ring.write(in.data(), 4) == 3);
+  CHECK(ring.write_available() == 0);
+
+  auto regions = ring.read_regions();
+  CHECK(regions.first.size() == 2);
+  CHECK(regions.second.size() == 2);
+
+  CHECK(ring.read(out.data(), 4) == 4);
+  CHECK(out == std::array<int, 4>{3, 1, 2, 3});
+  CHECK(ring.read_available() == 0);
+}
+
+TEST_CASE("spsc_ring keeps order across threads") {
+  constexpr int count = 200000;
+  detail::spsc_ring<int> ring(64);
+
+  std::thread producer([&ring] {
+    std::array<int, 7> chunk;
+    for (int next = 0; next < count;) {
+      int size = std::min<int>(chunk.size(), count - next);
+      std::iota(chunk.begin(), chunk.begin() + size, next);
+      next += ring.write(chunk.data(), size);
+    }
+  });
+
+  bool in_order = true;
+  std::array<int, 5> chunk;
+  for (int expected = 0; expected < count;) {
+    auto size = ring.read(chunk.data(), chunk.size());
+    for (size_t i = 0; i < size; ++i) {
+      in_order = in_order && chunk[i] == expected++;
+    }
+  }
+  producer.join();
+  CHECK(in_order);
+}
+
+TEST_CASE("audio_ring_buffer hands out frames as two interleaved views") {
+  audio_ring_buffer<float> ring(3, 2);
+  CHECK(ring.capacity_frames() == 4);
+  CHECK(ring.size_channels() == 2);
+
+  std::array<float, 6> planar = {0, 1, 2, 10, 11, 12};
+  audio_buffer<float, contiguous_deinterleaved_t> src(planar.data(), 3, 2);
+  CHECK(ring.write(src) == 3);
+  CHECK(ring.frames_readable() == 3);
+
+  ring.commit_read(2);
+  CHECK(ring.write(src) == 3);
+  CHECK(ring.frames_writable() == 0);
+
+  auto views = ring.read_views();
+  CHECK(views.first.size_frames() == 2);
+  CHECK(views.second.size_frames() == 2);
+  CHECK(views.first(0, 0) == 2);
+  CHECK(views.first(1, 0) == 12);
+  CHECK(views.second(0, 0) == 1);
+  CHECK(views.second(1, 0) == 11);
+
+  std::array<float, 8> out{};
+  audio_buffer<float> dst(out.data(), 4, 2, contiguous_deinterleaved);
+  CHECK(ring.read(dst) == 4);
+  CHECK(out == std::array<float, 8>{2, 0, 1, 2, 12, 10, 11, 12});
+  CHECK(ring.frames_readable() == 0);
+}
+
+TEST_CASE("audio_ring_buffer_io moves device audio through the ring") {
+  struct fake_device {};
+  fake_device device;
+  audio_ring_buffer<int16_t> ring(8, 2);
+  audio_ring_buffer_io<int16_t> callback(ring);
+
+  std::array<int16_t, 6> captured = {1, 2, 3, 4, 5, 6};
+  audio_device_io<int16_t> input_io;
+  input_io.input_buffer = audio_buffer<int16_t>(captured.data(), 3, 2,
+                                                contiguous_interleaved);
+  callback(device, input_io);
+  CHECK(ring.frames_readable() == 3);
+
+  std::array<int16_t, 8> played;
+  played.fill(-1);
+  audio_device_io<int16_t> output_io;
+  output_io.output_buffer =
+      audio_buffer<int16_t>(played.data(), 4, 2, contiguous_interleaved);
+  callback(device, output_io);
+  CHECK(played == std::array<int16_t, 8>{1, 2, 3, 4, 5, 6, 0, 0});
+}
@@ -0,0 +1,89 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "catch/catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <experimental/audio>
+#include <thread>
+
+using namespace std::experimental;
+
+TEST_CASE("log_histogram buckets are within an eighth of an octave") {
+  for (std::uint64_t value : {0ull, 1ull, 7ull, 8ull, 15ull, 16ull, 17ull,
+                              1000ull, 123456ull, 5000000000ull}) {
+    auto index = detail::log_histogram::bucket(value);
+    auto limit = detail::log_histogram::bucket_limit(index);
+    CHECK(value <= limit);
+    CHECK(double(limit - value) <= double(value) / 8);
+    if (index > 0) {
+      CHECK(detail::log_histogram::bucket_limit(index - 1) < value);
+    }
+  }
+}
+
+TEST_CASE("log_histogram reports percentiles and the exact max") {
+  detail::log_histogram histogram;
+  for (int i = 1; i <= 1000; ++i) {
+    histogram.record(i * 1000);
+  }
+  auto percentiles = histogram.snapshot();
+  CHECK(percentiles.p50.count() == Approx(500000).epsilon(0.125));
+  CHECK(percentiles.p99.count() == Approx(990000).epsilon(0.125));
+  CHECK(percentiles.p999.count() == Approx(999000).epsilon(0.125));
+  CHECK(percentiles.max == std::chrono::microseconds(1000));
+
+  histogram.reset();
+  CHECK(histogram.snapshot().p99 == std::chrono::nanoseconds(0));
+}
+
+TEST_CASE("callback_profiler measures load and jitter") {
+  detail::callback_profiler profiler;
+  profiler.reset(48000);
+  auto entered = audio_clock_t::now();
+  for (int i = 0; i < 100; ++i) {
+    // 480 frames are 10ms of audio, each callback takes 2.5ms and every
+    // other one is entered 1ms late.
+    auto jitter = std::chrono::milliseconds(i % 2);
+    profiler.record(entered + jitter,
+                    entered + jitter + std::chrono::microseconds(2500), 480);
+    entered += std::chrono::milliseconds(10);
+  }
+  auto profile = profiler.snapshot();
+  if constexpr (detail::callback_profiler::enabled) {
+    CHECK(profile.callbacks == 100);
+    CHECK(profile.dsp_load_percent == Approx(25));
+    CHECK(profile.callback_time.max == std::chrono::microseconds(2500));
+    CHECK(profile.jitter.p99.count() == Approx(1000000).epsilon(0.125));
+  } else {
+    CHECK(profile.callbacks == 0);
+  }
+}
+
+TEST_CASE("Devices profile their connected callback") {
+  auto device = get_default_audio_output_device();
+  if (!device.has_value()) {
+    return;
+  }
+  std::atomic<int> calls{0};
+  device->connect<float>(
+      [&](audio_device &, audio_device_io<float> &) noexcept { ++calls; });
+  REQUIRE(device->start());
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (calls < 5 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  auto profile = device->profile();
+  device->stop();
+  REQUIRE(calls >= 5);
+  if constexpr (detail::callback_profiler::enabled) {
+    // A callback is recorded once it returned.
+    CHECK(profile.callbacks >= 4);
+    CHECK(profile.callback_time.max > std::chrono::nanoseconds(0));
+  } else {
+    CHECK(profile.callbacks == 0);
+  }
+}
@@ -0,0 +1,237 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "allocation_counter.h"
+#include "catch/catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <experimental/__p1386/callback_swap.h>
+#include <experimental/audio>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std::experimental;
+
+namespace {
+
+struct fake_device {};
+
+using function = std::function<void(fake_device &, audio_device_io<float> &)>;
+
+// Fills the output with value and records the thread that destroys it.
+struct constant {
+  float value;
+  std::shared_ptr<std::thread::id> destroyed_on;
+
+  constant(float value, std::shared_ptr<std::thread::id> destroyed_on)
+      : value(value), destroyed_on(std::move(destroyed_on)) {}
+  constant(const constant &) = default;
+  constant(constant &&other) noexcept = default;
+
+  ~constant() {
+    // Only the last copy, the one the swap owns, reports.
+    if (destroyed_on && destroyed_on.use_count() == 2) {
+      *destroyed_on = std::this_thread::get_id();
+    }
+  }
+
+  void operator()(fake_device &, audio_device_io<float> &io) noexcept {
+    auto &out = *io.output_buffer;
+    for (std::size_t frame = 0; frame < out.size_frames(); ++frame) {
+      for (std::size_t ch = 0; ch < out.size_channels(); ++ch) {
+        out(ch, frame) = value;
+      }
+    }
+  }
+};
+
+// connect()ed with a constant, replaced by functions.
+using swap_type = detail::connected_callback<float, function, constant>;
+
+// Runs a swap for callbacks of 64 stereo frames.
+struct harness {
+  fake_device device;
+  std::vector<float> samples = std::vector<float>(2 * 64);
+
+  // First sample of the first channel after one callback.
+  float run(swap_type &swap) noexcept {
+    audio_device_io<float> io;
+    io.output_buffer.emplace(samples.data(), 64, 2, contiguous_interleaved);
+    swap(device, io);
+    return samples[0];
+  }
+
+  float left(std::size_t frame) const noexcept { return samples[2 * frame]; }
+};
+
+} // namespace
+
+TEST_CASE("callback_swap replaces the callback at the next callback") {
+  auto old_destroyed = std::make_shared<std::thread::id>();
+  swap_type swap(constant(1.0f, old_destroyed), 2);
+  harness h;
+  CHECK(h.run(swap) == 1.0f);
+
+  swap.post(std::make_unique<function>(constant(2.0f, nullptr)), 0, 64);
+  allocation_counter counter;
+  const float output = h.run(swap);
+  CHECK(counter.allocations() == 0);
+  CHECK(counter.deallocations() == 0);
+  CHECK(output == 2.0f);
+  CHECK(swap.wait(std::chrono::seconds(0)));
+  CHECK(*old_destroyed == std::thread::id());
+  swap.collect();
+  CHECK(*old_destroyed == std::this_thread::get_id());
+}
+
+TEST_CASE("callback_swap crossfades linearly") {
+  swap_type swap(constant(0.0f, nullptr), 2);
+  swap.post(std::make_unique<function>(constant(1.0f, nullptr)), 128, 64);
+
+  harness first, second;
+  allocation_counter counter;
+  first.run(swap);
+  CHECK_FALSE(swap.wait(std::chrono::seconds(0)));
+  second.run(swap);
+  CHECK(counter.allocations() == 0);
+  CHECK(counter.deallocations() == 0);
+  CHECK(swap.wait(std::chrono::seconds(0)));
+  swap.collect();
+
+  for (std::size_t frame = 0; frame < 64; ++frame) {
+    CHECK(first.left(frame) == Approx(float(frame + 1) / 128));
+    CHECK(second.left(frame) == Approx(float(frame + 65) / 128));
+  }
+  CHECK(first.run(swap) == 1.0f);
+}
+
+TEST_CASE("callback_swap take_over() replaces without the audio thread") {
+  auto old_destroyed = std::make_shared<std::thread::id>();
+  swap_type swap(constant(1.0f, old_destroyed), 2);
+  swap.post(std::make_unique<function>(constant(2.0f, nullptr)), 64, 64);
+  CHECK_FALSE(swap.wait(std::chrono::milliseconds(1)));
+  swap.take_over();
+  swap.collect();
+  CHECK(*old_destroyed == std::this_thread::get_id());
+  harness h;
+  CHECK(h.run(swap) == 2.0f);
+}
+
+TEST_CASE("callback_swap keeps running after the connected callback is "
+          "collected") {
+  auto old_destroyed = std::make_shared<std::thread::id>();
+  swap_type swap(constant(1.0f, old_destroyed), 2);
+  harness h;
+  swap.post(std::make_unique<function>(constant(2.0f, nullptr)), 0, 64);
+  CHECK(h.run(swap) == 2.0f);
+  REQUIRE(swap.wait(std::chrono::seconds(0)));
+  swap.collect();
+  CHECK(*old_destroyed == std::this_thread::get_id());
+  for (int i = 0; i < 4; ++i) {
+    CHECK(h.run(swap) == 2.0f);
+  }
+}
+
+TEST_CASE("callback_swap rejects a replacement before collect()") {
+  swap_type swap(constant(1.0f, nullptr), 2);
+  harness h;
+  swap.post(std::make_unique<function>(constant(2.0f, nullptr)), 0, 64);
+  h.run(swap);
+  REQUIRE(swap.wait(std::chrono::seconds(0)));
+  CHECK_THROWS_AS(
+      swap.post(std::make_unique<function>(constant(3.0f, nullptr)), 0, 64),
+      std::runtime_error);
+  swap.collect();
+  swap.post(std::make_unique<function>(constant(3.0f, nullptr)), 0, 64);
+  CHECK(h.run(swap) == 3.0f);
+  REQUIRE(swap.wait(std::chrono::seconds(0)));
+  swap.collect();
+}
+
+TEST_CASE("callback_swap fades out of silence the old callback didn't "
+          "write") {
+  // Writes only the first frame.
+  auto first_frame = [](fake_device &, audio_device_io<float> &io) noexcept {
+    (*io.output_buffer)(0, 0) = 1.0f;
+    (*io.output_buffer)(1, 0) = 1.0f;
+  };
+  swap_type swap(constant(0.0f, nullptr), 2);
+  swap.post(std::make_unique<function>(constant(1.0f, nullptr)), 0, 64);
+  harness h;
+  h.run(swap);
+  REQUIRE(swap.wait(std::chrono::seconds(0)));
+  swap.collect();
+  // Leave ones in the scratch memory.
+  swap.post(std::make_unique<function>(first_frame), 128, 64);
+  h.run(swap);
+  h.run(swap);
+  REQUIRE(swap.wait(std::chrono::seconds(0)));
+  swap.collect();
+
+  swap.post(std::make_unique<function>(constant(0.0f, nullptr)), 128, 64);
+  h.run(swap);
+  // The outgoing callback's unwritten frames are silence.
+  CHECK(h.left(32) == 0.0f);
+  h.run(swap);
+  REQUIRE(swap.wait(std::chrono::seconds(0)));
+  swap.collect();
+}
+
+TEST_CASE("callback_swap hands over to a running audio thread") {
+  swap_type swap(constant(0.0f, nullptr), 2);
+  std::atomic<bool> done{false};
+  std::atomic<float> last{0.0f};
+  std::thread audio([&] {
+    harness h;
+    while (!done.load()) {
+      h.run(swap);
+      last.store(h.left(63));
+    }
+  });
+  for (int i = 1; i <= 100; ++i) {
+    swap.post(std::make_unique<function>(constant(float(i), nullptr)),
+              i % 2 ? 0 : 256, 64);
+    REQUIRE(swap.wait(std::chrono::seconds(5)));
+    swap.collect();
+  }
+  done = true;
+  audio.join();
+  CHECK(last.load() == 100.0f);
+}
+
+#if defined(AUDIO_USE_SDL3)
+
+TEST_CASE("SDL devices replace their callback while running") {
+  auto device = get_default_audio_output_device();
+  REQUIRE(device.has_value());
+  std::atomic<int> old_calls{0};
+  std::atomic<int> new_calls{0};
+  device->connect<float>(
+      [&](audio_device &, audio_device_io<float> &) noexcept { ++old_calls; });
+  REQUIRE(device->start());
+  while (old_calls.load() == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  device->replace_callback<float>(
+      [&](audio_device &, audio_device_io<float> &) noexcept { ++new_calls; },
+      device->get_buffer_size_frames());
+  const int old_after = old_calls.load();
+  while (new_calls.load() < 4) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  CHECK(old_calls.load() == old_after);
+  CHECK_THROWS_AS(device->replace_callback<std::int16_t>(
+                      [](audio_device &,
+                         audio_device_io<std::int16_t> &) noexcept {}),
+                  std::runtime_error);
+  device->stop();
+}
+
+#endif
@@ -0,0 +1,196 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "catch/catch.hpp"
+#include <chrono>
+#include <experimental/audio>
+#include <numbers>
+#include <vector>
+
+using namespace std::experimental;
+
+namespace {
+// Longer than a transpose block and not a multiple of the vector widths.
+constexpr size_t test_frames = 601;
+
+// Sample of channel ch at frame.
+float signal(size_t ch, size_t frame) {
+  return float(ch + 1) * 0.01f + float(frame % 50) * 0.001f;
+}
+
+std::vector<float> interleaved(size_t num_channels) {
+  std::vector<float> samples(num_channels * test_frames);
+  for (size_t frame = 0; frame < test_frames; ++frame) {
+    for (size_t ch = 0; ch < num_channels; ++ch) {
+      samples[frame * num_channels + ch] = signal(ch, frame);
+    }
+  }
+  return samples;
+}
+
+// out(o, frame) must be the sum of gain(o, i) * signal(i, frame).
+template <typename Layout>
+void check_mix(const audio_channel_mixer &mixer,
+               const audio_buffer<float, Layout> &out) {
+  bool all_close = true;
+  for (size_t frame = 0; frame < test_frames; ++frame) {
+    for (size_t o = 0; o < mixer.output_channels(); ++o) {
+      float expected = 0;
+      for (size_t i = 0; i < mixer.input_channels(); ++i) {
+        expected += mixer.gain(o, i) * signal(i, frame);
+      }
+      all_close = all_close && std::abs(out(o, frame) - expected) < 1e-6f;
+    }
+  }
+  CHECK(all_close);
+}
+
+void check_layouts(audio_channel_mixer &mixer) {
+  const size_t in_channels = mixer.input_channels();
+  const size_t out_channels = mixer.output_channels();
+  auto in_samples = interleaved(in_channels);
+  std::vector<float> in_planar(in_samples.size());
+  audio_buffer<float> in(in_samples.data(), test_frames, in_channels,
+                         contiguous_interleaved);
+  audio_buffer<float> in_deinterleaved(in_planar.data(), test_frames,
+                                       in_channels, contiguous_deinterleaved);
+  copy(in, in_deinterleaved);
+
+  std::vector<float> out_samples(out_channels * test_frames);
+  audio_buffer<float> out(out_samples.data(), test_frames, out_channels,
+                          contiguous_interleaved);
+  audio_buffer<float> out_deinterleaved(out_samples.data(), test_frames,
+                                        out_channels,
+                                        contiguous_deinterleaved);
+  for (auto *src : {&in, &in_deinterleaved}) {
+    for (auto *dst : {&out, &out_deinterleaved}) {
+      std::fill(out_samples.begin(), out_samples.end(), -1.0f);
+      CHECK(mixer.process(*src, *dst) == test_frames);
+      check_mix(mixer, *dst);
+    }
+  }
+}
+} // namespace
+
+TEST_CASE("Channel mixer copies when the channels match") {
+  audio_channel_mixer mixer(4, 4);
+  for (size_t o = 0; o < 4; ++o) {
+    for (size_t i = 0; i < 4; ++i) {
+      CHECK(mixer.gain(o, i) == (o == i ? 1.0f : 0.0f));
+    }
+  }
+  check_layouts(mixer);
+}
+
+TEST_CASE("Channel mixer downmixes stereo to mono") {
+  audio_channel_mixer mixer(2, 1);
+  CHECK(mixer.gain(0, 0) == 0.5f);
+  CHECK(mixer.gain(0, 1) == 0.5f);
+  check_layouts(mixer);
+  mixer.set_gain(0, 1, -0.25f);
+  check_layouts(mixer);
+}
+
+TEST_CASE("Channel mixer downmixes 5.1 to stereo per ITU-R BS.775") {
+  audio_channel_mixer mixer(6, 2);
+  const float half_power = std::numbers::sqrt2_v<float> / 2;
+  CHECK(mixer.gain(0, 0) == 1.0f);
+  CHECK(mixer.gain(0, 2) == half_power);
+  CHECK(mixer.gain(0, 3) == 0.0f);
+  CHECK(mixer.gain(0, 4) == half_power);
+  CHECK(mixer.gain(1, 1) == 1.0f);
+  CHECK(mixer.gain(1, 2) == half_power);
+  CHECK(mixer.gain(1, 5) == half_power);
+  check_layouts(mixer);
+  // An LFE contribution leaves the fast path.
+  mixer.set_gain(0, 3, 0.5f);
+  check_layouts(mixer);
+}
+
+TEST_CASE("Channel mixer applies an arbitrary matrix") {
+  audio_channel_mixer mixer(3, 5);
+  mixer.clear();
+  mixer.set_gain(0, 2, 1.0f);
+  mixer.set_gain(1, 0, 0.5f);
+  mixer.set_gain(1, 1, -0.5f);
+  mixer.set_gain(3, 0, 0.25f);
+  mixer.set_gain(3, 1, 0.25f);
+  mixer.set_gain(3, 2, 0.25f);
+  check_layouts(mixer);
+  // Rows without any gain are silent.
+  CHECK(mixer.gain(2, 0) == 0.0f);
+  CHECK(mixer.gain(4, 2) == 0.0f);
+}
+
+TEST_CASE("Channel mixer upmixes mono to the front pair") {
+  audio_channel_mixer mixer(1, 6);
+  CHECK(mixer.gain(0, 0) == mixer.gain(1, 0));
+  CHECK(mixer.gain(2, 0) == 0.0f);
+  check_layouts(mixer);
+}
+
+TEST_CASE("channel_mixing_io lets a stereo callback drive a 5.1 device") {
+  struct fake_device {};
+  size_t calls = 0;
+  channel_mixing_io io(
+      2, 6, 48000,
+      [&](fake_device &, audio_device_io<float> &block) noexcept {
+        auto &out = *block.output_buffer;
+        CHECK(out.size_channels() == 2);
+        for (size_t frame = 0; frame < out.size_frames(); ++frame) {
+          out(0, frame) = 0.5f;
+          out(1, frame) = -0.5f;
+        }
+        ++calls;
+      },
+      256);
+
+  fake_device device;
+  std::vector<float> samples(6 * 600, 1.0f);
+  audio_device_io<float> device_io;
+  device_io.output_buffer.emplace(samples.data(), 600, 6,
+                                  contiguous_interleaved);
+  io(device, device_io);
+  CHECK(calls == 3);
+  bool front_only = true;
+  for (size_t frame = 0; frame < 600; ++frame) {
+    const float *f = samples.data() + 6 * frame;
+    front_only = front_only && f[0] == 0.5f && f[1] == -0.5f && f[2] == 0 &&
+                 f[3] == 0 && f[4] == 0 && f[5] == 0;
+  }
+  CHECK(front_only);
+}
+
+TEST_CASE("channel_mixing_io timestamps each block's first frame") {
+  struct fake_device {};
+  const auto start = audio_clock_t::now();
+  // 1000 Hz, a frame per millisecond.
+  auto at = [&](std::uint64_t frame) {
+    return start + std::chrono::milliseconds(frame);
+  };
+  bool on_time = true;
+  size_t calls = 0;
+  channel_mixing_io io(
+      2, 2, 1000,
+      [&](fake_device &, audio_device_io<float> &block) noexcept {
+        on_time = on_time && block.input_time == at(block.sample_position) &&
+                  block.output_time == at(block.sample_position + 10);
+        ++calls;
+      },
+      256);
+
+  fake_device device;
+  std::vector<float> in(2 * 600), out(2 * 600);
+  audio_device_io<float> device_io;
+  device_io.sample_position = 1000;
+  device_io.input_buffer.emplace(in.data(), 600, 2, contiguous_interleaved);
+  device_io.input_time = at(1000);
+  device_io.output_buffer.emplace(out.data(), 600, 2, contiguous_interleaved);
+  device_io.output_time = at(1010);
+  io(device, device_io);
+  CHECK(calls == 3);
+  CHECK(on_time);
+}
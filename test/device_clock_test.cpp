@@ -0,0 +1,60 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "catch/catch.hpp"
+#include <experimental/audio>
+#include <random>
+
+using namespace std::experimental;
+
+namespace {
+constexpr double sample_rate = 48000;
+constexpr std::size_t period = 480;
+} // namespace
+
+TEST_CASE("device_clock counts frame positions from reset()") {
+  detail::device_clock clock;
+  clock.reset(sample_rate, period);
+  auto now = audio_clock_t::now();
+  CHECK(clock.tick(now, period) == 0);
+  CHECK(clock.tick(now + std::chrono::milliseconds(10), period) == period);
+  CHECK(clock.tick(now + std::chrono::milliseconds(20), 100) == 2 * period);
+  CHECK(clock.tick(now + std::chrono::milliseconds(30), period) ==
+        2 * period + 100);
+}
+
+TEST_CASE("device_clock filters callback jitter and follows rate drift") {
+  detail::device_clock clock;
+  clock.reset(sample_rate, period, 0.5);
+
+  // The device actually runs 0.1% fast, callbacks wake up with up to 2ms of
+  // jitter.
+  const double frame_ns = 1e9 / (sample_rate * 1.001);
+  std::minstd_rand gen(42);
+  std::uniform_real_distribution<double> jitter_ns(0, 2e6);
+  const auto start = audio_clock_t::now();
+  auto true_time = [&](std::uint64_t position) {
+    return start + std::chrono::duration_cast<audio_clock_t::duration>(
+                       std::chrono::duration<double, std::nano>(
+                           double(position) * frame_ns));
+  };
+
+  std::uint64_t position = 0;
+  for (int i = 0; i < 3000; ++i) {
+    auto wakeup = true_time(position) +
+                  std::chrono::duration_cast<audio_clock_t::duration>(
+                      std::chrono::duration<double, std::nano>(
+                          jitter_ns(gen)));
+    position = clock.tick(wakeup, period) + period;
+  }
+
+  // The filtered time sits within the mean jitter of the true time, far
+  // closer than the 2ms spread of the raw wake-ups.
+  auto error = clock.time_at(position) - true_time(position);
+  CHECK(std::chrono::abs(error - std::chrono::milliseconds(1)) <
+        std::chrono::microseconds(300));
+  CHECK(clock.frame_duration().count() == Approx(frame_ns).epsilon(3e-4));
+}
@@ -0,0 +1,123 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "catch/catch.hpp"
+#include <algorithm>
+#include <atomic>
+#include <experimental/audio>
+#include <thread>
+#include <vector>
+
+using namespace std::experimental;
+using detail::device_list_notifier;
+
+namespace {
+
+constexpr auto list_changed = device_list_notifier::event_bit(
+    audio_device_list_event::device_list_changed);
+constexpr auto output_changed = device_list_notifier::event_bit(
+    audio_device_list_event::default_output_device_changed);
+
+} // namespace
+
+TEST_CASE("Device list notifier calls every subscriber of the event") {
+  device_list_notifier notifier;
+  int first = 0, second = 0, other = 0;
+  notifier.subscribe(audio_device_list_event::device_list_changed,
+                     [&] { ++first; });
+  notifier.subscribe(audio_device_list_event::device_list_changed,
+                     [&] { ++second; });
+  notifier.subscribe(audio_device_list_event::default_input_device_changed,
+                     [&] { ++other; });
+
+  notifier.post(list_changed);
+  CHECK(first == 1);
+  CHECK(second == 1);
+  CHECK(other == 0);
+
+  notifier.post(list_changed | output_changed);
+  CHECK(first == 2);
+  CHECK(second == 2);
+  CHECK(other == 0);
+}
+
+TEST_CASE("Device list notifier unsubscribes by id") {
+  device_list_notifier notifier;
+  int calls = 0;
+  auto id = notifier.subscribe(audio_device_list_event::device_list_changed,
+                               [&] { ++calls; });
+  notifier.post(list_changed);
+  CHECK(notifier.unsubscribe(id));
+  CHECK_FALSE(notifier.unsubscribe(id));
+  notifier.post(list_changed);
+  CHECK(calls == 1);
+}
+
+TEST_CASE("Device list notifier defers events posted by a callback") {
+  device_list_notifier notifier;
+  int depth = 0, max_depth = 0, list_calls = 0, output_calls = 0;
+  notifier.subscribe(audio_device_list_event::device_list_changed, [&] {
+    max_depth = std::max(max_depth, ++depth);
+    ++list_calls;
+    if (list_calls == 1) {
+      notifier.post(output_changed);
+      notifier.post(output_changed);
+    }
+    --depth;
+  });
+  notifier.subscribe(audio_device_list_event::default_output_device_changed,
+                     [&] {
+                       max_depth = std::max(max_depth, ++depth);
+                       ++output_calls;
+                       --depth;
+                     });
+
+  notifier.post(list_changed);
+  CHECK(list_calls == 1);
+  // Both posts were merged into one round after the first one.
+  CHECK(output_calls == 1);
+  CHECK(max_depth == 1);
+}
+
+TEST_CASE("Device list notifier delivers concurrent posts") {
+  device_list_notifier notifier;
+  std::atomic<int> running{0};
+  std::atomic<bool> overlapped{false};
+  std::atomic<int> calls{0};
+  notifier.subscribe(audio_device_list_event::device_list_changed, [&] {
+    if (running.fetch_add(1) != 0) {
+      overlapped = true;
+    }
+    ++calls;
+    running.fetch_sub(1);
+  });
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < 1000; ++j) {
+        notifier.post(list_changed);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  CHECK_FALSE(overlapped);
+  // Posts are coalesced, but the last one is never lost.
+  CHECK(calls >= 1);
+  CHECK(calls <= 4000);
+  int before = calls;
+  notifier.post(list_changed);
+  CHECK(calls == before + 1);
+}
+
+TEST_CASE("remove_audio_device_list_callback removes a set callback") {
+  auto id = set_audio_device_list_callback(
+      audio_device_list_event::device_list_changed, [] noexcept {});
+  CHECK(remove_audio_device_list_callback(id));
+  CHECK_FALSE(remove_audio_device_list_callback(id));
+}
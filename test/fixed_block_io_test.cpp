@@ -0,0 +1,233 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "catch/catch.hpp"
+#include <algorithm>
+#include <chrono>
+#include <experimental/audio>
+#include <functional>
+#include <vector>
+
+using namespace std::experimental;
+
+namespace {
+
+struct fake_device {};
+
+// Callback recording the block sizes and positions it sees, writing the
+// position of each output frame into every channel and appending the first
+// input channel to input.
+struct recorder {
+  std::vector<std::size_t> *sizes;
+  std::vector<float> *input;
+  bool positions_follow = true;
+  std::uint64_t next_position = 0;
+
+  void operator()(fake_device &, audio_device_io<float> &io) noexcept {
+    auto &buffer = io.output_buffer ? *io.output_buffer : *io.input_buffer;
+    sizes->push_back(buffer.size_frames());
+    positions_follow =
+        positions_follow && io.sample_position == next_position;
+    next_position = io.sample_position + buffer.size_frames();
+    if (io.input_buffer) {
+      for (std::size_t frame = 0; frame < buffer.size_frames(); ++frame) {
+        input->push_back((*io.input_buffer)(0, frame));
+      }
+    }
+    if (io.output_buffer) {
+      for (std::size_t ch = 0; ch < buffer.size_channels(); ++ch) {
+        for (std::size_t frame = 0; frame < buffer.size_frames(); ++frame) {
+          (*io.output_buffer)(ch, frame) = float(io.sample_position + frame);
+        }
+      }
+    }
+  }
+};
+
+bool all_equal(const std::vector<std::size_t> &sizes, std::size_t value) {
+  return std::all_of(sizes.begin(), sizes.end(),
+                     [value](std::size_t size) { return size == value; });
+}
+
+} // namespace
+
+TEST_CASE("fixed_block_io splits multiples of the block without copying") {
+  std::vector<std::size_t> sizes;
+  std::vector<float> input;
+  std::vector<float *> outputs;
+  fake_device device;
+  auto io = make_fixed_block_io<float>(
+      64, 2, 48000,
+      [&](fake_device &d, audio_device_io<float> &block) noexcept {
+        outputs.push_back(block.output_buffer->data());
+        recorder{&sizes, &input}(d, block);
+      });
+
+  for (auto layout : {0, 1}) {
+    std::vector<float> period(2 * 256, -1.0f);
+    audio_device_io<float> device_io;
+    device_io.sample_position = 256 * std::uint64_t(layout);
+    if (layout == 0) {
+      device_io.output_buffer.emplace(period.data(), 256, 2,
+                                      contiguous_interleaved);
+    } else {
+      device_io.output_buffer.emplace(period.data(), 256, 2,
+                                      contiguous_deinterleaved);
+    }
+    sizes.clear();
+    outputs.clear();
+    io(device, device_io);
+
+    CHECK(sizes.size() == 4);
+    CHECK(all_equal(sizes, 64));
+    if (layout == 0) {
+      // The blocks are the device buffer.
+      CHECK(outputs[1] == period.data() + 2 * 64);
+    }
+    bool written = true;
+    for (std::size_t frame = 0; frame < 256; ++frame) {
+      const float expected = float(device_io.sample_position + frame);
+      written = written && (*device_io.output_buffer)(0, frame) == expected &&
+                (*device_io.output_buffer)(1, frame) == expected;
+    }
+    CHECK(written);
+  }
+  CHECK(io.max_added_latency_frames() == 0);
+}
+
+TEST_CASE("fixed_block_io buffers output of other periods") {
+  std::vector<std::size_t> sizes;
+  std::vector<float> input;
+  recorder callback{&sizes, &input};
+  auto io = make_fixed_block_io<float>(64, 2, 48000, std::ref(callback));
+  fake_device device;
+
+  std::vector<float> played;
+  std::vector<float> period(2 * 100);
+  for (int i = 0; i < 50; ++i) {
+    audio_device_io<float> device_io;
+    device_io.output_buffer.emplace(period.data(), 100, 2,
+                                    contiguous_deinterleaved);
+    device_io.sample_position = std::uint64_t(i) * 100;
+    io(device, device_io);
+    played.insert(played.end(), period.begin(), period.begin() + 100);
+  }
+
+  CHECK(all_equal(sizes, 64));
+  CHECK(callback.positions_follow);
+  CHECK(io.max_added_latency_frames() == 64);
+  // Played without gaps or repeats.
+  bool continuous = true;
+  for (std::size_t frame = 0; frame < played.size(); ++frame) {
+    continuous = continuous && played[frame] == float(frame);
+  }
+  CHECK(continuous);
+}
+
+TEST_CASE("fixed_block_io collects input of other periods into blocks") {
+  // Periods longer than max_period_frames are taken in parts.
+  for (std::size_t period_frames : {100, 1000}) {
+    std::vector<std::size_t> sizes;
+    std::vector<float> input;
+    recorder callback{&sizes, &input};
+    auto io = make_fixed_block_io<float>(64, 1, 48000, std::ref(callback),
+                                         128);
+    fake_device device;
+
+    std::vector<float> period(period_frames);
+    float next = 0;
+    for (int i = 0; i < 20; ++i) {
+      for (float &sample : period) {
+        sample = next++;
+      }
+      audio_device_io<float> device_io;
+      device_io.input_buffer.emplace(period.data(), period_frames, 1,
+                                     contiguous_interleaved);
+      io(device, device_io);
+    }
+
+    CHECK(all_equal(sizes, 64));
+    CHECK(callback.positions_follow);
+    // Whatever doesn't fill a block waits for the next period.
+    CHECK(input.size() == 20 * period_frames / 64 * 64);
+    bool continuous = true;
+    for (std::size_t frame = 0; frame < input.size(); ++frame) {
+      continuous = continuous && input[frame] == float(frame);
+    }
+    CHECK(continuous);
+  }
+}
+
+TEST_CASE("fixed_block_io delays duplex input by one block") {
+  fake_device device;
+  auto io = make_fixed_block_io<float>(
+      64, 1, 48000, [](fake_device &, audio_device_io<float> &block) noexcept {
+        copy(*block.input_buffer, *block.output_buffer);
+      });
+
+  std::vector<float> in(100);
+  std::vector<float> out(100);
+  std::vector<float> played;
+  float next = 1;
+  for (int i = 0; i < 30; ++i) {
+    for (float &sample : in) {
+      sample = next++;
+    }
+    audio_device_io<float> device_io;
+    device_io.input_buffer.emplace(in.data(), 100, 1, contiguous_interleaved);
+    device_io.output_buffer.emplace(out.data(), 100, 1,
+                                    contiguous_interleaved);
+    io(device, device_io);
+    played.insert(played.end(), out.begin(), out.end());
+  }
+
+  bool delayed = true;
+  for (std::size_t frame = 0; frame < played.size(); ++frame) {
+    const float expected = frame < 64 ? 0.0f : float(frame - 64 + 1);
+    delayed = delayed && played[frame] == expected;
+  }
+  CHECK(delayed);
+}
+
+TEST_CASE("fixed_block_io timestamps each block's first frame") {
+  const auto start = audio_clock_t::now();
+  auto at = [&](std::uint64_t frame) {
+    // 1000 Hz, a frame per millisecond.
+    return start + std::chrono::milliseconds(frame);
+  };
+  fake_device device;
+  for (std::size_t period_frames : {128, 100}) {
+    for (bool is_input : {false, true}) {
+      bool on_time = true;
+      int blocks = 0;
+      auto io = make_fixed_block_io<float>(
+          64, 1, 1000,
+          [&](fake_device &, audio_device_io<float> &block) noexcept {
+            const auto &time = is_input ? block.input_time : block.output_time;
+            on_time = on_time && time == at(block.sample_position);
+            ++blocks;
+          });
+
+      std::vector<float> period(period_frames);
+      for (int i = 0; i < 10; ++i) {
+        audio_device_io<float> device_io;
+        device_io.sample_position = std::uint64_t(i) * period_frames;
+        if (is_input) {
+          device_io.input_buffer.emplace(period.data(), period_frames, 1,
+                                         contiguous_interleaved);
+          device_io.input_time = at(device_io.sample_position);
+        } else {
+          device_io.output_buffer.emplace(period.data(), period_frames, 1,
+                                          contiguous_interleaved);
+          device_io.output_time = at(device_io.sample_position);
+        }
+        io(device, device_io);
+      }
+      CHECK(blocks >= 10);
+      CHECK(on_time);
+    }
+  }
+}
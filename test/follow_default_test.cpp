@@ -0,0 +1,215 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "allocation_counter.h"
+#include "catch/catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <experimental/audio>
+#include <thread>
+#include <vector>
+
+#if defined(AUDIO_USE_SDL3)
+
+using namespace std::experimental;
+
+namespace {
+
+// Wait up to 5s for done().
+template <typename F> bool wait_for(F &&done) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!done() && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return done();
+}
+
+// What the notifier posts when SDL reports a new default output device.
+void post_default_output_changed() {
+  using detail::device_list_notifier;
+  device_list_notifier::instance().post(device_list_notifier::event_bit(
+      audio_device_list_event::default_output_device_changed));
+}
+
+} // namespace
+
+TEST_CASE("A device following the default device switches and keeps its "
+          "callback") {
+  auto device = get_default_audio_output_device();
+  REQUIRE(device.has_value());
+  REQUIRE(device->set_follow_default(true));
+  CHECK(device->follows_default());
+
+  std::atomic<int> calls{0};
+  device->connect<float>(
+      [&](audio_device &, audio_device_io<float> &io) noexcept {
+        auto &out = *io.output_buffer;
+        for (size_t frame = 0; frame < out.size_frames(); ++frame) {
+          for (size_t channel = 0; channel < out.size_channels(); ++channel) {
+            out(channel, frame) = 0.25f;
+          }
+        }
+        ++calls;
+      });
+  REQUIRE(device->start());
+  CHECK_FALSE(device->set_follow_default(false));
+  REQUIRE(wait_for([&] { return calls > 2; }));
+  const auto before = device->device_id();
+
+  post_default_output_changed();
+  // The switch is counted on the new device's first callback, a little
+  // before the worker publishes its id.
+  REQUIRE(wait_for([&] {
+    return device->stats().device_switches == 1 &&
+           device->device_id() != before;
+  }));
+  CHECK(device->is_playing());
+  auto took = device->stats().last_switch_duration;
+  REQUIRE(took.has_value());
+  CHECK(*took > std::chrono::nanoseconds(0));
+  CHECK(*took < std::chrono::seconds(1));
+
+  const int switched = calls;
+  CHECK(wait_for([&] { return calls > switched + 2; }));
+  CHECK(device->stop());
+  CHECK_FALSE(device->is_running());
+}
+
+TEST_CASE("An input device following the default device switches") {
+  auto device = get_default_audio_input_device();
+  REQUIRE(device.has_value());
+  REQUIRE(device->set_follow_default(true));
+  std::atomic<int> calls{0};
+  std::atomic<bool> full_periods{true};
+  const auto frames = device->get_buffer_size_frames();
+  device->connect<float>(
+      [&](audio_device &, audio_device_io<float> &io) noexcept {
+        full_periods = full_periods && io.input_buffer->size_frames() == frames;
+        ++calls;
+      });
+  REQUIRE(device->start());
+  REQUIRE(wait_for([&] { return calls > 2; }));
+  const auto before = device->device_id();
+
+  using detail::device_list_notifier;
+  device_list_notifier::instance().post(device_list_notifier::event_bit(
+      audio_device_list_event::default_input_device_changed));
+  REQUIRE(wait_for([&] {
+    return device->stats().device_switches == 1 &&
+           device->device_id() != before;
+  }));
+  const int switched = calls;
+  CHECK(wait_for([&] { return calls > switched + 2; }));
+  CHECK(full_periods);
+  CHECK(device->stop());
+  CHECK(device->device_id() == 0);
+}
+
+TEST_CASE("A paused device following the default device switches paused") {
+  auto device = get_default_audio_output_device();
+  REQUIRE(device.has_value());
+  REQUIRE(device->set_follow_default(true));
+  device->connect<float>([](audio_device &, audio_device_io<float> &) noexcept {
+  });
+  REQUIRE(device->start());
+  REQUIRE(device->pause());
+  const auto before = device->device_id();
+
+  post_default_output_changed();
+  REQUIRE(wait_for([&] { return device->device_id() != before; }));
+  CHECK(device->is_running());
+  CHECK_FALSE(device->is_playing());
+  CHECK(device->start());
+  CHECK(device->is_playing());
+  CHECK(device->stop());
+}
+
+TEST_CASE("A device not following the default device ignores changes") {
+  auto device = get_default_audio_output_device();
+  REQUIRE(device.has_value());
+  CHECK_FALSE(device->follows_default());
+  device->connect<float>([](audio_device &, audio_device_io<float> &) noexcept {
+  });
+  REQUIRE(device->start());
+  const auto before = device->device_id();
+  post_default_output_changed();
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  CHECK(device->device_id() == before);
+  CHECK(device->stats().device_switches == 0);
+  CHECK(device->stop());
+}
+
+TEST_CASE("Moving a running device following the default device stops it "
+          "first") {
+  auto device = get_default_audio_output_device();
+  REQUIRE(device.has_value());
+  REQUIRE(device->set_follow_default(true));
+  std::atomic<int> calls{0};
+  device->connect<float>(
+      [&](audio_device &, audio_device_io<float> &) noexcept { ++calls; });
+  REQUIRE(device->start());
+  REQUIRE(wait_for([&] { return calls > 0; }));
+  {
+    audio_device moved = std::move(*device);
+    CHECK_FALSE(device->is_running());
+    CHECK_FALSE(moved.is_running());
+    CHECK(moved.follows_default());
+
+    // The worker and the streams of the restarted device are its own.
+    REQUIRE(moved.start());
+    const auto before = moved.device_id();
+    post_default_output_changed();
+    REQUIRE(wait_for([&] {
+      return moved.stats().device_switches == 1 && moved.device_id() != before;
+    }));
+    CHECK(moved.is_playing());
+    CHECK(moved.stop());
+  }
+  CHECK(device->stop());
+  device.reset();
+}
+
+TEST_CASE("The SDL event filter only queues hotplug events") {
+  auto devices = get_audio_output_device_list();
+  auto &cache = detail::sdl_device_cache::instance();
+  auto ids = [&] {
+    std::vector<SDL_AudioDeviceID> ids;
+    for (const auto &device : cache.read(false)->devices) {
+      ids.push_back(device.id);
+    }
+    return ids;
+  };
+  const auto before = ids();
+
+  std::atomic<int> calls{0};
+  std::atomic<std::thread::id> called_on{};
+  auto id = set_audio_device_list_callback(
+      audio_device_list_event::device_list_changed, [&] noexcept {
+        called_on = std::this_thread::get_id();
+        ++calls;
+      });
+  SDL_Event event{};
+  event.type = SDL_EventType::SDL_EVENT_AUDIO_DEVICE_REMOVED;
+  event.adevice.which = 1234;
+  event.adevice.iscapture = 0;
+  std::size_t allocations, deallocations;
+  {
+    allocation_counter counter;
+    CHECK(detail::sdl_device_event_filter(nullptr, &event) == 1);
+    allocations = counter.allocations();
+    deallocations = counter.deallocations();
+  }
+  CHECK(allocations == 0);
+  CHECK(deallocations == 0);
+
+  REQUIRE(wait_for([&] { return calls > 0; }));
+  CHECK(called_on.load() != std::this_thread::get_id());
+  // Enumerated again, the devices keep their ids.
+  CHECK(ids() == before);
+  CHECK(remove_audio_device_list_callback(id));
+}
+
+#endif // AUDIO_USE_SDL3
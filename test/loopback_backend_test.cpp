@@ -0,0 +1,203 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "catch/catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <experimental/audio>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(AUDIO_USE_LOOPBACK)
+
+using namespace std::experimental;
+
+namespace {
+
+// Run device until its callback was called num_callbacks times. The callback
+// records the sample position, the timestamp and the stats as of that call.
+struct callback_log {
+  std::vector<std::uint64_t> positions;
+  std::vector<audio_clock_t::time_point> times;
+  audio_device_stats stats;
+};
+
+callback_log run_output(audio_device &device, std::size_t num_callbacks) {
+  callback_log log;
+  log.positions.reserve(num_callbacks);
+  log.times.reserve(num_callbacks);
+  std::atomic<bool> done{false};
+  device.connect<float>(
+      [&](audio_device &d, audio_device_io<float> &io) noexcept {
+        if (log.positions.size() == num_callbacks) {
+          return;
+        }
+        log.positions.push_back(io.sample_position);
+        log.times.push_back(*io.output_time);
+        if (log.positions.size() == num_callbacks) {
+          log.stats = d.stats();
+          done = true;
+        }
+      });
+  REQUIRE(device.start());
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!done && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  device.stop();
+  REQUIRE(done);
+  return log;
+}
+
+} // namespace
+
+TEST_CASE("Loopback output is captured by the loopback input") {
+  auto input = get_default_audio_input_device();
+  auto output = get_default_audio_output_device();
+  REQUIRE(input.has_value());
+  REQUIRE(output.has_value());
+
+  std::atomic<bool> heard{false};
+  input->connect<int16_t>(
+      [&](audio_device &, audio_device_io<int16_t> &io) noexcept {
+        auto &in = *io.input_buffer;
+        for (size_t frame = 0; frame < in.size_frames(); ++frame) {
+          if (in(0, frame) == 16384 && in(1, frame) == -16384) {
+            heard = true;
+          }
+        }
+      });
+  output->connect<float>(
+      [](audio_device &, audio_device_io<float> &io) noexcept {
+        auto &out = *io.output_buffer;
+        for (size_t frame = 0; frame < out.size_frames(); ++frame) {
+          out(0, frame) = 0.5f;
+          out(1, frame) = -0.5f;
+        }
+      });
+  REQUIRE(input->start());
+  REQUIRE(output->start());
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!heard && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  output->stop();
+  input->stop();
+  CHECK(heard);
+}
+
+TEST_CASE("Loopback timestamps follow the drifting virtual clock") {
+  auto device = get_default_audio_output_device();
+  REQUIRE(device.has_value());
+  device->set_sample_rate(48000);
+  device->set_buffer_size_frames(480);
+  audio_device_simulation simulation;
+  simulation.speed = 0;
+  simulation.drift_ppm = 1000;
+  REQUIRE(device->set_simulation(simulation));
+
+  auto log = run_output(*device, 16);
+  for (size_t i = 1; i < log.positions.size(); ++i) {
+    CHECK(log.positions[i] == i * 480);
+    auto period = std::chrono::duration<double, std::micro>(log.times[i] -
+                                                            log.times[i - 1]);
+    CHECK(std::abs(period.count() - 10010.0) < 0.01);
+  }
+  CHECK(log.stats.late_callbacks == 0);
+  CHECK(log.stats.underruns == 0);
+}
+
+TEST_CASE("Loopback xrun injection loses every n-th period") {
+  auto device = get_default_audio_output_device();
+  REQUIRE(device.has_value());
+  device->set_buffer_size_frames(64);
+  audio_device_simulation simulation;
+  simulation.speed = 0;
+  simulation.xrun_interval = 4;
+  REQUIRE(device->set_simulation(simulation));
+
+  auto log = run_output(*device, 12);
+  for (size_t i = 0; i < log.positions.size(); ++i) {
+    // Periods 3, 7, 11, ... never reach the callback.
+    CHECK(log.positions[i] == (i + i / 3) * 64);
+  }
+  CHECK(log.stats.underruns == 3);
+  CHECK(log.stats.last_xrun_time.has_value());
+}
+
+TEST_CASE("Loopback jitter beyond a period counts late callbacks "
+          "reproducibly") {
+  auto late_callbacks = [](std::chrono::nanoseconds jitter,
+                           std::uint64_t seed) {
+    auto device = get_default_audio_output_device();
+    REQUIRE(device.has_value());
+    device->set_sample_rate(48000);
+    device->set_buffer_size_frames(48);
+    audio_device_simulation simulation;
+    simulation.speed = 0;
+    simulation.jitter = jitter;
+    simulation.seed = seed;
+    REQUIRE(device->set_simulation(simulation));
+    return run_output(*device, 256).stats.late_callbacks;
+  };
+
+  // A period is 1ms.
+  CHECK(late_callbacks(std::chrono::microseconds(900), 1) == 0);
+  auto late = late_callbacks(std::chrono::milliseconds(4), 1);
+  // About three quarters of the callbacks are more than 1ms late.
+  CHECK(late > 128);
+  CHECK(late < 256);
+  CHECK(late_callbacks(std::chrono::milliseconds(4), 1) == late);
+  CHECK(late_callbacks(std::chrono::milliseconds(4), 2) != late);
+}
+
+TEST_CASE("Moving a running loopback device stops it first") {
+  static_assert(!std::is_move_constructible_v<audio_duplex_device>);
+  auto device = get_default_audio_output_device();
+  REQUIRE(device.has_value());
+  std::atomic<int> calls{0};
+  device->connect<float>(
+      [&](audio_device &, audio_device_io<float> &) noexcept { ++calls; });
+  REQUIRE(device->start());
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (calls.load() == 0 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  {
+    audio_device moved = std::move(*device);
+    CHECK_FALSE(device->is_running());
+    CHECK_FALSE(moved.is_running());
+    REQUIRE(moved.start());
+    REQUIRE(moved.stop());
+  }
+  // The moved-from device stops and destroys without its simulation.
+  CHECK(device->stop());
+  device.reset();
+  CHECK(calls.load() > 0);
+}
+
+TEST_CASE("Loopback duplex latency is one input and one output period") {
+  auto duplex = get_default_audio_duplex_device();
+  REQUIRE(duplex.has_value());
+  duplex->set_buffer_size_frames(480);
+  std::atomic<std::int64_t> latency_ns{0};
+  duplex->connect<float>(
+      [&](audio_device &, audio_device_io<float> &io) noexcept {
+        latency_ns = (*io.output_time - *io.input_time).count();
+      });
+  REQUIRE(duplex->start());
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (latency_ns == 0 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  duplex->stop();
+  CHECK(latency_ns == 20000000);
+  CHECK(duplex->get_latency() == std::chrono::milliseconds(20));
+}
+
+#endif // AUDIO_USE_LOOPBACK
@@ -0,0 +1,377 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "catch/catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <experimental/audio>
+#include <experimental/__p1386/wav_writer.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+using namespace std::experimental;
+
+namespace {
+
+std::vector<char> read_file(const std::filesystem::path &path) {
+  std::ifstream file(path, std::ios::binary);
+  return {std::istreambuf_iterator<char>(file),
+          std::istreambuf_iterator<char>()};
+}
+
+template <typename T> T read_le(const std::vector<char> &bytes, size_t pos) {
+  T value;
+  std::memcpy(&value, bytes.data() + pos, sizeof(T));
+  return value;
+}
+
+} // namespace
+
+TEST_CASE("wav_writer writes a RIFF header with the final sizes") {
+  auto path = std::filesystem::temp_directory_path() / "libstdaudio_test.wav";
+  {
+    auto wav = detail::wav_writer::open<int16_t>(path, 2, 44100);
+    const int16_t samples[] = {1, -1, 2, -2, 3, -3};
+    wav.write(samples, sizeof(samples));
+  }
+  auto bytes = read_file(path);
+  std::filesystem::remove(path);
+
+  REQUIRE(bytes.size() == 80 + 12);
+  CHECK(std::memcmp(bytes.data(), "RIFF", 4) == 0);
+  CHECK(read_le<uint32_t>(bytes, 4) == 72 + 12);
+  CHECK(std::memcmp(bytes.data() + 8, "WAVEJUNK", 8) == 0);
+  CHECK(read_le<uint32_t>(bytes, 16) == 28);
+  CHECK(std::memcmp(bytes.data() + 48, "fmt ", 4) == 0);
+  CHECK(read_le<uint16_t>(bytes, 56) == 1);
+  CHECK(read_le<uint16_t>(bytes, 58) == 2);
+  CHECK(read_le<uint32_t>(bytes, 60) == 44100);
+  CHECK(read_le<uint32_t>(bytes, 64) == 44100 * 4);
+  CHECK(read_le<uint16_t>(bytes, 68) == 4);
+  CHECK(read_le<uint16_t>(bytes, 70) == 16);
+  CHECK(std::memcmp(bytes.data() + 72, "data", 4) == 0);
+  CHECK(read_le<uint32_t>(bytes, 76) == 12);
+  CHECK(read_le<int16_t>(bytes, 82) == -1);
+}
+
+TEST_CASE("wav_writer writes float samples as IEEE float") {
+  auto path = std::filesystem::temp_directory_path() / "libstdaudio_test.wav";
+  {
+    auto wav = detail::wav_writer::open<float>(path, 1, 48000);
+    const float sample = 0.5f;
+    wav.write(&sample, sizeof(sample));
+  }
+  auto bytes = read_file(path);
+  std::filesystem::remove(path);
+
+  // An 18 byte fmt chunk and a fact chunk.
+  REQUIRE(bytes.size() == 94 + 4);
+  CHECK(read_le<uint32_t>(bytes, 4) == 86 + 4);
+  CHECK(read_le<uint32_t>(bytes, 52) == 18);
+  CHECK(read_le<uint16_t>(bytes, 56) == 3);
+  CHECK(read_le<uint16_t>(bytes, 70) == 32);
+  CHECK(read_le<uint16_t>(bytes, 72) == 0);
+  CHECK(std::memcmp(bytes.data() + 74, "fact", 4) == 0);
+  CHECK(read_le<uint32_t>(bytes, 78) == 4);
+  CHECK(read_le<uint32_t>(bytes, 82) == 1);
+  CHECK(std::memcmp(bytes.data() + 86, "data", 4) == 0);
+  CHECK(read_le<uint32_t>(bytes, 90) == 4);
+  CHECK(read_le<float>(bytes, 94) == 0.5f);
+}
+
+TEST_CASE("wav_writer uses WAVE_FORMAT_EXTENSIBLE past stereo or 16 bits") {
+  auto path = std::filesystem::temp_directory_path() / "libstdaudio_test.wav";
+  {
+    auto wav = detail::wav_writer::open<int32_t>(path, 6, 48000);
+    const int32_t samples[] = {1, 2, 3, 4, 5, 6};
+    wav.write(samples, sizeof(samples));
+  }
+  auto bytes = read_file(path);
+  std::filesystem::remove(path);
+
+  // A 40 byte fmt chunk, no fact chunk for PCM.
+  REQUIRE(bytes.size() == 104 + 24);
+  CHECK(read_le<uint32_t>(bytes, 4) == 96 + 24);
+  CHECK(read_le<uint32_t>(bytes, 52) == 40);
+  CHECK(read_le<uint16_t>(bytes, 56) == 0xFFFE);
+  CHECK(read_le<uint16_t>(bytes, 58) == 6);
+  CHECK(read_le<uint16_t>(bytes, 68) == 24);
+  CHECK(read_le<uint16_t>(bytes, 70) == 32);
+  CHECK(read_le<uint16_t>(bytes, 72) == 22);
+  CHECK(read_le<uint16_t>(bytes, 74) == 32);
+  // FL FR FC LFE BL BR.
+  CHECK(read_le<uint32_t>(bytes, 76) == 0x3F);
+  const unsigned char pcm_guid[16] = {0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                      0x10, 0x00, 0x80, 0x00, 0x00, 0xAA,
+                                      0x00, 0x38, 0x9B, 0x71};
+  CHECK(std::memcmp(bytes.data() + 80, pcm_guid, 16) == 0);
+  CHECK(std::memcmp(bytes.data() + 96, "data", 4) == 0);
+  CHECK(read_le<uint32_t>(bytes, 100) == 24);
+  CHECK(read_le<int32_t>(bytes, 124) == 6);
+}
+
+TEST_CASE("wav_writer writes int8 samples as offset binary") {
+  auto path = std::filesystem::temp_directory_path() / "libstdaudio_test.wav";
+  // More than one block of the sign flip.
+  std::vector<int8_t> samples(5000);
+  for (size_t i = 0; i < samples.size(); ++i) {
+    samples[i] = int8_t(int(i % 256) - 128);
+  }
+  {
+    auto wav = detail::wav_writer::open<int8_t>(path, 2, 8000);
+    wav.write(samples.data(), samples.size());
+  }
+  auto bytes = read_file(path);
+  std::filesystem::remove(path);
+
+  REQUIRE(bytes.size() == 80 + samples.size());
+  CHECK(read_le<uint16_t>(bytes, 56) == 1);
+  CHECK(read_le<uint16_t>(bytes, 70) == 8);
+  bool offset_binary = true;
+  for (size_t i = 0; i < samples.size(); ++i) {
+    offset_binary = offset_binary &&
+                    uint8_t(bytes[80 + i]) == uint8_t(samples[i] + 128);
+  }
+  CHECK(offset_binary);
+}
+
+TEST_CASE("wav_writer throws when the file can't be written") {
+  const std::filesystem::path full = "/dev/full";
+  if (!std::filesystem::exists(full)) {
+    return;
+  }
+  auto wav = detail::wav_writer::open<int16_t>(full, 2, 44100);
+  // Past the stream's buffer.
+  std::vector<int16_t> samples(1 << 16);
+  CHECK_THROWS_AS(wav.write(samples.data(), samples.size() * 2),
+                  std::runtime_error);
+  CHECK_THROWS_AS(wav.close(), std::runtime_error);
+  // Closed, whatever happened.
+  CHECK_NOTHROW(wav.close());
+}
+
+TEST_CASE("wav_writer switches to RF64 past the RIFF size limit") {
+  auto path = std::filesystem::temp_directory_path() / "libstdaudio_test.wav";
+  const int16_t samples[] = {1, -1, 2, -2, 3, -3};
+  // 72 header bytes after the RIFF size plus 12 of data: exactly the limit.
+  {
+    auto wav = detail::wav_writer::open<int16_t>(path, 2, 44100, 72 + 12);
+    wav.write(samples, sizeof(samples));
+  }
+  auto bytes = read_file(path);
+  CHECK(std::memcmp(bytes.data(), "RIFF", 4) == 0);
+  CHECK(read_le<uint32_t>(bytes, 4) == 72 + 12);
+  CHECK(std::memcmp(bytes.data() + 12, "JUNK", 4) == 0);
+
+  // One frame more.
+  {
+    auto wav = detail::wav_writer::open<int16_t>(path, 2, 44100, 72 + 12);
+    wav.write(samples, sizeof(samples));
+    wav.write(samples, 4);
+  }
+  bytes = read_file(path);
+  std::filesystem::remove(path);
+
+  REQUIRE(bytes.size() == 80 + 16);
+  CHECK(std::memcmp(bytes.data(), "RF64", 4) == 0);
+  CHECK(read_le<uint32_t>(bytes, 4) == 0xFFFFFFFF);
+  CHECK(std::memcmp(bytes.data() + 8, "WAVEds64", 8) == 0);
+  CHECK(read_le<uint32_t>(bytes, 16) == 28);
+  CHECK(read_le<uint64_t>(bytes, 20) == 72 + 16);
+  CHECK(read_le<uint64_t>(bytes, 28) == 16);
+  CHECK(read_le<uint64_t>(bytes, 36) == 4);
+  CHECK(read_le<uint32_t>(bytes, 44) == 0);
+  CHECK(std::memcmp(bytes.data() + 72, "data", 4) == 0);
+  CHECK(read_le<uint32_t>(bytes, 76) == 0xFFFFFFFF);
+  CHECK(read_le<int16_t>(bytes, 92) == 1);
+}
+
+#if defined(AUDIO_USE_OFFLINE)
+
+TEST_CASE("Offline render runs the callback for exactly the requested frames") {
+  auto device = get_default_audio_output_device();
+  REQUIRE(device.has_value());
+  device->set_num_channels(1);
+  device->set_buffer_size_frames(100);
+  device->set_output_to_memory(true);
+  std::uint64_t next_position = 0;
+  bool contiguous = true;
+  device->connect<float>(
+      [&](audio_device &, audio_device_io<float> &io) noexcept {
+        contiguous &= io.sample_position == next_position;
+        auto &out = *io.output_buffer;
+        for (size_t frame = 0; frame < out.size_frames(); ++frame) {
+          out(0, frame) = float(io.sample_position + frame);
+        }
+        next_position += out.size_frames();
+      });
+
+  CHECK(device->render(250) == 250);
+  CHECK(contiguous);
+  auto output = device->output<float>();
+  REQUIRE(output.size() == 250);
+  for (size_t i = 0; i < output.size(); ++i) {
+    CHECK(output[i] == float(i));
+  }
+  device->stop();
+}
+
+TEST_CASE("Offline timestamps follow the sample position, not the wall clock") {
+  auto device = get_default_audio_output_device();
+  REQUIRE(device.has_value());
+  device->set_sample_rate(1000);
+  device->set_buffer_size_frames(10);
+  std::vector<audio_clock_t::time_point> times;
+  times.reserve(4);
+  device->connect<float>(
+      [&](audio_device &, audio_device_io<float> &io) noexcept {
+        times.push_back(*io.output_time);
+      });
+  device->render(40);
+  device->stop();
+
+  REQUIRE(times.size() == 4);
+  for (size_t i = 0; i < times.size(); ++i) {
+    CHECK(times[i].time_since_epoch() == std::chrono::milliseconds(10 * i));
+  }
+}
+
+TEST_CASE("Offline input device captures the given samples, then silence") {
+  auto device = get_default_audio_input_device();
+  REQUIRE(device.has_value());
+  device->set_num_channels(1);
+  device->set_buffer_size_frames(4);
+  const int16_t input[] = {1, 2, 3, 4, 5, 6};
+  device->set_input<int16_t>(input);
+  std::vector<int16_t> captured;
+  captured.reserve(8);
+  device->connect<int16_t>(
+      [&](audio_device &, audio_device_io<int16_t> &io) noexcept {
+        for (size_t frame = 0; frame < io.input_buffer->size_frames();
+             ++frame) {
+          captured.push_back((*io.input_buffer)(0, frame));
+        }
+      });
+  device->render(8);
+  CHECK(device->input_exhausted());
+  device->stop();
+
+  CHECK(captured == std::vector<int16_t>{1, 2, 3, 4, 5, 6, 0, 0});
+}
+
+TEST_CASE("Offline output streams into a WAV file finished by stop()") {
+  auto path = std::filesystem::temp_directory_path() / "libstdaudio_out.wav";
+  auto device = get_default_audio_output_device();
+  REQUIRE(device.has_value());
+  device->set_num_channels(2);
+  device->set_sample_rate(8000);
+  REQUIRE(device->set_output_file(path));
+  device->connect<int16_t>(
+      [](audio_device &, audio_device_io<int16_t> &io) noexcept {
+        auto &out = *io.output_buffer;
+        for (size_t frame = 0; frame < out.size_frames(); ++frame) {
+          for (size_t channel = 0; channel < out.size_channels(); ++channel) {
+            out(channel, frame) = 7;
+          }
+        }
+      });
+  device->render(8000);
+  device->stop();
+
+  auto bytes = read_file(path);
+  std::filesystem::remove(path);
+  REQUIRE(bytes.size() == 80 + 8000 * 2 * 2);
+  CHECK(read_le<uint32_t>(bytes, 60) == 8000);
+  CHECK(read_le<uint32_t>(bytes, 76) == 8000 * 2 * 2);
+  CHECK(read_le<int16_t>(bytes, bytes.size() - 2) == 7);
+}
+
+TEST_CASE("Offline start() renders on its own thread until stop()") {
+  auto device = get_default_audio_output_device();
+  REQUIRE(device.has_value());
+  std::atomic<std::uint64_t> frames{0};
+  device->connect<float>(
+      [&](audio_device &, audio_device_io<float> &io) noexcept {
+        frames += io.output_buffer->size_frames();
+      });
+  REQUIRE(device->start());
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  // Ten seconds of audio, far faster than real time.
+  while (frames < 10 * std::uint64_t(device->get_sample_rate()) &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::yield();
+  }
+  device->stop();
+  CHECK(frames >= 10 * std::uint64_t(device->get_sample_rate()));
+  CHECK_FALSE(device->is_running());
+}
+
+TEST_CASE("Offline start() reports an output file it can't open") {
+  auto device = get_default_audio_output_device();
+  REQUIRE(device.has_value());
+  REQUIRE(device->set_output_file(std::filesystem::temp_directory_path() /
+                                  "libstdaudio_missing" / "out.wav"));
+  device->connect<float>(
+      [](audio_device &, audio_device_io<float> &) noexcept {});
+  CHECK_THROWS_AS(device->start(), std::runtime_error);
+  CHECK_FALSE(device->is_running());
+  CHECK_THROWS_AS(device->render(64), std::runtime_error);
+}
+
+TEST_CASE("Moving a running offline device stops it first") {
+  auto device = get_default_audio_output_device();
+  REQUIRE(device.has_value());
+  std::atomic<int> calls{0};
+  device->connect<float>(
+      [&](audio_device &, audio_device_io<float> &) noexcept { ++calls; });
+  REQUIRE(device->start());
+  while (calls.load() == 0) {
+    std::this_thread::yield();
+  }
+  audio_device moved = std::move(*device);
+  CHECK_FALSE(device->is_running());
+  CHECK_FALSE(moved.is_running());
+  const int stopped_at = calls.load();
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  CHECK(calls.load() == stopped_at);
+
+  REQUIRE(moved.start());
+  while (calls.load() == stopped_at) {
+    std::this_thread::yield();
+  }
+  moved.stop();
+  static_assert(!std::is_move_constructible_v<audio_duplex_device>);
+}
+
+TEST_CASE("Offline duplex device passes input through to the output") {
+  auto duplex = get_default_audio_duplex_device();
+  REQUIRE(duplex.has_value());
+  duplex->input_device().set_num_channels(1);
+  duplex->output_device().set_num_channels(1);
+  duplex->output_device().set_output_to_memory(true);
+  const float input[] = {0.25f, 0.5f, 0.75f};
+  duplex->input_device().set_input<float>(input);
+  duplex->connect<float>(
+      [](audio_device &, audio_device_io<float> &io) noexcept {
+        for (size_t frame = 0; frame < io.output_buffer->size_frames();
+             ++frame) {
+          (*io.output_buffer)(0, frame) = (*io.input_buffer)(0, frame);
+        }
+      });
+  duplex->render(4);
+  auto output = duplex->output_device().output<float>();
+  CHECK(std::vector<float>(output.begin(), output.end()) ==
+        std::vector<float>{0.25f, 0.5f, 0.75f, 0.0f});
+  duplex->stop();
+}
+
+#endif // AUDIO_USE_OFFLINE
@@ -0,0 +1,53 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "catch/catch.hpp"
+#include <atomic>
+#include <experimental/audio>
+#include <experimental/__p1386/rcu_cell.h>
+#include <thread>
+#include <vector>
+
+using namespace std::experimental;
+
+TEST_CASE("rcu_cell readers keep their snapshot across updates") {
+  detail::rcu_cell<std::vector<int>> cell({1, 2});
+  {
+    auto before = cell.read();
+    cell.update([](std::vector<int> &value) { value.push_back(3); });
+    CHECK(*before == std::vector<int>{1, 2});
+    CHECK(*cell.read() == std::vector<int>{1, 2, 3});
+    // Pinned by before.
+    CHECK(cell.retired() == 1);
+  }
+  cell.store({4});
+  CHECK(*cell.read() == std::vector<int>{4});
+  CHECK(cell.retired() == 0);
+}
+
+TEST_CASE("rcu_cell readers see consistent values while a writer publishes") {
+  // Every published value is a vector of n copies of n.
+  detail::rcu_cell<std::vector<int>> cell;
+  std::atomic<bool> done{false};
+  std::atomic<bool> consistent{true};
+
+  std::thread reader([&] {
+    while (!done.load()) {
+      auto value = cell.read();
+      for (int element : *value) {
+        if (element != int(value->size())) {
+          consistent = false;
+        }
+      }
+    }
+  });
+  for (int n = 1; n <= 2000; ++n) {
+    cell.store(std::vector<int>(n % 64, n % 64));
+  }
+  done = true;
+  reader.join();
+  CHECK(consistent);
+}
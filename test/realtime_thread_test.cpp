@@ -0,0 +1,168 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "catch/catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <experimental/audio>
+#include <system_error>
+#include <thread>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+using namespace std::experimental;
+
+namespace {
+
+// Run make_this_thread_realtime() on a thread of its own, so the test
+// thread keeps its scheduling.
+audio_realtime_result promote_other_thread(
+    const audio_realtime_config &config,
+    std::chrono::nanoseconds period = std::chrono::nanoseconds(0)) {
+  audio_realtime_result result;
+  std::thread([&] { result = make_this_thread_realtime(config, period); })
+      .join();
+  return result;
+}
+
+} // namespace
+
+#if defined(__linux__)
+
+TEST_CASE("make_this_thread_realtime() pins a thread to CPUs") {
+  audio_realtime_config config;
+  config.policy = audio_thread_policy::none;
+  config.cpus = {sched_getcpu()};
+  CHECK(promote_other_thread(config).has_value());
+}
+
+TEST_CASE("make_this_thread_realtime() rejects a config out of range") {
+  using step = audio_realtime_error::step;
+  audio_realtime_config config;
+
+  config.policy = audio_thread_policy::none;
+  config.cpus = {-1};
+  auto result = promote_other_thread(config);
+  REQUIRE_FALSE(result.has_value());
+  CHECK(result.error().failed == step::affinity);
+  CHECK(result.error().error == std::errc::invalid_argument);
+
+  config.cpus.clear();
+  config.policy = audio_thread_policy::fifo;
+  config.priority = 1000;
+  result = promote_other_thread(config);
+  REQUIRE_FALSE(result.has_value());
+  CHECK(result.error().failed == step::scheduling);
+  CHECK(result.error().error == std::errc::invalid_argument);
+
+  // Without a period there is nothing to derive the deadline from.
+  config.policy = audio_thread_policy::deadline;
+  result = promote_other_thread(config);
+  REQUIRE_FALSE(result.has_value());
+  CHECK(result.error().failed == step::scheduling);
+  CHECK(result.error().error == std::errc::invalid_argument);
+
+  config.runtime = std::chrono::milliseconds(20);
+  result = promote_other_thread(config, std::chrono::milliseconds(10));
+  REQUIRE_FALSE(result.has_value());
+  CHECK(result.error().error == std::errc::invalid_argument);
+
+  // SCHED_DEADLINE threads can't be pinned.
+  config.runtime = std::chrono::milliseconds(5);
+  config.cpus = {sched_getcpu()};
+  result = promote_other_thread(config, std::chrono::milliseconds(10));
+  REQUIRE_FALSE(result.has_value());
+  CHECK(result.error().failed == step::affinity);
+  CHECK(result.error().error == std::errc::invalid_argument);
+}
+
+TEST_CASE("make_this_thread_realtime() reports missing privileges") {
+  audio_realtime_config config;
+  config.policy = audio_thread_policy::fifo;
+  config.priority = 10;
+  auto result = promote_other_thread(config);
+  // Allowed with CAP_SYS_NICE or an RLIMIT_RTPRIO, as root.
+  if (!result.has_value()) {
+    CHECK(result.error().failed ==
+          audio_realtime_error::step::scheduling);
+    CHECK(result.error().error == std::errc::operation_not_permitted);
+  }
+}
+
+#else
+
+TEST_CASE("make_this_thread_realtime() is only supported on Linux") {
+  auto result = promote_other_thread(audio_realtime_config{});
+  REQUIRE_FALSE(result.has_value());
+  CHECK(result.error().error == std::errc::not_supported);
+}
+
+#endif
+
+TEST_CASE("audio_device_stats keeps a failed promotion") {
+  audio_device_stats promoted, failed;
+  promoted.realtime = audio_realtime_result();
+  failed.realtime = std::unexpected(audio_realtime_error{
+      audio_realtime_error::step::affinity,
+      std::make_error_code(std::errc::invalid_argument)});
+
+  audio_device_stats sum = promoted;
+  sum += failed;
+  sum += promoted;
+  REQUIRE(sum.realtime.has_value());
+  REQUIRE_FALSE(sum.realtime->has_value());
+  CHECK(sum.realtime->error().failed == audio_realtime_error::step::affinity);
+}
+
+// The offline backend renders on demand, it has no audio thread.
+#if !defined(AUDIO_USE_OFFLINE) && defined(__linux__)
+
+TEST_CASE("Devices report the promotion of their audio thread") {
+  auto device = get_default_audio_output_device();
+  REQUIRE(device.has_value());
+  audio_realtime_config config;
+  config.policy = audio_thread_policy::none;
+  config.cpus = {-1};
+  REQUIRE(device->set_realtime(config));
+
+  std::atomic<int> calls{0};
+  device->connect<float>(
+      [&](audio_device &, audio_device_io<float> &) noexcept { ++calls; });
+  CHECK_FALSE(device->stats().realtime.has_value());
+  REQUIRE(device->start());
+  CHECK_FALSE(device->set_realtime(config));
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (calls.load() == 0 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  auto stats = device->stats();
+  device->stop();
+
+  REQUIRE(calls.load() != 0);
+  REQUIRE(stats.realtime.has_value());
+  REQUIRE_FALSE(stats.realtime->has_value());
+  CHECK(stats.realtime->error().failed ==
+        audio_realtime_error::step::affinity);
+
+  config.cpus = {sched_getcpu()};
+  REQUIRE(device->set_realtime(config));
+  calls = 0;
+  device->connect<float>(
+      [&](audio_device &, audio_device_io<float> &) noexcept { ++calls; });
+  REQUIRE(device->start());
+  deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (calls.load() == 0 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  stats = device->stats();
+  device->stop();
+  REQUIRE(stats.realtime.has_value());
+  CHECK(stats.realtime->has_value());
+}
+
+#endif
@@ -0,0 +1,220 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "catch/catch.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <experimental/audio>
+#include <numbers>
+#include <vector>
+
+using namespace std::experimental;
+
+namespace {
+
+// Interleaved sine of frequency hz at rate, every channel shifted by a
+// quarter period from the previous one.
+std::vector<float> sine(double hz, double rate, std::size_t num_frames,
+                        std::size_t num_channels, double start = 0) {
+  std::vector<float> samples(num_frames * num_channels);
+  for (std::size_t frame = 0; frame < num_frames; ++frame) {
+    for (std::size_t ch = 0; ch < num_channels; ++ch) {
+      samples[frame * num_channels + ch] = float(
+          0.5 * std::sin(2 * std::numbers::pi * hz * (start + double(frame)) /
+                             rate +
+                         double(ch) * std::numbers::pi / 2));
+    }
+  }
+  return samples;
+}
+
+// Push input through rs in blocks of block_frames and collect the output.
+std::vector<float> resample(resampler &rs, const std::vector<float> &input,
+                            std::size_t block_frames) {
+  const std::size_t num_channels = rs.num_channels();
+  const std::size_t num_frames = input.size() / num_channels;
+  std::vector<float> output;
+  std::vector<float> block(4096 * num_channels);
+  for (std::size_t frame = 0; frame < num_frames;) {
+    const std::size_t frames = std::min(block_frames, num_frames - frame);
+    audio_buffer<float> in(const_cast<float *>(input.data()) +
+                               frame * num_channels,
+                           frames, num_channels, contiguous_interleaved);
+    std::size_t consumed = 0;
+    while (consumed < frames) {
+      consumed += rs.write(in, consumed);
+      audio_buffer<float> out(block.data(), 4096, num_channels,
+                              contiguous_interleaved);
+      std::size_t produced = rs.read(out);
+      output.insert(output.end(), block.begin(),
+                    block.begin() + produced * num_channels);
+    }
+    frame += frames;
+  }
+  return output;
+}
+
+double max_error(const std::vector<float> &a, const std::vector<float> &b,
+                 std::size_t first, std::size_t last) {
+  double error = 0;
+  for (std::size_t i = first; i < last; ++i) {
+    error = std::max(error, double(std::abs(a[i] - b[i])));
+  }
+  return error;
+}
+
+} // namespace
+
+TEST_CASE("Resampler reproduces a sine at the output rate") {
+  struct {
+    resampler_quality quality;
+    double tolerance;
+  } tiers[] = {{resampler_quality::fast, 2e-3},
+               {resampler_quality::balanced, 1e-4},
+               {resampler_quality::best, 2e-5}};
+  for (auto [quality, tolerance] : tiers) {
+    for (auto [from, to] : {std::pair{44100.0, 48000.0},
+                            std::pair{48000.0, 44100.0},
+                            std::pair{48000.0, 16000.0}}) {
+      resampler rs(2, from, to, quality);
+      auto output = resample(rs, sine(1000, from, 8192, 2), 480);
+      auto expected = sine(1000, to, output.size() / 2, 2);
+      // Skip the ramp up from the initial silence.
+      const std::size_t settled = 2 * 2 * rs.latency_frames();
+      REQUIRE(output.size() > settled + 1000);
+      CHECK(max_error(output, expected, settled, output.size()) < tolerance);
+    }
+  }
+}
+
+TEST_CASE("Resampler output does not depend on the block size") {
+  auto input = sine(440, 48000, 5000, 2);
+  resampler whole(2, 48000, 44100);
+  resampler blocks(2, 48000, 44100);
+  auto a = resample(whole, input, 4096);
+  auto b = resample(blocks, input, 37);
+  REQUIRE(a.size() == b.size());
+  // Only the rounding of the read position differs.
+  CHECK(max_error(a, b, 0, a.size()) < 1e-6);
+}
+
+TEST_CASE("Resampler produces ratio output frames per input frame") {
+  resampler rs(1, 44100, 48000);
+  auto output = resample(rs, std::vector<float>(44100, 0.25f), 512);
+  const double expected = 48000 - double(rs.latency_frames()) * 48000 / 44100;
+  CHECK(std::abs(double(output.size()) - expected) <= 2);
+  // DC passes with unity gain.
+  CHECK(output.back() == Approx(0.25f).margin(1e-6));
+}
+
+TEST_CASE("Resampler follows a changed ratio") {
+  resampler rs(1, 48000, 48000);
+  auto constant = std::vector<float>(4800, 0.5f);
+  // Past the filter delay the output keeps pace with the input.
+  resample(rs, constant, 480);
+  auto before = resample(rs, constant, 480).size();
+  CHECK(before == 4800);
+  rs.set_ratio(1.01);
+  auto after = resample(rs, constant, 480).size();
+  CHECK(after - before == Approx(48).margin(2));
+}
+
+TEST_CASE("Resampler attenuates what aliases when downsampling") {
+  for (auto [quality, floor] : {std::pair{resampler_quality::fast, 2e-3},
+                                std::pair{resampler_quality::balanced, 5e-5},
+                                std::pair{resampler_quality::best, 5e-6}}) {
+    resampler rs(1, 48000, 24000, quality);
+    // 20kHz is above the 12kHz output Nyquist frequency.
+    auto output = resample(rs, sine(20000, 48000, 16384, 1), 512);
+    const std::size_t settled = 2 * rs.latency_frames();
+    double peak = 0;
+    for (std::size_t i = settled; i < output.size(); ++i) {
+      peak = std::max(peak, double(std::abs(output[i])));
+    }
+    CHECK(peak < floor);
+  }
+}
+
+TEST_CASE("resampling_io runs the callback at its own rate") {
+  struct fake_device {};
+  std::size_t callback_frames = 0;
+  std::size_t next_position = 0;
+  bool positions_follow = true;
+  resampling_io io(44100, 48000, 2,
+                   [&](fake_device &, audio_device_io<float> &block) noexcept {
+                     auto &out = *block.output_buffer;
+                     for (std::size_t frame = 0; frame < out.size_frames();
+                          ++frame) {
+                       out(0, frame) = out(1, frame) = 0.5f;
+                     }
+                     positions_follow = positions_follow &&
+                                        block.sample_position == next_position;
+                     next_position += out.size_frames();
+                     callback_frames += out.size_frames();
+                   });
+
+  fake_device device;
+  std::vector<float> period(2 * 480);
+  std::size_t device_frames = 0;
+  bool full = true;
+  for (int i = 0; i < 100; ++i) {
+    audio_device_io<float> device_io;
+    device_io.output_buffer.emplace(period.data(), 480, 2,
+                                    contiguous_interleaved);
+    std::fill(period.begin(), period.end(), -1.0f);
+    io(device, device_io);
+    device_frames += 480;
+    full = full && period.back() != -1.0f;
+  }
+  CHECK(full);
+  CHECK(positions_follow);
+  CHECK(period.back() == Approx(0.5f).margin(1e-5));
+  const double expected = double(device_frames) * 44100 / 48000;
+  CHECK(std::abs(double(callback_frames) - expected) < 64);
+}
+
+TEST_CASE("resampling_io timestamps each block's first frame") {
+  struct fake_device {};
+  const auto start = audio_clock_t::now();
+  // Frame frame at rate, from start.
+  auto at = [&](double frame, double rate) {
+    return start + std::chrono::round<audio_clock_t::duration>(
+                       std::chrono::duration<double>(frame / rate));
+  };
+  for (bool is_input : {false, true}) {
+    double worst = 0;
+    int blocks = 0;
+    resampling_io io(
+        44100, 48000, 1,
+        [&](fake_device &, audio_device_io<float> &block) noexcept {
+          const auto &time = is_input ? block.input_time : block.output_time;
+          const std::chrono::duration<double> error =
+              *time - at(double(block.sample_position), 44100);
+          worst = std::max(worst, std::abs(error.count()));
+          ++blocks;
+        });
+
+    fake_device device;
+    std::vector<float> period(480);
+    for (int i = 0; i < 50; ++i) {
+      audio_device_io<float> device_io;
+      if (is_input) {
+        device_io.input_buffer.emplace(period.data(), 480, 1,
+                                       contiguous_interleaved);
+        device_io.input_time = at(double(i) * 480, 48000);
+      } else {
+        device_io.output_buffer.emplace(period.data(), 480, 1,
+                                        contiguous_interleaved);
+        device_io.output_time = at(double(i) * 480, 48000);
+      }
+      io(device, device_io);
+    }
+    CHECK(blocks >= 50);
+    // Within a microsecond, a twentieth of a frame.
+    CHECK(worst < 1e-6);
+  }
+}
@@ -0,0 +1,167 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "catch/catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <experimental/audio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(AUDIO_ENABLE_RT_SANITIZER)
+
+using namespace std::experimental;
+
+namespace {
+
+struct reported_violation {
+  std::string function;
+  int thread;
+  std::size_t stack_size;
+};
+
+std::mutex reported_mutex;
+std::vector<reported_violation> reported;
+
+void record_violation(const audio_rt_violation &violation) {
+  std::lock_guard lock(reported_mutex);
+  reported.push_back(
+      {violation.function, violation.thread, violation.stack.size()});
+}
+
+// Collects the violations reported while alive.
+class violation_recorder {
+public:
+  violation_recorder() {
+    flush_audio_rt_violations();
+    set_audio_rt_violation_handler(record_violation);
+    std::lock_guard lock(reported_mutex);
+    reported.clear();
+  }
+
+  ~violation_recorder() {
+    flush_audio_rt_violations();
+    set_audio_rt_violation_handler(nullptr);
+  }
+
+  std::vector<reported_violation> take() {
+    flush_audio_rt_violations();
+    std::lock_guard lock(reported_mutex);
+    return std::exchange(reported, {});
+  }
+};
+
+bool contains(const std::vector<reported_violation> &violations,
+              const std::string &function) {
+  for (const auto &violation : violations) {
+    if (violation.function == function) {
+      return violation.stack_size != 0;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+TEST_CASE("The RT sanitizer reports allocations in an rt_section") {
+  violation_recorder recorder;
+  {
+    detail::rt_section rt;
+    void *volatile block = std::malloc(16);
+    std::free(block);
+  }
+  auto violations = recorder.take();
+  CHECK(contains(violations, "malloc"));
+  CHECK(contains(violations, "free"));
+}
+
+TEST_CASE("The RT sanitizer reports locks, sleeps and I/O") {
+  violation_recorder recorder;
+  std::mutex mutex;
+  std::FILE *null = std::fopen("/dev/null", "w");
+  REQUIRE(null != nullptr);
+  {
+    detail::rt_section rt;
+    mutex.lock();
+    mutex.unlock();
+    std::this_thread::sleep_for(std::chrono::microseconds(1));
+    std::fwrite("x", 1, 1, null);
+  }
+  std::fclose(null);
+  auto violations = recorder.take();
+  CHECK(contains(violations, "pthread_mutex_lock"));
+  CHECK((contains(violations, "nanosleep") ||
+         contains(violations, "clock_nanosleep")));
+  CHECK(contains(violations, "fwrite"));
+}
+
+TEST_CASE("The RT sanitizer ignores code outside an rt_section") {
+  violation_recorder recorder;
+  std::free(std::malloc(16));
+  std::mutex mutex;
+  { std::lock_guard lock(mutex); }
+  CHECK(recorder.take().empty());
+}
+
+TEST_CASE("The RT sanitizer reports what a device callback does") {
+  violation_recorder recorder;
+  auto device = get_default_audio_output_device();
+  REQUIRE(device.has_value());
+  std::atomic<int> calls{0};
+  device->connect<float>([&](audio_device &,
+                             audio_device_io<float> &) noexcept {
+    if (calls++ == 0) {
+      int *volatile allocated = new int(1);
+      delete allocated;
+    }
+  });
+  REQUIRE(device->start());
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (calls.load() < 4 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  device->stop();
+  REQUIRE(calls.load() >= 1);
+
+  auto violations = recorder.take();
+  CHECK(contains(violations, "malloc"));
+  CHECK(contains(violations, "free"));
+  // Only the first callback allocates.
+  std::size_t mallocs = 0;
+  for (const auto &violation : violations) {
+    mallocs += violation.function == "malloc";
+  }
+  CHECK(mallocs == 1);
+}
+
+TEST_CASE("The RT sanitizer accepts a real-time safe device callback") {
+  violation_recorder recorder;
+  auto device = get_default_audio_output_device();
+  REQUIRE(device.has_value());
+  std::atomic<int> calls{0};
+  device->connect<float>(
+      [&](audio_device &, audio_device_io<float> &io) noexcept {
+        auto &out = *io.output_buffer;
+        for (std::size_t frame = 0; frame < out.size_frames(); ++frame) {
+          out(0, frame) = 0.25f;
+        }
+        ++calls;
+      });
+  REQUIRE(device->start());
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (calls.load() < 4 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  device->stop();
+  CHECK(calls.load() >= 4);
+  CHECK(recorder.take().empty());
+}
+
+#endif
@@ -0,0 +1,176 @@
+// libstdaudio
+// Copyright 2023 Zongwei Lan. All rights reserved.
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE.md or copy at
+// http://boost.org/LICENSE_1_0.txt)
+
+#include "catch/catch.hpp"
+#include <experimental/audio>
+#include <vector>
+
+using namespace std::experimental;
+
+namespace {
+// Long enough to run through the vector bodies and the scalar tails.
+constexpr size_t test_size = 37;
+
+template <typename Src, typename Dst>
+std::vector<Dst> convert(const std::vector<Src> &src) {
+  std::vector<Dst> dst(src.size());
+  convert_samples(src.data(), dst.data(), src.size());
+  return dst;
+}
+
+std::vector<float> ramp() {
+  std::vector<float> samples(test_size);
+  for (size_t i = 0; i < samples.size(); ++i) {
+    samples[i] = -1.0f + 2.0f * float(i) / float(samples.size());
+  }
+  return samples;
+}
+} // namespace
+
+TEST_CASE("int24_t packs three little-endian bytes") {
+  int24_t sample(-2);
+  CHECK(sample.bytes[0] == 0xFE);
+  CHECK(sample.bytes[1] == 0xFF);
+  CHECK(sample.bytes[2] == 0xFF);
+  CHECK(int32_t(sample) == -2);
+  CHECK(int32_t(int24_t(8388607)) == 8388607);
+  CHECK(int32_t(int24_t(-8388608)) == -8388608);
+}
+
+TEST_CASE("Float to integer conversion scales, rounds and clips") {
+  std::vector<float> src(test_size, 0.5f);
+  src[0] = 1.0f;
+  src[1] = -1.0f;
+  src[2] = 2.0f;
+  src[3] = -2.0f;
+  src[test_size - 1] = 1.0f;
+
+  auto s16 = convert<float, int16_t>(src);
+  CHECK(s16[0] == 32767);
+  CHECK(s16[1] == -32768);
+  CHECK(s16[2] == 32767);
+  CHECK(s16[3] == -32768);
+  CHECK(s16[4] == 16384);
+  CHECK(s16[test_size - 1] == 32767);
+
+  auto s32 = convert<float, int32_t>(src);
+  CHECK(s32[0] == 2147483647);
+  CHECK(s32[1] == -2147483647 - 1);
+  CHECK(s32[2] == 2147483647);
+  CHECK(s32[4] == 1073741824);
+  CHECK(s32[test_size - 1] == 2147483647);
+
+  auto u8 = convert<float, uint8_t>(src);
+  CHECK(u8[0] == 255);
+  CHECK(u8[1] == 0);
+  CHECK(u8[4] == 192);
+
+  auto s24 = convert<float, int24_t>(src);
+  CHECK(int32_t(s24[0]) == 8388607);
+  CHECK(int32_t(s24[4]) == 4194304);
+}
+
+TEST_CASE("Integer samples survive a round trip through float") {
+  std::vector<int16_t> s16(test_size);
+  for (size_t i = 0; i < s16.size(); ++i) {
+    s16[i] = int16_t(-32768 + int(i) * 1771);
+  }
+  CHECK(convert<float, int16_t>(convert<int16_t, float>(s16)) == s16);
+
+  std::vector<int32_t> s32(test_size);
+  for (size_t i = 0; i < s32.size(); ++i) {
+    s32[i] = int32_t(-2147483647 + int64_t(i) * 116069549);
+  }
+  CHECK(convert<double, int32_t>(convert<int32_t, double>(s32)) == s32);
+}
+
+TEST_CASE("Vector and scalar paths agree") {
+  auto src = ramp();
+  auto s16 = convert<float, int16_t>(src);
+  auto s32 = convert<float, int32_t>(src);
+  for (size_t i = 0; i < src.size(); ++i) {
+    CHECK(s16[i] == detail::convert_one<int16_t>(src[i]));
+    CHECK(s32[i] == detail::convert_one<int32_t>(src[i]));
+  }
+  auto f16 = convert<int16_t, float>(s16);
+  auto f32 = convert<int32_t, float>(s32);
+  for (size_t i = 0; i < src.size(); ++i) {
+    CHECK(f16[i] == detail::convert_one<float>(s16[i]));
+    CHECK(f32[i] == detail::convert_one<float>(s32[i]));
+  }
+}
+
+TEST_CASE("Integer to integer conversion shifts") {
+  std::vector<int16_t> s16 = {-32768, -1, 0, 1, 32767};
+  auto s32 = convert<int16_t, int32_t>(s16);
+  CHECK(s32 == std::vector<int32_t>{-2147483647 - 1, -65536, 0, 65536,
+                                    2147418112});
+  CHECK(convert<int32_t, int16_t>(s32) == s16);
+  auto u8 = convert<int16_t, uint8_t>(s16);
+  CHECK(u8 == std::vector<uint8_t>{0, 127, 128, 128, 255});
+  auto s8 = convert<uint8_t, int8_t>(u8);
+  CHECK(s8 == std::vector<int8_t>{-128, -1, 0, 0, 127});
+}
+
+TEST_CASE("TPDF dither stays within one LSB and averages out") {
+  std::vector<float> src(4099, 0.25f / 32768.0f);
+  std::vector<int16_t> dst(src.size());
+  tpdf_dither dither;
+  convert_samples(src.data(), dst.data(), src.size(), dither);
+
+  double sum = 0;
+  bool all_equal = true;
+  for (auto sample : dst) {
+    CHECK(sample >= -1);
+    CHECK(sample <= 1);
+    sum += sample;
+    all_equal = all_equal && sample == dst[0];
+  }
+  CHECK_FALSE(all_equal);
+  CHECK(sum / double(dst.size()) == Approx(0.25).margin(0.05));
+}
+
+TEST_CASE("Dither is skipped when precision is not reduced") {
+  std::vector<int16_t> src = {-32768, 0, 12345, 32767};
+  std::vector<int32_t> dst(src.size());
+  tpdf_dither dither;
+  convert_samples(src.data(), dst.data(), src.size(), dither);
+  CHECK(dst == convert<int16_t, int32_t>(src));
+}
+
+TEST_CASE("Gain ramp fades interleaved frames in and out") {
+  std::vector<float> stereo(8, 1.0f);
+  apply_gain_ramp(stereo.data(), 4, 2, 0.0f, 1.0f);
+  CHECK(stereo == std::vector<float>{0.25f, 0.25f, 0.5f, 0.5f, 0.75f, 0.75f,
+                                     1.0f, 1.0f});
+
+  std::vector<int16_t> mono(4, 16384);
+  apply_gain_ramp(mono.data(), 4, 1, 1.0f, 0.0f);
+  CHECK(mono == std::vector<int16_t>{12288, 8192, 4096, 0});
+
+  // Offset binary fades towards its center.
+  std::vector<uint8_t> u8(2, 255);
+  apply_gain_ramp(u8.data(), 2, 1, 1.0f, 0.0f);
+  CHECK(u8 == std::vector<uint8_t>{192, 128});
+}
+
+TEST_CASE("Crossfade ramps keep the level of the same signal") {
+  std::vector<float> from{0.0f, 0.0f, 0.0f, 0.0f};
+  std::vector<float> to{1.0f, 1.0f, 1.0f, 1.0f};
+  detail::crossfade_ramp(from.data(), to.data(), 4, 1);
+  CHECK(to == std::vector<float>{0.25f, 0.5f, 0.75f, 1.0f});
+
+  // Complementary gains, no dip when both sides play the same period.
+  std::vector<int16_t> same(6, -20000);
+  std::vector<int16_t> copy = same;
+  detail::crossfade_ramp(copy.data(), same.data(), 3, 2);
+  CHECK(same == copy);
+
+  std::vector<uint8_t> u8_from(2, 0);
+  std::vector<uint8_t> u8_to(2, 255);
+  detail::crossfade_ramp(u8_from.data(), u8_to.data(), 2, 1);
+  CHECK(u8_to == std::vector<uint8_t>{128, 255});
+}